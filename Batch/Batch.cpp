@@ -0,0 +1,430 @@
+
+#include <cstring>
+#include <cerrno>
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <Batch/Batch.h>
+
+#include <Common/Exception.h>
+#include <Endian/Endian.h>
+#include <File/File.h>
+
+
+using namespace Batch;
+using namespace LittleEndian;
+
+
+#pragma mark -
+#pragma mark CRC-32
+
+static const uint32_t *crcTable()
+{
+    struct Table {
+        uint32_t crc[256];
+
+        Table()
+        {
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+
+                for (unsigned j = 0; j < 8; ++j)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+                crc[i] = c;
+            }
+        }
+    };
+
+    static const Table table;
+
+    return table.crc;
+}
+
+uint32_t Batch::Crc32(uint32_t crc, const void *data, size_t size)
+{
+    const uint32_t *table = crcTable();
+    const uint8_t *cp = (const uint8_t *)data;
+    const uint8_t *end = cp + size;
+
+    crc = ~crc;
+
+    while (cp < end)
+        crc = table[(crc ^ *cp++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+
+#pragma mark -
+#pragma mark Record
+
+Record::Record(const char *type, const std::string &image)
+{
+    add("type", type);
+    add("image", image);
+}
+
+Record &Record::add(const char *key, const std::string &value)
+{
+    Field f;
+
+    f.key = key;
+    f.value = value;
+    f.number = false;
+
+    _fields.push_back(f);
+
+    return *this;
+}
+
+Record &Record::add(const char *key, const char *value)
+{
+    return add(key, std::string(value ? value : ""));
+}
+
+Record &Record::add(const char *key, unsigned long long value)
+{
+    char buffer[32];
+
+    std::snprintf(buffer, sizeof(buffer), "%llu", value);
+
+    add(key, std::string(buffer));
+    _fields.back().number = true;
+
+    return *this;
+}
+
+
+static void quote(const std::string &s, std::string &out)
+{
+    out += '"';
+
+    for (std::string::const_iterator iter = s.begin(); iter != s.end(); ++iter)
+    {
+        unsigned char c = *iter;
+
+        switch (c)
+        {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            default:
+                if (c < 0x20 || c >= 0x80)
+                {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                }
+                else out += c;
+                break;
+        }
+    }
+
+    out += '"';
+}
+
+std::string Record::json() const
+{
+    std::string rv("{");
+
+    for (unsigned i = 0; i < _fields.size(); ++i)
+    {
+        const Field &f = _fields[i];
+
+        if (i) rv += ',';
+
+        quote(f.key, rv);
+        rv += ':';
+
+        if (f.number) rv += f.value;
+        else quote(f.value, rv);
+    }
+
+    rv += "}\n";
+
+    return rv;
+}
+
+// image, type, then key=value, tab separated.
+std::string Record::text() const
+{
+    std::string rv;
+
+    if (_fields.size() < 2) return rv;
+
+    rv = _fields[1].value;
+    rv += '\t';
+    rv += _fields[0].value;
+
+    for (unsigned i = 2; i < _fields.size(); ++i)
+    {
+        rv += '\t';
+        rv += _fields[i].key;
+        rv += '=';
+        rv += _fields[i].value;
+    }
+
+    rv += '\n';
+
+    return rv;
+}
+
+
+#pragma mark -
+#pragma mark Output
+
+Output::Output(std::FILE *fp, bool json) :
+    _fp(fp),
+    _json(json)
+{
+}
+
+void Output::write(const Record &record)
+{
+    std::string line = _json ? record.json() : record.text();
+
+    Locker locker(_lock);
+
+    std::fputs(line.c_str(), _fp);
+}
+
+
+#pragma mark -
+#pragma mark Image
+
+const char *Image::FileSystemName(unsigned fileSystem)
+{
+    switch (fileSystem)
+    {
+        case kProDOS:
+            return "prodos";
+        case kPascal:
+            return "pascal";
+    }
+    return "unknown";
+}
+
+Image::Image(const std::string &path, Device::BlockDevicePointer device) :
+    _path(path),
+    _device(device)
+{
+    uint8_t buffer[512];
+    unsigned blocks = device->blocks();
+
+    _fileSystem = kUnknown;
+
+    if (blocks < 6) return;
+
+    device->read(2, buffer);
+
+    // prodos: volume directory header (storage type $f), no previous block.
+    if (Read16(buffer, 0) == 0 && (buffer[4] >> 4) == 0x0f
+        && buffer[0x23] == 0x27 && buffer[0x24] == 0x0d)
+    {
+        _fileSystem = kProDOS;
+        return;
+    }
+
+    // pascal: volume entry starting at block 0, 1-7 character name.
+    unsigned lastBlock = Read16(buffer, 2);
+
+    if (Read16(buffer, 0) == 0 && lastBlock > 2 && lastBlock < blocks
+        && Read16(buffer, 4) == 0
+        && buffer[6] >= 1 && buffer[6] <= 7
+        && Read16(buffer, 0x10) <= 77)
+    {
+        _fileSystem = kPascal;
+    }
+}
+
+
+#pragma mark -
+#pragma mark Task
+
+Task::~Task()
+{
+}
+
+
+#pragma mark -
+#pragma mark Driver
+
+// the message, and the errno string if there is one.
+static std::string errorMessage(std::exception &e)
+{
+    std::string message(e.what());
+    ::Exception *ex = dynamic_cast< ::Exception *>(&e);
+
+    if (ex && ex->error())
+    {
+        message += ": ";
+        message += ex->errorString();
+    }
+
+    return message;
+}
+
+Driver::Driver(Output &output, unsigned threads) :
+    _output(output),
+    _pool(threads)
+{
+    _format = 0;
+
+    _images = 0;
+    _problems = 0;
+    _errors = 0;
+    _bytes = 0;
+}
+
+Driver::~Driver()
+{
+}
+
+
+void Driver::addTask(Task *task)
+{
+    _tasks.push_back(task);
+}
+
+
+void Driver::run(const std::vector<std::string> &paths)
+{
+    std::vector<std::string>::const_iterator iter;
+
+    for (iter = paths.begin(); iter != paths.end(); ++iter)
+    {
+        std::string path(*iter);
+
+        // trailing /
+        while (path.length() > 1 && path[path.length() - 1] == '/')
+            path.erase(path.length() - 1);
+
+        _pool.enqueue(std::bind(&Driver::scan, this, path));
+    }
+
+    _pool.wait();
+}
+
+
+// directories queue their contents; anything else is an image.
+void Driver::scan(std::string path)
+{
+    struct stat st;
+
+    if (::stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        process(path);
+        return;
+    }
+
+    DIR *dp = ::opendir(path.c_str());
+
+    if (!dp)
+    {
+        Record r("error", path);
+        r.add("error", std::strerror(errno));
+
+        _output.write(r);
+
+        Locker locker(_lock);
+        ++_errors;
+        return;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *dir;
+
+    while ((dir = ::readdir(dp)) != NULL)
+    {
+        if (dir->d_name[0] == '.') continue;
+        names.push_back(dir->d_name);
+    }
+    ::closedir(dp);
+
+    std::sort(names.begin(), names.end());
+
+    for (std::vector<std::string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        std::string child = path + "/" + *iter;
+
+        if (::stat(child.c_str(), &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode))
+            _pool.enqueue(std::bind(&Driver::scan, this, child));
+
+        else if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))
+            _pool.enqueue(std::bind(&Driver::process, this, child));
+    }
+}
+
+
+void Driver::process(std::string path)
+{
+    unsigned problems = 0;
+    unsigned errors = 0;
+    unsigned long long bytes = 0;
+
+    Device::BlockDevicePointer device;
+    SHARED_PTR(Image) image;
+
+    // the image reads block 2, so a truncated image fails here too.
+    try
+    {
+        unsigned format = _format ? _format : Device::BlockDevice::ImageType(path.c_str(), 0);
+
+        device = Device::BlockDevice::Open(path.c_str(), File::ReadOnly, format);
+
+        if (!device) throw ::Exception("Unknown or unsupported device type.");
+
+        image = MAKE_SHARED(Image, path, device);
+    }
+    catch (std::exception &e)
+    {
+        Record r("error", path);
+        r.add("error", errorMessage(e));
+
+        _output.write(r);
+
+        Locker locker(_lock);
+        ++_images;
+        ++_errors;
+        return;
+    }
+
+    for (std::vector<Task *>::iterator iter = _tasks.begin(); iter != _tasks.end(); ++iter)
+    {
+        Task *task = *iter;
+
+        try
+        {
+            if (task->run(*image, _output)) ++problems;
+        }
+        catch (std::exception &e)
+        {
+            Record r("error", path);
+            r.add("task", task->name());
+            r.add("error", errorMessage(e));
+
+            _output.write(r);
+
+            ++errors;
+        }
+    }
+
+    bytes = device->blocks() * 512ull;
+
+    Locker locker(_lock);
+
+    ++_images;
+    if (problems) ++_problems;
+    if (errors) ++_errors;
+    _bytes += bytes;
+}
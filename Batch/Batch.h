@@ -0,0 +1,155 @@
+#ifndef __BATCH_BATCH_H__
+#define __BATCH_BATCH_H__
+
+#include <stdint.h>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+#include <Device/BlockDevice.h>
+
+#include <Common/WorkPool.h>
+#include <Common/Lock.h>
+
+
+namespace Batch {
+
+    // crc is the result of the previous call (0 to start.)
+    uint32_t Crc32(uint32_t crc, const void *data, size_t size);
+
+    /*
+     * One result, written as a single line (JSON or text).  Every
+     * record has a type and the image path; tasks add the rest.
+     */
+    class Record {
+    public:
+
+        Record(const char *type, const std::string &image);
+
+        Record &add(const char *key, const std::string &value);
+        Record &add(const char *key, const char *value);
+        Record &add(const char *key, unsigned long long value);
+
+        std::string json() const;
+        std::string text() const;
+
+    private:
+
+        struct Field {
+            std::string key;
+            std::string value;
+            bool number;
+        };
+
+        std::vector<Field> _fields;
+    };
+
+
+    // the result stream.  Thread safe; each record is written whole.
+    class Output {
+    public:
+
+        Output(std::FILE *fp, bool json);
+
+        void write(const Record &record);
+
+    private:
+
+        Lock _lock;
+        std::FILE *_fp;
+        bool _json;
+    };
+
+
+    class Image {
+    public:
+
+        enum {
+            kUnknown = 0,
+            kProDOS,
+            kPascal
+        };
+
+        static const char *FileSystemName(unsigned fileSystem);
+
+        Image(const std::string &path, Device::BlockDevicePointer device);
+
+        const std::string &path() const { return _path; }
+        Device::BlockDevicePointer device() const { return _device; }
+
+        // from the volume directory header in block 2.
+        unsigned fileSystem() const { return _fileSystem; }
+
+    private:
+
+        std::string _path;
+        Device::BlockDevicePointer _device;
+        unsigned _fileSystem;
+    };
+
+
+    /*
+     * A per-image task.  run() is called on the worker threads, once
+     * per image, so it must not keep per-image state in the task.
+     * Returns 0 if the image is ok, non-zero if problems were found.
+     * Exceptions are reported as error records.
+     */
+    class Task {
+    public:
+
+        virtual ~Task();
+
+        virtual const char *name() const = 0;
+        virtual int run(Image &image, Output &output) = 0;
+    };
+
+
+    /*
+     * Runs every task on every image under a set of paths.  Directories
+     * are searched recursively; each directory and each image is a task
+     * on a work stealing pool, so a worker opens one image at a time.
+     */
+    class Driver {
+    public:
+
+        Driver(Output &output, unsigned threads = 0);
+        ~Driver();
+
+        // tasks are not owned.
+        void addTask(Task *task);
+
+        // 0 to detect the format from the extension or the contents.
+        void setFormat(unsigned format) { _format = format; }
+
+        void run(const std::vector<std::string> &paths);
+
+        unsigned images() const { return _images; }
+        unsigned problems() const { return _problems; }
+        unsigned errors() const { return _errors; }
+        unsigned long long bytes() const { return _bytes; }
+
+    private:
+
+        Driver(const Driver &);
+        Driver& operator=(const Driver &);
+
+        void scan(std::string path);
+        void process(std::string path);
+
+        Output &_output;
+        std::vector<Task *> _tasks;
+        unsigned _format;
+
+        WorkPool _pool;
+
+        Lock _lock;
+        unsigned _images;
+        unsigned _problems;
+        unsigned _errors;
+        unsigned long long _bytes;
+    };
+
+}
+
+#endif
@@ -0,0 +1,638 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+
+#include <algorithm>
+#include <vector>
+
+#include <strings.h>
+#include <fnmatch.h>
+#include <sys/uio.h>
+
+#include <Batch/Catalog.h>
+
+#include <ProDOS/Disk.h>
+
+#include <Pascal/Pascal.h>
+
+#include <Endian/Endian.h>
+
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+using namespace Batch;
+using namespace LittleEndian;
+
+
+enum {
+    kChunkBlocks = 64,
+
+    kHeaderSize = 64,
+    kImageSize = 48,
+    kEntrySize = 40
+};
+
+static const char kMagic[8] = { 'P', 'F', 'C', 'A', 'T', 'L', 'G', '1' };
+
+
+#pragma mark -
+#pragma mark Scan
+
+static uint32_t crcProDOS(Disk *disk, const FileEntry &e, std::vector<uint8_t> &buffer, unsigned *problems)
+{
+    FileEntry f = e;
+    ExtentList extents;
+    uint32_t crc = 0;
+
+    if (disk->Normalize(f, P8_DATA_FORK) < 0 || disk->ReadExtents(f, &extents) < 0)
+    {
+        ++*problems;
+        return 0;
+    }
+
+    uint32_t remaining = f.eof;
+    unsigned block = 0;
+
+    while (remaining)
+    {
+        unsigned count = std::min((uint32_t)kChunkBlocks, (remaining + 511) >> 9);
+        uint32_t size = std::min(remaining, (uint32_t)count * 512);
+
+        if (disk->ReadBlocks(extents, block, count, &buffer[0]) < 0)
+        {
+            ++*problems;
+            return 0;
+        }
+
+        crc = Crc32(crc, &buffer[0], size);
+
+        block += count;
+        remaining -= size;
+    }
+
+    return crc;
+}
+
+static void scanProDOS(Disk *disk, unsigned block, const std::string &prefix, unsigned depth,
+    std::vector<uint8_t> &buffer, CatalogImage &rv)
+{
+    std::vector<FileEntry> files;
+    int ok;
+
+    // a path is at most 64 characters, so this must be a loop.
+    if (depth > 32) ok = -P8_CYCLICAL_BLOCK;
+    else if (block == 2) ok = disk->ReadVolume(NULL, &files);
+    else ok = disk->ReadDirectory(block, NULL, &files);
+
+    if (ok < 0)
+    {
+        ++rv.problems;
+        return;
+    }
+
+    for (std::vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
+    {
+        CatalogEntry e;
+        bool directory = iter->storage_type == DIRECTORY_FILE;
+
+        e.path = prefix + "/" + iter->file_name;
+        e.fileType = iter->file_type;
+        e.auxType = iter->aux_type;
+        e.storage = iter->storage_type;
+        e.size = directory ? 0 : iter->eof;
+        e.blocks = iter->blocks_used;
+        e.modified = iter->last_mod;
+        e.created = iter->creation;
+        e.crc = directory ? 0 : crcProDOS(disk, *iter, buffer, &rv.problems);
+
+        rv.entries.push_back(e);
+
+        if (directory)
+            scanProDOS(disk, iter->key_pointer, e.path, depth + 1, buffer, rv);
+    }
+}
+
+static void scanPascal(Device::BlockDevicePointer device, std::vector<uint8_t> &buffer, CatalogImage &rv)
+{
+    Pascal::VolumeEntryPointer volume = Pascal::VolumeEntry::Open(device);
+
+    rv.volume = volume->name();
+
+    for (unsigned i = 0; i < volume->fileCount(); ++i)
+    {
+        Pascal::FileEntryPointer file = volume->fileAtIndex(i);
+        CatalogEntry e;
+
+        // pascal names may contain /
+        e.path = file->name();
+        std::replace(e.path.begin(), e.path.end(), '/', ':');
+
+        e.fileType = file->fileKind();
+        e.auxType = 0;
+        e.storage = 0;
+        e.size = file->fileSize();
+        e.blocks = file->blocks();
+        e.modified = (std::time_t)file->modification();
+        e.created = 0;
+        e.crc = 0;
+
+        for (uint32_t offset = 0; offset < e.size; )
+        {
+            int count = file->read(&buffer[0], buffer.size(), offset);
+
+            if (count <= 0)
+            {
+                ++rv.problems;
+                e.crc = 0;
+                break;
+            }
+
+            e.crc = Crc32(e.crc, &buffer[0], count);
+            offset += count;
+        }
+
+        rv.entries.push_back(e);
+    }
+}
+
+void Batch::CatalogScan(Image &image, CatalogImage &rv)
+{
+    std::vector<uint8_t> buffer(kChunkBlocks * 512);
+
+    rv.fileSystem = image.fileSystem();
+    rv.problems = 0;
+    rv.entries.clear();
+
+    switch (image.fileSystem())
+    {
+        case Image::kProDOS:
+        {
+            DiskPointer disk = Disk::OpenFile(image.device());
+            VolumeEntry v;
+
+            if (disk->ReadVolume(&v, NULL) < 0)
+            {
+                ++rv.problems;
+                return;
+            }
+
+            rv.volume = v.volume_name;
+
+            scanProDOS(disk.get(), 2, "", 0, buffer, rv);
+            break;
+        }
+
+        case Image::kPascal:
+            scanPascal(image.device(), buffer, rv);
+            break;
+    }
+}
+
+
+#pragma mark -
+#pragma mark Write
+
+struct NameLess {
+    const char *strings;
+    const std::vector<uint32_t> *names;
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        int cmp = ::strcasecmp(strings + (*names)[a], strings + (*names)[b]);
+
+        return cmp ? cmp < 0 : a < b;
+    }
+};
+
+struct KeyLess {
+    const std::vector<uint32_t> *keys;
+
+    bool operator()(unsigned a, unsigned b) const
+    {
+        uint32_t ka = (*keys)[a];
+        uint32_t kb = (*keys)[b];
+
+        return ka != kb ? ka < kb : a < b;
+    }
+};
+
+static uint32_t addString(std::string &strings, const std::string &s)
+{
+    uint32_t offset = strings.size();
+
+    strings.append(s);
+    strings.push_back(0);
+
+    return offset;
+}
+
+void Batch::CatalogWrite(const char *name, const std::vector<CatalogImage> &images)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::CatalogWrite"
+
+    std::string strings;
+    std::vector<uint32_t> names;
+    std::vector<uint32_t> types;
+    std::vector<uint32_t> crcs;
+    std::vector<unsigned> hashOrder;
+
+    unsigned entries = 0;
+
+    for (unsigned i = 0; i < images.size(); ++i)
+        entries += images[i].entries.size();
+
+    std::vector<uint8_t> imageTable(images.size() * kImageSize);
+    std::vector<uint8_t> entryTable(entries * kEntrySize);
+
+    names.reserve(entries);
+    types.reserve(entries);
+    crcs.reserve(entries);
+
+    unsigned index = 0;
+
+    for (unsigned i = 0; i < images.size(); ++i)
+    {
+        const CatalogImage &image = images[i];
+        uint8_t *ip = &imageTable[i * kImageSize];
+
+        Write32(ip, 0, addString(strings, image.path));
+        Write32(ip, 4, addString(strings, image.volume));
+        Write32(ip, 8, (uint64_t)image.mtime);
+        Write32(ip, 12, (uint64_t)image.mtime >> 32);
+        Write32(ip, 16, image.mtimeNSec);
+        Write32(ip, 20, image.fileSystem);
+        Write32(ip, 24, image.size);
+        Write32(ip, 28, image.size >> 32);
+        Write32(ip, 32, index);
+        Write32(ip, 36, image.entries.size());
+        Write32(ip, 40, image.problems);
+        Write32(ip, 44, 0);
+
+        for (std::vector<CatalogEntry>::const_iterator iter = image.entries.begin(); iter != image.entries.end(); ++iter, ++index)
+        {
+            uint8_t *ep = &entryTable[index * kEntrySize];
+
+            std::string::size_type slash = iter->path.rfind('/');
+            uint32_t path = addString(strings, iter->path);
+            uint32_t name = path + (slash == std::string::npos ? 0 : slash + 1);
+
+            Write32(ep, 0, i);
+            Write32(ep, 4, path);
+            Write32(ep, 8, name);
+            Write16(ep, 12, iter->fileType);
+            Write16(ep, 14, iter->auxType);
+            Write32(ep, 16, iter->storage);
+            Write32(ep, 20, iter->size);
+            Write32(ep, 24, iter->blocks);
+            Write32(ep, 28, iter->modified);
+            Write32(ep, 32, iter->created);
+            Write32(ep, 36, iter->crc);
+
+            names.push_back(name);
+            types.push_back(((iter->fileType & 0xffff) << 16) | (iter->auxType & 0xffff));
+            crcs.push_back(iter->crc);
+
+            if (iter->storage != DIRECTORY_FILE) hashOrder.push_back(index);
+        }
+    }
+
+    std::vector<unsigned> nameOrder(entries);
+    std::vector<unsigned> typeOrder(entries);
+
+    for (unsigned i = 0; i < entries; ++i) nameOrder[i] = typeOrder[i] = i;
+
+    NameLess nameLess = { strings.c_str(), &names };
+    KeyLess typeLess = { &types };
+    KeyLess crcLess = { &crcs };
+
+    std::sort(nameOrder.begin(), nameOrder.end(), nameLess);
+    std::sort(typeOrder.begin(), typeOrder.end(), typeLess);
+    std::sort(hashOrder.begin(), hashOrder.end(), crcLess);
+
+    std::vector<uint8_t> orders((entries * 2 + hashOrder.size()) * 4);
+    uint8_t *op = orders.empty() ? NULL : &orders[0];
+
+    for (unsigned i = 0; i < entries; ++i)
+    {
+        Write32(op, i * 4, nameOrder[i]);
+        Write32(op, (entries + i) * 4, typeOrder[i]);
+    }
+    for (unsigned i = 0; i < hashOrder.size(); ++i)
+        Write32(op, (entries * 2 + i) * 4, hashOrder[i]);
+
+    uint8_t header[kHeaderSize];
+    uint64_t size = kHeaderSize + imageTable.size() + entryTable.size() + orders.size() + strings.size();
+
+    if (size > 0xffffffff)
+        throw ::Exception(__METHOD__ ": Catalog is too large.");
+
+    uint32_t offset = kHeaderSize;
+
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header, kMagic, 8);
+
+    Write32(header, 8, images.size());
+    Write32(header, 12, entries);
+    Write32(header, 16, hashOrder.size());
+    Write32(header, 20, strings.size());
+
+    Write32(header, 24, offset);
+    offset += imageTable.size();
+    Write32(header, 28, offset);
+    offset += entryTable.size();
+    Write32(header, 32, offset);
+    Write32(header, 36, offset + entries * 4);
+    Write32(header, 40, offset + entries * 8);
+    offset += orders.size();
+    Write32(header, 44, offset);
+    Write32(header, 48, size);
+
+    struct iovec iov[5];
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = kHeaderSize;
+    iov[1].iov_base = imageTable.empty() ? NULL : &imageTable[0];
+    iov[1].iov_len = imageTable.size();
+    iov[2].iov_base = entryTable.empty() ? NULL : &entryTable[0];
+    iov[2].iov_len = entryTable.size();
+    iov[3].iov_base = op;
+    iov[3].iov_len = orders.size();
+    iov[4].iov_base = (void *)strings.data();
+    iov[4].iov_len = strings.size();
+
+    std::string tmp = std::string(name) + ".tmp";
+
+    delete MappedFile::Create(tmp.c_str(), size, iov, 5);
+
+    if (std::rename(tmp.c_str(), name) != 0)
+        throw POSIX::Exception(__METHOD__ ": rename", errno);
+}
+
+
+#pragma mark -
+#pragma mark Catalog
+
+// every entry number in an order is < entries.
+static bool validOrder(const uint8_t *order, uint64_t count, uint64_t entries)
+{
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (Read32(order, i * 4) >= entries) return false;
+    }
+
+    return true;
+}
+
+Catalog::Catalog(const char *name) :
+    _file(name, File::ReadOnly)
+{
+    Validate(&_file);
+
+    _base = (const uint8_t *)_file.address();
+
+    _images = Read32(_base, 8);
+    _entries = Read32(_base, 12);
+    _hashed = Read32(_base, 16);
+    _stringSize = Read32(_base, 20);
+
+    _imageTable = _base + Read32(_base, 24);
+    _entryTable = _base + Read32(_base, 28);
+    _nameOrder = _base + Read32(_base, 32);
+    _typeOrder = _base + Read32(_base, 36);
+    _hashOrder = _base + Read32(_base, 40);
+    _strings = (const char *)_base + Read32(_base, 44);
+}
+
+Catalog::~Catalog()
+{
+}
+
+
+bool Catalog::Validate(MappedFile *file, const std::nothrow_t &)
+{
+    const uint8_t *header = (const uint8_t *)file->address();
+    uint64_t size = file->length();
+
+    if (size < kHeaderSize) return false;
+
+    if (std::memcmp(header, kMagic, 8)) return false;
+
+    if (Read32(header, 48) != size) return false;
+
+    uint64_t images = Read32(header, 8);
+    uint64_t entries = Read32(header, 12);
+    uint64_t hashed = Read32(header, 16);
+    uint64_t strings = Read32(header, 20);
+
+    if (hashed > entries) return false;
+
+    if (Read32(header, 24) + images * kImageSize > size) return false;
+    if (Read32(header, 28) + entries * kEntrySize > size) return false;
+    if (Read32(header, 32) + entries * 4 > size) return false;
+    if (Read32(header, 36) + entries * 4 > size) return false;
+    if (Read32(header, 40) + hashed * 4 > size) return false;
+    if (Read32(header, 44) + strings > size) return false;
+
+    // every string is terminated.
+    if (strings && header[Read32(header, 44) + strings - 1] != 0) return false;
+
+    // lookups index the tables with these without checking.
+    if (!validOrder(header + Read32(header, 32), entries, entries)) return false;
+    if (!validOrder(header + Read32(header, 36), entries, entries)) return false;
+    if (!validOrder(header + Read32(header, 40), hashed, entries)) return false;
+
+    const uint8_t *entryTable = header + Read32(header, 28);
+
+    for (uint64_t i = 0; i < entries; ++i)
+    {
+        if (Read32(entryTable, i * kEntrySize) >= images) return false;
+    }
+
+    return true;
+}
+
+bool Catalog::Validate(MappedFile *file)
+{
+#undef __METHOD__
+#define __METHOD__ "Catalog::Validate"
+
+    if (!Validate(file, std::nothrow))
+        throw ::Exception(__METHOD__ ": Invalid file format.");
+
+    return true;
+}
+
+
+const uint8_t *Catalog::imageRecord(unsigned index) const
+{
+    return _imageTable + index * kImageSize;
+}
+
+const uint8_t *Catalog::entryRecord(unsigned index) const
+{
+    return _entryTable + index * kEntrySize;
+}
+
+const char *Catalog::string(uint32_t offset) const
+{
+    return offset < _stringSize ? _strings + offset : "";
+}
+
+const char *Catalog::entryName(unsigned index) const
+{
+    return string(Read32(entryRecord(index), 8));
+}
+
+
+unsigned Catalog::entryImage(unsigned index) const
+{
+    return Read32(entryRecord(index), 0);
+}
+
+const char *Catalog::imagePath(unsigned index) const
+{
+    return string(Read32(imageRecord(index), 0));
+}
+
+
+void Catalog::image(unsigned index, CatalogImage &rv, bool entries) const
+{
+    const uint8_t *ip = imageRecord(index);
+
+    rv.path = string(Read32(ip, 0));
+    rv.volume = string(Read32(ip, 4));
+    rv.mtime = (int64_t)(Read32(ip, 8) | ((uint64_t)Read32(ip, 12) << 32));
+    rv.mtimeNSec = Read32(ip, 16);
+    rv.fileSystem = Read32(ip, 20);
+    rv.size = Read32(ip, 24) | ((uint64_t)Read32(ip, 28) << 32);
+    rv.problems = Read32(ip, 40);
+
+    rv.entries.clear();
+
+    if (!entries) return;
+
+    unsigned first = Read32(ip, 32);
+    unsigned count = Read32(ip, 36);
+
+    if (first > _entries || count > _entries - first) return;
+
+    rv.entries.resize(count);
+
+    for (unsigned i = 0; i < count; ++i)
+        entry(first + i, rv.entries[i]);
+}
+
+void Catalog::entry(unsigned index, CatalogEntry &rv) const
+{
+    const uint8_t *ep = entryRecord(index);
+
+    rv.path = string(Read32(ep, 4));
+    rv.fileType = Read16(ep, 12);
+    rv.auxType = Read16(ep, 14);
+    rv.storage = Read32(ep, 16);
+    rv.size = Read32(ep, 20);
+    rv.blocks = Read32(ep, 24);
+    rv.modified = Read32(ep, 28);
+    rv.created = Read32(ep, 32);
+    rv.crc = Read32(ep, 36);
+}
+
+
+void Catalog::findName(const char *pattern, std::vector<unsigned> &rv) const
+{
+    size_t length = std::strcspn(pattern, "*?[\\");
+    bool exact = pattern[length] == 0;
+
+    // first and last entries starting with the prefix.
+    unsigned lo = 0;
+    unsigned hi = _entries;
+
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (::strncasecmp(entryName(Read32(_nameOrder, mid * 4)), pattern, length) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    unsigned first = lo;
+
+    hi = _entries;
+
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (::strncasecmp(entryName(Read32(_nameOrder, mid * 4)), pattern, length) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (unsigned i = first; i < lo; ++i)
+    {
+        unsigned index = Read32(_nameOrder, i * 4);
+        const char *name = entryName(index);
+
+        if (exact ? name[length] == 0 : ::fnmatch(pattern, name, FNM_CASEFOLD) == 0)
+            rv.push_back(index);
+    }
+
+    std::sort(rv.begin(), rv.end());
+}
+
+void Catalog::findType(unsigned fileType, int auxType, std::vector<unsigned> &rv) const
+{
+    uint32_t key = (fileType & 0xffff) << 16 | (auxType < 0 ? 0 : auxType & 0xffff);
+    uint32_t last = auxType < 0 ? key | 0xffff : key;
+
+    unsigned lo = 0;
+    unsigned hi = _entries;
+
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+        const uint8_t *ep = entryRecord(Read32(_typeOrder, mid * 4));
+
+        if ((uint32_t)(Read16(ep, 12) << 16 | Read16(ep, 14)) < key) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (; lo < _entries; ++lo)
+    {
+        unsigned index = Read32(_typeOrder, lo * 4);
+        const uint8_t *ep = entryRecord(index);
+
+        if ((uint32_t)(Read16(ep, 12) << 16 | Read16(ep, 14)) > last) break;
+
+        rv.push_back(index);
+    }
+
+    std::sort(rv.begin(), rv.end());
+}
+
+void Catalog::findCrc(uint32_t crc, std::vector<unsigned> &rv) const
+{
+    unsigned lo = 0;
+    unsigned hi = _hashed;
+
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (Read32(entryRecord(Read32(_hashOrder, mid * 4)), 36) < crc) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (; lo < _hashed; ++lo)
+    {
+        unsigned index = Read32(_hashOrder, lo * 4);
+
+        if (Read32(entryRecord(index), 36) != crc) break;
+
+        rv.push_back(index);
+    }
+
+    std::sort(rv.begin(), rv.end());
+}
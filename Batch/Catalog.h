@@ -0,0 +1,134 @@
+#ifndef __BATCH_CATALOG_H__
+#define __BATCH_CATALOG_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Batch/Batch.h>
+
+#include <File/MappedFile.h>
+
+
+namespace Batch {
+
+    // one file.  Pascal files use the file kind as the file type.
+    struct CatalogEntry {
+        std::string path;
+        unsigned fileType;
+        unsigned auxType;
+        unsigned storage;
+        uint32_t size;
+        uint32_t blocks;
+        uint32_t modified;
+        uint32_t created;
+        uint32_t crc;
+    };
+
+    // one image, as it was (mtime and size) when it was scanned.
+    struct CatalogImage {
+        std::string path;
+        std::string volume;
+        int64_t mtime;
+        uint32_t mtimeNSec;
+        uint64_t size;
+        unsigned fileSystem;
+        unsigned problems;
+
+        std::vector<CatalogEntry> entries;
+    };
+
+
+    /*
+     * Every file and directory of an image.  The crc is the CRC-32 of
+     * the data fork (0 for directories.)  Directories which can't be
+     * read are skipped and counted as problems.
+     */
+    void CatalogScan(Image &image, CatalogImage &rv);
+
+    // write to name.tmp, then rename, so readers see the old or new catalog.
+    void CatalogWrite(const char *name, const std::vector<CatalogImage> &images);
+
+
+    /*
+     * A catalog file, memory mapped read only.  Lookups by name, file
+     * type or crc are binary searches of a sorted array of entry
+     * numbers, so opening and searching doesn't depend on the size of
+     * the catalog.
+     *
+     * header (64 bytes, little endian):
+     *  0 'PFCATLG1'
+     *  8 images, entries, hashed entries, string bytes
+     * 24 offsets of the images, entries, name order, type order, hash
+     *    order and strings; file size.
+     *
+     * image (48 bytes): path, volume name, mtime (64-bit), mtime ns,
+     * file system, size (64-bit), first entry, entries, problems.
+     *
+     * entry (40 bytes): image, path, name (within the path), file type,
+     * aux type (16-bit each), storage, size, blocks, modified, created,
+     * crc.
+     *
+     * name order: every entry, by name (case insensitive.)
+     * type order: every entry, by file type and aux type.
+     * hash order: every file (not directories), by crc.
+     * strings: nul terminated.
+     */
+    class Catalog {
+    public:
+
+        Catalog(const char *name);
+        ~Catalog();
+
+        static bool Validate(MappedFile *, const std::nothrow_t &);
+        static bool Validate(MappedFile *);
+
+        unsigned images() const { return _images; }
+        unsigned entries() const { return _entries; }
+
+        void image(unsigned index, CatalogImage &rv, bool entries = true) const;
+        void entry(unsigned index, CatalogEntry &rv) const;
+
+        unsigned entryImage(unsigned index) const;
+        const char *imagePath(unsigned index) const;
+
+        /*
+         * Entry numbers, in order.  A name may be a shell pattern
+         * (case insensitive); the characters before the first * ? or [
+         * are a binary search.  auxType -1 matches any aux type.
+         */
+        void findName(const char *pattern, std::vector<unsigned> &rv) const;
+        void findType(unsigned fileType, int auxType, std::vector<unsigned> &rv) const;
+        void findCrc(uint32_t crc, std::vector<unsigned> &rv) const;
+
+    private:
+
+        Catalog();
+        Catalog(const Catalog &);
+        Catalog& operator=(const Catalog &);
+
+        const uint8_t *imageRecord(unsigned index) const;
+        const uint8_t *entryRecord(unsigned index) const;
+        const char *string(uint32_t offset) const;
+        const char *entryName(unsigned index) const;
+
+        MappedFile _file;
+
+        const uint8_t *_base;
+        unsigned _images;
+        unsigned _entries;
+        unsigned _hashed;
+        uint32_t _stringSize;
+
+        const uint8_t *_imageTable;
+        const uint8_t *_entryTable;
+        const uint8_t *_nameOrder;
+        const uint8_t *_typeOrder;
+        const uint8_t *_hashOrder;
+        const char *_strings;
+    };
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include <cstring>
+
+#include <algorithm>
+#include <vector>
+
+#include <Batch/Convert.h>
+
+#include <Common/Exception.h>
+
+
+using namespace Batch;
+
+
+enum {
+    kChunkBlocks = 64,
+    // ProDOS volumes are at most 32M; anything larger is copied a
+    // chunk at a time.
+    kMaxBlocks = 65536
+};
+
+
+static bool isZero(const uint8_t *cp, size_t size)
+{
+    static const uint8_t zero[512] = { 0 };
+
+    for ( ; size; cp += 512, size -= 512)
+        if (std::memcmp(cp, zero, 512)) return false;
+
+    return true;
+}
+
+
+unsigned Batch::Convert(Device::BlockDevicePointer device, const char *name, unsigned imageType, const char *vname)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::Convert"
+
+    Device::BlockDevicePointer image;
+    unsigned blocks = device->blocks();
+
+    if (blocks > kMaxBlocks)
+    {
+        image = Device::BlockDevice::Create(name, vname, blocks, imageType);
+
+        if (!image)
+            throw ::Exception(__METHOD__ ": Unsupported image type.");
+
+        std::vector<uint8_t> buffer(kChunkBlocks * 512);
+
+        for (unsigned block = 0; block < blocks; block += kChunkBlocks)
+        {
+            unsigned count = std::min(blocks - block, (unsigned)kChunkBlocks);
+
+            device->readBlocks(block, count, &buffer[0]);
+            image->writeBlocks(block, count, &buffer[0]);
+        }
+
+        image->sync();
+
+        return blocks;
+    }
+
+    std::vector<uint8_t> buffer(blocks * 512);
+    unsigned count = 0;
+
+    for (unsigned block = 0; block < blocks; block += kChunkBlocks)
+    {
+        unsigned n = std::min(blocks - block, (unsigned)kChunkBlocks);
+        uint8_t *cp = &buffer[block * 512];
+
+        device->readBlocks(block, n, cp);
+
+        if (!isZero(cp, n * 512))
+        {
+            count = block + n;
+            while (isZero(&buffer[(count - 1) * 512], 512)) --count;
+        }
+    }
+
+    image = Device::BlockDevice::Create(name, vname, blocks, imageType, buffer.empty() ? NULL : &buffer[0], count);
+
+    if (!image)
+        throw ::Exception(__METHOD__ ": Unsupported image type.");
+
+    return count;
+}
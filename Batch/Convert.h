@@ -0,0 +1,23 @@
+#ifndef __BATCH_CONVERT_H__
+#define __BATCH_CONVERT_H__
+
+#include <Device/BlockDevice.h>
+
+
+namespace Batch {
+
+    /*
+     * Copy a device to a new image of any format BlockDevice::Create
+     * supports.  Blocks are read in 32K chunks (whole tracks for DOS
+     * order images) and the new image is written in one pass: header,
+     * data and checksum together, before it is mapped.  Trailing zero
+     * blocks aren't written (the file is sparse.)
+     *
+     * vname is the volume name for formats which have one (NULL for
+     * the file name.)  Returns the number of blocks written.
+     */
+    unsigned Convert(Device::BlockDevicePointer device, const char *name, unsigned imageType, const char *vname = NULL);
+
+}
+
+#endif
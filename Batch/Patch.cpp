@@ -0,0 +1,315 @@
+
+#include <cstring>
+#include <cerrno>
+
+#include <algorithm>
+#include <map>
+
+#include <Batch/Patch.h>
+
+#include <ProDOS/Fsck.h>
+
+#include <Pascal/Pascal.h>
+
+#include <Endian/Endian.h>
+
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+using namespace Batch;
+using namespace LittleEndian;
+
+
+enum {
+    kChunkBlocks = 64,
+    kHeaderSize = 16,
+    kRecordSize = 12,
+    kEnd = 0xffffffff
+};
+
+static const char kMagic[8] = { 'P', 'F', 'P', 'A', 'T', 'C', 'H', '1' };
+
+
+#pragma mark -
+#pragma mark Diff
+
+/*
+ * 32K at a time.  Equal chunks (the usual case) are a single memcmp;
+ * only chunks which differ are compared block by block.
+ */
+std::vector<BlockRun> Batch::DiffBlocks(Device::BlockDevicePointer oldDevice, Device::BlockDevicePointer newDevice)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::DiffBlocks"
+
+    std::vector<BlockRun> runs;
+    unsigned blocks = oldDevice->blocks();
+
+    if (newDevice->blocks() != blocks)
+        throw ::Exception(__METHOD__ ": The images are different sizes.");
+
+    std::vector<uint8_t> a(kChunkBlocks * 512);
+    std::vector<uint8_t> b(kChunkBlocks * 512);
+
+    for (unsigned block = 0; block < blocks; )
+    {
+        unsigned count = std::min((unsigned)kChunkBlocks, blocks - block);
+
+        oldDevice->readBlocks(block, count, &a[0]);
+        newDevice->readBlocks(block, count, &b[0]);
+
+        if (std::memcmp(&a[0], &b[0], count * 512))
+        {
+            for (unsigned i = 0; i < count; ++i)
+            {
+                if (!std::memcmp(&a[i * 512], &b[i * 512], 512)) continue;
+
+                if (!runs.empty() && runs.back().block + runs.back().count == block + i)
+                {
+                    ++runs.back().count;
+                    continue;
+                }
+
+                BlockRun r;
+                r.block = block + i;
+                r.count = 1;
+
+                runs.push_back(r);
+            }
+        }
+
+        block += count;
+    }
+
+    return runs;
+}
+
+
+#pragma mark -
+#pragma mark BlockOwners
+
+BlockOwners::BlockOwners(Image &image)
+{
+    // a damaged volume has no owners (rather than failing the diff.)
+    try
+    {
+        Device::BlockDevicePointer device = image.device();
+
+        switch (image.fileSystem())
+        {
+            case Image::kProDOS:
+            {
+                ProDOS::Fsck fsck(device);
+                std::map<std::string, uint32_t> ids;
+
+                fsck.check();
+
+                _owners.assign(device->blocks(), 0);
+
+                for (unsigned block = 0; block < _owners.size(); ++block)
+                {
+                    const char *name = fsck.blockOwner(block);
+
+                    if (!name) continue;
+
+                    uint32_t &id = ids[name];
+
+                    if (!id)
+                    {
+                        _names.push_back(name);
+                        id = _names.size();
+                    }
+
+                    _owners[block] = id;
+                }
+                break;
+            }
+
+            case Image::kPascal:
+            {
+                Pascal::VolumeEntryPointer volume = Pascal::VolumeEntry::Open(device);
+                unsigned blocks = std::min(device->blocks(), volume->volumeBlocks());
+
+                _owners.assign(device->blocks(), 0);
+
+                _names.push_back("<boot>");
+                _names.push_back("<directory>");
+
+                for (unsigned block = 0; block < 2; ++block)
+                    _owners[block] = 1;
+
+                for (unsigned block = 2; block < std::min(blocks, volume->lastBlock()); ++block)
+                    _owners[block] = 2;
+
+                for (unsigned i = 0; i < volume->fileCount(); ++i)
+                {
+                    Pascal::FileEntryPointer file = volume->fileAtIndex(i);
+
+                    _names.push_back(std::string("/") + file->name());
+
+                    for (unsigned block = file->firstBlock(); block < std::min(blocks, file->lastBlock()); ++block)
+                        _owners[block] = _names.size();
+                }
+                break;
+            }
+        }
+    }
+    catch (::Exception &e)
+    {
+        _owners.clear();
+        _names.clear();
+    }
+}
+
+const char *BlockOwners::owner(unsigned block) const
+{
+    if (block >= _owners.size() || _owners[block] == 0) return NULL;
+
+    return _names[_owners[block] - 1].c_str();
+}
+
+
+#pragma mark -
+#pragma mark Patch
+
+static void writeAll(std::FILE *fp, const void *data, size_t size)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::WritePatch"
+
+    if (std::fwrite(data, 1, size, fp) != size)
+        throw POSIX::Exception(__METHOD__ ": fwrite", errno);
+}
+
+static bool readAll(std::FILE *fp, void *data, size_t size)
+{
+    return std::fread(data, 1, size, fp) == size;
+}
+
+
+void Batch::WritePatch(std::FILE *fp, Device::BlockDevicePointer oldDevice, Device::BlockDevicePointer newDevice,
+    const std::vector<BlockRun> &runs)
+{
+    uint8_t header[kHeaderSize];
+    uint8_t record[kRecordSize];
+
+    std::vector<uint8_t> buffer(kChunkBlocks * 512);
+
+    std::memcpy(header, kMagic, 8);
+    Write32(header, 8, newDevice->blocks());
+    Write32(header, 12, 0);
+
+    writeAll(fp, header, kHeaderSize);
+
+    for (std::vector<BlockRun>::const_iterator iter = runs.begin(); iter != runs.end(); ++iter)
+    {
+        for (unsigned done = 0; done < iter->count; )
+        {
+            unsigned block = iter->block + done;
+            unsigned count = std::min((unsigned)kChunkBlocks, iter->count - done);
+
+            oldDevice->readBlocks(block, count, &buffer[0]);
+
+            Write32(record, 0, block);
+            Write32(record, 4, count);
+            Write32(record, 8, Crc32(0, &buffer[0], count * 512));
+
+            newDevice->readBlocks(block, count, &buffer[0]);
+
+            writeAll(fp, record, kRecordSize);
+            writeAll(fp, &buffer[0], count * 512);
+
+            done += count;
+        }
+    }
+
+    Write32(record, 0, kEnd);
+    Write32(record, 4, 0);
+    Write32(record, 8, 0);
+
+    writeAll(fp, record, kRecordSize);
+}
+
+
+/*
+ * One pass over the patch.  If write is false, each record is checked;
+ * a record which is already applied is not an error.  Returns the number
+ * of blocks which need to be written.
+ */
+static unsigned applyPass(std::FILE *fp, Device::BlockDevicePointer device, bool write)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::ApplyPatch"
+
+    uint8_t header[kHeaderSize];
+    uint8_t record[kRecordSize];
+
+    std::vector<uint8_t> data(kChunkBlocks * 512);
+    std::vector<uint8_t> current(kChunkBlocks * 512);
+
+    unsigned blocks = device->blocks();
+    unsigned changed = 0;
+
+    if (!readAll(fp, header, kHeaderSize) || std::memcmp(header, kMagic, 8))
+        throw ::Exception(__METHOD__ ": Invalid patch file.");
+
+    if (Read32(header, 8) != blocks)
+        throw ::Exception(__METHOD__ ": The patch is for a different size image.");
+
+    for (;;)
+    {
+        if (!readAll(fp, record, kRecordSize))
+            throw ::Exception(__METHOD__ ": Truncated patch file.");
+
+        unsigned block = Read32(record, 0);
+        unsigned count = Read32(record, 4);
+        uint32_t crc = Read32(record, 8);
+
+        if (block == kEnd) break;
+
+        if (count == 0 || count > kChunkBlocks || block >= blocks || count > blocks - block)
+            throw ::Exception(__METHOD__ ": Invalid patch file.");
+
+        if (!readAll(fp, &data[0], count * 512))
+            throw ::Exception(__METHOD__ ": Truncated patch file.");
+
+        device->readBlocks(block, count, &current[0]);
+
+        // already patched.
+        if (!std::memcmp(&current[0], &data[0], count * 512)) continue;
+
+        if (Crc32(0, &current[0], count * 512) != crc)
+            throw ::Exception(__METHOD__ ": The image doesn't match the patch.");
+
+        if (write) device->writeBlocks(block, count, &data[0]);
+
+        changed += count;
+    }
+
+    return changed;
+}
+
+unsigned Batch::ApplyPatch(std::FILE *fp, Device::BlockDevicePointer device, bool dryRun)
+{
+#undef __METHOD__
+#define __METHOD__ "Batch::ApplyPatch"
+
+    long start = std::ftell(fp);
+
+    unsigned changed = applyPass(fp, device, false);
+
+    if (dryRun || !changed) return changed;
+
+    if (device->readOnly())
+        throw ::Exception(__METHOD__ ": The image is read only.");
+
+    if (std::fseek(fp, start, SEEK_SET) != 0)
+        throw POSIX::Exception(__METHOD__ ": fseek", errno);
+
+    applyPass(fp, device, true);
+
+    device->sync();
+
+    return changed;
+}
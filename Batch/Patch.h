@@ -0,0 +1,64 @@
+#ifndef __BATCH_PATCH_H__
+#define __BATCH_PATCH_H__
+
+#include <stdint.h>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+#include <Batch/Batch.h>
+
+
+namespace Batch {
+
+    // a run of changed blocks.
+    struct BlockRun {
+        unsigned block;
+        unsigned count;
+    };
+
+    // both devices must be the same size.
+    std::vector<BlockRun> DiffBlocks(Device::BlockDevicePointer oldDevice, Device::BlockDevicePointer newDevice);
+
+
+    /*
+     * The file (or directory) using each block of a ProDOS or Pascal
+     * volume.  Unknown file systems have no owners.
+     */
+    class BlockOwners {
+    public:
+
+        BlockOwners(Image &image);
+
+        // NULL if the block isn't used.
+        const char *owner(unsigned block) const;
+
+    private:
+
+        std::vector<uint32_t> _owners;
+        std::vector<std::string> _names;
+    };
+
+
+    /*
+     * patch file:
+     * header: 'PFPATCH1', blocks (32-bit), 0 (32-bit)
+     * then records of block, count, crc32 of the old blocks, new data.
+     * The last record is block $ffffffff, count 0.
+     * Numbers are little endian.  A record is at most 64 blocks, so a
+     * patch is applied in constant memory.
+     */
+    void WritePatch(std::FILE *fp, Device::BlockDevicePointer oldDevice, Device::BlockDevicePointer newDevice,
+        const std::vector<BlockRun> &runs);
+
+    /*
+     * Every record is checked against the device before anything is
+     * written, so a patch is applied whole or not at all.  Returns the
+     * number of blocks written (or that would be written if dryRun).
+     */
+    unsigned ApplyPatch(std::FILE *fp, Device::BlockDevicePointer device, bool dryRun = false);
+
+}
+
+#endif
@@ -0,0 +1,540 @@
+
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <Batch/Tasks.h>
+
+#include <ProDOS/Disk.h>
+#include <ProDOS/Fsck.h>
+
+#include <Pascal/Pascal.h>
+
+#include <File/File.h>
+
+
+using namespace Batch;
+
+
+enum {
+    // 32K at a time, so memory use doesn't depend on the file size.
+    kChunkBlocks = 64
+};
+
+
+static int writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t count = ::write(fd, data, size);
+
+        if (count < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        data += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+static int makeDirectory(const std::string &path)
+{
+    for (size_t i = 1; i <= path.length(); ++i)
+    {
+        if (i < path.length() && path[i] != '/') continue;
+
+        std::string prefix = path.substr(0, i);
+
+        if (::mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) return -1;
+    }
+
+    return 0;
+}
+
+static void fileError(Image &image, Output &output, const char *task, const std::string &path, const char *message)
+{
+    Record r("error", image.path());
+
+    r.add("task", task);
+    r.add("path", path);
+    r.add("error", message);
+
+    output.write(r);
+}
+
+
+#pragma mark -
+#pragma mark ProDOS
+
+typedef std::function<void(const std::string &path, const FileEntry &entry)> FileVisitor;
+
+/*
+ * visit every file and directory, depth first.  Returns the number of
+ * directories which couldn't be read.
+ */
+static unsigned walkProDOS(Disk *disk, unsigned block, const std::string &prefix, unsigned depth,
+    const FileVisitor &visitor, Image &image, Output &output)
+{
+    std::vector<FileEntry> files;
+    int ok;
+
+    // a path is at most 64 characters, so this must be a loop.
+    if (depth > 32) ok = -P8_CYCLICAL_BLOCK;
+    else if (block == 2) ok = disk->ReadVolume(NULL, &files);
+    else ok = disk->ReadDirectory(block, NULL, &files);
+
+    if (ok < 0)
+    {
+        Record r("problem", image.path());
+
+        r.add("path", prefix.empty() ? std::string("/") : prefix);
+        r.add("block", (unsigned long long)block);
+        r.add("error", (unsigned long long)-ok);
+
+        output.write(r);
+        return 1;
+    }
+
+    unsigned errors = 0;
+
+    for (std::vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
+    {
+        std::string path = prefix + "/" + iter->file_name;
+
+        visitor(path, *iter);
+
+        if (iter->storage_type == DIRECTORY_FILE)
+            errors += walkProDOS(disk, iter->key_pointer, path, depth + 1, visitor, image, output);
+    }
+
+    return errors;
+}
+
+static void catalogProDOS(const std::string &path, const FileEntry &e, Image &image, Output &output)
+{
+    Record r("file", image.path());
+
+    r.add("path", path);
+    r.add("storage", (unsigned long long)e.storage_type);
+    r.add("filetype", (unsigned long long)e.file_type);
+    r.add("auxtype", (unsigned long long)e.aux_type);
+    r.add("size", (unsigned long long)(e.storage_type == DIRECTORY_FILE ? 0 : e.eof));
+    r.add("blocks", (unsigned long long)e.blocks_used);
+    r.add("modified", (unsigned long long)e.last_mod);
+
+    output.write(r);
+}
+
+static void extractProDOS(Disk *disk, const std::string &root, const std::string &path, const FileEntry &e,
+    unsigned *errors, Image &image, Output &output)
+{
+    std::string outfile = root + path;
+
+    if (e.storage_type == DIRECTORY_FILE)
+    {
+        if (makeDirectory(outfile) != 0)
+        {
+            fileError(image, output, "extract", path, std::strerror(errno));
+            ++*errors;
+        }
+        return;
+    }
+
+    FileEntry f = e;
+    ExtentList extents;
+
+    if (disk->Normalize(f, P8_DATA_FORK) < 0 || disk->ReadExtents(f, &extents) < 0)
+    {
+        fileError(image, output, "extract", path, "Unable to read the file index.");
+        ++*errors;
+        return;
+    }
+
+    File file(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666, std::nothrow);
+
+    if (!file.isValid())
+    {
+        fileError(image, output, "extract", path, std::strerror(errno));
+        ++*errors;
+        return;
+    }
+
+    std::vector<uint8_t> buffer(kChunkBlocks * 512);
+    uint32_t remaining = f.eof;
+    unsigned block = 0;
+
+    while (remaining)
+    {
+        unsigned count = std::min((uint32_t)kChunkBlocks, (remaining + 511) >> 9);
+        uint32_t size = std::min(remaining, (uint32_t)count * 512);
+
+        if (disk->ReadBlocks(extents, block, count, &buffer[0]) < 0)
+        {
+            fileError(image, output, "extract", path, "Unable to read the file.");
+            ++*errors;
+            return;
+        }
+
+        if (writeAll(file.fd(), &buffer[0], size) != 0)
+        {
+            fileError(image, output, "extract", path, std::strerror(errno));
+            ++*errors;
+            return;
+        }
+
+        block += count;
+        remaining -= size;
+    }
+}
+
+
+#pragma mark -
+#pragma mark Pascal
+
+static const char *PascalKind(unsigned kind)
+{
+    static const char *kinds[] = {
+        "untyped",
+        "bad",
+        "code",
+        "text",
+        "info",
+        "data",
+        "graf",
+        "foto",
+        "securedir"
+    };
+
+    return kind < 9 ? kinds[kind] : "unknown";
+}
+
+// pascal names may contain /
+static std::string PascalPath(const char *name)
+{
+    std::string rv(name);
+
+    std::replace(rv.begin(), rv.end(), '/', ':');
+
+    return rv;
+}
+
+
+#pragma mark -
+#pragma mark CatalogTask
+
+const char *CatalogTask::name() const
+{
+    return "catalog";
+}
+
+int CatalogTask::run(Image &image, Output &output)
+{
+    switch (image.fileSystem())
+    {
+        case Image::kProDOS:
+        {
+            DiskPointer disk = Disk::OpenFile(image.device());
+            VolumeEntry v;
+
+            if (disk->ReadVolume(&v, NULL) < 0) return 1;
+
+            Record r("volume", image.path());
+
+            r.add("filesystem", Image::FileSystemName(image.fileSystem()));
+            r.add("name", v.volume_name);
+            r.add("blocks", (unsigned long long)v.total_blocks);
+            r.add("files", (unsigned long long)v.file_count);
+
+            output.write(r);
+
+            FileVisitor visitor = std::bind(catalogProDOS, std::placeholders::_1, std::placeholders::_2,
+                std::ref(image), std::ref(output));
+
+            return walkProDOS(disk.get(), 2, "", 0, visitor, image, output) ? 1 : 0;
+        }
+
+        case Image::kPascal:
+        {
+            Pascal::VolumeEntryPointer volume = Pascal::VolumeEntry::Open(image.device());
+
+            Record r("volume", image.path());
+
+            r.add("filesystem", Image::FileSystemName(image.fileSystem()));
+            r.add("name", volume->name());
+            r.add("blocks", (unsigned long long)volume->volumeBlocks());
+            r.add("files", (unsigned long long)volume->fileCount());
+            r.add("free", (unsigned long long)volume->freeBlocks());
+
+            output.write(r);
+
+            for (unsigned i = 0; i < volume->fileCount(); ++i)
+            {
+                Pascal::FileEntryPointer e = volume->fileAtIndex(i);
+
+                Record r("file", image.path());
+
+                r.add("path", PascalPath(e->name()));
+                r.add("kind", PascalKind(e->fileKind()));
+                r.add("size", (unsigned long long)e->fileSize());
+                r.add("blocks", (unsigned long long)e->blocks());
+                r.add("first", (unsigned long long)e->firstBlock());
+                r.add("modified", (unsigned long long)(std::time_t)e->modification());
+
+                output.write(r);
+            }
+            return 0;
+        }
+    }
+
+    Record r("volume", image.path());
+
+    r.add("filesystem", Image::FileSystemName(image.fileSystem()));
+    r.add("blocks", (unsigned long long)image.device()->blocks());
+
+    output.write(r);
+
+    return 1;
+}
+
+
+#pragma mark -
+#pragma mark ExtractTask
+
+ExtractTask::ExtractTask(const std::string &directory) :
+    _directory(directory)
+{
+}
+
+const char *ExtractTask::name() const
+{
+    return "extract";
+}
+
+int ExtractTask::run(Image &image, Output &output)
+{
+    std::string root(_directory);
+    unsigned errors = 0;
+
+    // directory/image.d -- without any /, . or .. components of the image path.
+    const std::string &path = image.path();
+
+    for (size_t i = 0; i < path.length(); )
+    {
+        size_t j = path.find('/', i);
+        if (j == std::string::npos) j = path.length();
+
+        std::string component = path.substr(i, j - i);
+
+        if (!component.empty() && component != "." && component != "..")
+        {
+            if (!root.empty() && root[root.length() - 1] != '/') root += '/';
+            root += component;
+        }
+
+        i = j + 1;
+    }
+    root += ".d";
+
+    if (makeDirectory(root) != 0)
+    {
+        fileError(image, output, name(), root, std::strerror(errno));
+        return 1;
+    }
+
+    switch (image.fileSystem())
+    {
+        case Image::kProDOS:
+        {
+            DiskPointer disk = Disk::OpenFile(image.device());
+
+            FileVisitor visitor = std::bind(extractProDOS, disk.get(), root,
+                std::placeholders::_1, std::placeholders::_2,
+                &errors, std::ref(image), std::ref(output));
+
+            errors += walkProDOS(disk.get(), 2, "", 0, visitor, image, output);
+            break;
+        }
+
+        case Image::kPascal:
+        {
+            Pascal::VolumeEntryPointer volume = Pascal::VolumeEntry::Open(image.device());
+            std::vector<uint8_t> buffer(kChunkBlocks * 512);
+
+            for (unsigned i = 0; i < volume->fileCount(); ++i)
+            {
+                Pascal::FileEntryPointer e = volume->fileAtIndex(i);
+                std::string name = PascalPath(e->name());
+                std::string outfile = root + "/" + name;
+
+                File file(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666, std::nothrow);
+
+                if (!file.isValid())
+                {
+                    fileError(image, output, this->name(), name, std::strerror(errno));
+                    ++errors;
+                    continue;
+                }
+
+                unsigned fileSize = e->fileSize();
+
+                for (unsigned offset = 0; offset < fileSize; )
+                {
+                    int count = e->read(&buffer[0], std::min((unsigned)buffer.size(), fileSize - offset), offset);
+
+                    if (count <= 0) break;
+
+                    if (writeAll(file.fd(), &buffer[0], count) != 0)
+                    {
+                        fileError(image, output, this->name(), name, std::strerror(errno));
+                        ++errors;
+                        break;
+                    }
+
+                    offset += count;
+                }
+            }
+            break;
+        }
+
+        default:
+            return 1;
+    }
+
+    return errors ? 1 : 0;
+}
+
+
+#pragma mark -
+#pragma mark VerifyTask
+
+const char *VerifyTask::name() const
+{
+    return "verify";
+}
+
+int VerifyTask::run(Image &image, Output &output)
+{
+    unsigned problems = 0;
+
+    switch (image.fileSystem())
+    {
+        case Image::kProDOS:
+        {
+            ProDOS::Fsck fsck(image.device());
+
+            problems = fsck.check();
+
+            const std::vector<ProDOS::Fsck::Problem> &list = fsck.problems();
+
+            for (unsigned i = 0; i < list.size(); ++i)
+            {
+                Record r("problem", image.path());
+
+                r.add("problem", ProDOS::Fsck::ProblemName(list[i].type));
+                r.add("block", (unsigned long long)list[i].block);
+                r.add("path", list[i].path);
+                r.add("message", list[i].message);
+
+                output.write(r);
+            }
+            break;
+        }
+
+        case Image::kPascal:
+        {
+            Pascal::VolumeEntryPointer volume = Pascal::VolumeEntry::Open(image.device());
+            unsigned next = volume->lastBlock();
+
+            for (unsigned i = 0; i < volume->fileCount(); ++i)
+            {
+                Pascal::FileEntryPointer e = volume->fileAtIndex(i);
+                const char *message = NULL;
+
+                if (e->firstBlock() < next) message = "Overlaps the previous file.";
+                else if (e->lastBlock() < e->firstBlock()) message = "Invalid block range.";
+                else if (e->lastBlock() > volume->volumeBlocks()) message = "Past the end of the volume.";
+
+                if (message)
+                {
+                    Record r("problem", image.path());
+
+                    r.add("path", PascalPath(e->name()));
+                    r.add("block", (unsigned long long)e->firstBlock());
+                    r.add("message", message);
+
+                    output.write(r);
+                    ++problems;
+                }
+
+                next = std::max(next, e->lastBlock());
+            }
+            break;
+        }
+
+        default:
+            ++problems;
+            break;
+    }
+
+    Record r("verify", image.path());
+
+    r.add("filesystem", Image::FileSystemName(image.fileSystem()));
+    r.add("status", problems ? "damaged" : "ok");
+    r.add("problems", (unsigned long long)problems);
+
+    output.write(r);
+
+    return problems ? 1 : 0;
+}
+
+
+#pragma mark -
+#pragma mark ChecksumTask
+
+const char *ChecksumTask::name() const
+{
+    return "checksum";
+}
+
+int ChecksumTask::run(Image &image, Output &output)
+{
+    Device::BlockDevicePointer device = image.device();
+
+    std::vector<uint8_t> buffer(kChunkBlocks * 512);
+    unsigned blocks = device->blocks();
+    uint32_t crc = 0;
+
+    for (unsigned block = 0; block < blocks; )
+    {
+        unsigned count = std::min((unsigned)kChunkBlocks, blocks - block);
+
+        device->readBlocks(block, count, &buffer[0]);
+
+        crc = Crc32(crc, &buffer[0], count * 512);
+
+        block += count;
+    }
+
+    char hex[16];
+    std::snprintf(hex, sizeof(hex), "%08x", crc);
+
+    Record r("checksum", image.path());
+
+    r.add("blocks", (unsigned long long)blocks);
+    r.add("crc32", hex);
+
+    output.write(r);
+
+    return 0;
+}
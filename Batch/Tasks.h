@@ -0,0 +1,47 @@
+#ifndef __BATCH_TASKS_H__
+#define __BATCH_TASKS_H__
+
+#include <string>
+
+#include <Batch/Batch.h>
+
+
+namespace Batch {
+
+    // a volume record and a record for every file.
+    class CatalogTask : public Task {
+    public:
+        virtual const char *name() const;
+        virtual int run(Image &image, Output &output);
+    };
+
+    // copy every file (data forks only) to directory/image.d/
+    class ExtractTask : public Task {
+    public:
+        ExtractTask(const std::string &directory);
+
+        virtual const char *name() const;
+        virtual int run(Image &image, Output &output);
+
+    private:
+        std::string _directory;
+    };
+
+    // ProDOS volumes are checked with Fsck; Pascal volumes for
+    // overlapping or out of range files.
+    class VerifyTask : public Task {
+    public:
+        virtual const char *name() const;
+        virtual int run(Image &image, Output &output);
+    };
+
+    // CRC-32 of every block (in ProDOS order.)
+    class ChecksumTask : public Task {
+    public:
+        virtual const char *name() const;
+        virtual int run(Image &image, Output &output);
+    };
+
+}
+
+#endif
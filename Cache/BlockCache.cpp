@@ -56,6 +56,28 @@ BlockCachePointer BlockCache::Create(BlockDevicePointer device)
 }
 
 
+void BlockCache::copyBlocks(unsigned from, unsigned to, unsigned count)
+{
+    uint8_t buffer[512];
+    
+    if (to > from && to < from + count)
+    {
+        while (count--)
+        {
+            read(from + count, buffer);
+            write(to + count, buffer);
+        }
+        return;
+    }
+    
+    for (unsigned i = 0; i < count; ++i)
+    {
+        read(from + i, buffer);
+        write(to + i, buffer);
+    }
+}
+
+
 void BlockCache::zeroBlock(unsigned block)
 {
     /*
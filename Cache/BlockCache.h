@@ -40,6 +40,9 @@ public:
     
     virtual void zeroBlock(unsigned block);
     
+    // the ranges may overlap.
+    virtual void copyBlocks(unsigned from, unsigned to, unsigned count);
+    
     void release(unsigned block) { release(block, 0); }
     void release(unsigned block, bool dirty) 
     {
@@ -155,6 +155,42 @@ void ConcreteBlockCache::write(unsigned block, const void *bp)
 
 
 
+/*
+ * the copy is done by the device.  Dirty source blocks are written 
+ * first and cached destination blocks are re-read afterwards.
+ */
+void ConcreteBlockCache::copyBlocks(unsigned from, unsigned to, unsigned count)
+{
+    Entry *e;
+    
+    if (from == to || !count) return;
+    
+    for (unsigned i = 0; i < count; ++i)
+    {
+        e = findEntry(from + i);
+        
+        if (e && e->dirty)
+        {
+            _device->write(e->block, e->buffer);
+            e->dirty = false;
+        }
+    }
+    
+    _device->copyBlocks(from, to, count);
+    
+    for (unsigned i = 0; i < count; ++i)
+    {
+        e = findEntry(to + i);
+        
+        if (e)
+        {
+            _device->read(e->block, e->buffer);
+            e->dirty = false;
+        }
+    }
+}
+
+
 void ConcreteBlockCache::markDirty(unsigned block)
 {
     Entry *e = findEntry(block);
@@ -16,6 +16,7 @@ public:
 
     virtual void sync();
     virtual void write(unsigned block, const void *vp);
+    virtual void copyBlocks(unsigned from, unsigned to, unsigned count);
 
 
     virtual void *acquire(unsigned block);
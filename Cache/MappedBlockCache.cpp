@@ -94,6 +94,18 @@ void MappedBlockCache::zeroBlock(unsigned block)
 }
 
 
+void MappedBlockCache::copyBlocks(unsigned from, unsigned to, unsigned count)
+{
+#undef __METHOD__
+#define __METHOD__ "MappedBlockCache::copyBlocks"
+    
+    if (from + count > blocks() || to + count > blocks())
+        throw Exception(__METHOD__ ": Invalid block.");
+    
+    _dirty = true;
+    std::memmove(_data + to * 512, _data + from * 512, count * 512);
+}
+
 
 // sync everything.
 void MappedBlockCache::sync()
@@ -16,6 +16,7 @@ class MappedBlockCache : public BlockCache {
     virtual void write(unsigned block, const void *vp);
 
     virtual void zeroBlock(unsigned block);    
+    virtual void copyBlocks(unsigned from, unsigned to, unsigned count);
     
 
     virtual void *acquire(unsigned block);
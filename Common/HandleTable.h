@@ -0,0 +1,132 @@
+#ifndef __HANDLETABLE_H__
+#define __HANDLETABLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+/*
+ * Fixed size table of open handles, safe for concurrent use without
+ * locks.
+ *
+ * A handle is (generation << 32) | index.  The slot generation is odd
+ * while the slot is in use and is bumped on allocate and free, so a
+ * stale handle (already released, or released and re-used) is never
+ * found.  Free slots are kept on a stack whose head is tagged with a
+ * counter (ABA).  0 is never a valid handle.
+ *
+ * T must be default constructible; free() resets the slot to T().
+ * Callers must not free a handle while another thread is using it.
+ */
+
+template <class T, unsigned Size = 1024>
+class HandleTable {
+public:
+
+    HandleTable()
+    {
+        for (unsigned i = 0; i < Size; ++i)
+        {
+            _slots[i].generation.store(0, std::memory_order_relaxed);
+            _slots[i].next.store(i + 1 < Size ? i + 2 : 0, std::memory_order_relaxed);
+        }
+        _free.store(1, std::memory_order_release);
+    }
+
+    // returns 0 if the table is full.
+    uint64_t allocate(const T &value)
+    {
+        uint64_t head = _free.load(std::memory_order_acquire);
+        uint64_t newHead;
+        unsigned index;
+
+        do {
+            index = head & 0xffffffff;
+            if (!index) return 0;
+
+            newHead = ((head >> 32) + 1) << 32;
+            newHead |= _slots[index - 1].next.load(std::memory_order_relaxed);
+
+        } while (!_free.compare_exchange_weak(head, newHead, std::memory_order_acq_rel));
+
+        Slot &slot = _slots[--index];
+
+        slot.value = value;
+
+        uint64_t generation = slot.generation.fetch_add(1, std::memory_order_release) + 1;
+
+        return (generation << 32) | index;
+    }
+
+    bool free(uint64_t handle)
+    {
+        T *value = find(handle);
+        if (!value) return false;
+
+        unsigned index = handle & 0xffffffff;
+        Slot &slot = _slots[index];
+
+        *value = T();
+        slot.generation.fetch_add(1, std::memory_order_release);
+
+        uint64_t head = _free.load(std::memory_order_acquire);
+        uint64_t newHead;
+
+        do {
+            slot.next.store(head & 0xffffffff, std::memory_order_relaxed);
+
+            newHead = (((head >> 32) + 1) << 32) | (index + 1);
+
+        } while (!_free.compare_exchange_weak(head, newHead, std::memory_order_acq_rel));
+
+        return true;
+    }
+
+    // NULL if the handle is stale or invalid.
+    T *find(uint64_t handle)
+    {
+        unsigned index = handle & 0xffffffff;
+        uint32_t generation = handle >> 32;
+
+        if (index >= Size || !(generation & 0x01)) return NULL;
+
+        Slot &slot = _slots[index];
+
+        if (slot.generation.load(std::memory_order_acquire) != generation) return NULL;
+
+        return &slot.value;
+    }
+
+    // iteration (for slots which are in use.)
+    unsigned size() const { return Size; }
+
+    T *at(unsigned index)
+    {
+        if (index >= Size) return NULL;
+
+        Slot &slot = _slots[index];
+
+        if (!(slot.generation.load(std::memory_order_acquire) & 0x01)) return NULL;
+
+        return &slot.value;
+    }
+
+private:
+
+    HandleTable(const HandleTable &);
+    HandleTable& operator=(const HandleTable &);
+
+    struct Slot {
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> next; // index + 1 of the next free slot.
+        T value;
+    };
+
+    Slot _slots[Size];
+
+    // (tag << 32) | (index + 1) of the first free slot.
+    std::atomic<uint64_t> _free;
+};
+
+#endif
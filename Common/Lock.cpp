@@ -25,3 +25,55 @@ bool Lock::tryLock()
 {
     return pthread_mutex_trylock(&_mutex) == 0;
 }
+
+
+RWLock::RWLock()
+{
+    pthread_rwlock_init(&_rwlock, NULL);
+}
+
+RWLock::~RWLock()
+{
+    pthread_rwlock_destroy(&_rwlock);
+}
+
+void RWLock::readLock()
+{
+    pthread_rwlock_rdlock(&_rwlock);
+}
+
+void RWLock::writeLock()
+{
+    pthread_rwlock_wrlock(&_rwlock);
+}
+
+void RWLock::unlock()
+{
+    pthread_rwlock_unlock(&_rwlock);
+}
+
+
+Condition::Condition()
+{
+    pthread_cond_init(&_cond, NULL);
+}
+
+Condition::~Condition()
+{
+    pthread_cond_destroy(&_cond);
+}
+
+void Condition::wait(Lock &lock)
+{
+    pthread_cond_wait(&_cond, &lock._mutex);
+}
+
+void Condition::signal()
+{
+    pthread_cond_signal(&_cond);
+}
+
+void Condition::broadcast()
+{
+    pthread_cond_broadcast(&_cond);
+}
@@ -15,6 +15,8 @@ public:
     bool tryLock();
     
 private:
+    friend class Condition;
+    
     pthread_mutex_t _mutex;
 };
 
@@ -27,4 +29,51 @@ private:
 };
 
 
+// many readers or one writer.
+class RWLock {
+public:
+    RWLock();
+    ~RWLock();
+    
+    void readLock();
+    void writeLock();
+    void unlock();
+    
+private:
+    pthread_rwlock_t _rwlock;
+};
+
+class ReadLocker {
+public:
+    ReadLocker(RWLock& lock) : _lock(lock) { _lock.readLock(); }
+    ~ReadLocker() { _lock.unlock(); }
+private:
+    RWLock &_lock;
+};
+
+class WriteLocker {
+public:
+    WriteLocker(RWLock& lock) : _lock(lock) { _lock.writeLock(); }
+    ~WriteLocker() { _lock.unlock(); }
+private:
+    RWLock &_lock;
+};
+
+
+class Condition {
+public:
+    Condition();
+    ~Condition();
+    
+    // lock must be held by the caller.
+    void wait(Lock &lock);
+    
+    void signal();
+    void broadcast();
+    
+private:
+    pthread_cond_t _cond;
+};
+
+
 #endif
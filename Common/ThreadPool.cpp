@@ -0,0 +1,131 @@
+
+#include <unistd.h>
+
+#include <Common/ThreadPool.h>
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+unsigned ThreadPool::DefaultThreads()
+{
+    long count = -1;
+    
+#ifdef _SC_NPROCESSORS_ONLN
+    count = ::sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    
+    if (count < 1) return 1;
+    if (count > 64) return 64;
+    return count;
+}
+
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+#undef __METHOD__
+#define __METHOD__ "ThreadPool::ThreadPool"
+    
+    _active = 0;
+    _shutdown = false;
+    
+    if (!threads) threads = DefaultThreads();
+    
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        pthread_t thread;
+        int error = ::pthread_create(&thread, NULL, worker, this);
+        
+        if (error)
+        {
+            if (i) break; // run with fewer threads.
+            throw POSIX::Exception(__METHOD__ ": pthread_create", error);
+        }
+        _threads.push_back(thread);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    // pending tasks are discarded; running tasks are allowed to finish.
+    _lock.lock();
+    _shutdown = true;
+    _tasks.clear();
+    _taskCondition.broadcast();
+    _lock.unlock();
+    
+    for (unsigned i = 0; i < _threads.size(); ++i)
+    {
+        ::pthread_join(_threads[i], NULL);
+    }
+}
+
+
+void ThreadPool::enqueue(const Task &task, bool priority)
+{
+    Locker locker(_lock);
+    
+    if (_shutdown) return;
+    
+    if (priority) _tasks.push_front(task);
+    else _tasks.push_back(task);
+    
+    _taskCondition.signal();
+}
+
+
+void ThreadPool::wait()
+{
+    Locker locker(_lock);
+    
+    while (_active || !_tasks.empty())
+        _idleCondition.wait(_lock);
+}
+
+bool ThreadPool::idle()
+{
+    Locker locker(_lock);
+    
+    return !_active && _tasks.empty();
+}
+
+
+void *ThreadPool::worker(void *vp)
+{
+    ((ThreadPool *)vp)->run();
+    return NULL;
+}
+
+void ThreadPool::run()
+{
+    _lock.lock();
+    
+    for (;;)
+    {
+        while (!_shutdown && _tasks.empty())
+            _taskCondition.wait(_lock);
+        
+        if (_shutdown) break;
+        
+        Task task = _tasks.front();
+        _tasks.pop_front();
+        ++_active;
+        
+        _lock.unlock();
+        
+        // a task should not throw, but if it does, don't take down the process.
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+        }
+        
+        _lock.lock();
+        
+        --_active;
+        if (!_active && _tasks.empty()) _idleCondition.broadcast();
+    }
+    
+    _lock.unlock();
+}
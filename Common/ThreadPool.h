@@ -0,0 +1,60 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include <pthread.h>
+
+#include <Common/Lock.h>
+
+/*
+ * Fixed size pool of worker threads sharing a single task queue.
+ * Priority tasks are queued at the front, so they run before
+ * anything already waiting.
+ *
+ * Threads are created in the constructor, so a pool must not be
+ * created before fork() (eg, fuse_daemonize).
+ */
+
+class ThreadPool {
+public:
+    
+    typedef std::function<void()> Task;
+    
+    static unsigned DefaultThreads();
+    
+    ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    
+    void enqueue(const Task &task, bool priority = false);
+    
+    // block until the queue is empty and all workers are idle.
+    void wait();
+    
+    // true if no tasks are queued or running.
+    bool idle();
+    
+    unsigned threads() const { return _threads.size(); }
+    
+private:
+    
+    ThreadPool(const ThreadPool &);
+    ThreadPool& operator=(const ThreadPool &);
+    
+    static void *worker(void *);
+    void run();
+    
+    Lock _lock;
+    Condition _taskCondition;
+    Condition _idleCondition;
+    
+    std::deque<Task> _tasks;
+    std::vector<pthread_t> _threads;
+    
+    unsigned _active;
+    bool _shutdown;
+};
+
+#endif
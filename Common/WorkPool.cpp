@@ -0,0 +1,189 @@
+
+#include <Common/WorkPool.h>
+#include <Common/ThreadPool.h>
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+WorkPool::WorkPool(unsigned threads)
+{
+#undef __METHOD__
+#define __METHOD__ "WorkPool::WorkPool"
+
+    int error;
+
+    _queued = 0;
+    _pending = 0;
+    _next = 0;
+    _running = 0;
+    _shutdown = false;
+
+    if (!threads) threads = ThreadPool::DefaultThreads();
+
+    error = ::pthread_key_create(&_key, NULL);
+    if (error) throw POSIX::Exception(__METHOD__ ": pthread_key_create", error);
+
+    // all the queues must exist before any worker starts stealing.
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        Worker *w = new Worker();
+
+        w->pool = this;
+        w->index = i;
+        _workers.push_back(w);
+    }
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        error = ::pthread_create(&_workers[i]->thread, NULL, worker, _workers[i]);
+
+        if (error)
+        {
+            if (i) break; // run with fewer threads (the extra queues are only stolen from.)
+
+            for (unsigned j = 0; j < threads; ++j) delete _workers[j];
+            _workers.clear();
+            ::pthread_key_delete(_key);
+            throw POSIX::Exception(__METHOD__ ": pthread_create", error);
+        }
+        ++_running;
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    // pending tasks are discarded; running tasks are allowed to finish.
+    _lock.lock();
+    _shutdown = true;
+    _taskCondition.broadcast();
+    _lock.unlock();
+
+    for (unsigned i = 0; i < _running; ++i)
+    {
+        ::pthread_join(_workers[i]->thread, NULL);
+    }
+
+    for (unsigned i = 0; i < _workers.size(); ++i)
+    {
+        delete _workers[i];
+    }
+
+    ::pthread_key_delete(_key);
+}
+
+
+void WorkPool::enqueue(const Task &task)
+{
+    Worker *w = (Worker *)::pthread_getspecific(_key);
+
+    // counted before it's visible, so a thief can't finish it (and
+    // take _pending to 0) before it's counted.
+    {
+        Locker locker(_lock);
+
+        if (!w || w->pool != this) w = _workers[_next++ % _running];
+
+        ++_queued;
+        ++_pending;
+    }
+
+    {
+        Locker locker(w->lock);
+        w->tasks.push_back(task);
+    }
+
+    Locker locker(_lock);
+
+    _taskCondition.signal();
+}
+
+
+void WorkPool::wait()
+{
+    Locker locker(_lock);
+
+    while (_pending)
+        _idleCondition.wait(_lock);
+}
+
+
+// the newest task from our own queue or the oldest from someone else's.
+bool WorkPool::take(Worker *self, Task &task)
+{
+    {
+        Locker locker(self->lock);
+
+        if (!self->tasks.empty())
+        {
+            task = self->tasks.back();
+            self->tasks.pop_back();
+            return true;
+        }
+    }
+
+    unsigned count = _workers.size();
+
+    for (unsigned i = 1; i < count; ++i)
+    {
+        Worker *victim = _workers[(self->index + i) % count];
+
+        Locker locker(victim->lock);
+
+        if (!victim->tasks.empty())
+        {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void *WorkPool::worker(void *vp)
+{
+    Worker *w = (Worker *)vp;
+
+    ::pthread_setspecific(w->pool->_key, w);
+    w->pool->run(w);
+
+    return NULL;
+}
+
+void WorkPool::run(Worker *self)
+{
+    for (;;)
+    {
+        Task task;
+
+        if (take(self, task))
+        {
+            _lock.lock();
+            --_queued;
+            _lock.unlock();
+
+            // a task should not throw, but if it does, don't take down the process.
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+            }
+
+            _lock.lock();
+            if (--_pending == 0) _idleCondition.broadcast();
+            _lock.unlock();
+
+            continue;
+        }
+
+        Locker locker(_lock);
+
+        while (!_shutdown && !_queued)
+            _taskCondition.wait(_lock);
+
+        if (_shutdown) break;
+    }
+}
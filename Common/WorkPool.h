@@ -0,0 +1,73 @@
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include <pthread.h>
+
+#include <Common/Lock.h>
+
+/*
+ * Fixed size pool of worker threads, each with its own task queue.
+ *
+ * A task queued from a worker goes on that worker's queue and the
+ * worker runs its own queue newest first, so work spawned by a task
+ * (eg, the contents of a directory) stays on the same thread.  An idle
+ * worker steals the oldest task from another worker.  Tasks queued from
+ * outside the pool are dealt out round robin.
+ *
+ * As with ThreadPool, a pool must not be created before fork().
+ */
+
+class WorkPool {
+public:
+
+    typedef std::function<void()> Task;
+
+    WorkPool(unsigned threads = 0);
+    ~WorkPool();
+
+    void enqueue(const Task &task);
+
+    // block until every task (including tasks they queue) has run.
+    void wait();
+
+    unsigned threads() const { return _running; }
+
+private:
+
+    WorkPool(const WorkPool &);
+    WorkPool& operator=(const WorkPool &);
+
+    struct Worker {
+        WorkPool *pool;
+        unsigned index;
+        pthread_t thread;
+
+        Lock lock;
+        std::deque<Task> tasks;
+    };
+
+    static void *worker(void *);
+    void run(Worker *self);
+
+    bool take(Worker *self, Task &task);
+
+    std::vector<Worker *> _workers;
+
+    pthread_key_t _key;
+
+    Lock _lock;
+    Condition _taskCondition;
+    Condition _idleCondition;
+
+    unsigned _queued;   // tasks waiting in a queue.
+    unsigned _pending;  // tasks queued or running.
+    unsigned _next;
+    unsigned _running;
+    bool _shutdown;
+};
+
+#endif
@@ -14,6 +14,22 @@ Adaptor::~Adaptor()
 {
 }
 
+void Adaptor::readBlocks(unsigned block, unsigned count, void *bp)
+{
+    uint8_t *cp = (uint8_t *)bp;
+    
+    for (unsigned i = 0; i < count; ++i)
+        readBlock(block + i, cp + 512 * i);
+}
+
+void Adaptor::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+    const uint8_t *cp = (const uint8_t *)bp;
+    
+    for (unsigned i = 0; i < count; ++i)
+        writeBlock(block + i, cp + 512 * i);
+}
+
 
 
 POAdaptor::POAdaptor(void *address)
@@ -31,6 +47,16 @@ void POAdaptor::writeBlock(unsigned block, const void *bp)
     std::memcpy(_address + block * 512, bp, 512);
 }
 
+void POAdaptor::readBlocks(unsigned block, unsigned count, void *bp)
+{
+    std::memcpy(bp, _address + block * 512, count * 512);
+}
+
+void POAdaptor::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+    std::memcpy(_address + block * 512, bp, count * 512);
+}
+
 
 unsigned DOAdaptor::Map[] = {
     0x00, 0x0e, 0x0d, 0x0c, 
@@ -74,6 +100,56 @@ void DOAdaptor::writeBlock(unsigned block, const void *bp)
     }
 }
 
+/*
+ * a track (8 blocks, 16 sectors) at a time.  Partial tracks at either
+ * end are done a block at a time.
+ */
+void DOAdaptor::readBlocks(unsigned block, unsigned count, void *bp)
+{
+    uint8_t *cp = (uint8_t *)bp;
+    
+    while (count && ((block & 0x07) || count < 8))
+    {
+        readBlock(block++, cp);
+        cp += 512;
+        --count;
+    }
+    
+    for ( ; count >= 8; count -= 8, block += 8, cp += 4096)
+    {
+        const uint8_t *track = _address + (block << 9);
+        
+        for (unsigned sector = 0; sector < 16; ++sector)
+            std::memcpy(cp + (sector << 8), track + (Map[sector] << 8), 256);
+    }
+    
+    for ( ; count; --count, ++block, cp += 512)
+        readBlock(block, cp);
+}
+
+void DOAdaptor::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+    const uint8_t *cp = (const uint8_t *)bp;
+    
+    while (count && ((block & 0x07) || count < 8))
+    {
+        writeBlock(block++, cp);
+        cp += 512;
+        --count;
+    }
+    
+    for ( ; count >= 8; count -= 8, block += 8, cp += 4096)
+    {
+        uint8_t *track = _address + (block << 9);
+        
+        for (unsigned sector = 0; sector < 16; ++sector)
+            std::memcpy(track + (Map[sector] << 8), cp + (sector << 8), 256);
+    }
+    
+    for ( ; count; --count, ++block, cp += 512)
+        writeBlock(block, cp);
+}
+
 
 
 #pragma mark -
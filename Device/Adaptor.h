@@ -16,6 +16,10 @@ namespace Device {
         virtual ~Adaptor();
         virtual void readBlock(unsigned block, void *bp) = 0;
         virtual void writeBlock(unsigned block, const void *bp) = 0;        
+        
+        // count consecutive blocks.
+        virtual void readBlocks(unsigned block, unsigned count, void *bp);
+        virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
     };
     
 
@@ -25,6 +29,9 @@ namespace Device {
         POAdaptor(void *address);
         virtual void readBlock(unsigned block, void *bp);
         virtual void writeBlock(unsigned block, const void *bp);
+        
+        virtual void readBlocks(unsigned block, unsigned count, void *bp);
+        virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
     private:
         uint8_t *_address;
     };
@@ -35,6 +42,9 @@ namespace Device {
         DOAdaptor(void *address);
         virtual void readBlock(unsigned block, void *bp);
         virtual void writeBlock(unsigned block, const void *bp);
+        
+        virtual void readBlocks(unsigned block, unsigned count, void *bp);
+        virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
 
     
         static unsigned Map[];
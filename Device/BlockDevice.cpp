@@ -13,6 +13,7 @@
 #include <Cache/ConcreteBlockCache.h>
 
 #include <Common/Exception.h>
+#include <Common/auto.h>
 #include <POSIX/Exception.h>
 
 #include <Device/DiskImage.h>
@@ -20,6 +21,7 @@
 #include <Device/DiskCopy42Image.h>
 #include <Device/DavexDiskImage.h>
 #include <Device/RawDevice.h>
+#include <Device/ChunkDevice.h>
 
 #ifdef HAVE_NUFX
 #include <Device/SDKImage.h>
@@ -46,6 +48,9 @@ unsigned BlockDevice::ImageType(MappedFile *f, unsigned defv)
         return 'SDK_';
 #endif
     
+    if (ChunkDevice::Validate(f, std::nothrow))
+        return 'PFM_';
+    
     if (ProDOSOrderDiskImage::Validate(f, std::nothrow))
         return 'PO__';
     
@@ -101,6 +106,9 @@ unsigned BlockDevice::ImageType(const char *type, unsigned defv)
     if (::strcasecmp(type, "davex") == 0)
         return 'DVX_';
     
+    if (::strcasecmp(type, "pfm") == 0)
+        return 'PFM_';
+    
    
 #ifdef HAVE_NUFX 
     if (::strcasecmp(type, "sdk") == 0)
@@ -155,6 +163,9 @@ BlockDevicePointer BlockDevice::Open(const char *name, File::FileFlags flags, un
             
         case 'DVX_':
             return DavexDiskImage::Open(&file);
+            
+        case 'PFM_':
+            return ChunkDevice::Open(&file, name);
            
 #if HAVE_NUFX 
         case 'SDK_':
@@ -226,12 +237,57 @@ BlockDevicePointer BlockDevice::Create(const char *fname, const char *vname, uns
             
         case 'DVX_':
             return DavexDiskImage::Create(fname, blocks, vname);
+            
+        case 'PFM_':
+            return ChunkDevice::Create(fname, blocks);
     }
     
     return BlockDevicePointer();
     
 }
 
+/*
+ * disk images are created with the header and data in place (one
+ * write, before the file is mapped.)  Others are created and then
+ * written.
+ */
+BlockDevicePointer BlockDevice::Create(const char *fname, const char *vname, unsigned blocks, unsigned imageType, const void *data, unsigned count)
+{
+    std::string xname;
+    
+    if (!imageType) imageType = ImageType(fname, 'PO__');
+    
+    if (vname == NULL)
+    {
+        xname = filename(std::string(fname));
+        vname = xname.c_str();
+    }
+    
+    switch(imageType)
+    {
+        case '2IMG':
+            return UniversalDiskImage::Create(fname, blocks, data, count);
+            
+        case 'DC42':
+            return DiskCopy42Image::Create(fname, blocks, vname, data, count);
+            
+        case 'DO__':
+            return DOSOrderDiskImage::Create(fname, blocks, data, count);
+            
+        case 'PO__':
+            return ProDOSOrderDiskImage::Create(fname, blocks, data, count);
+            
+        case 'DVX_':
+            return DavexDiskImage::Create(fname, blocks, vname, data, count);
+    }
+    
+    BlockDevicePointer device = Create(fname, vname, blocks, imageType);
+    
+    if (device) device->writeBlocks(0, count, data);
+    
+    return device;
+}
+
 
 
 
@@ -253,6 +309,50 @@ void BlockDevice::zeroBlock(unsigned block)
 
 
 
+void BlockDevice::readBlocks(unsigned block, unsigned count, void *bp)
+{
+    uint8_t *cp = (uint8_t *)bp;
+    
+    for (unsigned i = 0; i < count; ++i)
+        read(block + i, cp + 512 * i);
+}
+
+void BlockDevice::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+    const uint8_t *cp = (const uint8_t *)bp;
+    
+    for (unsigned i = 0; i < count; ++i)
+        write(block + i, cp + 512 * i);
+}
+
+/*
+ * copied in 32K chunks.  If the destination overlaps the end of the
+ * source, the chunks are copied last to first.
+ */
+void BlockDevice::copyBlocks(unsigned from, unsigned to, unsigned count)
+{
+    enum { kChunk = 64 };
+    
+    if (from == to || !count) return;
+    
+    ::auto_array<uint8_t> buffer(new uint8_t[512 * kChunk]);
+    
+    bool backwards = to > from && to < from + count;
+    unsigned done = 0;
+    
+    while (done < count)
+    {
+        unsigned n = std::min(count - done, (unsigned)kChunk);
+        unsigned offset = backwards ? count - done - n : done;
+        
+        readBlocks(from + offset, n, buffer.get());
+        writeBlocks(to + offset, n, buffer.get());
+        
+        done += n;
+    }
+}
+
+
 bool BlockDevice::mapped()
 {
     return false;
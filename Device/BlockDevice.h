@@ -28,6 +28,9 @@ public:
     static BlockDevicePointer Open(const char *name, File::FileFlags flags, unsigned imageType = 0);
     static BlockDevicePointer Create(const char *fname, const char *vname, unsigned blocks, unsigned imageType = 0);
     
+    // the first count blocks are data, the rest are zero.
+    static BlockDevicePointer Create(const char *fname, const char *vname, unsigned blocks, unsigned imageType, const void *data, unsigned count);
+    
     
     
     
@@ -43,6 +46,13 @@ public:
     virtual void write(unsigned block, const void *bp) = 0;
     //virtual void write(TrackSector ts, const void *bp) = 0;
 
+    // count consecutive blocks.
+    virtual void readBlocks(unsigned block, unsigned count, void *bp);
+    virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
+    
+    // the ranges may overlap.
+    virtual void copyBlocks(unsigned from, unsigned to, unsigned count);
+
 
     virtual unsigned blocks() = 0;
     
@@ -0,0 +1,167 @@
+#include <cstring>
+#include <string>
+
+#include <Device/ChunkDevice.h>
+
+#include <Endian/Endian.h>
+
+#include <Common/Exception.h>
+
+
+using namespace Device;
+using namespace LittleEndian;
+
+
+enum {
+    kHeaderSize = 16
+};
+
+static const char kMagic[8] = { 'P', 'F', 'M', 'A', 'N', 'I', 'F', '1' };
+
+
+// the store is the manifest's directory.
+static std::string directory(const char *name)
+{
+    const char *cp = std::strrchr(name, '/');
+
+    if (!cp) return std::string(".");
+    if (cp == name) return std::string("/");
+
+    return std::string(name, cp);
+}
+
+
+BlockDevicePointer ChunkDevice::Create(const char *name, unsigned blocks)
+{
+    ChunkStorePointer store = ChunkStore::Open(directory(name).c_str(), File::ReadWrite);
+
+    // every block starts as the zero chunk.
+    MappedFile *file = MappedFile::Create(name, kHeaderSize + blocks * 4ull);
+
+    uint8_t *header = (uint8_t *)file->address();
+
+    std::memcpy(header, kMagic, 8);
+    Write32(header, 8, blocks);
+    Write32(header, 12, 0);
+
+    BlockDevicePointer device = MAKE_SHARED(ChunkDevice, file, store);
+
+    delete file;
+
+    return device;
+}
+
+BlockDevicePointer ChunkDevice::Open(MappedFile *file, const char *name)
+{
+    Validate(file);
+
+    ChunkStorePointer store = ChunkStore::Open(directory(name).c_str(),
+        file->readOnly() ? File::ReadOnly : File::ReadWrite);
+
+    return MAKE_SHARED(ChunkDevice, file, store);
+}
+
+
+bool ChunkDevice::Validate(MappedFile *file, const std::nothrow_t &)
+{
+    const uint8_t *header = (const uint8_t *)file->address();
+    size_t size = file->length();
+
+    if (size < kHeaderSize) return false;
+
+    if (std::memcmp(header, kMagic, 8)) return false;
+
+    if (size != kHeaderSize + Read32(header, 8) * 4ull) return false;
+
+    return true;
+}
+
+bool ChunkDevice::Validate(MappedFile *file)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkDevice::Validate"
+
+    if (!Validate(file, std::nothrow))
+        throw ::Exception(__METHOD__ ": Invalid file format.");
+
+    return true;
+}
+
+
+ChunkDevice::ChunkDevice(MappedFile *manifest, ChunkStorePointer store) :
+    _store(store)
+{
+    _manifest.adopt(*manifest);
+
+    _chunks = (uint8_t *)_manifest.address() + kHeaderSize;
+    _blocks = Read32(_manifest.address(), 8);
+
+    _table.assign(_chunks, _chunks + _blocks * 4ull);
+    _changed = false;
+}
+
+ChunkDevice::~ChunkDevice()
+{
+    try
+    {
+        sync();
+    }
+    catch (...)
+    {
+    }
+}
+
+
+void ChunkDevice::read(unsigned block, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkDevice::read"
+
+    if (block >= _blocks)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    _store->read(Read32(&_table[0], block * 4), bp);
+}
+
+void ChunkDevice::write(unsigned block, const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkDevice::write"
+
+    if (block >= _blocks)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    if (readOnly())
+        throw ::Exception(__METHOD__ ": File is readonly.");
+
+    Write32(&_table[0], block * 4, _store->add(bp));
+    _changed = true;
+}
+
+
+unsigned ChunkDevice::blocks()
+{
+    return _blocks;
+}
+
+bool ChunkDevice::readOnly()
+{
+    return _manifest.readOnly() || _store->readOnly();
+}
+
+// the mapped manifest is only changed here, after the chunks are
+// synced, so it never refers to a chunk which isn't on disk.
+void ChunkDevice::sync()
+{
+    if (readOnly()) return;
+
+    _store->sync();
+
+    if (_changed && _blocks)
+    {
+        std::memcpy(_chunks, &_table[0], _table.size());
+        _changed = false;
+    }
+
+    _manifest.sync();
+}
@@ -0,0 +1,70 @@
+#ifndef __CHUNKDEVICE_H__
+#define __CHUNKDEVICE_H__
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <Device/BlockDevice.h>
+#include <Device/ChunkStore.h>
+
+#include <File/MappedFile.h>
+
+namespace Device {
+
+/*
+ * A disk image stored as a manifest of chunks in the ChunkStore of the
+ * manifest's directory.  Identical blocks (in any image in the
+ * directory) are stored once.
+ *
+ * manifest (.pfm):
+ * 16 byte header ('PFMANIF1', blocks, 0), then the chunk number of
+ * each block (32-bit, little endian).  A write stores a new chunk (if
+ * needed) and updates a copy of the manifest, which is written when the
+ * device is synced (after the chunks); chunks are never changed.
+ */
+
+class ChunkDevice : public BlockDevice {
+public:
+
+    static BlockDevicePointer Create(const char *name, unsigned blocks);
+    static BlockDevicePointer Open(MappedFile *, const char *name);
+
+    static bool Validate(MappedFile *, const std::nothrow_t &);
+    static bool Validate(MappedFile *);
+
+
+    virtual ~ChunkDevice();
+
+    virtual void read(unsigned block, void *bp);
+    virtual void write(unsigned block, const void *bp);
+
+    virtual unsigned blocks();
+
+    virtual bool readOnly();
+
+    virtual void sync();
+
+
+    ChunkStorePointer store() const { return _store; }
+
+
+    ChunkDevice(MappedFile *manifest, ChunkStorePointer store);
+
+private:
+
+    ChunkDevice();
+
+    MappedFile _manifest;
+    ChunkStorePointer _store;
+
+    uint8_t *_chunks;
+    unsigned _blocks;
+
+    std::vector<uint8_t> _table;
+    bool _changed;
+};
+
+}
+
+#endif
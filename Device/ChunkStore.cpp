@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <Device/ChunkStore.h>
+
+#include <Endian/Endian.h>
+
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+using namespace Device;
+using namespace LittleEndian;
+
+
+enum {
+    kIndexHeaderSize = 32,
+    kSlotSize = 8,
+    kMinSlots = 1024,
+    kMinChunks = 2048
+};
+
+static const char kMagic[8] = { 'P', 'F', 'I', 'N', 'D', 'E', 'X', '1' };
+
+
+static bool isZero(const void *bp)
+{
+    static const uint8_t zero[512] = { 0 };
+
+    return !std::memcmp(bp, zero, 512);
+}
+
+static uint64_t hashBlock(const void *bp)
+{
+    const uint8_t *cp = (const uint8_t *)bp;
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+
+    for (unsigned i = 0; i < 512; i += 8)
+    {
+        uint64_t w = Read32(cp, i) | ((uint64_t)Read32(cp, i + 4) << 32);
+
+        h ^= w * 0x87c37b91114253d5ull;
+        h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937full;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+ChunkStorePointer ChunkStore::Open(const char *directory, File::FileFlags flags)
+{
+    typedef std::map<std::string, WEAK_PTR(ChunkStore)> Registry;
+
+    static Lock lock;
+    static Registry registry;
+
+    if (flags == File::ReadWrite) ::mkdir(directory, 0777);
+
+    char buffer[PATH_MAX];
+    std::string key = ::realpath(directory, buffer) ? buffer : directory;
+
+    Locker locker(lock);
+
+    Registry::iterator iter = registry.find(key);
+
+    if (iter != registry.end())
+    {
+        ChunkStorePointer store = iter->second.lock();
+
+        if (store && (flags == File::ReadOnly || !store->readOnly())) return store;
+    }
+
+    ChunkStorePointer store = MAKE_SHARED(ChunkStore, key, flags);
+
+    registry[key] = store;
+
+    return store;
+}
+
+
+ChunkStore::ChunkStore(const std::string &directory, File::FileFlags flags) :
+    _directory(directory)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkStore::ChunkStore"
+
+    struct stat st;
+
+    _readOnly = flags == File::ReadOnly;
+    _capacity = 0;
+    _slots = 0;
+
+    std::string path = directory + "/.chunks";
+    File chunkFile(path.c_str(), _readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+
+    _chunkFile.adopt(chunkFile);
+
+    if (::fstat(_chunkFile.fd(), &st) != 0)
+        throw POSIX::Exception(__METHOD__ ": fstat", errno);
+
+    if (st.st_size < 512 && _readOnly)
+        throw ::Exception(__METHOD__ ": Invalid chunk store.");
+
+    mapChunks(std::max((unsigned)(st.st_size / 512), _readOnly ? 1u : (unsigned)kMinChunks));
+
+    // the index is only needed to add chunks.
+    if (_readOnly) return;
+
+    path = directory + "/.index";
+    File indexFile(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+    _indexFile.adopt(indexFile);
+
+    if (::fstat(_indexFile.fd(), &st) != 0)
+        throw POSIX::Exception(__METHOD__ ": fstat", errno);
+
+    if (st.st_size >= kIndexHeaderSize)
+    {
+        MappedFile header(_indexFile, File::ReadOnly, kIndexHeaderSize);
+        const uint8_t *cp = (const uint8_t *)header.address();
+
+        unsigned slots = Read32(cp, 8);
+
+        if (!std::memcmp(cp, kMagic, 8)
+            && slots >= kMinSlots && !(slots & (slots - 1))
+            && st.st_size >= kIndexHeaderSize + (off_t)slots * kSlotSize
+            && Read32(cp, 12) == std::max(countChunks(), 1u)
+            && Read32(cp, 16) + 1 == Read32(cp, 12))
+        {
+            mapIndex(slots);
+            return;
+        }
+    }
+
+    rebuildIndex(kMinSlots);
+}
+
+ChunkStore::~ChunkStore()
+{
+}
+
+
+uint8_t *ChunkStore::chunk(uint32_t chunk) const
+{
+    return (uint8_t *)_chunkMap.address() + chunk * 512ull;
+}
+
+uint8_t *ChunkStore::slot(unsigned index) const
+{
+    return (uint8_t *)_indexMap.address() + kIndexHeaderSize + index * kSlotSize;
+}
+
+
+unsigned ChunkStore::chunks()
+{
+    ReadLocker locker(_lock);
+
+    if (_readOnly) return countChunks();
+
+    return Read32(_indexMap.address(), 12);
+}
+
+// the chunk file is extended ahead of use; stored chunks are never zero.
+unsigned ChunkStore::countChunks() const
+{
+    unsigned count = _capacity;
+
+    while (count > 1 && isZero(chunk(count - 1))) --count;
+
+    return count;
+}
+
+
+void ChunkStore::mapChunks(unsigned capacity)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkStore::mapChunks"
+
+    // the unused chunks are a hole.
+    if (!_readOnly && ::ftruncate(_chunkFile.fd(), capacity * 512ull) != 0)
+        throw POSIX::Exception(__METHOD__ ": ftruncate", errno);
+
+    MappedFile map(_chunkFile, _readOnly ? File::ReadOnly : File::ReadWrite, capacity * 512ull);
+
+    _chunkMap.adopt(map);
+    _capacity = capacity;
+}
+
+void ChunkStore::mapIndex(unsigned slots)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkStore::mapIndex"
+
+    size_t size = kIndexHeaderSize + (size_t)slots * kSlotSize;
+
+    if (::ftruncate(_indexFile.fd(), size) != 0)
+        throw POSIX::Exception(__METHOD__ ": ftruncate", errno);
+
+    MappedFile map(_indexFile, File::ReadWrite, size);
+
+    _indexMap.adopt(map);
+    _slots = slots;
+}
+
+
+// re-hash every chunk.
+void ChunkStore::rebuildIndex(unsigned slots)
+{
+    unsigned count = countChunks();
+
+    while (count * 2 > slots) slots *= 2;
+
+    mapIndex(slots);
+
+    uint8_t *header = (uint8_t *)_indexMap.address();
+
+    std::memset(header, 0, kIndexHeaderSize + (size_t)slots * kSlotSize);
+
+    for (unsigned i = 1; i < count; ++i)
+        insert(hashBlock(chunk(i)), i);
+
+    std::memcpy(header, kMagic, 8);
+    Write32(header, 8, slots);
+    Write32(header, 12, std::max(count, 1u));
+    Write32(header, 16, std::max(count, 1u) - 1);
+}
+
+
+uint32_t ChunkStore::find(const void *bp, uint64_t hash)
+{
+    uint32_t tag = hash >> 32;
+
+    for (unsigned i = hash & (_slots - 1); ; i = (i + 1) & (_slots - 1))
+    {
+        uint8_t *cp = slot(i);
+        uint32_t c = Read32(cp, 4);
+
+        if (c == kZeroChunk) return kZeroChunk;
+
+        if (Read32(cp, 0) == tag && !std::memcmp(chunk(c), bp, 512)) return c;
+    }
+}
+
+void ChunkStore::insert(uint64_t hash, uint32_t chunk)
+{
+    for (unsigned i = hash & (_slots - 1); ; i = (i + 1) & (_slots - 1))
+    {
+        uint8_t *cp = slot(i);
+
+        if (Read32(cp, 4) != kZeroChunk) continue;
+
+        Write32(cp, 0, hash >> 32);
+        Write32(cp, 4, chunk);
+        return;
+    }
+}
+
+
+uint32_t ChunkStore::add(const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkStore::add"
+
+    if (_readOnly)
+        throw ::Exception(__METHOD__ ": Chunk store is read only.");
+
+    if (isZero(bp)) return kZeroChunk;
+
+    uint64_t hash = hashBlock(bp);
+
+    WriteLocker locker(_lock);
+
+    uint32_t c = find(bp, hash);
+
+    if (c != kZeroChunk) return c;
+
+    uint8_t *header = (uint8_t *)_indexMap.address();
+
+    c = Read32(header, 12);
+
+    if (c == 0xffffffff)
+        throw ::Exception(__METHOD__ ": Chunk store is full.");
+
+    if (c >= _capacity) mapChunks(std::max(_capacity * 2, (unsigned)kMinChunks));
+
+    std::memcpy(chunk(c), bp, 512);
+
+    insert(hash, c);
+
+    Write32(header, 12, c + 1);
+    Write32(header, 16, Read32(header, 16) + 1);
+
+    // at most half full.
+    if (Read32(header, 16) * 2 > _slots) rebuildIndex(_slots * 2);
+
+    return c;
+}
+
+
+void ChunkStore::read(uint32_t c, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "ChunkStore::read"
+
+    if (c == kZeroChunk)
+    {
+        std::memset(bp, 0, 512);
+        return;
+    }
+
+    {
+        ReadLocker locker(_lock);
+
+        if (c < _capacity)
+        {
+            std::memcpy(bp, chunk(c), 512);
+            return;
+        }
+    }
+
+    // added by another ChunkStore on the same files.
+    WriteLocker locker(_lock);
+    struct stat st;
+
+    if (::fstat(_chunkFile.fd(), &st) != 0)
+        throw POSIX::Exception(__METHOD__ ": fstat", errno);
+
+    if (c >= st.st_size / 512)
+        throw ::Exception(__METHOD__ ": Invalid chunk.");
+
+    if (c >= _capacity) mapChunks(st.st_size / 512);
+
+    std::memcpy(bp, chunk(c), 512);
+}
+
+
+void ChunkStore::sync()
+{
+    WriteLocker locker(_lock);
+
+    if (_readOnly) return;
+
+    _chunkMap.sync();
+    _indexMap.sync();
+}
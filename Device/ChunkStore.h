@@ -0,0 +1,96 @@
+#ifndef __CHUNKSTORE_H__
+#define __CHUNKSTORE_H__
+
+#include <stdint.h>
+
+#include <string>
+
+#include <Device/Device.h>
+
+#include <File/File.h>
+#include <File/MappedFile.h>
+
+#include <Common/Lock.h>
+
+namespace Device {
+
+class ChunkStore;
+typedef SHARED_PTR(ChunkStore) ChunkStorePointer;
+
+/*
+ * Content addressed store of 512 byte blocks, shared by every
+ * ChunkDevice in a directory.
+ *
+ * directory/.chunks: chunk n is at offset n * 512.  Chunk 0 is the
+ * zero block and is never stored.  Chunks are never changed.
+ *
+ * directory/.index: open addressed hash table (chunk hash -> chunk).
+ * Both files are memory mapped.  The index is only used to add chunks;
+ * reads go straight to the chunk.  A damaged index, or one whose next
+ * chunk doesn't match the chunks (the maps are written back in any
+ * order), is rebuilt from the chunks when the store is opened.  Manifests
+ * are only written after the chunks are synced, so a chunk a manifest
+ * refers to is never handed out again.
+ *
+ * Thread safe, but only one process should write to a store.
+ */
+
+class ChunkStore {
+public:
+
+    enum {
+        kZeroChunk = 0
+    };
+
+    // one store per directory per process.
+    static ChunkStorePointer Open(const char *directory, File::FileFlags flags);
+
+    ~ChunkStore();
+
+    // returns the chunk for the block (existing or new).
+    uint32_t add(const void *bp);
+
+    void read(uint32_t chunk, void *bp);
+
+    unsigned chunks();
+    bool readOnly() const { return _readOnly; }
+
+    void sync();
+
+
+    ChunkStore(const std::string &directory, File::FileFlags flags);
+
+private:
+
+    ChunkStore();
+    ChunkStore(const ChunkStore &);
+    ChunkStore& operator=(const ChunkStore &);
+
+    uint8_t *chunk(uint32_t chunk) const;
+    uint8_t *slot(unsigned index) const;
+    unsigned countChunks() const;
+
+    uint32_t find(const void *bp, uint64_t hash);
+    void insert(uint64_t hash, uint32_t chunk);
+
+    void mapChunks(unsigned capacity);
+    void mapIndex(unsigned slots);
+    void rebuildIndex(unsigned slots);
+
+    std::string _directory;
+    bool _readOnly;
+
+    File _chunkFile;
+    MappedFile _chunkMap;
+    unsigned _capacity;
+
+    File _indexFile;
+    MappedFile _indexMap;
+    unsigned _slots;
+
+    RWLock _lock;
+};
+
+}
+
+#endif
@@ -16,6 +16,8 @@
 
 #include <Cache/MappedBlockCache.h>
 
+#include <Common/Exception.h>
+
 using namespace Device;
 using namespace LittleEndian;
 
@@ -105,18 +107,20 @@ BlockDevicePointer DavexDiskImage::Create(const char *name, size_t blocks)
     return Create(name, blocks, "Untitled");
 }
 BlockDevicePointer DavexDiskImage::Create(const char *name, size_t blocks, const char *vname)
+{
+    return Create(name, blocks, vname, NULL, 0);
+}
+
+BlockDevicePointer DavexDiskImage::Create(const char *name, size_t blocks, const char *vname, const void *data, unsigned count)
 {
 #undef __METHOD__
 #define __METHOD__ "DavexDiskImage::Create"
 
-    uint8_t *data;
     uint8_t tmp[512];
     IOBuffer header(tmp,512);
 
-    
-    MappedFile *file = MappedFile::Create(name, blocks * 512 + 512);
-    
-    data = (uint8_t *)file->address();
+    if (count > blocks)
+        throw ::Exception(__METHOD__ ": Invalid block count.");
         
     header.writeBytes(IdentityCheck, 16);
     // file Format
@@ -157,8 +161,14 @@ BlockDevicePointer DavexDiskImage::Create(const char *name, size_t blocks, const
     header.setOffset(512, true);
     
     
-    std::memcpy(file->address(), header.buffer(), 512);
-    file->sync();
+    // header and data are written before the file is mapped.
+    struct iovec iov[2];
+    iov[0].iov_base = header.buffer();
+    iov[0].iov_len = 512;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = count * 512;
+    
+    MappedFile *file = MappedFile::Create(name, blocks * 512 + 512, iov, 2);
     
     //return BlockDevicePointer(new DavexDiskImage(file));
     
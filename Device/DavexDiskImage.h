@@ -19,6 +19,7 @@ public:
     
     static BlockDevicePointer Create(const char *name, size_t blocks);
     static BlockDevicePointer Create(const char *name, size_t blocks, const char *vname);
+    static BlockDevicePointer Create(const char *name, size_t blocks, const char *vname, const void *data, unsigned count);
     static BlockDevicePointer Open(MappedFile *);
 
     virtual BlockCachePointer createBlockCache();
@@ -11,6 +11,8 @@
 
 #include <Cache/MappedBlockCache.h>
 
+#include <Common/Exception.h>
+
 
 using namespace Device;
 using namespace BigEndian;
@@ -107,9 +109,16 @@ BlockDevicePointer DiskCopy42Image::Create(const char *name, size_t blocks)
 
 BlockDevicePointer DiskCopy42Image::Create(const char *name, size_t blocks, const char *vname)
 {
-    MappedFile *file = MappedFile::Create(name, blocks * 512 + oUserData);
+    return Create(name, blocks, vname, NULL, 0);
+}
 
-    
+BlockDevicePointer DiskCopy42Image::Create(const char *name, size_t blocks, const char *vname, const void *data, unsigned count)
+{
+#undef __METHOD__
+#define __METHOD__ "DiskCopy42Image::Create"
+
+    if (count > blocks)
+        throw ::Exception(__METHOD__ ": Invalid block count.");
     
     uint8_t tmp[oUserData];
     IOBuffer header(tmp, oUserData);
@@ -131,9 +140,14 @@ BlockDevicePointer DiskCopy42Image::Create(const char *name, size_t blocks, cons
     header.write32(0);
     
     // data checksum
-    // if data is 0, will be 0.
-    //header.push32be(Checksum(file->fileData(), blocks * 512));
-    header.write32(0);
+    // the rest of the data is 0, so the checksum just rotates
+    // (once per 16-bit word.)
+    uint32_t cs = Checksum((void *)data, count * 512);
+    unsigned rotate = ((blocks - count) * 256) & 0x1f;
+    
+    if (rotate) cs = (cs >> rotate) | (cs << (32 - rotate));
+    
+    header.write32(cs);
     
     // tag checksum
     header.write32(0);
@@ -159,8 +173,14 @@ BlockDevicePointer DiskCopy42Image::Create(const char *name, size_t blocks, cons
     // private
     header.write16(0x100);
     
-    std::memcpy(file->address(), header.buffer(), oUserData);
-    file->sync();
+    // header and data are written before the file is mapped.
+    struct iovec iov[2];
+    iov[0].iov_base = header.buffer();
+    iov[0].iov_len = oUserData;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = count * 512;
+    
+    MappedFile *file = MappedFile::Create(name, blocks * 512 + oUserData, iov, 2);
     
     //return BlockDevicePointer(new DiskCopy42Image(file));
     
@@ -229,6 +249,12 @@ void DiskCopy42Image::write(unsigned block, const void *bp)
     _changed = true;
 }
 
+void DiskCopy42Image::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+    DiskImage::writeBlocks(block, count, bp);
+    _changed = true;
+}
+
 
 BlockCachePointer DiskCopy42Image::createBlockCache()
 {
@@ -236,5 +262,5 @@ BlockCachePointer DiskCopy42Image::createBlockCache()
     
     if (!readOnly()) _changed = true;
     
-    return MappedBlockCache::Create(shared_from_this(), address());
+    return MappedBlockCache::Create(shared_from_this(), oUserData + (uint8_t *)address());
 }
\ No newline at end of file
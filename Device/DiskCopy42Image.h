@@ -14,6 +14,7 @@ public:
 
     static BlockDevicePointer Create(const char *name, size_t blocks);
     static BlockDevicePointer Create(const char *name, size_t blocks, const char *vname);
+    static BlockDevicePointer Create(const char *name, size_t blocks, const char *vname, const void *data, unsigned count);
     
     static BlockDevicePointer Open(MappedFile *);
 
@@ -25,6 +26,7 @@ public:
     
     
     virtual void write(unsigned block, const void *bp);
+    virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
     
 
     virtual BlockCachePointer createBlockCache();    
@@ -1,7 +1,9 @@
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -88,6 +90,28 @@ void DiskImage::write(unsigned block, const void *bp)
     _adaptor->writeBlock(block, bp);
 }
 
+void DiskImage::readBlocks(unsigned block, unsigned count, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "DiskImage::readBlocks"
+
+    if (block + count > _blocks || block + count < block)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+    
+    _adaptor->readBlocks(block, count, bp);
+}
+
+void DiskImage::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "DiskImage::writeBlocks"
+
+    if (block + count > _blocks || block + count < block)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+    
+    _adaptor->writeBlocks(block, count, bp);
+}
+
 void DiskImage::sync()
 {
     #undef __METHOD__
@@ -117,6 +141,23 @@ BlockDevicePointer ProDOSOrderDiskImage::Create(const char *name, size_t blocks)
     return MAKE_SHARED(ProDOSOrderDiskImage, file);
 }
 
+BlockDevicePointer ProDOSOrderDiskImage::Create(const char *name, size_t blocks, const void *data, unsigned count)
+{
+#undef __METHOD__
+#define __METHOD__ "ProDOSOrderDiskImage::Create"
+
+    if (count > blocks)
+        throw ::Exception(__METHOD__ ": Invalid block count.");
+
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = count * 512;
+
+    MappedFile *file = MappedFile::Create(name, blocks * 512, &iov, 1);
+
+    return MAKE_SHARED(ProDOSOrderDiskImage, file);
+}
+
 BlockDevicePointer ProDOSOrderDiskImage::Open(MappedFile *file)
 {
     Validate(file);
@@ -189,6 +230,32 @@ BlockDevicePointer DOSOrderDiskImage::Create(const char *name, size_t blocks)
     return MAKE_SHARED(DOSOrderDiskImage, file);
 }
 
+// the data is interleaved (whole tracks) before it's written.
+BlockDevicePointer DOSOrderDiskImage::Create(const char *name, size_t blocks, const void *data, unsigned count)
+{
+#undef __METHOD__
+#define __METHOD__ "DOSOrderDiskImage::Create"
+
+    if (count > blocks)
+        throw ::Exception(__METHOD__ ": Invalid block count.");
+
+    std::vector<uint8_t> buffer(((count + 7) & ~0x07) * 512);
+
+    if (count)
+    {
+        DOAdaptor adaptor(&buffer[0]);
+        adaptor.writeBlocks(0, count, data);
+    }
+
+    struct iovec iov;
+    iov.iov_base = buffer.empty() ? NULL : &buffer[0];
+    iov.iov_len = std::min(buffer.size(), blocks * 512);
+
+    MappedFile *file = MappedFile::Create(name, blocks * 512, &iov, 1);
+
+    return MAKE_SHARED(DOSOrderDiskImage, file);
+}
+
 BlockDevicePointer DOSOrderDiskImage::Open(MappedFile *file)
 {
     Validate(file);
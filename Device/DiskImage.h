@@ -21,6 +21,10 @@ public:
         
     virtual void read(unsigned block, void *bp);
     virtual void write(unsigned block, const void *bp);
+    
+    virtual void readBlocks(unsigned block, unsigned count, void *bp);
+    virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
+    
     virtual void sync();
     
     virtual bool readOnly();
@@ -56,6 +60,7 @@ public:
 
     
     static BlockDevicePointer Create(const char *name, size_t blocks);
+    static BlockDevicePointer Create(const char *name, size_t blocks, const void *data, unsigned count);
     static BlockDevicePointer Open(MappedFile *);
 
     
@@ -76,6 +81,7 @@ public:
     
 
     static BlockDevicePointer Create(const char *name, size_t blocks);
+    static BlockDevicePointer Create(const char *name, size_t blocks, const void *data, unsigned count);
     static BlockDevicePointer Open(MappedFile *);
 
     static bool Validate(MappedFile *, const std::nothrow_t &);
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <Device/OverlayDevice.h>
+
+#include <Endian/Endian.h>
+
+#include <Common/auto.h>
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+using namespace Device;
+using namespace LittleEndian;
+
+
+enum {
+    kHeaderSize = 512,
+    kVersion = 1,
+    kChunk = 64
+};
+
+static const char kMagic[8] = { 'P', 'F', 'O', 'V', 'R', 'L', 'A', 'Y' };
+
+
+static unsigned bitmapSize(unsigned blocks)
+{
+    return ((blocks + 7) / 8 + 511) & ~511;
+}
+
+
+BlockDevicePointer OverlayDevice::Open(BlockDevicePointer base, const char *delta)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::Open"
+
+    struct stat st;
+
+    if (::stat(delta, &st) != 0)
+    {
+        if (errno == ENOENT) return Create(base, delta);
+
+        throw POSIX::Exception(__METHOD__ ": stat error", errno);
+    }
+
+    MappedFile file(delta, File::ReadWrite);
+
+    Validate(&file, base->blocks());
+
+    return MAKE_SHARED(OverlayDevice, base, &file);
+}
+
+
+BlockDevicePointer OverlayDevice::Create(BlockDevicePointer base, const char *delta)
+{
+    unsigned blocks = base->blocks();
+    unsigned bitmap = bitmapSize(blocks);
+
+    // ftruncate leaves the data (and bitmap) as a hole.
+    MappedFile *file = MappedFile::Create(delta, kHeaderSize + bitmap + blocks * 512ull);
+
+    uint8_t *header = (uint8_t *)file->address();
+
+    std::memcpy(header, kMagic, 8);
+    Write16(header, 8, kVersion);
+    Write32(header, 12, blocks);
+    Write32(header, 16, kHeaderSize);
+    Write32(header, 20, kHeaderSize + bitmap);
+
+    BlockDevicePointer device = MAKE_SHARED(OverlayDevice, base, file);
+
+    delete file;
+
+    return device;
+}
+
+
+bool OverlayDevice::Validate(MappedFile *file, unsigned blocks, const std::nothrow_t &)
+{
+    const uint8_t *header = (const uint8_t *)file->address();
+    size_t size = file->length();
+
+    if (size < kHeaderSize) return false;
+
+    if (std::memcmp(header, kMagic, 8)) return false;
+    if (Read16(header, 8) != kVersion) return false;
+    if (Read32(header, 12) != blocks) return false;
+    if (Read32(header, 16) != kHeaderSize) return false;
+    if (Read32(header, 20) != kHeaderSize + bitmapSize(blocks)) return false;
+
+    if (size < kHeaderSize + bitmapSize(blocks) + blocks * 512ull) return false;
+
+    return true;
+}
+
+bool OverlayDevice::Validate(MappedFile *file, unsigned blocks)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::Validate"
+
+    if (!Validate(file, blocks, std::nothrow))
+        throw ::Exception(__METHOD__ ": Invalid file format.");
+
+    return true;
+}
+
+
+OverlayDevice::OverlayDevice(BlockDevicePointer base, MappedFile *delta) :
+    _base(base)
+{
+    _delta.adopt(*delta);
+
+    uint8_t *header = (uint8_t *)_delta.address();
+
+    _blocks = Read32(header, 12);
+    _bitmap = header + Read32(header, 16);
+    _dataOffset = Read32(header, 20);
+
+    _changed = 0;
+    for (unsigned i = 0; i < _blocks; ++i)
+        if (changed(i)) ++_changed;
+}
+
+OverlayDevice::~OverlayDevice()
+{
+}
+
+
+uint8_t *OverlayDevice::data(unsigned block) const
+{
+    return (uint8_t *)_delta.address() + _dataOffset + block * 512ull;
+}
+
+bool OverlayDevice::changed(unsigned block) const
+{
+    return _bitmap[block >> 3] & (0x80 >> (block & 0x07));
+}
+
+
+void OverlayDevice::read(unsigned block, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::read"
+
+    if (block >= _blocks)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    if (changed(block)) std::memcpy(bp, data(block), 512);
+    else _base->read(block, bp);
+}
+
+void OverlayDevice::write(unsigned block, const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::write"
+
+    if (block >= _blocks)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    std::memcpy(data(block), bp, 512);
+
+    if (!changed(block))
+    {
+        _bitmap[block >> 3] |= (0x80 >> (block & 0x07));
+        ++_changed;
+    }
+}
+
+
+// unchanged runs are read from the base device in one call.
+void OverlayDevice::readBlocks(unsigned block, unsigned count, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::readBlocks"
+
+    uint8_t *cp = (uint8_t *)bp;
+
+    if (block > _blocks || count > _blocks - block)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    while (count)
+    {
+        bool c = changed(block);
+        unsigned n = 1;
+
+        while (n < count && changed(block + n) == c) ++n;
+
+        if (c) std::memcpy(cp, data(block), n * 512);
+        else _base->readBlocks(block, n, cp);
+
+        block += n;
+        count -= n;
+        cp += n * 512;
+    }
+}
+
+void OverlayDevice::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::writeBlocks"
+
+    const uint8_t *cp = (const uint8_t *)bp;
+
+    if (block > _blocks || count > _blocks - block)
+        throw ::Exception(__METHOD__ ": Invalid block.");
+
+    for (unsigned i = 0; i < count; ++i)
+        write(block + i, cp + 512 * i);
+}
+
+
+unsigned OverlayDevice::blocks()
+{
+    return _blocks;
+}
+
+bool OverlayDevice::readOnly()
+{
+    return _delta.readOnly();
+}
+
+void OverlayDevice::sync()
+{
+    _delta.sync();
+}
+
+
+void OverlayDevice::commit()
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::commit"
+
+    if (_base->readOnly())
+        throw ::Exception(__METHOD__ ": Base device is read only.");
+
+    for (unsigned block = 0; block < _blocks; )
+    {
+        if (!changed(block))
+        {
+            ++block;
+            continue;
+        }
+
+        unsigned n = 1;
+        while (block + n < _blocks && changed(block + n)) ++n;
+
+        _base->writeBlocks(block, n, data(block));
+
+        block += n;
+    }
+
+    _base->sync();
+
+    discard();
+}
+
+void OverlayDevice::discard()
+{
+    std::memset(_bitmap, 0, bitmapSize(_blocks));
+    _changed = 0;
+
+    _delta.sync();
+}
+
+
+void OverlayDevice::exportImage(const char *name, unsigned imageType)
+{
+#undef __METHOD__
+#define __METHOD__ "OverlayDevice::exportImage"
+
+    BlockDevicePointer device = BlockDevice::Create(name, NULL, _blocks, imageType);
+
+    if (!device)
+        throw ::Exception(__METHOD__ ": Unsupported image type.");
+
+    ::auto_array<uint8_t> buffer(new uint8_t[512 * kChunk]);
+
+    for (unsigned block = 0; block < _blocks; block += kChunk)
+    {
+        unsigned n = std::min(_blocks - block, (unsigned)kChunk);
+
+        readBlocks(block, n, buffer.get());
+        device->writeBlocks(block, n, buffer.get());
+    }
+
+    device->sync();
+}
@@ -0,0 +1,82 @@
+#ifndef __OVERLAYDEVICE_H__
+#define __OVERLAYDEVICE_H__
+
+#include <stdint.h>
+
+#include <Device/BlockDevice.h>
+
+#include <File/MappedFile.h>
+
+namespace Device {
+
+/*
+ * Copy on write overlay for another device.  Reads come from the base
+ * device unless the block has been written; writes go to a sparse delta
+ * file.  The base device is never written (except by commit).
+ *
+ * delta file:
+ * 512 byte header, block bitmap (rounded up to 512 bytes), then the
+ * data, 512 bytes per base block.  Unwritten blocks are holes.
+ */
+
+class OverlayDevice : public BlockDevice {
+public:
+
+    // re-uses an existing delta file for the same number of blocks.
+    static BlockDevicePointer Open(BlockDevicePointer base, const char *delta);
+    static BlockDevicePointer Create(BlockDevicePointer base, const char *delta);
+
+    static bool Validate(MappedFile *, unsigned blocks, const std::nothrow_t &);
+    static bool Validate(MappedFile *, unsigned blocks);
+
+
+    virtual ~OverlayDevice();
+
+    virtual void read(unsigned block, void *bp);
+    virtual void write(unsigned block, const void *bp);
+
+    virtual void readBlocks(unsigned block, unsigned count, void *bp);
+    virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
+
+    virtual unsigned blocks();
+
+    virtual bool readOnly();
+
+    virtual void sync();
+
+
+    BlockDevicePointer base() const { return _base; }
+
+    bool changed(unsigned block) const;
+    unsigned changedBlocks() const { return _changed; }
+
+    // write the changed blocks to the base device and discard them.
+    void commit();
+
+    // forget the changed blocks.
+    void discard();
+
+    // write every block (base and changed) to a new image.
+    void exportImage(const char *name, unsigned imageType = 0);
+
+
+    OverlayDevice(BlockDevicePointer base, MappedFile *delta);
+
+private:
+
+    OverlayDevice();
+
+    uint8_t *data(unsigned block) const;
+
+    BlockDevicePointer _base;
+    MappedFile _delta;
+
+    uint8_t *_bitmap;
+    unsigned _dataOffset;
+    unsigned _blocks;
+    unsigned _changed;
+};
+
+}
+
+#endif
@@ -290,6 +290,68 @@ void RawDevice::write(TrackSector ts, const void *bp)
 }
 
 
+// a single pread/pwrite for the whole run.
+void RawDevice::readBlocks(unsigned block, unsigned count, void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "RawDevice::readBlocks"
+
+    if (block + count > _blocks || block + count < block) 
+        throw ::Exception(__METHOD__ ": Invalid block number.");
+    if (bp == 0) throw ::Exception(__METHOD__ ": Invalid address."); 
+
+    uint8_t *cp = (uint8_t *)bp;
+    off_t offset = (off_t)block * 512;
+    size_t size = count * 512;
+    
+    while (size)
+    {
+        ssize_t ok = ::pread(_file.fd(), cp, size, offset);
+        
+        if (ok < 0 && errno == EINTR) continue;
+        if (ok <= 0)
+            throw ok < 0
+                ? POSIX::Exception(__METHOD__ ": Error reading block.", errno)
+                : ::Exception(__METHOD__ ": Error reading block.");
+        
+        cp += ok;
+        offset += ok;
+        size -= ok;
+    }
+}
+
+void RawDevice::writeBlocks(unsigned block, unsigned count, const void *bp)
+{
+#undef __METHOD__
+#define __METHOD__ "RawDevice::writeBlocks"
+
+    if (block + count > _blocks || block + count < block) 
+        throw ::Exception(__METHOD__ ": Invalid block number.");
+
+    if (_readOnly)
+        throw ::Exception(__METHOD__ ": File is readonly.");
+
+    const uint8_t *cp = (const uint8_t *)bp;
+    off_t offset = (off_t)block * 512;
+    size_t size = count * 512;
+    
+    while (size)
+    {
+        ssize_t ok = ::pwrite(_file.fd(), cp, size, offset);
+        
+        if (ok < 0 && errno == EINTR) continue;
+        if (ok <= 0)
+            throw ok < 0
+                ? POSIX::Exception(__METHOD__ ": Error writing block.", errno)
+                : ::Exception(__METHOD__ ": Error writing block.");
+        
+        cp += ok;
+        offset += ok;
+        size -= ok;
+    }
+}
+
+
 bool RawDevice::readOnly()
 {
     return _readOnly;
@@ -28,6 +28,9 @@ public:
     virtual void write(unsigned block, const void *bp);
     virtual void write(TrackSector ts, const void *bp);
     
+    virtual void readBlocks(unsigned block, unsigned count, void *bp);
+    virtual void writeBlocks(unsigned block, unsigned count, const void *bp);
+    
     virtual bool readOnly();
     virtual bool mapped();
     virtual void sync();
@@ -39,9 +39,18 @@ UniversalDiskImage::UniversalDiskImage(MappedFile *file) :
 
 BlockDevicePointer UniversalDiskImage::Create(const char *name, size_t blocks)
 {
-    // 64-byte header.
-    MappedFile *file = MappedFile::Create(name, blocks * 512 + 64);
+    return Create(name, blocks, NULL, 0);
+}
 
+BlockDevicePointer UniversalDiskImage::Create(const char *name, size_t blocks, const void *data, unsigned count)
+{
+#undef __METHOD__
+#define __METHOD__ "UniversalDiskImage::Create"
+
+    if (count > blocks)
+        throw ::Exception(__METHOD__ ": Invalid block count.");
+
+    // 64-byte header.
     uint8_t tmp[64];
     
     IOBuffer header(tmp, 64);
@@ -74,8 +83,14 @@ BlockDevicePointer UniversalDiskImage::Create(const char *name, size_t blocks)
     // comment offset, creator, reserved -- 0.
     header.setOffset(64, true);
     
-    std::memcpy(file->address(), header.buffer(), 64);
+    // header and data are written before the file is mapped.
+    struct iovec iov[2];
+    iov[0].iov_base = header.buffer();
+    iov[0].iov_len = 64;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = count * 512;
     
+    MappedFile *file = MappedFile::Create(name, blocks * 512 + 64, iov, 2);
 
     //return BlockDevicePointer(new UniversalDiskImage(file));
     
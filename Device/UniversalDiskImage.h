@@ -15,6 +15,7 @@ public:
     
     
     static BlockDevicePointer Create(const char *name, size_t blocks);
+    static BlockDevicePointer Create(const char *name, size_t blocks, const void *data, unsigned count);
     static BlockDevicePointer Open(MappedFile *);
 
     virtual bool readOnly();
@@ -1,5 +1,13 @@
 #include <algorithm>
 #include <cerrno>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include <File/File.h>
 #include <Common/Exception.h>
@@ -122,3 +130,112 @@ void File::swap(File &f)
 {
     std::swap(_fd, f._fd);
 }
+
+
+// copy [offset, offset + size) with pread/pwrite.
+static void copyRange(int in, int out, off_t offset, off_t size)
+{
+#undef __METHOD__
+#define __METHOD__ "File::Clone"
+
+    std::vector<char> buffer(64 * 1024);
+
+    while (size)
+    {
+        ssize_t ok = ::pread(in, &buffer[0], std::min(size, (off_t)buffer.size()), offset);
+
+        if (ok < 0 && errno == EINTR) continue;
+        if (ok <= 0)
+            throw ok < 0
+                ? POSIX::Exception(__METHOD__ ": read", errno)
+                : ::Exception(__METHOD__ ": Unexpected end of file.");
+
+        for (ssize_t done = 0; done < ok; )
+        {
+            ssize_t w = ::pwrite(out, &buffer[done], ok - done, offset + done);
+
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0)
+                throw w < 0
+                    ? POSIX::Exception(__METHOD__ ": write", errno)
+                    : ::Exception(__METHOD__ ": Unable to write file.");
+
+            done += w;
+        }
+
+        offset += ok;
+        size -= ok;
+    }
+}
+
+/*
+ * A reflink (FICLONE) shares the blocks outright.  Otherwise only the
+ * data regions (SEEK_DATA/SEEK_HOLE) are copied, with copy_file_range
+ * where available, so the holes in a sparse image stay holes.
+ */
+void File::Clone(const char *src, const char *dest)
+{
+#undef __METHOD__
+#define __METHOD__ "File::Clone"
+
+    struct stat st;
+
+    File in(src, O_RDONLY);
+
+    if (::fstat(in.fd(), &st) != 0)
+        throw POSIX::Exception(__METHOD__ ": fstat", errno);
+
+    File out(dest, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+
+#ifdef FICLONE
+    if (::ioctl(out.fd(), FICLONE, in.fd()) == 0) return;
+#endif
+
+    off_t offset = 0;
+
+    while (offset < st.st_size)
+    {
+        off_t end = st.st_size;
+
+#ifdef SEEK_DATA
+        off_t data = ::lseek(in.fd(), offset, SEEK_DATA);
+
+        // ENXIO -- nothing but a hole from here on.
+        if (data < 0 && errno == ENXIO) break;
+
+        if (data >= 0)
+        {
+            offset = data;
+            end = ::lseek(in.fd(), offset, SEEK_HOLE);
+            if (end < 0) end = st.st_size;
+        }
+#endif
+
+        off_t size = end - offset;
+
+#ifdef __linux__
+        while (size)
+        {
+            loff_t inOffset = offset;
+            loff_t outOffset = offset;
+
+            ssize_t ok = ::copy_file_range(in.fd(), &inOffset, out.fd(), &outOffset, size, 0);
+
+            if (ok < 0 && errno == EINTR) continue;
+            if (ok <= 0) break;
+
+            offset += ok;
+            size -= ok;
+        }
+#endif
+
+        // not supported (or not across these file systems.)
+        copyRange(in.fd(), out.fd(), offset, size);
+
+        offset += size;
+    }
+
+    // a trailing hole.
+    if (::ftruncate(out.fd(), st.st_size) != 0)
+        throw POSIX::Exception(__METHOD__ ": ftruncate", errno);
+}
@@ -47,6 +47,9 @@ class File {
     void adopt(int fd);
     
     void swap(File &f);
+    
+    // copy src to dest, sharing blocks (reflink) where possible.
+    static void Clone(const char *src, const char *dest);
         
     private:
     
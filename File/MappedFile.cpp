@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <cerrno>
+#include <vector>
 
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <File/MappedFile.h>
 #include <Common/Exception.h>
@@ -181,5 +184,68 @@ MappedFile *MappedFile::Create(const char *name, size_t size)
         throw POSIX::Exception(__METHOD__ ": Unable to truncate file.", errno);    
     }
     
+    return new MappedFile(fd, File::ReadWrite, size);
+}
+
+/*
+ * as above, but the start of the file is written with a single pwritev
+ * before it's mapped.  The rest of the file is a hole.  Writing to a
+ * hole through the mapping faults in (and allocates) a page at a time,
+ * which is most of the cost of creating a new image.
+ */
+MappedFile *MappedFile::Create(const char *name, size_t size, const struct iovec *iov, int iovcnt)
+{
+#undef __METHOD__
+#define __METHOD__ "MappedFile::Create"
+
+    File fd(::open(name, O_CREAT | O_TRUNC | O_RDWR, 0644));
+
+    if (!fd.isValid())
+    {
+        throw POSIX::Exception(__METHOD__ ": Unable to create file.", errno);
+    }
+
+    if (::ftruncate(fd.fd(), size) < 0)
+    {
+        throw POSIX::Exception(__METHOD__ ": Unable to truncate file.", errno);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+
+    if (total > size)
+        throw ::Exception(__METHOD__ ": Invalid size.");
+
+    std::vector<struct iovec> v(iov, iov + iovcnt);
+    struct iovec *vp = v.empty() ? NULL : &v[0];
+    off_t offset = 0;
+
+    while (total)
+    {
+        ssize_t ok = ::pwritev(fd.fd(), vp, iovcnt, offset);
+
+        if (ok < 0 && errno == EINTR) continue;
+        if (ok <= 0)
+            throw ok < 0
+                ? POSIX::Exception(__METHOD__ ": Unable to write file.", errno)
+                : ::Exception(__METHOD__ ": Unable to write file.");
+
+        offset += ok;
+        total -= ok;
+
+        // short write -- skip what was written.
+        while (iovcnt && (size_t)ok >= vp->iov_len)
+        {
+            ok -= vp->iov_len;
+            ++vp;
+            --iovcnt;
+        }
+        if (iovcnt)
+        {
+            vp->iov_base = (uint8_t *)vp->iov_base + ok;
+            vp->iov_len -= ok;
+        }
+    }
+
     return new MappedFile(fd, File::ReadWrite, size);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include <new>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <File/File.h>
 
@@ -22,6 +23,7 @@ class MappedFile {
     
     
     static MappedFile *Create(const char *name, size_t size);
+    static MappedFile *Create(const char *name, size_t size, const struct iovec *iov, int iovcnt);
     
     bool isValid() const
     {
@@ -65,9 +65,9 @@ FileEntry::FileEntry(void *vp) :
     _lastByte = Read16(vp, 0x16);
     _modification = Date(Read16(vp, 0x18));
     
-    _fileSize = 0;
-    _pageSize = NULL;
     _maxFileSize = 0;
+    _encoding = false;
+    _dirty = false;
 }
 
 FileEntry::FileEntry(const char *name, unsigned fileKind)
@@ -91,26 +91,20 @@ FileEntry::FileEntry(const char *name, unsigned fileKind)
     _modification = Date::Today();
     _lastByte = 0;
     
-    _fileSize = 0;
-    _pageSize = NULL;
     _maxFileSize = 0;
+    _encoding = false;
+    _dirty = false;
 }
 
 FileEntry::~FileEntry()
 {
-    delete _pageSize;
 }
 
 
 void FileEntry::setFileKind(unsigned kind)
 {
     _fileKind = kind;
-    if (_pageSize)
-    {
-        delete _pageSize;
-        _fileSize = 0;
-        _pageSize = NULL;
-    }
+    textInvalidate();
     
     VolumeEntryPointer v = parent().lock();
     
@@ -130,6 +124,7 @@ void FileEntry::setName(const char *name)
         throw ProDOS::Exception(__METHOD__ ": Invalid file name.", ProDOS::badPathSyntax);
     
     _fileNameLength = length;
+    std::memset(_fileName, 0, sizeof(_fileName));
     for (unsigned i = 0; i < length; ++i)
         _fileName[i] = std::toupper(name[i]);
 
@@ -199,11 +194,7 @@ int FileEntry::truncate(unsigned newSize)
         }
         newSize = 2; // text files have a 2-page scratch buffer for the editor.
         
-        if (_pageSize)
-        {
-            _pageSize->clear();
-            _fileSize = 0;
-        }
+        textInvalidate();
     }
     
     if (truncateCommon(newSize) != 0)
@@ -322,6 +313,7 @@ int FileEntry::write(TextWriter &text)
     _modification = Date::Today();
     
     setFileSize(blocks * 512);
+    textInvalidate();
     
     v->writeEntry(this);
     v->sync();
@@ -392,7 +384,7 @@ int FileEntry::write(const uint8_t *buffer, unsigned size, unsigned offset)
     {
         uint8_t *address = (uint8_t *)v->loadBlock(block);
 
-        unsigned count = std::min(512u, size);
+        unsigned count = std::min(512u, remainder);
         
         std::memcpy(address, buffer, count);
         v->unloadBlock(block, true);
@@ -406,8 +398,9 @@ int FileEntry::write(const uint8_t *buffer, unsigned size, unsigned offset)
     if (newSize > currentSize) setFileSize(newSize);
 
     
+    // the directory entry is written when the volume is synced.
     _modification = Date::Today();
-    v->writeEntry(this);
+    _dirty = true;
     
     return size;
 }
@@ -420,17 +413,25 @@ int FileEntry::write(const uint8_t *buffer, unsigned size, unsigned offset)
  */
 void FileEntry::setFileSize(unsigned size)
 {
+    unsigned lastBlock = _lastBlock;
+    VolumeEntryPointer v;
+
     if (size == 0)
     {
         // TODO -- verify how 0 byte files are handled.
         _lastBlock = _firstBlock + 1;
         _lastByte = 0;
-        return;
+    }
+    else
+    {
+        _lastBlock = _firstBlock + (size + 511) / 512;
+        _lastByte = size % 512;
+        if (_lastByte == 0) _lastByte = 512;
     }
 
-    _lastBlock = 1 + _firstBlock + size / 512;
-    _lastByte = size % 512;
-    if (_lastByte == 0) _lastByte = 512;
+    // keep the volume's free extents up to date.
+    v = parent().lock();
+    if (v && _lastBlock != lastBlock) v->resizeExtent(lastBlock, _lastBlock);
 }
 
 unsigned FileEntry::dataFileSize()
@@ -440,8 +441,7 @@ unsigned FileEntry::dataFileSize()
 
 unsigned FileEntry::textFileSize()
 {
-    if (!_pageSize) textInit();
-    return _fileSize;  
+    return textIndex()->fileSize;
 }
 
 
@@ -474,11 +474,12 @@ int FileEntry::dataRead(uint8_t *buffer, unsigned size, unsigned offset)
     
     if (offset % 512)
     {
-        unsigned bytes = std::min(offset % 512, size);
+        unsigned start = offset % 512;
+        unsigned bytes = std::min(512 - start, size);
         
         v->readBlock(block++, tmp);
         
-        std::memcpy(buffer, tmp + 512 - bytes, bytes);
+        std::memcpy(buffer, tmp + start, bytes);
         
         buffer += bytes;
         count += bytes;
@@ -518,31 +519,19 @@ int FileEntry::dataRead(uint8_t *buffer, unsigned size, unsigned offset)
 
 int FileEntry::textRead(uint8_t *buffer, unsigned size, unsigned offset)
 {
-    unsigned page = 0;
-    unsigned to = 0;
+    unsigned page;
     unsigned block;
-    unsigned l;
     unsigned count = 0;
     
-    ::auto_array<uint8_t> tmp;
-    unsigned tmpSize = 0;
+    std::vector<uint8_t> tmp;
     
-    if (!_pageSize) textInit();
+    TextIndexPointer index = textIndex();
+    const std::vector<unsigned> &offsets = index->pageOffset;
     
-    l = _pageSize->size();
-
+    if (offsets.size() < 2) return 0;
 
-    // find the first page.    
-    for (page = 0; page < l; ++page)
-    {
-        unsigned pageSize = (*_pageSize)[page];
-        if (to + pageSize > offset)
-        {
-            break;
-        }
-        
-        to += pageSize;
-    }
+    // find the first page (the last page starting at or before offset.)
+    page = std::upper_bound(offsets.begin(), offsets.end() - 1, offset) - offsets.begin() - 1;
     
     // first 2 pages are spare, for editor use, not actually text.
     block = _firstBlock + 2 + (page * 2);
@@ -550,26 +539,26 @@ int FileEntry::textRead(uint8_t *buffer, unsigned size, unsigned offset)
     
     // offset not needed anymore,
     // convert to offset from *this* page.
-    offset -= to;
+    offset -= offsets[page];
     
-    while (size)
+    while (size && page + 1 < offsets.size())
     {
-        unsigned pageSize = (*_pageSize)[page];
+        unsigned pageSize = offsets[page + 1] - offsets[page];
         unsigned bytes = std::min(size, pageSize - offset);
         
-        if (pageSize > tmpSize)
+        if (offset == 0 && bytes == pageSize)
         {
-            tmp.reset(new uint8_t[pageSize]);
-            tmpSize = pageSize;            
+            // the whole page fits -- decode straight to the buffer.
+            textDecodePage(block, buffer);
+        }
+        else
+        {
+            if (pageSize > tmp.size()) tmp.resize(pageSize);
+            
+            textDecodePage(block, &tmp[0]);
+            
+            std::memcpy(buffer, &tmp[0] + offset, bytes);
         }
-        
-        
-        // can decode straight to buffer if size >= bytes && offset = 0.
-        textDecodePage(block, tmp.get());
-        
-        
-        std::memcpy(buffer, tmp.get() + offset, bytes);
-        
         
         block += 2;
         page += 1;
@@ -586,6 +575,29 @@ int FileEntry::textRead(uint8_t *buffer, unsigned size, unsigned offset)
 
 
 
+// 8 copies of a byte.
+#define SWAR_BYTES(x) (0x0101010101010101ULL * (x))
+
+// true if any byte in the word is zero.
+static inline bool swarHasZero(uint64_t x)
+{
+    return ((x - SWAR_BYTES(0x01)) & ~x & SWAR_BYTES(0x80)) != 0;
+}
+
+// true if any byte is 0, DLE or CR (ie, needs special handling.)
+static inline bool swarSpecial(uint64_t x)
+{
+    return swarHasZero(x)
+        || swarHasZero(x ^ SWAR_BYTES(kDLE))
+        || swarHasZero(x ^ SWAR_BYTES(0x0d));
+}
+
+
+/*
+ * decodes a page (out may be NULL to just calculate the size.)
+ * DLE + n expands to n - 32 spaces, CR is converted to LF and nulls
+ * are dropped.  Everything else is copied as-is, 8 bytes at a time.
+ */
 unsigned FileEntry::textDecodePage(unsigned block, uint8_t *out)
 {
     uint8_t buffer[1024];
@@ -593,10 +605,30 @@ unsigned FileEntry::textDecodePage(unsigned block, uint8_t *out)
     bool dle = false;
     
     unsigned bytes = textReadPage(block, buffer);
+    unsigned i = 0;
     
-    for (unsigned i = 0; i < bytes; ++i)
+    while (i < bytes)
     {
-        uint8_t c = buffer[i];
+        if (!dle && i + 8 <= bytes)
+        {
+            uint64_t word;
+            
+            std::memcpy(&word, buffer + i, 8);
+            
+            if (!swarSpecial(word))
+            {
+                if (out)
+                {
+                    std::memcpy(out, &word, 8);
+                    out += 8;
+                }
+                size += 8;
+                i += 8;
+                continue;
+            }
+        }
+        
+        uint8_t c = buffer[i++];
         
         if (!c) continue;
         
@@ -607,8 +639,11 @@ unsigned FileEntry::textDecodePage(unsigned block, uint8_t *out)
             {
                 unsigned x = c - 32;
                 size += x;
-                if (out) for (unsigned j = 0; j < x; ++j)
-                    *out++ = ' ';
+                if (out)
+                {
+                    std::memset(out, ' ', x);
+                    out += x;
+                }
             }
             dle = false;
             continue;
@@ -656,20 +691,47 @@ unsigned FileEntry::textReadPage(unsigned block, uint8_t *in)
 
 
 
-void FileEntry::textInit()
+/*
+ * returns the page index, building it if necessary.  The index is built
+ * with the lock held so concurrent readers don't duplicate the work.
+ */
+FileEntry::TextIndexPointer FileEntry::textIndex()
 {
+    Locker locker(_textLock);
+    
+    if (_textIndex) return _textIndex;
+    
     // calculate the file size and page offsets.
-    _pageSize = new std::vector<unsigned>;
-    _pageSize->reserve((_lastBlock - _firstBlock + 1 - 2) / 2);
-
-    _fileSize = 0;
+    TextIndexPointer index = MAKE_SHARED(TextIndex);
+    
+    index->pageOffset.reserve((_lastBlock - _firstBlock + 1 - 2) / 2 + 1);
+    index->fileSize = 0;
+    
     for (unsigned block = _firstBlock + 2; block < _lastBlock; block += 2)
     {
         unsigned size = textDecodePage(block, NULL);
         //printf("%u: %u\n", block, size);
-        _fileSize += size;
-        _pageSize->push_back(size);
+        index->pageOffset.push_back(index->fileSize);
+        index->fileSize += size;
     }
+    
+    index->pageOffset.push_back(index->fileSize);
+    
+    _textIndex = index;
+    
+    return index;
+}
+
+void FileEntry::textInvalidate()
+{
+    Locker locker(_textLock);
+    
+    _textIndex.reset();
+}
+
+void FileEntry::buildTextIndex()
+{
+    if (fileKind() == kTextFile) textIndex();
 }
 
 
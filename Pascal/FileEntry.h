@@ -4,6 +4,8 @@
 #include <Pascal/Entry.h>
 #include <Pascal/Date.h>
 
+#include <Common/Lock.h>
+
 #include <vector>
 #include <string>
 
@@ -47,6 +49,10 @@ namespace Pascal {
         
         int truncate(unsigned newSize);
         
+        // build the text page index now rather than on first use.
+        // thread safe; a no-op for non-text files.
+        void buildTextIndex();
+        
 
         FileEntry(const char *name, unsigned fileKind);
         FileEntry(void *vp);
@@ -59,6 +65,7 @@ namespace Pascal {
         
         
         friend class VolumeEntry;
+        friend class TextEncoder;
         
 
         FileEntryPointer thisPointer() 
@@ -84,6 +91,11 @@ namespace Pascal {
         
         unsigned _maxFileSize; // maximum file size.
         
+        // a TextEncoder is writing it; nothing is placed right after it.
+        bool _encoding;
+        
+        bool _dirty; // directory entry needs to be written.
+        
         
         
         
@@ -91,16 +103,29 @@ namespace Pascal {
         unsigned dataFileSize();
         int dataRead(uint8_t *buffer, unsigned size, unsigned offset); 
            
-        // for text files.
-        void textInit();
+        // for text files.  The page index is built on first use and
+        // replaced (never modified) so readers can use a snapshot
+        // without holding the lock.
+        // pageOffset[i] is the (decoded) offset of page i; the last
+        // element is the file size.
+        struct TextIndex {
+            std::vector<unsigned> pageOffset;
+            unsigned fileSize;
+        };
+        
+        typedef SHARED_PTR(TextIndex) TextIndexPointer;
+        
+        TextIndexPointer textIndex();
+        void textInvalidate();
+        
         unsigned textFileSize();
         int textRead(uint8_t *buffer, unsigned size, unsigned offset);
         
         unsigned textReadPage(unsigned block, uint8_t *in);
         unsigned textDecodePage(unsigned block, uint8_t *out);    
         
-        std::vector<unsigned> *_pageSize;
-        unsigned _fileSize;
+        Lock _textLock;
+        TextIndexPointer _textIndex;
         
     };
 
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <Pascal/Pascal.h>
+#include <Pascal/TextEncoder.h>
+
+using namespace Pascal;
+
+enum {
+    kDLE = 16
+};
+
+
+/*
+ * each page is flushed because the next line did not fit, so any two
+ * consecutive pages hold more than 1024 bytes.  The encoded text is
+ * at most 1 byte longer than the input (a final line end.)
+ */
+unsigned TextEncoder::MaxBlocks(size_t length)
+{
+    return 6 + (length + 1 + 255) / 256;
+}
+
+
+TextEncoder::TextEncoder(FileEntryPointer file) :
+    _file(file)
+{
+    _volume = file->parent().lock();
+
+    // the file can't move, so it keeps the gap after it.
+    _file->_encoding = true;
+
+    std::memset(_page, 0, sizeof(_page));
+
+    _lineStart = 0;
+    _offset = 0;
+    _pages = 0;
+
+    _spaces = 0;
+    _leading = true;
+    _cr = false;
+    _error = false;
+}
+
+TextEncoder::~TextEncoder()
+{
+    _file->_encoding = false;
+}
+
+
+unsigned TextEncoder::blocks() const
+{
+    // 2 header blocks + pages + the partial page.
+    unsigned blocks = 2 + _pages * 2;
+
+    if (_offset) blocks += _offset <= 512 ? 1 : 2;
+
+    return blocks;
+}
+
+
+/*
+ * write the first size bytes of the current page, zero-filled.
+ * Any partial line (after size) is moved to the start of the next page.
+ */
+int TextEncoder::writePage(unsigned size)
+{
+    uint8_t line[1024];
+    unsigned length = _offset - size;
+    unsigned block = _file->firstBlock() + 2 + _pages * 2;
+
+    if ((2 + _pages * 2 + 2) * 512 > _file->_maxFileSize)
+    {
+        errno = ENOSPC;
+        _error = true;
+        return -1;
+    }
+
+    std::memcpy(line, _page + size, length);
+    std::memset(_page + size, 0, sizeof(_page) - size);
+
+    _volume->writeBlock(block, _page);
+    _volume->writeBlock(block + 1, _page + 512);
+
+    ++_pages;
+
+    // claim the blocks so nothing else is placed over them.
+    _file->setFileSize((2 + _pages * 2) * 512);
+
+    std::memset(_page, 0, sizeof(_page));
+    std::memcpy(_page, line, length);
+
+    _offset = length;
+    _lineStart = 0;
+
+    return 0;
+}
+
+
+// append bytes to the current line, starting a new page if necessary.
+int TextEncoder::append(const uint8_t *data, unsigned length)
+{
+    while (length)
+    {
+        if (_offset == 1024)
+        {
+            // a single line can't be larger than a page.
+            if (_lineStart == 0)
+            {
+                errno = EINVAL;
+                _error = true;
+                return -1;
+            }
+
+            if (writePage(_lineStart) < 0) return -1;
+        }
+
+        unsigned count = std::min(length, 1024 - _offset);
+
+        std::memcpy(_page + _offset, data, count);
+
+        _offset += count;
+        data += count;
+        length -= count;
+    }
+
+    return 0;
+}
+
+
+// leading spaces are compressed to DLE, 32 + count (if there are 3 or more.)
+int TextEncoder::flushSpaces()
+{
+    static const uint8_t spaces[] = "                                ";
+
+    _leading = false;
+
+    if (_spaces >= 3)
+    {
+        uint8_t dle[2];
+        unsigned count = std::min(_spaces, 255u - 32);
+
+        dle[0] = kDLE;
+        dle[1] = 32 + count;
+
+        if (append(dle, 2) < 0) return -1;
+        _spaces -= count;
+    }
+
+    while (_spaces)
+    {
+        unsigned count = std::min(_spaces, (unsigned)sizeof(spaces) - 1);
+
+        if (append(spaces, count) < 0) return -1;
+        _spaces -= count;
+    }
+
+    return 0;
+}
+
+int TextEncoder::endLine()
+{
+    static const uint8_t cr = 0x0d;
+
+    if (_leading && flushSpaces() < 0) return -1;
+
+    if (append(&cr, 1) < 0) return -1;
+
+    _lineStart = _offset;
+    _leading = true;
+
+    return 0;
+}
+
+
+int TextEncoder::write(const void *data, size_t length)
+{
+    const uint8_t *cp = (const uint8_t *)data;
+    const uint8_t *end = cp + length;
+
+    if (_error) return -1;
+
+    while (cp < end)
+    {
+        uint8_t c = *cp;
+
+        // CR LF is a single line end.
+        if (_cr)
+        {
+            _cr = false;
+            if (c == 0x0a)
+            {
+                ++cp;
+                continue;
+            }
+        }
+
+        if (c == 0x0d || c == 0x0a)
+        {
+            if (endLine() < 0) return -1;
+
+            _cr = c == 0x0d;
+            ++cp;
+            continue;
+        }
+
+        if (_leading)
+        {
+            if (c == ' ')
+            {
+                ++_spaces;
+                ++cp;
+                continue;
+            }
+
+            if (flushSpaces() < 0) return -1;
+        }
+
+        // copy everything up to the next line end.
+        const uint8_t *run = cp;
+        while (run < end && *run != 0x0d && *run != 0x0a) ++run;
+
+        if (append(cp, run - cp) < 0) return -1;
+
+        cp = run;
+    }
+
+    return length;
+}
+
+
+int TextEncoder::close()
+{
+    if (_error) return -1;
+
+    if (!_volume)
+    {
+        errno = EROFS;
+        return -1;
+    }
+
+    // any remainder is a line.
+    if (_spaces || _offset > _lineStart)
+    {
+        if (endLine() < 0) return -1;
+    }
+
+    unsigned blocks = this->blocks();
+
+    if (blocks * 512 > _file->_maxFileSize)
+    {
+        errno = ENOSPC;
+        _error = true;
+        return -1;
+    }
+
+    // the final partial page.
+    if (_offset)
+    {
+        unsigned block = _file->firstBlock() + 2 + _pages * 2;
+
+        _volume->writeBlock(block, _page);
+        if (_offset > 512) _volume->writeBlock(block + 1, _page + 512);
+    }
+
+    // 2 header blocks for the editor.
+    uint8_t zero[512];
+    std::memset(zero, 0, sizeof(zero));
+
+    _volume->writeBlock(_file->firstBlock(), zero);
+    _volume->writeBlock(_file->firstBlock() + 1, zero);
+
+    _file->_fileKind = kTextFile;
+    _file->_modification = Date::Today();
+    _file->setFileSize(blocks * 512);
+    _file->textInvalidate();
+
+    _volume->writeEntry(_file.get());
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __PASCAL_TEXTENCODER_H__
+#define __PASCAL_TEXTENCODER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Pascal/Entry.h>
+
+namespace Pascal {
+
+    /*
+     * Streaming text file encoder.
+     *
+     * Input is native text (CR, LF or CR LF line endings) in chunks of
+     * any size.  Leading spaces are DLE compressed and lines are packed
+     * into 1K pages in a single pass; full pages are written directly to
+     * the file's blocks, so the file must be large enough (see
+     * MaxBlocks).  close() sets the file size and kind and updates the
+     * directory entry but does not sync.  Until the encoder is deleted,
+     * new and moved files aren't placed in the gap after the file.
+     */
+    class TextEncoder {
+
+    public:
+
+        // upper bound on the blocks needed to encode length bytes.
+        static unsigned MaxBlocks(size_t length);
+
+        TextEncoder(FileEntryPointer file);
+        ~TextEncoder();
+
+        int write(const void *data, size_t length);
+        int close();
+
+        unsigned blocks() const;
+
+    private:
+
+        TextEncoder(const TextEncoder &);
+        TextEncoder& operator=(const TextEncoder &);
+
+        int append(const uint8_t *data, unsigned length);
+        int flushSpaces();
+        int endLine();
+        int writePage(unsigned size);
+
+        FileEntryPointer _file;
+        VolumeEntryPointer _volume;
+
+        uint8_t _page[1024];
+
+        // the current line starts at _lineStart and runs to _offset.
+        unsigned _lineStart;
+        unsigned _offset;
+
+        // pages written (not including the 2 header blocks).
+        unsigned _pages;
+
+        unsigned _spaces;
+        bool _leading;
+        bool _cr;
+        bool _error;
+    };
+
+}
+
+#endif
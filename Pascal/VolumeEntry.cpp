@@ -2,8 +2,10 @@
 #include <memory>
 #include <algorithm>
 #include <cerrno>
+#include <cstring>
 
 #include <Pascal/Pascal.h>
+#include <Pascal/TextEncoder.h>
 
 #include <Common/auto.h>
 #include <Common/Exception.h>
@@ -48,6 +50,17 @@ static bool NameEqual(const char *a, const char *b)
     return ::strcasecmp(a, b) == 0;
 }
 
+// directory order.
+static bool FileEntryLess(const FileEntryPointer &a, const FileEntryPointer &b)
+{
+    return a->firstBlock() < b->firstBlock();
+}
+
+static bool FileEntryBefore(const FileEntryPointer &e, unsigned block)
+{
+    return e->firstBlock() < block;
+}
+
 
 
 unsigned VolumeEntry::ValidName(const char *cp)
@@ -95,20 +108,36 @@ VolumeEntry::VolumeEntry()
     setInode(1);
     
     _inodeGenerator = 1;
+    _freeBlocks = 0;
+    
+    _dirtyFirst = _dirtyLast = 0;
+    
+    _batch = _journaling = false;
 }
 
-VolumeEntry::VolumeEntry(Device::BlockDevicePointer device, const char *name) :
-    _device(device)
+void VolumeEntry::Format(void *bp, unsigned blocks, const char *name)
+{
+    VolumeEntry volume;
+    
+    volume.init(name, blocks);
+    
+    std::memset(bp, 0, 4 * 512);
+    
+    IOBuffer iob(bp, 0x1a);
+    volume.writeDirectoryEntry(&iob);
+}
+
+
+// volume header fields for a new volume.
+void VolumeEntry::init(const char *name, unsigned blocks)
 {
 #undef __METHOD__
-#define __METHOD__ "VolumeEntry::VolumeEntry"
+#define __METHOD__ "VolumeEntry::init"
 
     unsigned length;
-    unsigned deviceBlocks = device->blocks();
     
-    
-    deviceBlocks = std::min(0xffffu, deviceBlocks);
-    if (deviceBlocks < 6)
+    blocks = std::min(0xffffu, blocks);
+    if (blocks < 6)
         throw ::Exception(__METHOD__ ": device too small.");
     
     
@@ -131,10 +160,16 @@ VolumeEntry::VolumeEntry(Device::BlockDevicePointer device, const char *name) :
         _fileName[i] = std::toupper(name[i]);
     }
     
-    _lastVolumeBlock = deviceBlocks;
+    _lastVolumeBlock = blocks;
     _fileCount = 0;
     _accessTime = 0;
     _lastBoot = Date::Today(); 
+}
+
+VolumeEntry::VolumeEntry(Device::BlockDevicePointer device, const char *name) :
+    _device(device)
+{
+    init(name, device->blocks());
     
     _device = device;
     _cache = BlockCache::Create(device);
@@ -142,19 +177,18 @@ VolumeEntry::VolumeEntry(Device::BlockDevicePointer device, const char *name) :
     _address = 512 * 2;
 
 
-    for (unsigned i = 2; i < 6; ++i)
-    {
-        _cache->zeroBlock(i);
-    }
+    _directory.assign((_lastBlock - 2) * 512, 0);
+    _dirtyFirst = 0;
+    _dirtyLast = _directory.size();
     
-    void *vp = _cache->acquire(2);
-    IOBuffer b(vp, 512);
+    _batch = _journaling = false;
     
-    writeDirectoryEntry(&b);
-        
-    _cache->release(2, true);
+    writeEntry();
     
-    _cache->sync();
+    rebuildFreeExtents();
+    rebuildNameIndex();
+    
+    sync();
 }
 
 
@@ -181,12 +215,19 @@ VolumeEntry::VolumeEntry(Device::BlockDevicePointer device)
     
     //printf("%u %u\n", blocks(), _lastBlock - _firstBlock);
     
-    blockCount = blocks();
+    // the directory is kept in memory; changes are written back on sync().
+    blockCount = _lastBlock - 2;
     
-    if (blockCount > 1)
-    {
-        buffer.reset(readDirectoryHeader());
-    }
+    if (_lastBlock < 3 || _lastBlock > _lastVolumeBlock || (_fileCount + 1) * 0x1a > blockCount * 512)
+        throw ProDOS::Exception(__METHOD__ ": Invalid directory.", ProDOS::dirError);
+    
+    _directory.resize(blockCount * 512);
+    _dirtyFirst = _dirtyLast = 0;
+    
+    _batch = _journaling = false;
+    
+    for (unsigned i = 0; i < blockCount; ++i)
+        _cache->read(2 + i, &_directory[i * 512]);
     
     // now load up all the children.
     // the parent cannot be set (yet), since we need a shared_ptr to create a weak_ptr.
@@ -201,7 +242,7 @@ VolumeEntry::VolumeEntry(Device::BlockDevicePointer device)
         FileEntryPointer child;
         
         //
-        child = FileEntry::Open(buffer.get() + i * 0x1a);
+        child = FileEntry::Open(&_directory[i * 0x1a]);
         
         child->setInode(++_inodeGenerator);
         // need to set later....
@@ -238,12 +279,15 @@ VolumeEntry::VolumeEntry(Device::BlockDevicePointer device)
         
     }
     
-    
+    rebuildFreeExtents();
+    rebuildNameIndex();
     calcMaxFileSize();
 }
 
 VolumeEntry::~VolumeEntry()
 {
+    // the cache writes back when it's destroyed.
+    if (_device && !_device->readOnly()) flushDirectory();
 }
 
 
@@ -299,11 +343,16 @@ FileEntryPointer VolumeEntry::fileAtIndex(unsigned i) const
 
 FileEntryPointer VolumeEntry::fileByName(const char *name) const
 {
-    std::vector<FileEntryPointer>::const_iterator iter;
-    for(iter = _files.begin(); iter != _files.end(); ++iter)
+    unsigned hash = NameHash(name);
+    unsigned mask = _nameIndex.size() - 1;
+    
+    if (_nameIndex.empty()) return FileEntryPointer();
+    
+    for (unsigned i = hash & mask; _nameIndex[i].file; i = (i + 1) & mask)
     {
-        FileEntryPointer e = *iter;
-        if (::strcasecmp(name, e->name()) == 0) return e;
+        const NameSlot &slot = _nameIndex[i];
+        
+        if (slot.hash == hash && NameEqual(name, slot.file->name())) return slot.file;
     }
     return FileEntryPointer();
 }
@@ -325,34 +374,30 @@ int VolumeEntry::unlink(const char *name)
         return -1;
     }
     
-    // TODO -- consider having an unordered_map of file names.
+    FileEntryPointer e = fileByName(name);
     
-    for (iter = _files.begin(); iter != _files.end(); ++iter)
-    {
-        FileEntryPointer e = *iter;
-        if (::strcasecmp(name, e->name()) == 0)
-        {
-            
-            // if not the first entry, update the previous entry's 
-            // _maxFileSize.
-            if (iter != _files.begin())
-            {
-                FileEntryPointer prev = iter[-1];
-                prev->_maxFileSize += e->_maxFileSize;
-            }
-            
-            iter->reset();
-            break;
-        }
-    }
-    if (iter == _files.end())
+    if (!e)
     {
         errno = ENOENT;
         return -1;
     }
+    
+    iter = std::lower_bound(_files.begin(), _files.end(), e->_firstBlock, FileEntryBefore);
+    while (*iter != e) ++iter;
+    
+    // if not the first entry, update the previous entry's 
+    // _maxFileSize.
+    if (iter != _files.begin())
+    {
+        FileEntryPointer prev = iter[-1];
+        prev->_maxFileSize += e->_maxFileSize;
+    }
+    
+    releaseExtent(e->_firstBlock, e->_lastBlock);
+    eraseName(e.get());
 
     
-    _files.erase(iter);
+    iter = _files.erase(iter);
     _fileCount--;
     
     index = distance(_files.begin(), iter);
@@ -364,24 +409,18 @@ int VolumeEntry::unlink(const char *name)
         e->_address -= 0x1a;
     }
 
-    // need to update the header blocks.
-    ::auto_array<uint8_t> buffer(readDirectoryHeader());
-
-
-    // update the filecount.
-    IOBuffer b(buffer.get(), 512 * blocks());
-    writeDirectoryEntry(&b);
- 
     // move up all the entries.
-    uint8_t *address = buffer.get() + 0x1a + 0x1a * index;
+    uint8_t *address = &_directory[0x1a + 0x1a * index];
     std::memmove(address, address + 0x1a, 0x1a * (_fileCount - index));
     // zero out the memory on the previous entry.
-    std::memset(buffer.get() + 0x1a + _fileCount * 0x1a, 0, 0x1a);
+    std::memset(&_directory[0x1a + _fileCount * 0x1a], 0, 0x1a);
+    
+    markDirectory(0x1a + 0x1a * index, 0x1a * (_fileCount - index + 1));
 
-    // now write to disk.
-    writeDirectoryHeader(buffer.get());
+    // update the filecount.
+    writeEntry();
     
-    _cache->sync();
+    sync();
     return 0;
 }
 
@@ -419,19 +458,21 @@ int VolumeEntry::rename(const char *oldName, const char *newName)
         return -1;
     }
 
-    // delete the new file
-    if (unlink(newName) != 0)
+    // delete the new file (unless it's only a change of case.)
+    if (fileByName(newName) != e && unlink(newName) != 0)
     {
         if (errno != ENOENT) return -1;
     }
 
     // update with the new name.
+    eraseName(e.get());
     e->setName(newName);
+    insertName(e);
     
     // and commit to disk.
     
     writeEntry(e.get());
-    _cache->sync();
+    sync();
     
     return 0;
 }
@@ -480,12 +521,7 @@ int VolumeEntry::copy(const char *oldName, const char *newName)
         // if newEntry is large enough, overwrite it.
         if (newEntry->_maxFileSize >= blocks * 512)
         {
-            if (newEntry->_pageSize)
-            {
-                delete newEntry->_pageSize;
-                newEntry->_pageSize = NULL;
-                newEntry->_fileSize = 0;
-            }
+            newEntry->textInvalidate();
         }
         else
         {
@@ -519,35 +555,36 @@ int VolumeEntry::copy(const char *oldName, const char *newName)
 
     newEntry->_fileKind = oldEntry->fileKind();
     newEntry->_lastByte = oldEntry->lastByte();
+    resizeExtent(newEntry->_lastBlock, newEntry->firstBlock() + blocks);
     newEntry->_lastBlock = newEntry->firstBlock() + blocks;
     newEntry->_modification = Date::Today();
+    newEntry->_dirty = true;
    
-    for (unsigned i = 0; i < blocks; i++)
-    {
-        void *src = loadBlock(oldEntry->firstBlock() + i);
-        _cache->write(newEntry->firstBlock() + i, src);
-        unloadBlock(oldEntry->firstBlock() + i, false);
-    }
+    copyBlocks(oldEntry->firstBlock(), newEntry->firstBlock(), blocks);
     
-    _cache->sync();
+    sync();
     
     
     return 0;
 }
 
 /*
- * create a file.  if blocks is defined, verifies the file could
- * expand to fit.
+ * create a file in the smallest gap which could expand to blocks
+ * blocks (at least 1).
  * returns FileEntry on success, NULL (and errno) on failure.
  *
  */
-/*
- * TODO -- if blocks is defined, try to fit in a gap rather than putting at the end.
- *
- *
- *
- */
 FileEntryPointer VolumeEntry::create(const char *name, unsigned blocks)
+{
+    FileEntryPointer entry = createEntry(name, blocks);
+    
+    if (entry) sync();
+    
+    return entry;
+}
+
+// does not sync.
+FileEntryPointer VolumeEntry::createEntry(const char *name, unsigned blocks)
 {
     // 0. check read only access.
     // 1. verify < 77 file names.
@@ -557,13 +594,10 @@ FileEntryPointer VolumeEntry::create(const char *name, unsigned blocks)
     // 6. create the file entry.
     // 7. insert into _files, write to disk, update _maxFileSize
     
-    unsigned lastBlock = _lastBlock;
-
-    
     FileEntryPointer entry;
-    FileEntryPointer prev;
     FileEntryPointer curr;
     std::vector<FileEntryPointer>::iterator iter;
+    std::set<std::pair<unsigned, unsigned> >::const_iterator fit;
     
     
     if (readOnly())
@@ -572,7 +606,7 @@ FileEntryPointer VolumeEntry::create(const char *name, unsigned blocks)
         return FileEntryPointer();
     }
     
-    if (_fileCount == kMaxFiles)
+    if (_fileCount >= kMaxFiles)
     {
         errno = ENOSPC;
         return FileEntryPointer();
@@ -592,141 +626,433 @@ FileEntryPointer VolumeEntry::create(const char *name, unsigned blocks)
     }
     
     
+    // best fit.
+    fit = findFreeExtent(std::max(1u, blocks));
+    if (fit == _freeBySize.end())
+    {
+        errno = ENOSPC;
+        return FileEntryPointer();
+    }
+    
+    unsigned freeSpace = fit->first;
+    unsigned lastBlock = fit->second;
+    
     entry = FileEntry::Create(name, kUntypedFile);
+    entry->setInode(++_inodeGenerator);
     
-    ::auto_array<uint8_t> buffer(readDirectoryHeader());
-        
-    for (iter = _files.begin(); iter != _files.end(); ++iter)
+    iter = std::lower_bound(_files.begin(), _files.end(), lastBlock, FileEntryBefore);
+    
+    // update previous entry max file size.
+    if (iter != _files.begin())
     {
-        FileEntryPointer e = *iter;
-        
-        unsigned freeSpace = e->_firstBlock - lastBlock;
-        // this could do something stupid like selecting a slot with only 1 free block but too bad.
-        
-        if (freeSpace < blocks)
-        {
-            lastBlock = e->_lastBlock;
-            prev = e;
-            continue;
-        }
-        
-        // update previous entry max file size.
-        if (prev)
-        {
-            prev->_maxFileSize = prev->blocks() * 512;
-        }
-        
-        // insert() inserts an item *before* the current item and returns an iterator to the 
-        // element inserted.
-        // afterwards, iter will point to curr+1
-        
-        // keep track of the index *before* the insert.
-        unsigned index = distance(_files.begin(), iter); // current index.
-        
-        iter = _files.insert(iter, entry);
-        ++_fileCount;
+        FileEntryPointer prev = iter[-1];
+        prev->_maxFileSize = prev->blocks() * 512;
+    }
+    
+    // keep track of the index *before* the insert.
+    unsigned index = distance(_files.begin(), iter);
+    
+    _files.insert(iter, entry);
+    ++_fileCount;
+    
+    insertName(entry);
+    
+    curr = entry;
+    
+    //curr->_parent = this;
+    curr->_parent = VolumeEntryWeakPointer(thisPointer());
+    curr->_firstBlock = lastBlock;
+    curr->_lastBlock = lastBlock + 1;
+    curr->_lastByte = 0;
+    curr->_maxFileSize = freeSpace * 512;
+    
+    allocateExtent(lastBlock, lastBlock + 1);
+    
+    // entry 0 is the header.
+    for (unsigned i = index; i < _fileCount; ++i)
+        _files[i]->_address = 2 * 512 + 0x1a + 0x1a * i;
+    
+    // move all entries after this one up by 0x1a bytes, then write this entry.
+    uint8_t *address = &_directory[0x1a + 0x1a * index];
+    std::memmove(address + 0x1a, address, 0x1a * (_fileCount - index - 1));
+    
+    markDirectory(0x1a + 0x1a * index, 0x1a * (_fileCount - index));
+    
+    writeEntry(curr.get());
+    writeEntry(); // header.
+    
+    return curr;
+}
+
+
+/*
+ * The file is created in the first hole large enough for the worst case
+ * encoding (or the largest hole) and truncated to the encoded size.
+ * does not sync.
+ */
+FileEntryPointer VolumeEntry::importTextEntry(const char *name, const void *data, size_t length)
+{
+    unsigned blocks = std::min(TextEncoder::MaxBlocks(length), maxContiguousBlocks());
+    
+    if (blocks < 2)
+    {
+        errno = ENOSPC;
+        return FileEntryPointer();
+    }
+    
+    FileEntryPointer entry = createEntry(name, blocks);
+    if (!entry) return entry;
+    
+    TextEncoder encoder(entry);
+    
+    if (encoder.write(data, length) < 0 || encoder.close() < 0)
+    {
+        int error = errno;
         
-        curr = entry;
+        unlink(name);
         
-        //curr->_parent = this;
-        curr->_parent = VolumeEntryWeakPointer(thisPointer());
-        curr->_firstBlock = lastBlock;
-        curr->_lastBlock = lastBlock + 1;
-        curr->_lastByte = 0;
-        curr->_maxFileSize = freeSpace * 512;
-        //curr->_address = 2 * 512 + 0x1a + 0x1a * index;
+        errno = error;
+        return FileEntryPointer();
+    }
+    
+    return entry;
+}
+
+FileEntryPointer VolumeEntry::importText(const char *name, const void *data, size_t length)
+{
+    FileEntryPointer entry = importTextEntry(name, data, length);
+    
+    if (entry) sync();
+    
+    return entry;
+}
+
+/*
+ * bulk import.  Files are imported in order; the volume is synced once.
+ * returns the number of files imported.
+ */
+unsigned VolumeEntry::importText(std::vector<TextImport> &files)
+{
+    unsigned count = 0;
+    
+    std::vector<TextImport>::iterator iter;
+    for (iter = files.begin(); iter != files.end(); ++iter)
+    {
+        FileEntryPointer entry = importTextEntry(iter->name, iter->data, iter->length);
         
-        // move all entries after this one up by 0x1a bytes, then write this header.
-        unsigned count = _fileCount - index - 1;
-        unsigned offset = index * 0x1a + 0x1a;
-        std::memmove(buffer.get() + offset + 0x1a, buffer.get() + offset, count * 0x1a);
-        break;
+        iter->error = entry ? 0 : errno;
+        if (entry) ++count;
     }
     
-    if (iter == _files.end())
+    sync();
+    
+    return count;
+}
+
+
+
+/*
+ * krunch planning.
+ *
+ * The volume is modeled as a list of extents, sorted by block.  Each step
+ * closes the first hole.  A file is never copied over itself; a move
+ * which would overlap is staged in free space.  If there's no free space
+ * to stage it, the file stays where it is and the hole before it is left
+ * open.  Three strategies are planned and the one which leaves the
+ * fewest blocks in holes (then moves the fewest blocks) is used:
+ *
+ * slide: slide the next file down (staging and moving back if needed.)
+ * fill:  move the last file into the first hole large enough to hold it
+ *        (which doesn't open a new hole), otherwise slide.
+ * defer: files which would overlap are staged at the end of the volume
+ *        and placed after everything else has been packed.
+ */
+
+enum {
+    kKrunchSlide,
+    kKrunchFill,
+    kKrunchDefer
+};
+
+struct KrunchExtent {
+    FileEntryPointer file;
+    unsigned first;
+    unsigned blocks;
+    bool deferred;
+};
+
+static bool KrunchExtentLess(const KrunchExtent &a, const KrunchExtent &b)
+{
+    return a.first < b.first;
+}
+
+// returns the new index.
+static unsigned KrunchMoveExtent(std::vector<KrunchExtent> &extents, unsigned index, unsigned to,
+    std::vector<VolumeEntry::KrunchMove> &plan)
+{
+    VolumeEntry::KrunchMove move;
+
+    move.file = extents[index].file;
+    move.from = extents[index].first;
+    move.to = to;
+    move.blocks = extents[index].blocks;
+
+    plan.push_back(move);
+
+    extents[index].first = to;
+    std::sort(extents.begin(), extents.end(), KrunchExtentLess);
+
+    for (index = 0; extents[index].first != to; ++index) ;
+
+    return index;
+}
+
+// find count free blocks in [start, end) which don't intersect [lo, hi).
+static bool KrunchFindFree(const std::vector<KrunchExtent> &extents, unsigned start, unsigned end,
+    unsigned count, unsigned lo, unsigned hi, unsigned *block)
+{
+    unsigned a = start;
+
+    for (unsigned i = 0; i <= extents.size(); ++i)
     {
+        unsigned b = i < extents.size() ? extents[i].first : end;
 
-        // check if we can append
-        unsigned freeSpace = _lastVolumeBlock - lastBlock;
-        if (freeSpace < blocks)
+        if (std::min(b, lo) >= a + count)
         {
-            errno = ENOSPC;
-            return FileEntryPointer();        
+            *block = a;
+            return true;
         }
-                
-        _files.push_back(entry);
-        _fileCount++;
-        
-        curr = entry;
-        
-        //curr->_parent = this;
-        curr->_parent = VolumeEntryWeakPointer(thisPointer());
-        curr->_firstBlock = lastBlock;
-        curr->_lastBlock = lastBlock + 1;
-        curr->_lastByte = 0;
-        curr->_maxFileSize = freeSpace * 512;
-        curr->_address = 2 * 512 + 0x1a * _fileCount; // s/b +1 since entry 0 is the header.
-        
-        if (prev)
-        {    
-            prev->_maxFileSize = prev->blocks() * 512;
+
+        unsigned x = std::max(a, hi);
+        if (b >= x + count)
+        {
+            *block = x;
+            return true;
         }
-        
-        writeEntry(curr.get());
-        writeEntry(); // header.        
-        
+
+        if (i < extents.size()) a = extents[i].first + extents[i].blocks;
     }
-    else
+
+    return false;
+}
+
+// *gaps is the number of free blocks left in holes.
+static unsigned KrunchPlan(std::vector<KrunchExtent> extents, unsigned start, unsigned end,
+    unsigned mode, std::vector<VolumeEntry::KrunchMove> &plan, unsigned *gaps)
+{
+    unsigned moved = 0;
+    bool placing = false;
+
+    // files before floor are packed, or stuck behind a hole.
+    unsigned floor = start;
+
+    plan.clear();
+    *gaps = 0;
+
+    for (;;)
     {
+        unsigned block = floor;
+        unsigned i;
 
+        // find the first hole (deferred files are placed last.)
+        for (i = 0; i < extents.size(); ++i)
+        {
+            if (extents[i].deferred) continue;
+            if (extents[i].first < floor) continue;
+            if (extents[i].first != block) break;
+            block += extents[i].blocks;
+        }
 
-        // update all addresses to make life easier.
-        unsigned address = 2 * 512 + 0x1a;
-        for (iter = _files.begin(); iter != _files.end(); ++iter, address += 0x1a)
+        if (i == extents.size())
         {
-            FileEntryPointer e = *iter;
-            e->_address = address;
+            // everything else is packed -- the staged files are past the
+            // end, and are placed like any other file.
+            bool deferred = false;
+
+            for (i = 0; i < extents.size(); ++i)
+            {
+                if (extents[i].deferred) deferred = true;
+                extents[i].deferred = false;
+            }
+
+            if (!deferred) break;
+
+            placing = true;
+            continue;
         }
-             
-        IOBuffer b(buffer.get(), 4 * 512);
-        writeDirectoryEntry(&b);
-        
-        b.setOffset(curr->_address - 2 * 512);
-        curr->writeDirectoryEntry(&b);
-        
-        writeDirectoryHeader(buffer.get());
 
+        unsigned last = extents.size() - 1;
+        unsigned count;
+
+        if (mode == kKrunchFill && !extents[last].deferred)
+        {
+            unsigned a = block;
+            unsigned j;
+
+            count = extents[last].blocks;
+
+            for (j = i; j <= last; ++j)
+            {
+                if (extents[j].first >= a + count) break;
+                a = extents[j].first + extents[j].blocks;
+            }
+
+            if (j <= last)
+            {
+                KrunchMoveExtent(extents, last, a, plan);
+                moved += count;
+                continue;
+            }
+        }
+
+        count = extents[i].blocks;
+
+        unsigned hole = extents[i].first - block;
+        unsigned tail = extents[last].first + extents[last].blocks;
+        unsigned stage;
+
+        if (hole >= count)
+        {
+            KrunchMoveExtent(extents, i, block, plan);
+            moved += count;
+        }
+        else if (mode == kKrunchDefer && !placing && end - tail >= count)
+        {
+            i = KrunchMoveExtent(extents, i, tail, plan);
+            extents[i].deferred = true;
+            moved += count;
+        }
+        else if (KrunchFindFree(extents, start, end, count, block, extents[i].first + count, &stage))
+        {
+            i = KrunchMoveExtent(extents, i, stage, plan);
+            KrunchMoveExtent(extents, i, block, plan);
+            moved += count * 2;
+        }
+        else
+        {
+            // no free space to stage it.  Leave it (and the hole.)
+            *gaps += hole;
+            floor = extents[i].first + count;
+        }
     }
-        
-    _cache->sync();
-    return curr;
+
+    return moved;
 }
 
 
+/*
+ * make room for a file to grow to size bytes.  If the gap after it is
+ * too small, the file is moved to the smallest gap which will hold it.
+ * The data is synced before the directory is updated (but the directory
+ * is not synced.)
+ * Returns 0 on success, -1 on error (and sets errno)
+ */
+int VolumeEntry::reserve(FileEntry *e, unsigned size)
+{
+    if (size <= e->_maxFileSize) return 0;
+    
+    if (readOnly())
+    {
+        errno = EROFS;
+        return -1;
+    }
+    
+    unsigned blocks = std::max(1u, (size + 511) / 512);
+    
+    std::set<std::pair<unsigned, unsigned> >::const_iterator fit;
+    
+    fit = findFreeExtent(blocks);
+    if (fit == _freeBySize.end())
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    unsigned best = fit->second;
+    unsigned count = e->_lastBlock - e->_firstBlock;
+    
+    copyBlocks(e->_firstBlock, best, count);
+    sync();
+    
+    moveExtent(e->_firstBlock, best, count);
+    
+    e->_firstBlock = best;
+    e->_lastBlock = best + count;
+    
+    std::sort(_files.begin(), _files.end(), FileEntryLess);
+    
+    writeDirectory();
+    calcMaxFileSize();
+    
+    return 0;
+}
+
 
 /*
- * TODO -- consider trying to move files from the end to fill gaps
- * if it would reduce the number of blocks that need to be re-arranged.
- *
- * build a list of gaps, reverse iterate and move last file to first gap
- * only 77 files, so can consider all options.
- *
- *
- *
- *
- *
+ * returns the number of blocks krunch() would move, and the moves.
+ * If gaps isn't NULL, it's set to the number of free blocks which will
+ * be left in holes (files which can't be moved without copying them
+ * over themselves.)
  */
-int VolumeEntry::krunch()
+unsigned VolumeEntry::krunchPlan(std::vector<KrunchMove> &plan, unsigned *gaps) const
+{
+    std::vector<KrunchExtent> extents;
+    std::vector<KrunchMove> tmp;
+    unsigned best = 0;
+    unsigned bestGaps = 0;
+
+    std::vector<FileEntryPointer>::const_iterator iter;
+
+    for (iter = _files.begin(); iter != _files.end(); ++iter)
+    {
+        KrunchExtent e;
+
+        e.file = *iter;
+        e.first = (*iter)->_firstBlock;
+        e.blocks = (*iter)->_lastBlock - (*iter)->_firstBlock;
+        e.deferred = false;
+
+        extents.push_back(e);
+    }
+
+    unsigned modes[] = { kKrunchSlide, kKrunchFill, kKrunchDefer };
+
+    for (unsigned i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+    {
+        unsigned left;
+        unsigned moved = KrunchPlan(extents, _lastBlock, _lastVolumeBlock, modes[i], tmp, &left);
+
+        if (i == 0 || left < bestGaps || (left == bestGaps && moved < best))
+        {
+            best = moved;
+            bestGaps = left;
+            plan.swap(tmp);
+        }
+    }
+
+    if (gaps) *gaps = bestGaps;
+
+    return best;
+}
+
+
+/*
+ * Each move is committed before the next one starts: the data is copied
+ * into free space and synced, then the directory is updated and synced.
+ * Files are never copied over themselves, so an interrupted krunch
+ * leaves every file intact (at either its old or new location).  A file
+ * which can't be moved that way stays put, and the hole before it is
+ * left (see krunchPlan.)  Freed blocks are not zeroed.
+ */
+int VolumeEntry::krunch(unsigned *gaps)
 {
     unsigned prevBlock;
     
     std::vector<FileEntryPointer>::const_iterator iter;
     
-    bool gap = false;
-    
     // sanity check to make sure no weird overlap issues.
 
-    prevBlock = lastBlock();
+    prevBlock = _lastBlock;
     
     for (iter = _files.begin(); iter != _files.end(); ++iter)
     {
@@ -735,15 +1061,13 @@ int VolumeEntry::krunch()
         unsigned first = e->firstBlock();
         unsigned last = e->lastBlock();
         
-        if (first != prevBlock) gap = true;
-        
         if (first < prevBlock) 
             return ProDOS::damagedBitMap;
         
         if (last < first) 
             return ProDOS::damagedBitMap;
         
-        if (first < volumeBlocks()) 
+        if (last > volumeBlocks()) 
             return ProDOS::damagedBitMap;
         
         
@@ -751,59 +1075,33 @@ int VolumeEntry::krunch()
         
     }
 
+    std::vector<KrunchMove> plan;
+    std::vector<KrunchMove>::iterator move;
     
-    if (!gap) return 0;
-    
+    krunchPlan(plan, gaps);
     
-    // need to update the header blocks.
-    ::auto_array<uint8_t> buffer(readDirectoryHeader());
-    IOBuffer b(buffer.get(), 512 * blocks());
+    if (plan.empty()) return 0;
     
-
-    prevBlock = lastBlock();
-    
-    unsigned offset = 0;
-    for (iter = _files.begin(); iter != _files.end(); ++iter, ++offset)
+    for (move = plan.begin(); move != plan.end(); ++move)
     {
-        FileEntryPointer e = *iter;
-        
-        b.setOffset(0x1a + 0x1a * offset);
+        FileEntryPointer e = move->file;
         
-        unsigned first = e->firstBlock();
-        unsigned last = e->lastBlock();
+        if (e->_firstBlock != move->from)
+            return ProDOS::damagedBitMap;
         
-        unsigned blocks = last - first;
-        unsigned offset = first - prevBlock;
+        copyBlocks(move->from, move->to, move->blocks);
+        sync();
         
-        if (offset == 0)
-        {
-            prevBlock = last;
-            continue;
-        }
+        moveExtent(move->from, move->to, move->blocks);
         
-        e->_firstBlock = first - offset;
-        e->_lastBlock = last - offset;
+        e->_firstBlock = move->to;
+        e->_lastBlock = move->to + move->blocks;
         
-        e->writeDirectoryEntry(&b);
+        std::sort(_files.begin(), _files.end(), FileEntryLess);
         
-        for (unsigned i = 0; i < blocks; ++i)
-        {
-            uint8_t buffer[512];
-            
-            _cache->read(first + i, buffer);
-            _cache->write(prevBlock +i, buffer);
-            _cache->zeroBlock(first + i);
-        }
+        writeDirectory();
+        sync();
     }
-    
-    // now save the directory entries.
-
-    // load up the directory blocks.
-    writeDirectoryHeader(buffer.get());
-    
-    
-    _cache->sync();
-    
 
     calcMaxFileSize();
     
@@ -821,30 +1119,13 @@ int VolumeEntry::krunch()
  */
 unsigned VolumeEntry::freeBlocks(bool krunched) const
 {
-    unsigned freeBlocks = 0;
-    unsigned lastBlock = 0;
+    if (krunched) return _freeBlocks;
     
-    if (krunched)
-    {
-        std::vector<FileEntryPointer>::const_iterator iter;
-        
-        lastBlock = _lastBlock;
-        
-        for (iter = _files.begin(); iter != _files.end(); ++iter)
-        {
-            const FileEntryPointer e = *iter;
-            freeBlocks += e->_firstBlock - lastBlock;
-            lastBlock = e->_lastBlock;
-        }
-    }
-    else
-    {
-        lastBlock = _fileCount ? _files.back()->_lastBlock : _lastBlock;
-    }
-
+    if (_freeExtents.empty()) return 0;
+    
+    std::map<unsigned, unsigned>::const_reverse_iterator tail = _freeExtents.rbegin();
     
-    freeBlocks += _lastVolumeBlock - lastBlock;
-    return freeBlocks;
+    return tail->first + tail->second == _lastVolumeBlock ? tail->second : 0;
 }
 
 
@@ -855,19 +1136,12 @@ unsigned VolumeEntry::freeBlocks(bool krunched) const
  */
 bool VolumeEntry::canKrunch() const
 {
+    unsigned count = _freeExtents.size();
     
-    std::vector<FileEntryPointer>::const_iterator iter;
-    
-    unsigned lastBlock = _lastBlock;
-
-    for (iter = _files.begin(); iter != _files.end(); ++iter)
-    {
-        const FileEntryPointer e = *iter;
-        if (e->_lastBlock != lastBlock) return true;
-        lastBlock = e->_lastBlock;
-    }
+    // free space at the end doesn't count.
+    if (count && freeBlocks(false)) --count;
     
-    return false;
+    return count != 0;
 }
 
 /*
@@ -876,51 +1150,159 @@ bool VolumeEntry::canKrunch() const
  */
 unsigned VolumeEntry::maxContiguousBlocks() const
 {
-    unsigned max = 0;
-    
-    std::vector<FileEntryPointer>::const_iterator iter;
-    
-    unsigned lastBlock = _lastBlock;
+    std::set<std::pair<unsigned, unsigned> >::const_reverse_iterator iter;
     
-    for (iter = _files.begin(); iter != _files.end(); ++iter)
+    for (iter = _freeBySize.rbegin(); iter != _freeBySize.rend(); ++iter)
     {
-        const FileEntryPointer e = *iter;
-        unsigned free = e->_firstBlock - lastBlock;
-        max = std::max(max, free);
-        
-        lastBlock = e->_lastBlock;
+        if (!followsEncoder(iter->second)) return iter->first;
     }
     
-    max = std::max(max, _lastVolumeBlock - lastBlock);
-    
-    return max;    
-    
+    return 0;
 }
 
 
 
+// the block may be changed before it's unloaded.
 void *VolumeEntry::loadBlock(unsigned block)
 {
+    Locker locker(_cacheLock);
+    journalBlocks(block);
     return _cache->acquire(block);
 }
 void VolumeEntry::unloadBlock(unsigned block, bool dirty)
 {
+    Locker locker(_cacheLock);
     return _cache->release(block, dirty);
 }
 
 void VolumeEntry::readBlock(unsigned block, void *buffer)
 {
+    Locker locker(_cacheLock);
     _cache->read(block, buffer);
 }
 void VolumeEntry::writeBlock(unsigned block, void *buffer)
 {
+    Locker locker(_cacheLock);
+    journalBlocks(block);
     _cache->write(block, buffer);
 }
 
 
 void VolumeEntry::sync()
 {
+    flushDirectory();
+    
+    if (_batch) return;
+    
+    Locker locker(_cacheLock);
+    _cache->sync();
+}
+
+
+void VolumeEntry::beginBatch(bool journal)
+{
+    _batch = true;
+    _journaling = journal;
+    _journal.clear();
+}
+
+void VolumeEntry::endBatch()
+{
+    _batch = false;
+    sync();
+    
+    _journaling = false;
+    _journal.clear();
+}
+
+/*
+ * write back the saved blocks.  Pending directory changes are dropped
+ * but the in-memory directory is not reloaded.
+ */
+void VolumeEntry::rollback()
+{
+    std::vector<FileEntryPointer>::iterator iter;
+    std::map<unsigned, std::vector<uint8_t> >::iterator jiter;
+    
+    for (iter = _files.begin(); iter != _files.end(); ++iter)
+        (*iter)->_dirty = false;
+    
+    _dirtyFirst = _dirtyLast = 0;
+    
+    Locker locker(_cacheLock);
+    
+    for (jiter = _journal.begin(); jiter != _journal.end(); ++jiter)
+        _cache->write(jiter->first, &jiter->second[0]);
+    
     _cache->sync();
+    
+    _batch = _journaling = false;
+    _journal.clear();
+}
+
+// save blocks before they are first changed.  _cacheLock must be held.
+void VolumeEntry::journalBlocks(unsigned block, unsigned count)
+{
+    if (!_journaling) return;
+    
+    for (unsigned i = 0; i < count; ++i)
+    {
+        std::vector<uint8_t> &saved = _journal[block + i];
+        
+        if (!saved.empty()) continue;
+        
+        saved.resize(512);
+        _cache->read(block + i, &saved[0]);
+    }
+}
+
+
+void VolumeEntry::markDirectory(unsigned offset, unsigned length)
+{
+    if (!length) return;
+    
+    if (_dirtyFirst == _dirtyLast)
+    {
+        _dirtyFirst = offset;
+        _dirtyLast = offset + length;
+        return;
+    }
+    
+    _dirtyFirst = std::min(_dirtyFirst, offset);
+    _dirtyLast = std::max(_dirtyLast, offset + length);
+}
+
+/*
+ * write any pending file entries, then the changed directory blocks
+ * (to the cache.)
+ */
+void VolumeEntry::flushDirectory()
+{
+    std::vector<FileEntryPointer>::iterator iter;
+    
+    for (iter = _files.begin(); iter != _files.end(); ++iter)
+    {
+        FileEntryPointer e = *iter;
+        
+        if (!e->_dirty) continue;
+        
+        e->_dirty = false;
+        writeEntry(e.get());
+    }
+    
+    if (_dirtyFirst == _dirtyLast) return;
+    
+    unsigned first = _dirtyFirst / 512;
+    unsigned last = (_dirtyLast - 1) / 512;
+    
+    Locker locker(_cacheLock);
+    
+    journalBlocks(2 + first, last - first + 1);
+    
+    for (unsigned i = first; i <= last; ++i)
+        _cache->write(2 + i, &_directory[i * 512]);
+    
+    _dirtyFirst = _dirtyLast = 0;
 }
 
 void VolumeEntry::writeDirectoryEntry(IOBuffer *b)
@@ -941,72 +1323,248 @@ void VolumeEntry::writeDirectoryEntry(IOBuffer *b)
 
 
 
-uint8_t *VolumeEntry::readDirectoryHeader()
+// copy a run of blocks.  The runs may overlap.
+void VolumeEntry::copyBlocks(unsigned from, unsigned to, unsigned count)
+{
+    Locker locker(_cacheLock);
+    
+    journalBlocks(to, count);
+    
+    _cache->copyBlocks(from, to, count);
+}
+
+
+// rewrite the header and all file entries (in _files order).  does not sync.
+void VolumeEntry::writeDirectory()
+{
+    std::vector<FileEntryPointer>::iterator iter;
+    unsigned address = 2 * 512 + 0x1a;
+    
+    writeEntry();
+    
+    for (iter = _files.begin(); iter != _files.end(); ++iter, address += 0x1a)
+    {
+        FileEntryPointer e = *iter;
+        
+        e->_address = address;
+        writeEntry(e.get());
+    }
+}
+
+
+// write directory entry, does not sync.
+void VolumeEntry::writeEntry()
+{
+    IOBuffer iob(&_directory[0], 0x1a);
+    writeDirectoryEntry(&iob);
+    
+    markDirectory(0, 0x1a);
+}
+
+// does not sync.
+void VolumeEntry::writeEntry(FileEntry *e)
 {
-    return readBlocks(2, blocks());
+    unsigned offset = e->_address - 2 * 512;
+    
+    IOBuffer b(&_directory[offset], 0x1a);
+    e->writeDirectoryEntry(&b);
+    
+    markDirectory(offset, 0x1a);
 }
 
-void VolumeEntry::writeDirectoryHeader(void *buffer)
+
+// true if the extent starting at block is right after a file being encoded.
+bool VolumeEntry::followsEncoder(unsigned block) const
 {
-    writeBlocks(buffer, 2, blocks());
+    std::vector<FileEntryPointer>::const_iterator iter;
+    
+    iter = std::lower_bound(_files.begin(), _files.end(), block, FileEntryBefore);
+    
+    if (iter == _files.begin()) return false;
+    
+    return iter[-1]->_encoding && iter[-1]->_lastBlock == block;
+}
+
+// the smallest free extent of at least blocks, or _freeBySize.end().
+std::set<std::pair<unsigned, unsigned> >::const_iterator VolumeEntry::findFreeExtent(unsigned blocks) const
+{
+    std::set<std::pair<unsigned, unsigned> >::const_iterator iter;
+    
+    for (iter = _freeBySize.lower_bound(std::make_pair(blocks, 0u)); iter != _freeBySize.end(); ++iter)
+    {
+        if (!followsEncoder(iter->second)) break;
+    }
+    
+    return iter;
 }
 
 
-uint8_t *VolumeEntry::readBlocks(unsigned startingBlock, unsigned count)
+/*
+ * free extents.  These are updated as files are created, removed,
+ * resized or moved.  Blocks 0 .. _lastBlock (boot blocks and the
+ * directory) are never free.
+ */
+void VolumeEntry::rebuildFreeExtents()
 {
-    ::auto_array<uint8_t> buffer(new uint8_t[512 * count]);
+    std::vector<FileEntryPointer>::iterator iter;
+    unsigned block = _lastBlock;
+    
+    _freeExtents.clear();
+    _freeBySize.clear();
+    _freeBlocks = 0;
+    
+    for (iter = _files.begin(); iter != _files.end(); ++iter)
+    {
+        FileEntryPointer e = *iter;
         
-    for (unsigned i = 0; i < count; ++i)
-        _cache->read(startingBlock + i, buffer.get() + 512 * i);
+        insertFreeExtent(block, e->_firstBlock - block);
+        block = e->_lastBlock;
+    }
     
-    return buffer.release();
+    insertFreeExtent(block, _lastVolumeBlock - block);
 }
 
+void VolumeEntry::insertFreeExtent(unsigned first, unsigned count)
+{
+    if (!count) return;
+    
+    _freeExtents[first] = count;
+    _freeBySize.insert(std::make_pair(count, first));
+    _freeBlocks += count;
+}
 
-void VolumeEntry::writeBlocks(void *buffer, unsigned startingBlock, unsigned count)
+void VolumeEntry::eraseFreeExtent(std::map<unsigned, unsigned>::iterator iter)
 {
-    for (unsigned i = 0; i < count; ++i)
-        _cache->write(startingBlock + i, (uint8_t *)buffer + 512 * i);
+    _freeBySize.erase(std::make_pair(iter->second, iter->first));
+    _freeBlocks -= iter->second;
+    _freeExtents.erase(iter);
 }
 
+// blocks first .. last are now in use (they must be in a single free extent.)
+void VolumeEntry::allocateExtent(unsigned first, unsigned last)
+{
+#undef __METHOD__
+#define __METHOD__ "VolumeEntry::allocateExtent"
 
-// write directory entry, does not sync.
-void VolumeEntry::writeEntry()
+    std::map<unsigned, unsigned>::iterator iter;
+    
+    if (first >= last) return;
+    
+    iter = _freeExtents.upper_bound(first);
+    if (iter == _freeExtents.begin())
+        throw ::Exception(__METHOD__ ": Blocks not free.");
+    
+    --iter;
+    
+    unsigned start = iter->first;
+    unsigned end = start + iter->second;
+    
+    if (last > end)
+        throw ::Exception(__METHOD__ ": Blocks not free.");
+    
+    eraseFreeExtent(iter);
+    insertFreeExtent(start, first - start);
+    insertFreeExtent(last, end - last);
+}
+
+// blocks first .. last are now free (merged with any adjacent extents.)
+void VolumeEntry::releaseExtent(unsigned first, unsigned last)
 {
-    IOBuffer iob(loadBlock(2),512);
-    writeDirectoryEntry(&iob);
-    unloadBlock(2, true);
+    std::map<unsigned, unsigned>::iterator iter;
+    
+    if (first >= last) return;
+    
+    iter = _freeExtents.find(last);
+    if (iter != _freeExtents.end())
+    {
+        last += iter->second;
+        eraseFreeExtent(iter);
+    }
+    
+    iter = _freeExtents.lower_bound(first);
+    if (iter != _freeExtents.begin())
+    {
+        --iter;
+        if (iter->first + iter->second == first)
+        {
+            first = iter->first;
+            eraseFreeExtent(iter);
+        }
+    }
+    
+    insertFreeExtent(first, last - first);
 }
 
-// does not sync.
-void VolumeEntry::writeEntry(FileEntry *e)
+// a file's last block moved from oldLast to newLast.
+void VolumeEntry::resizeExtent(unsigned oldLast, unsigned newLast)
+{
+    if (newLast > oldLast) allocateExtent(oldLast, newLast);
+    else releaseExtent(newLast, oldLast);
+}
+
+void VolumeEntry::moveExtent(unsigned from, unsigned to, unsigned count)
+{
+    // release first; the new location may overlap the old one.
+    releaseExtent(from, from + count);
+    allocateExtent(to, to + count);
+}
+
+
+/*
+ * the name index is at least twice the maximum number of files, so
+ * probe sequences are short and there is always an empty slot.
+ */
+void VolumeEntry::rebuildNameIndex()
 {
-    unsigned address = e->_address;
-    unsigned startBlock = address / 512;
-    unsigned endBlock = (address + 0x1a - 1) / 512;
-    unsigned offset = address % 512;
+    std::vector<FileEntryPointer>::iterator iter;
+    unsigned size = 128;
     
-    if (startBlock == endBlock)
+    while (size < 2 * std::max((unsigned)kMaxFiles, _fileCount)) size <<= 1;
+    
+    _nameIndex.clear();
+    _nameIndex.resize(size);
+    
+    for (iter = _files.begin(); iter != _files.end(); ++iter)
+        insertName(*iter);
+}
+
+void VolumeEntry::insertName(FileEntryPointer e)
+{
+    unsigned hash = NameHash(e->name());
+    unsigned mask = _nameIndex.size() - 1;
+    unsigned i;
+    
+    for (i = hash & mask; _nameIndex[i].file; i = (i + 1) & mask) ;
+    
+    _nameIndex[i].hash = hash;
+    _nameIndex[i].file = e;
+}
+
+// remove e, then shift back any entries which probed past it.
+void VolumeEntry::eraseName(FileEntry *e)
+{
+    unsigned mask = _nameIndex.size() - 1;
+    unsigned i, j;
+    
+    for (i = NameHash(e->name()) & mask; _nameIndex[i].file; i = (i + 1) & mask)
     {
-        void *buffer = _cache->acquire(startBlock);
-        
-        IOBuffer b((uint8_t *)buffer + offset, 0x1a);
-        
-        e->writeDirectoryEntry(&b);
-        
-        _cache->release(startBlock, true);
+        if (_nameIndex[i].file.get() == e) break;
     }
-    else
+    
+    if (!_nameIndex[i].file) return;
+    
+    for (j = (i + 1) & mask; _nameIndex[j].file; j = (j + 1) & mask)
     {
-        // crosses page boundaries.
-        ::auto_array<uint8_t> buffer(readBlocks(startBlock, 2));
-        
-        IOBuffer b(buffer.get() + offset, 0x1a);
+        unsigned k = _nameIndex[j].hash & mask;
         
-        e->writeDirectoryEntry(&b);        
+        // k (the home slot) is cyclically in (i, j] -- leave it.
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
         
-        writeBlocks(buffer.get(), startBlock, 2);
+        _nameIndex[i] = _nameIndex[j];
+        i = j;
     }
+    
+    _nameIndex[i].file.reset();
 }
 
 
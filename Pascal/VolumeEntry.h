@@ -4,9 +4,13 @@
 #include <Pascal/Entry.h>
 
 #include <vector>
+#include <map>
+#include <set>
 
 #include <Device/BlockDevice.h>
 
+#include <Common/Lock.h>
+
 namespace Pascal {
 
     
@@ -18,6 +22,9 @@ namespace Pascal {
     
         static VolumeEntryPointer Open(Device::BlockDevicePointer);
         static VolumeEntryPointer Create(Device::BlockDevicePointer, const char *name);
+        
+        // the directory (blocks 2-5, 2048 bytes) of a new, empty volume.
+        static void Format(void *bp, unsigned blocks, const char *name);
 
         //
         
@@ -46,6 +53,15 @@ namespace Pascal {
 
         void sync();
         
+        // batch updates.  Until endBatch(), sync() only writes the 
+        // directory to the cache.  With a journal, each block is saved
+        // before it is first changed so rollback() can restore it.
+        void beginBatch(bool journal = false);
+        void endBatch();
+        
+        // the volume must be re-opened after a rollback.
+        void rollback();
+        
         bool readOnly() { return _device->readOnly(); }
 
         int unlink(const char *name);
@@ -53,8 +69,31 @@ namespace Pascal {
         int copy(const char *oldName, const char *newName);
         FileEntryPointer create(const char *name, unsigned blocks);
         
+        // move a file (if needed) so it can grow to size bytes.
+        int reserve(FileEntry *file, unsigned size);
+        
+        // import native text (one pass, directly into the volume.)
+        struct TextImport {
+            const char *name;
+            const void *data;
+            size_t length;
+            int error; // errno, or 0 on success.
+        };
         
-        int krunch();
+        FileEntryPointer importText(const char *name, const void *data, size_t length);
+        unsigned importText(std::vector<TextImport> &files);
+        
+        
+        // a krunch step: move blocks from -> to.
+        struct KrunchMove {
+            FileEntryPointer file;
+            unsigned from;
+            unsigned to;
+            unsigned blocks;
+        };
+        
+        unsigned krunchPlan(std::vector<KrunchMove> &plan, unsigned *gaps = NULL) const;
+        int krunch(unsigned *gaps = NULL);
 
         VolumeEntry(Device::BlockDevicePointer, const char *name);
         VolumeEntry(Device::BlockDevicePointer);
@@ -65,6 +104,7 @@ namespace Pascal {
     private:
         
         friend class FileEntry;
+        friend class TextEncoder;
 
         
         VolumeEntry();
@@ -76,22 +116,44 @@ namespace Pascal {
         }
                 
         void init(void *);
+        void init(const char *name, unsigned blocks);
         void setParents();
         
 
         
         
-        uint8_t *readDirectoryHeader();
-        void writeDirectoryHeader(void *);
+        void copyBlocks(unsigned from, unsigned to, unsigned count);
         
-        uint8_t *readBlocks(unsigned startingBlock, unsigned count);
-        void writeBlocks(void *buffer, unsigned startingBlock, unsigned count);
+        void writeDirectory();
         
         void writeEntry(FileEntry *e);
         void writeEntry();
         
+        void markDirectory(unsigned offset, unsigned length);
+        void flushDirectory();
+        
+        void journalBlocks(unsigned block, unsigned count = 1);
+        
         void calcMaxFileSize();
         
+        std::set<std::pair<unsigned, unsigned> >::const_iterator findFreeExtent(unsigned blocks) const;
+        bool followsEncoder(unsigned block) const;
+        
+        void rebuildFreeExtents();
+        void insertFreeExtent(unsigned first, unsigned count);
+        void eraseFreeExtent(std::map<unsigned, unsigned>::iterator iter);
+        void allocateExtent(unsigned first, unsigned last);
+        void releaseExtent(unsigned first, unsigned last);
+        void resizeExtent(unsigned oldLast, unsigned newLast);
+        void moveExtent(unsigned from, unsigned to, unsigned count);
+        
+        void rebuildNameIndex();
+        void insertName(FileEntryPointer e);
+        void eraseName(FileEntry *e);
+        
+        FileEntryPointer createEntry(const char *name, unsigned blocks);
+        FileEntryPointer importTextEntry(const char *name, const void *data, size_t length);
+        
         
         unsigned _fileNameLength;
         char _fileName[8];
@@ -103,8 +165,34 @@ namespace Pascal {
         std::vector<FileEntryPointer> _files;
         unsigned _inodeGenerator;
         
+        // free extents by position (first -> count) and by
+        // size (count, first) for best fit and the largest gap.
+        std::map<unsigned, unsigned> _freeExtents;
+        std::set<std::pair<unsigned, unsigned> > _freeBySize;
+        unsigned _freeBlocks;
+        
+        // case insensitive name index (open addressing, linear probing.)
+        struct NameSlot {
+            unsigned hash;
+            FileEntryPointer file;
+        };
+        std::vector<NameSlot> _nameIndex;
+        
+        // directory blocks (2 .. _lastBlock) and the changed range.
+        std::vector<uint8_t> _directory;
+        unsigned _dirtyFirst;
+        unsigned _dirtyLast;
+        
         Device::BlockDevicePointer _device;
         Device::BlockCachePointer _cache;
+        
+        // the block cache is not thread safe (text files may be
+        // indexed in the background.)
+        Lock _cacheLock;
+        
+        bool _batch;
+        bool _journaling;
+        std::map<unsigned, std::vector<uint8_t> > _journal;
     };
 
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 
 #include <ProDOS/Bitmap.h>
@@ -6,15 +7,21 @@
 
 using namespace ProDOS;
 
-// returns # of 1-bits set (0-8)
-inline static unsigned popCount(uint8_t x)
+enum {
+    // words (and blocks) per run group.
+    kRunWords = 8,
+    kRunBlocks = kRunWords * 64
+};
+
+// returns # of 1-bits set (0-64)
+inline static unsigned popCount(uint64_t x)
 {
     #ifdef __GNUC__
-    return __builtin_popcount(x);
+    return __builtin_popcountll(x);
     #endif
-    
+
     // Brian Kernighan / Peter Wegner in CACM 3 (1960), 322.
-    
+
     unsigned count;
     for (count = 0; x; ++count)
     {
@@ -23,32 +30,89 @@ inline static unsigned popCount(uint8_t x)
     return count;
 }
 
+// returns the index of the lowest 1-bit.  x must not be 0.
+inline static unsigned countTrailingZeros(uint64_t x)
+{
+    #ifdef __GNUC__
+    return __builtin_ctzll(x);
+    #endif
+
+    unsigned count = 0;
+    while (!(x & 1))
+    {
+        x >>= 1;
+        ++count;
+    }
+    return count;
+}
+
+// returns the index of the highest 1-bit, counted from bit 63.  x must not be 0.
+inline static unsigned countLeadingZeros(uint64_t x)
+{
+    #ifdef __GNUC__
+    return __builtin_clzll(x);
+    #endif
+
+    unsigned count = 0;
+    while (!(x & ((uint64_t)1 << 63)))
+    {
+        x <<= 1;
+        ++count;
+    }
+    return count;
+}
+
+// returns the length of the longest run of 1-bits (0-64).
+inline static unsigned longestRun(uint64_t x)
+{
+    // each pass shortens every run by one.
+    unsigned count;
+    for (count = 0; x; ++count)
+    {
+        x &= x >> 1;
+    }
+    return count;
+}
+
+// the on-disk bitmap is msb first.
+static uint8_t ReverseBits[256];
+
+static bool InitReverseBits()
+{
+    for (unsigned i = 0; i < 256; ++i)
+    {
+        unsigned x = 0;
+        for (unsigned bit = 0; bit < 8; ++bit)
+        {
+            if (i & (1 << bit)) x |= 0x80 >> bit;
+        }
+        ReverseBits[i] = x;
+    }
+    return true;
+}
+
+static bool ReverseBitsInitialized = InitReverseBits();
+
 
 
 Bitmap::Bitmap(unsigned blocks)
 {
     _blocks = _freeBlocks = blocks;
-    
+
     _bitmapBlocks = (blocks + 4095) / 4096;
     _freeIndex = 0;
-    
-    unsigned bitmapSize = _bitmapBlocks * 512;
-    
-    _bitmap.reserve(bitmapSize);
-    
-    // mark blocks as free.. 
-    _bitmap.resize(blocks / 8, 0xff);
-    
-    // edge case...
-    
-    if (blocks & 0x0f)
-    {
-        _bitmap.push_back( ~(0xff >> (blocks & 0x0f)) );
-    }
-    
+    _runIndex = 0;
+
+    // mark blocks as free..
+    _bitmap.resize((blocks + 63) / 64, ~(uint64_t)0);
+
     // mark any trailing blocks as in use.
-    
-    _bitmap.resize(bitmapSize, 0x00);  
+    if (blocks & 0x3f)
+    {
+        _bitmap.back() = ((uint64_t)1 << (blocks & 0x3f)) - 1;
+    }
+
+    rebuild();
 }
 
 Bitmap::Bitmap(Device::BlockCache *cache, unsigned keyPointer, unsigned blocks)
@@ -56,70 +120,28 @@ Bitmap::Bitmap(Device::BlockCache *cache, unsigned keyPointer, unsigned blocks)
     _blocks = blocks;
     _freeBlocks = 0;
     _freeIndex = 0;
-    
+    _runIndex = 0;
+
     _bitmapBlocks = (blocks + 4095) / 4096;
 
-    unsigned bitmapSize = _bitmapBlocks * 512;
-    unsigned blockSize = blocks / 8;
-    
-    _bitmap.reserve(bitmapSize);
-    
-
-    // load the full block(s).
-    for (unsigned i = 0; i < blockSize; ++i)
-    {
-        uint8_t *buffer = (uint8_t *)cache->acquire(keyPointer);
-        
-        _bitmap.insert(_bitmap.end(), buffer, buffer + 512);
-        
-        cache->release(keyPointer);
-        
-        keyPointer++;
-    }
-    
-    // and any remaining partial block.
-    
-    if (blocks & 4095)
-    {
-
-        uint8_t *buffer = (uint8_t *)cache->acquire(keyPointer);
-
-        unsigned bits = blocks & 4095;
-        unsigned bytes = bits / 8;
-                
-        //for (unsigned i = 0; i < bits / 8; ++i) _bitmap.push_back(buffer[i]);
-        
-        _bitmap.insert(_bitmap.end(), buffer, buffer + bytes);
-        // partial...
-        
-        if (blocks & 0x0f)
-        {
-            uint8_t tmp = buffer[bytes];
-            tmp &= ~(0xff >> (blocks & 0x0f));
-            
-            _bitmap.push_back(tmp);
-        }
-        
-        // remainder set to in use.
-        _bitmap.resize(bitmapSize, 0x00);
+    _bitmap.resize((blocks + 63) / 64, 0);
+
+    for (unsigned i = 0; i < _bitmapBlocks; ++i)
+    {
+        uint8_t *buffer = (uint8_t *)cache->acquire(keyPointer + i);
 
-        cache->release(keyPointer);
-        
-        keyPointer++;        
-        
+        load(buffer, i * 512, 512);
+
+        cache->release(keyPointer + i);
     }
-    
-    
-    // now set _freeBlocks and _freeIndex;
-    std::vector<uint8_t>::iterator iter;
-    
-    _freeIndex = -1;
-    for (iter = _bitmap.begin(); iter != _bitmap.end(); ++iter)
+
+    // trailing bits beyond the volume are in use.
+    if (blocks & 0x3f)
     {
-        _freeBlocks += popCount(*iter);
-        if (_freeIndex == -1 && *iter) 
-            _freeIndex = std::distance(_bitmap.begin(), iter); 
+        _bitmap.back() &= ((uint64_t)1 << (blocks & 0x3f)) - 1;
     }
+
+    rebuild();
 }
 
 Bitmap::~Bitmap()
@@ -127,93 +149,316 @@ Bitmap::~Bitmap()
 }
 
 
-void Bitmap::freeBlock(unsigned block)
+void Bitmap::load(const uint8_t *buffer, unsigned offset, unsigned bytes)
 {
-    if (block >= _blocks) return;
-    
-    unsigned index = block / 8;
-    unsigned offset = block & 0x07;
-    unsigned mask = 0x80 >> offset;
-    
-    uint8_t tmp = _bitmap[index];
-    
-    if ((tmp & mask) == 0)
+    unsigned maxBytes = _bitmap.size() * 8;
+
+    for (unsigned i = 0; i < bytes && offset + i < maxBytes; ++i)
     {
-        ++_freeBlocks;
-        _bitmap[index] = tmp | mask;
+        unsigned index = offset + i;
+
+        _bitmap[index / 8] |= (uint64_t)ReverseBits[buffer[i]] << ((index & 0x07) * 8);
     }
 }
 
 
-int Bitmap::allocBlock(unsigned block)
+// recalculate the summary level, runs, free count and free index.
+void Bitmap::rebuild()
+{
+    _summary.clear();
+    _summary.resize((_bitmap.size() + 63) / 64, 0);
+
+    Run run = { 0, 0, 0, true };
+
+    _runs.clear();
+    _runs.resize((_bitmap.size() + kRunWords - 1) / kRunWords, run);
+    _runIndex = 0;
+
+    _freeBlocks = 0;
+
+    for (unsigned i = 0; i < _bitmap.size(); ++i)
+    {
+        uint64_t word = _bitmap[i];
+
+        if (!word) continue;
+
+        _freeBlocks += popCount(word);
+        _summary[i / 64] |= (uint64_t)1 << (i & 0x3f);
+    }
+
+    int block = findFree(0);
+    _freeIndex = block < 0 ? 0 : block;
+}
+
+
+void Bitmap::bitmap(void *buffer) const
+{
+    uint8_t *cp = (uint8_t *)buffer;
+    unsigned size = bitmapSize();
+    unsigned maxBytes = _bitmap.size() * 8;
+
+    for (unsigned i = 0; i < size; ++i)
+    {
+        if (i >= maxBytes)
+        {
+            cp[i] = 0;
+            continue;
+        }
+
+        cp[i] = ReverseBits[(_bitmap[i / 8] >> ((i & 0x07) * 8)) & 0xff];
+    }
+}
+
+void Bitmap::store(Device::BlockCache *cache, unsigned keyPointer) const
+{
+    std::vector<uint8_t> buffer(bitmapSize());
+
+    bitmap(&buffer[0]);
+
+    for (unsigned i = 0; i < _bitmapBlocks; ++i)
+    {
+        cache->write(keyPointer + i, &buffer[i * 512]);
+    }
+}
+
+
+void Bitmap::clearBit(unsigned block)
+{
+    unsigned index = block / 64;
+
+    _bitmap[index] &= ~((uint64_t)1 << (block & 0x3f));
+    _runs[index / kRunWords].dirty = true;
+
+    if (!_bitmap[index])
+        _summary[index / 64] &= ~((uint64_t)1 << (index & 0x3f));
+}
+
+void Bitmap::setBit(unsigned block)
+{
+    unsigned index = block / 64;
+
+    _bitmap[index] |= (uint64_t)1 << (block & 0x3f);
+    _summary[index / 64] |= (uint64_t)1 << (index & 0x3f);
+    _runs[index / kRunWords].dirty = true;
+}
+
+
+// returns the first free block >= block, or -1.
+int Bitmap::findFree(unsigned block) const
 {
     if (block >= _blocks) return -1;
-    
-    
-    unsigned index = block / 8;
-    unsigned offset = block & 0x07;
-    unsigned mask = 0x80 >> offset;
-    
-    uint8_t tmp = _bitmap[index];
-    
-    if ((tmp & mask))
+
+    unsigned index = block / 64;
+    uint64_t word = _bitmap[index] & (~(uint64_t)0 << (block & 0x3f));
+
+    if (word) return index * 64 + countTrailingZeros(word);
+
+    // check the summary for the next word with a free block.
+    ++index;
+    if (index >= _bitmap.size()) return -1;
+
+    unsigned s = index / 64;
+    uint64_t summary = _summary[s] & (~(uint64_t)0 << (index & 0x3f));
+
+    for (;;)
     {
-        --_freeBlocks;
-        _bitmap[index] = tmp & ~mask;
-        return block;
+        if (summary)
+        {
+            index = s * 64 + countTrailingZeros(summary);
+            return index * 64 + countTrailingZeros(_bitmap[index]);
+        }
+
+        if (++s >= _summary.size()) return -1;
+        summary = _summary[s];
     }
-    
-    return -1;
 }
 
+// returns the first used block >= block (or blocks())
+unsigned Bitmap::findUsed(unsigned block) const
+{
+    if (block >= _blocks) return _blocks;
 
-int Bitmap::allocBlock()
+    unsigned index = block / 64;
+    uint64_t word = ~_bitmap[index] & (~(uint64_t)0 << (block & 0x3f));
+
+    while (!word)
+    {
+        if (++index >= _bitmap.size()) return _blocks;
+        word = ~_bitmap[index];
+    }
+
+    block = index * 64 + countTrailingZeros(word);
+
+    return block < _blocks ? block : _blocks;
+}
+
+
+// recalculate the runs of a group.  Blocks past the end of
+// the volume are in use, so they end the runs of the last group.
+void Bitmap::updateRun(unsigned group)
 {
-    if (!_freeBlocks) return -1;
-    
-    unsigned freeIndex = _freeIndex;
-    unsigned maxIndex = (_blocks + 7) / 8;
+    Run &r = _runs[group];
+
+    unsigned first = group * kRunWords;
+    unsigned last = std::min(first + kRunWords, (unsigned)_bitmap.size());
+
+    // free blocks up to the end of the previous word.
+    unsigned run = 0;
+    bool head = true;
 
+    r.longest = 0;
 
-    for (unsigned index = _freeIndex; index < maxIndex; ++index)
+    for (unsigned i = first; i < last; ++i)
     {
-        uint8_t tmp = _bitmap[index];
-        if (!tmp) continue;
-        
-        unsigned mask = 0x80;
-        for (unsigned offset = 0; offset < 8; ++offset)
+        uint64_t word = _bitmap[i];
+
+        if (word == ~(uint64_t)0)
         {
-            if (tmp & mask)
-            {
-                _freeIndex = index;
-                _bitmap[index] = tmp & ~mask;
-                --_freeBlocks;
-                return index * 8 + offset;
-            }
-            mask = mask >> 1;
+            run += 64;
+            continue;
         }
+
+        run += countTrailingZeros(~word);
+
+        if (head) r.head = run;
+        head = false;
+
+        r.longest = std::max(r.longest, run);
+
+        // a word can't hold a run longer than its free blocks.
+        if (popCount(word) > r.longest)
+            r.longest = std::max(r.longest, longestRun(word));
+
+        run = countLeadingZeros(~word);
     }
 
-    for (unsigned index = 0; index < freeIndex; ++index)
+    if (head) r.head = run;
+
+    r.tail = run;
+    r.longest = std::max(r.longest, run);
+    r.dirty = false;
+}
+
+/*
+ * returns the first block of the first run of count free blocks
+ * starting at or after block (or a little before, if block is in a
+ * free run), or -1.  Groups are skipped unless the run fits inside or
+ * ends in them.
+ */
+int Bitmap::findRun(unsigned block, unsigned count)
+{
+    // free blocks up to the end of the previous group.
+    unsigned carry = 0;
+
+    for (unsigned g = block / kRunBlocks; g < _runs.size(); ++g)
     {
-        uint8_t tmp = _bitmap[index];
-        if (!tmp) continue;
-        
-        unsigned mask = 0x80;
-        for (unsigned offset = 0; offset < 8; ++offset)
+        if (_runs[g].dirty) updateRun(g);
+
+        const Run &r = _runs[g];
+
+        unsigned start = std::max(g * kRunBlocks, block);
+        unsigned end = (g + 1) * kRunBlocks;
+
+        if (start == g * kRunBlocks && carry + r.head >= count) return start - carry;
+
+        if (r.longest >= count)
         {
-            if (tmp & mask)
+            while (start < end)
             {
-                _freeIndex = index;
-                _bitmap[index] = tmp & ~mask;
-                --_freeBlocks;
-                return index * 8 + offset;
+                int first = findFree(start);
+                if (first < 0 || (unsigned)first >= end) break;
+
+                unsigned last = findUsed(first);
+
+                if (last - first >= count) return first;
+
+                start = last;
             }
-            mask = mask >> 1;
         }
+
+        if (r.head == std::min(end, (unsigned)_bitmap.size() * 64) - g * kRunBlocks) carry += r.head;
+        else carry = r.tail;
     }
 
-    
-    // should never happen...
     return -1;
-}
\ No newline at end of file
+}
+
+
+bool Bitmap::isFree(unsigned block) const
+{
+    if (block >= _blocks) return false;
+
+    return (_bitmap[block / 64] >> (block & 0x3f)) & 1;
+}
+
+
+void Bitmap::freeBlock(unsigned block)
+{
+    if (block >= _blocks) return;
+
+    if (!isFree(block))
+    {
+        ++_freeBlocks;
+        setBit(block);
+
+        if (block < _freeIndex) _freeIndex = block;
+        if (block < _runIndex) _runIndex = block;
+    }
+}
+
+
+int Bitmap::allocBlock(unsigned block)
+{
+    if (block >= _blocks) return -1;
+
+    if (isFree(block))
+    {
+        --_freeBlocks;
+        clearBit(block);
+        return block;
+    }
+
+    return -1;
+}
+
+
+int Bitmap::allocBlock()
+{
+    if (!_freeBlocks) return -1;
+
+    int block = findFree(_freeIndex);
+    if (block < 0) block = findFree(0);
+
+    // should never happen...
+    if (block < 0) return -1;
+
+    clearBit(block);
+    --_freeBlocks;
+    _freeIndex = block;
+
+    return block;
+}
+
+
+/*
+ * first fit, starting at the last run (like allocBlock) and wrapping
+ * around.  Only groups which can hold the run are scanned.
+ */
+int Bitmap::allocRun(unsigned count)
+{
+    if (count == 0 || count > _freeBlocks) return -1;
+    if (count == 1) return allocBlock();
+
+    int first = findRun(_runIndex, count);
+    if (first < 0 && _runIndex) first = findRun(0, count);
+
+    if (first < 0) return -1;
+
+    for (unsigned i = 0; i < count; ++i)
+        clearBit(first + i);
+
+    _freeBlocks -= count;
+    _runIndex = first;
+
+    return first;
+}
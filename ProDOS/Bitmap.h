@@ -14,6 +14,18 @@ namespace Device
 
 namespace ProDOS {
 
+/*
+ * The volume bitmap.
+ *
+ * Held as 64-bit words (bit n of word w is block w * 64 + n, 1 = free)
+ * rather than the on-disk msb-first bytes.  A summary level has a bit
+ * set for each word with at least one free block, so searches skip full
+ * regions 4096 blocks at a time.
+ *
+ * Each 512 block group also has its free run at the start and end and
+ * its longest free run (recalculated when the group has changed), so
+ * allocRun only looks inside groups which can hold the run.
+ */
 
 class Bitmap {
 public:
@@ -26,24 +38,53 @@ public:
     int allocBlock();
     int allocBlock(unsigned block);
     
+    // allocate count contiguous blocks; returns the first block or -1.
+    int allocRun(unsigned count);
+    
     void freeBlock(unsigned block);
     
+    bool isFree(unsigned block) const;
+    
     
     unsigned freeBlocks() const { return _freeBlocks; }
     unsigned blocks() const { return _blocks; }
     unsigned bitmapBlocks() const { return _bitmapBlocks; }
     unsigned bitmapSize() const { return _bitmapBlocks * 512; }
-    const void *bitmap() const { return &_bitmap[0]; }
+    
+    // on-disk format.
+    void bitmap(void *buffer) const;
+    void store(Device::BlockCache *cache, unsigned keyPointer) const;
 
 private:
 
+    void load(const uint8_t *buffer, unsigned offset, unsigned bytes);
+    void rebuild();
+    
+    int findFree(unsigned block) const;
+    unsigned findUsed(unsigned block) const;
+    int findRun(unsigned block, unsigned count);
+    void updateRun(unsigned group);
+    
+    void clearBit(unsigned block);
+    void setBit(unsigned block);
+
+    struct Run {
+        unsigned head;
+        unsigned tail;
+        unsigned longest;
+        bool dirty;
+    };
+
     unsigned _freeIndex;
+    unsigned _runIndex;
     unsigned _freeBlocks;
     
     unsigned _blocks;
     unsigned _bitmapBlocks;
     
-    std::vector<uint8_t> _bitmap;
+    std::vector<uint64_t> _bitmap;
+    std::vector<uint64_t> _summary;
+    std::vector<Run> _runs;
 };
 
 
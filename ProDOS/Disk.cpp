@@ -20,40 +20,45 @@
 #include <cstring>
 
 #include <algorithm>
-#include <set>
 #include <vector>
 
 #include <Endian/Endian.h>
 
-struct ucmp
-{
-    bool operator()(unsigned a, unsigned b) const
-    {
-        return a < b;
-    }
-};
+#include <ProDOS/Bitmap.h>
 
-using std::set;
 using std::vector;
 
 using namespace LittleEndian;
-
-typedef set<unsigned, ucmp> uset;
+using ProDOS::VisitedSet;
 
 Disk::Disk()
 {
     _blocks = 0;
-
+    _bitmap = NULL;
+    _bitmapPointer = 0;
 }
 
 Disk::~Disk()
 {
+    std::vector<VisitedSet *>::iterator iter;
+    
+    for (iter = _visitedPool.begin(); iter != _visitedPool.end(); ++iter)
+        delete *iter;
+    
+    delete _bitmap;
+    
+    // flush any dirty blocks.
+    if (_cache) _cache->sync();
 }
 
 Disk::Disk(Device::BlockDevicePointer device) :
     _device(device)
 {
     _blocks = _device->blocks();
+    _bitmap = NULL;
+    _bitmapPointer = 0;
+    
+    _cache = _device->createBlockCache();
 }
 
 DiskPointer Disk::OpenFile(Device::BlockDevicePointer device)
@@ -63,6 +68,34 @@ DiskPointer Disk::OpenFile(Device::BlockDevicePointer device)
     return disk;
 }
 
+
+Disk::Visited::Visited(Disk *disk) :
+    _disk(disk)
+{
+    _set = NULL;
+    
+    {
+        Locker locker(_disk->_visitedLock);
+        
+        if (!_disk->_visitedPool.empty())
+        {
+            _set = _disk->_visitedPool.back();
+            _disk->_visitedPool.pop_back();
+        }
+    }
+    
+    if (!_set) _set = new VisitedSet(_disk->_blocks);
+    
+    _set->reset();
+}
+
+Disk::Visited::~Visited()
+{
+    Locker locker(_disk->_visitedLock);
+    
+    _disk->_visitedPool.push_back(_set);
+}
+
 // load the mini entry into the regular entry.
 int Disk::Normalize(FileEntry &f, unsigned fork, ExtendedEntry *ee)
 {
@@ -107,9 +140,11 @@ int Disk::Normalize(FileEntry &f, unsigned fork, ExtendedEntry *ee)
 int Disk::Read(unsigned block, void *buffer)
 {
 
-    if (block > _blocks) return -P8_INVALID_BLOCK;
+    if (block >= _blocks) return -P8_INVALID_BLOCK;
 
-    _device->read(block, buffer);
+    Locker locker(_lock);
+    
+    _cache->read(block, buffer);
     
     return 1;
 }
@@ -258,6 +293,13 @@ int Disk::ReadFile(const FileEntry &f, void *buffer)
 
 
 int Disk::ReadIndex(unsigned block, void *buffer, unsigned level, off_t offset, unsigned blocks)
+{
+    Visited visited(this);
+    
+    return ReadIndex(block, buffer, level, offset, blocks, visited.get());
+}
+
+int Disk::ReadIndex(unsigned block, void *buffer, unsigned level, off_t offset, unsigned blocks, VisitedSet *visited)
 {    
     if (level == 0)
     {
@@ -303,6 +345,9 @@ int Disk::ReadIndex(unsigned block, void *buffer, unsigned level, off_t offset,
     
     if (block) // not sparse.
     {
+        // an index block should only be referenced once.
+        if (!visited->insert(block)) return -P8_CYCLICAL_BLOCK;
+        
         ok = Read(block, key);
         if (ok < 0 ) return ok;
     }
@@ -319,7 +364,7 @@ int Disk::ReadIndex(unsigned block, void *buffer, unsigned level, off_t offset,
         
         unsigned b = std::min(blocks, blockCount);
         
-        ok = ReadIndex(newBlock, buffer, level - 1, offset, b);
+        ok = ReadIndex(newBlock, buffer, level - 1, offset, b, visited);
         if (ok < 0) return ok;
         offset = 0;
         buffer = ((char *)buffer) + readSize;
@@ -339,10 +384,10 @@ int Disk::ReadVolume(VolumeEntry *volume, std::vector<FileEntry> *files)
     unsigned prev;
     unsigned next;
     
-    uset blocks; 
+    Visited blocks(this);
 
     unsigned block = 2;
-    blocks.insert(block);
+    blocks->insert(block);
     ok = Read(block, buffer);
     
     if (ok < 0) return ok;
@@ -385,7 +430,7 @@ int Disk::ReadVolume(VolumeEntry *volume, std::vector<FileEntry> *files)
                 if (!next) break; // all done!
                 
 
-                if (blocks.insert(next).second == false)
+                if (!blocks->insert(next))
                 {
                     return -P8_CYCLICAL_BLOCK;
                 }                
@@ -416,9 +461,9 @@ int Disk::ReadDirectory(unsigned block, SubdirEntry *dir, std::vector<FileEntry>
     unsigned next;
     
     // keep a list of blocks to prevent cyclical problems.
-    uset blocks; 
+    Visited blocks(this);
     
-    blocks.insert(block);
+    blocks->insert(block);
     
     ok = Read(block, buffer);
     
@@ -464,7 +509,7 @@ int Disk::ReadDirectory(unsigned block, SubdirEntry *dir, std::vector<FileEntry>
                 if (!next) break; // all done!
                 
                 
-                if (blocks.insert(next).second == false)
+                if (!blocks->insert(next))
                 {
                     return -P8_CYCLICAL_BLOCK;
                 }
@@ -484,3 +529,703 @@ int Disk::ReadDirectory(unsigned block, SubdirEntry *dir, std::vector<FileEntry>
     
     return 1;
 }
+
+
+
+static void AddExtent(ExtentList *extents, unsigned block, unsigned count)
+{
+    if (!extents->empty())
+    {
+        Extent &e = extents->back();
+        
+        // merge sparse runs and contiguous runs.
+        if ((block == 0 && e.block == 0) || (block && e.block && e.block + e.count == block))
+        {
+            e.count += count;
+            return;
+        }
+    }
+    
+    Extent e = { block, count };
+    extents->push_back(e);
+}
+
+/*
+ * build a list of runs for the data blocks of a (normalized) file.
+ * trailing blocks beyond the eof are not included.
+ */
+int Disk::ReadExtents(const FileEntry &f, ExtentList *extents)
+{
+    unsigned blocks = (f.eof + BLOCK_SIZE - 1) >> 9;
+    Visited visited(this);
+    
+    extents->clear();
+    
+    switch(f.storage_type)
+    {
+        case SEEDLING_FILE:
+            if (blocks) AddExtent(extents, f.key_pointer, 1);
+            return 1;
+        case SAPLING_FILE:
+            return ReadExtents(f.key_pointer, 1, blocks, extents, visited.get());
+        case TREE_FILE:
+            return ReadExtents(f.key_pointer, 2, blocks, extents, visited.get());
+        default:
+            return -P8_INVALID_STORAGE_TYPE;
+    }
+}
+
+
+int Disk::ReadExtents(unsigned block, unsigned level, unsigned blocks, ExtentList *extents, VisitedSet *visited)
+{
+    uint8_t key[BLOCK_SIZE];
+    unsigned blockCount = level == 2 ? 256 : 1;
+    int ok;
+    
+    if (block == 0)
+    {
+        // sparse index block.
+        AddExtent(extents, 0, blocks);
+        return 1;
+    }
+    
+    if (!visited->insert(block)) return -P8_CYCLICAL_BLOCK;
+    
+    ok = Read(block, key);
+    if (ok < 0) return ok;
+    
+    for (unsigned i = 0; blocks && i < 256; ++i)
+    {
+        unsigned newBlock = (key[i]) | (key[256 + i] << 8);
+        unsigned b = std::min(blocks, blockCount);
+        
+        if (level == 1)
+        {
+            AddExtent(extents, newBlock, 1);
+        }
+        else
+        {
+            ok = ReadExtents(newBlock, level - 1, b, extents, visited);
+            if (ok < 0) return ok;
+        }
+        blocks -= b;
+    }
+    
+    return 1;
+}
+
+/*
+ * read count blocks, starting at (file relative) block, using a previously
+ * loaded extent list.  Sparse blocks (and blocks past the end) are zero-filled.
+ */
+int Disk::ReadBlocks(const ExtentList &extents, unsigned block, unsigned count, void *buffer)
+{
+    uint8_t *out = (uint8_t *)buffer;
+    ExtentList::const_iterator iter;
+    
+    for (iter = extents.begin(); count && iter != extents.end(); ++iter)
+    {
+        const Extent &e = *iter;
+        
+        if (block >= e.count)
+        {
+            block -= e.count;
+            continue;
+        }
+        
+        for ( ; count && block < e.count; ++block, --count)
+        {
+            if (e.block)
+            {
+                int ok = Read(e.block + block, out);
+                if (ok < 0) return ok;
+            }
+            else bzero(out, BLOCK_SIZE);
+            
+            out += BLOCK_SIZE;
+        }
+        block = 0;
+    }
+    
+    if (count) bzero(out, count * BLOCK_SIZE);
+    
+    return 1;
+}
+
+
+#pragma mark -
+#pragma mark Write Support
+
+bool Disk::ReadOnly() const
+{
+    return _cache->readOnly();
+}
+
+
+int Disk::Write(unsigned block, const void *buffer)
+{
+    if (block >= _blocks) return -P8_INVALID_BLOCK;
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    Locker locker(_lock);
+    
+    _cache->write(block, buffer);
+    
+    return 1;
+}
+
+int Disk::Zero(unsigned block)
+{
+    if (block >= _blocks) return -P8_INVALID_BLOCK;
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    Locker locker(_lock);
+    
+    _cache->zeroBlock(block);
+    
+    return 1;
+}
+
+int Disk::Sync()
+{
+    if (ReadOnly()) return 1;
+    
+    Locker locker(_lock);
+    
+    _cache->sync();
+    
+    return 1;
+}
+
+
+int Disk::LoadBitmap()
+{
+    VolumeEntry v;
+    int ok;
+    
+    if (_bitmap) return 1;
+    
+    ok = ReadVolume(&v, NULL);
+    if (ok < 0) return ok;
+    
+    unsigned blocks = std::min(v.total_blocks, _blocks);
+    unsigned bitmapBlocks = (blocks + 4095) / 4096;
+    
+    if (v.bit_map_pointer < 3 || v.bit_map_pointer + bitmapBlocks > blocks)
+        return -P8_INVALID_BLOCK;
+    
+    Locker locker(_lock);
+    
+    _bitmapPointer = v.bit_map_pointer;
+    _bitmap = new ProDOS::Bitmap(_cache.get(), _bitmapPointer, blocks);
+    
+    return 1;
+}
+
+
+int Disk::FreeBlocks()
+{
+    int ok = LoadBitmap();
+    if (ok < 0) return ok;
+    
+    return _bitmap->freeBlocks();
+}
+
+int Disk::AllocBlock()
+{
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    int ok = LoadBitmap();
+    if (ok < 0) return ok;
+    
+    ok = _bitmap->allocBlock();
+    
+    return ok < 0 ? -P8_VOLUME_FULL : ok;
+}
+
+int Disk::AllocRun(unsigned count)
+{
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    int ok = LoadBitmap();
+    if (ok < 0) return ok;
+    
+    ok = _bitmap->allocRun(count);
+    
+    return ok < 0 ? -P8_VOLUME_FULL : ok;
+}
+
+void Disk::FreeBlock(unsigned block)
+{
+    // never release the boot blocks or the volume directory.
+    if (block < 6) return;
+    
+    if (LoadBitmap() < 0) return;
+    
+    _bitmap->freeBlock(block);
+}
+
+int Disk::WriteBitmap()
+{
+    if (!_bitmap) return 1;
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    Locker locker(_lock);
+    
+    _bitmap->store(_cache.get(), _bitmapPointer);
+    
+    return 1;
+}
+
+
+// update the directory entry (at f.address)
+int Disk::WriteEntry(const FileEntry &f)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    int ok;
+    
+    ok = Read(f.address >> 9, buffer);
+    if (ok < 0) return ok;
+    
+    f.Store(buffer + (f.address & 0x1ff));
+    
+    return Write(f.address >> 9, buffer);
+}
+
+
+bool Disk::ValidName(const char *name)
+{
+    // [A-Za-z][0-9A-Za-z.]{0,14}
+    
+    if (!name || !isalpha(*name)) return false;
+    
+    unsigned i;
+    for (i = 1; name[i]; i++)
+    {
+        char c = name[i];
+        if (c == '.' || isalnum(c)) continue;
+        
+        return false;
+    }
+    
+    return i < 16;
+}
+
+
+int Disk::FindEntry(unsigned dirKey, const char *name, FileEntry *entry)
+{
+    std::vector<FileEntry> files;
+    int ok;
+    
+    if (dirKey == 2)
+    {
+        VolumeEntry v;
+        ok = ReadVolume(&v, &files);
+    }
+    else
+    {
+        ok = ReadDirectory(dirKey, NULL, &files);
+    }
+    if (ok < 0) return ok;
+    
+    std::vector<FileEntry>::iterator iter;
+    for (iter = files.begin(); iter != files.end(); ++iter)
+    {
+        if (::strcasecmp(iter->file_name, name) == 0)
+        {
+            if (entry) *entry = *iter;
+            return 1;
+        }
+    }
+    
+    return -P8_FILE_NOT_FOUND;
+}
+
+
+/*
+ * find a free entry in a directory.  Subdirectories are extended
+ * by a block if necessary; the volume directory is fixed size.
+ */
+int Disk::FindSlot(unsigned dirKey, uint32_t *address)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    unsigned block = dirKey;
+    unsigned index = 1; // skip the header
+    unsigned entryLength;
+    unsigned entriesPerBlock;
+    int ok;
+    
+    Visited visited(this);
+    
+    ok = Read(block, buffer);
+    if (ok < 0) return ok;
+    
+    entryLength = buffer[0x04 + 0x1f];
+    entriesPerBlock = buffer[0x04 + 0x20];
+    
+    if (entryLength < FILE_ENTRY_SIZE || 4 + entryLength * entriesPerBlock > BLOCK_SIZE)
+        return -P8_INVALID_STORAGE_TYPE;
+    
+    for(;;)
+    {
+        if (!visited->insert(block)) return -P8_CYCLICAL_BLOCK;
+        
+        for ( ; index < entriesPerBlock; ++index)
+        {
+            unsigned offset = 0x04 + index * entryLength;
+            
+            if ((buffer[offset] >> 4) == DELETED_FILE)
+            {
+                *address = (block << 9) + offset;
+                return 1;
+            }
+        }
+        
+        unsigned next = Read16(&buffer[0x02]);
+        if (!next) break;
+        
+        block = next;
+        index = 0;
+        
+        ok = Read(block, buffer);
+        if (ok < 0) return ok;
+    }
+    
+    if (dirKey == 2) return -P8_DIRECTORY_FULL;
+    
+    
+    // add a new block to the end of the chain.
+    
+    int newBlock = AllocBlock();
+    if (newBlock < 0) return newBlock;
+    
+    uint8_t tmp[BLOCK_SIZE];
+    
+    std::memset(tmp, 0, sizeof(tmp));
+    Write16(&tmp[0x00], block);
+    
+    ok = Write(newBlock, tmp);
+    if (ok < 0) return ok;
+    
+    ok = WriteBitmap();
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    Write16(&buffer[0x02], newBlock);
+    ok = Write(block, buffer);
+    if (ok < 0) return ok;
+    
+    
+    // and update the parent entry.
+    
+    ok = Read(dirKey, tmp);
+    if (ok < 0) return ok;
+    
+    SubdirEntry s;
+    s.Load(tmp + 0x04);
+    
+    if (s.parent_entry && s.parent_entry_length >= FILE_ENTRY_SIZE
+        && 0x04 + s.parent_entry * s.parent_entry_length <= BLOCK_SIZE)
+    {
+        FileEntry parent;
+        unsigned offset = 0x04 + (s.parent_entry - 1) * s.parent_entry_length;
+        
+        ok = Read(s.parent_pointer, tmp);
+        if (ok < 0) return ok;
+        
+        parent.Load(tmp + offset);
+        parent.address = (s.parent_pointer << 9) + offset;
+        
+        if (parent.storage_type == DIRECTORY_FILE && parent.key_pointer == dirKey)
+        {
+            parent.blocks_used += 1;
+            parent.eof += BLOCK_SIZE;
+            
+            ok = WriteEntry(parent);
+            if (ok < 0) return ok;
+        }
+    }
+    
+    *address = (newBlock << 9) + 0x04;
+    
+    return 1;
+}
+
+
+// write a new entry and bump the directory file count.
+int Disk::AddEntry(unsigned dirKey, FileEntry *entry)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    int ok;
+    
+    entry->header_pointer = dirKey;
+    
+    ok = WriteEntry(*entry);
+    if (ok < 0) return ok;
+    
+    ok = Read(dirKey, buffer);
+    if (ok < 0) return ok;
+    
+    Write16(&buffer[0x04 + 0x21], Read16(&buffer[0x04 + 0x21]) + 1);
+    
+    return Write(dirKey, buffer);
+}
+
+
+int Disk::CreateFile(unsigned dirKey, const char *name, unsigned fileType, FileEntry *entry)
+{
+    FileEntry e;
+    uint32_t address;
+    int ok;
+    
+    if (!ValidName(name)) return -P8_INVALID_NAME;
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    ok = FindEntry(dirKey, name, NULL);
+    if (ok >= 0) return -P8_DUPLICATE_NAME;
+    if (ok != -P8_FILE_NOT_FOUND) return ok;
+    
+    ok = FindSlot(dirKey, &address);
+    if (ok < 0) return ok;
+    
+    // a seedling always has a key block.
+    int key = AllocBlock();
+    if (key < 0) return key;
+    
+    ok = Zero(key);
+    if (ok < 0) return ok;
+    
+    ok = WriteBitmap();
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    std::memset(&e, 0, sizeof(e));
+    
+    e.storage_type = SEEDLING_FILE;
+    e.name_length = std::strlen(name);
+    std::strcpy(e.file_name, name);
+    e.file_type = fileType;
+    e.key_pointer = key;
+    e.blocks_used = 1;
+    e.eof = 0;
+    e.creation = e.last_mod = ::time(NULL);
+    e.access = 0xe3;
+    e.aux_type = 0;
+    e.address = address;
+    
+    ok = AddEntry(dirKey, &e);
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    if (entry) *entry = e;
+    
+    return 1;
+}
+
+
+int Disk::CreateDirectory(unsigned dirKey, const char *name, FileEntry *entry)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    FileEntry e;
+    uint32_t address;
+    unsigned entryLength;
+    int ok;
+    
+    if (!ValidName(name)) return -P8_INVALID_NAME;
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    ok = FindEntry(dirKey, name, NULL);
+    if (ok >= 0) return -P8_DUPLICATE_NAME;
+    if (ok != -P8_FILE_NOT_FOUND) return ok;
+    
+    ok = FindSlot(dirKey, &address);
+    if (ok < 0) return ok;
+    
+    ok = Read(dirKey, buffer);
+    if (ok < 0) return ok;
+    
+    entryLength = buffer[0x04 + 0x1f];
+    
+    int key = AllocBlock();
+    if (key < 0) return key;
+    
+    std::memset(&e, 0, sizeof(e));
+    
+    e.storage_type = DIRECTORY_FILE;
+    e.name_length = std::strlen(name);
+    std::strcpy(e.file_name, name);
+    e.file_type = 0x0f;
+    e.key_pointer = key;
+    e.blocks_used = 1;
+    e.eof = BLOCK_SIZE;
+    e.creation = e.last_mod = ::time(NULL);
+    e.access = 0xe3;
+    e.aux_type = 0;
+    e.address = address;
+    
+    
+    // the subdirectory header is a file entry with a different layout.
+    std::memset(buffer, 0, sizeof(buffer));
+    
+    e.Store(buffer + 0x04);
+    
+    uint8_t *cp = buffer + 0x04;
+    
+    cp[0x00] = (SUBDIR_HEADER << 4) | e.name_length;
+    cp[0x10] = 0x75;
+    std::memset(&cp[0x11], 0, 7);
+    cp[0x1e] = 0xe3;
+    cp[0x1f] = FILE_ENTRY_SIZE;
+    cp[0x20] = (BLOCK_SIZE - 4) / FILE_ENTRY_SIZE;
+    Write16(&cp[0x21], 0);
+    Write16(&cp[0x23], address >> 9);
+    cp[0x25] = ((address & 0x1ff) - 0x04) / entryLength + 1;
+    cp[0x26] = entryLength;
+    
+    ok = Write(key, buffer);
+    if (ok < 0) return ok;
+    
+    ok = WriteBitmap();
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    ok = AddEntry(dirKey, &e);
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    if (entry) *entry = e;
+    
+    return 1;
+}
+
+
+int Disk::Delete(unsigned dirKey, const char *name)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    FileEntry e;
+    int ok;
+    
+    if (ReadOnly()) return -P8_READ_ONLY;
+    
+    ok = FindEntry(dirKey, name, &e);
+    if (ok < 0) return ok;
+    
+    if (e.storage_type == DIRECTORY_FILE)
+    {
+        SubdirEntry s;
+        
+        ok = ReadDirectory(e.key_pointer, &s, NULL);
+        if (ok < 0) return ok;
+        
+        if (s.file_count) return -P8_DIRECTORY_NOT_EMPTY;
+    }
+    
+    // remove the entry first; a crash will leak blocks rather than share them.
+    
+    ok = Read(e.address >> 9, buffer);
+    if (ok < 0) return ok;
+    
+    buffer[e.address & 0x1ff] &= 0x0f;
+    
+    ok = Write(e.address >> 9, buffer);
+    if (ok < 0) return ok;
+    
+    ok = Read(dirKey, buffer);
+    if (ok < 0) return ok;
+    
+    unsigned count = Read16(&buffer[0x04 + 0x21]);
+    if (count) Write16(&buffer[0x04 + 0x21], count - 1);
+    
+    ok = Write(dirKey, buffer);
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    ok = ReleaseBlocks(e.storage_type, e.key_pointer);
+    if (ok < 0) return ok;
+    
+    ok = WriteBitmap();
+    if (ok < 0) return ok;
+    
+    Sync();
+    
+    return 1;
+}
+
+
+// free all blocks belonging to a file, fork, or directory.
+int Disk::ReleaseBlocks(unsigned storageType, unsigned block)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    int ok;
+    
+    switch (storageType)
+    {
+        case SEEDLING_FILE:
+            FreeBlock(block);
+            return 1;
+        
+        case SAPLING_FILE:
+        case TREE_FILE:
+            ok = Read(block, buffer);
+            if (ok < 0) return ok;
+            
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                unsigned p = buffer[i] | (buffer[256 + i] << 8);
+                if (!p) continue;
+                
+                if (storageType == TREE_FILE)
+                {
+                    ok = ReleaseBlocks(SAPLING_FILE, p);
+                    if (ok < 0) return ok;
+                }
+                else FreeBlock(p);
+            }
+            FreeBlock(block);
+            return 1;
+        
+        case EXTENDED_FILE:
+        {
+            ExtendedEntry ee;
+            
+            ok = Read(block, buffer);
+            if (ok < 0) return ok;
+            
+            ee.Load(buffer);
+            
+            ok = ReleaseBlocks(ee.dataFork.storage_type, ee.dataFork.key_block);
+            if (ok < 0) return ok;
+            
+            ok = ReleaseBlocks(ee.resourceFork.storage_type, ee.resourceFork.key_block);
+            if (ok < 0) return ok;
+            
+            FreeBlock(block);
+            return 1;
+        }
+        
+        case DIRECTORY_FILE:
+        {
+            Visited visited(this);
+            
+            while (block)
+            {
+                if (!visited->insert(block)) return -P8_CYCLICAL_BLOCK;
+                
+                ok = Read(block, buffer);
+                if (ok < 0) return ok;
+                
+                FreeBlock(block);
+                block = Read16(&buffer[0x02]);
+            }
+            return 1;
+        }
+    }
+    
+    return -P8_INVALID_STORAGE_TYPE;
+}
@@ -14,8 +14,13 @@
 #include <vector>
 
 #include <ProDOS/File.h>
+#include <ProDOS/VisitedSet.h>
 #include <Device/BlockDevice.h>
 
+#include <Cache/BlockCache.h>
+
+#include <Common/Lock.h>
+
 #include <memory>
 #include <Common/smart_pointers.h>
 
@@ -26,7 +31,15 @@ enum {
     P8_INVALID_FORK,
     P8_INVALID_BLOCK,
     P8_INVALID_STORAGE_TYPE,
-    P8_CYCLICAL_BLOCK
+    P8_CYCLICAL_BLOCK,
+    P8_READ_ONLY,
+    P8_VOLUME_FULL,
+    P8_DIRECTORY_FULL,
+    P8_DUPLICATE_NAME,
+    P8_FILE_NOT_FOUND,
+    P8_DIRECTORY_NOT_EMPTY,
+    P8_INVALID_NAME,
+    P8_FILE_TOO_LARGE
     
 };
 
@@ -47,6 +60,19 @@ enum {
 class Disk;
 typedef SHARED_PTR(Disk) DiskPointer;
 
+namespace ProDOS {
+    class Bitmap;
+}
+
+
+// a run of data blocks.  block == 0 indicates a sparse run.
+struct Extent {
+    unsigned block;
+    unsigned count;
+};
+
+typedef std::vector<Extent> ExtentList;
+
 class Disk {
 
 public:
@@ -69,13 +95,72 @@ public:
     int ReadVolume(VolumeEntry *volume, std::vector<FileEntry> *files);
     int ReadDirectory(unsigned block, SubdirEntry *dir, std::vector<FileEntry> *files);
     
+    int ReadExtents(const FileEntry &f, ExtentList *extents);
+    int ReadBlocks(const ExtentList &extents, unsigned block, unsigned count, void *buffer);
+    
+    
+    // write support.  All i/o goes through the block cache.
+    bool ReadOnly() const;
+    
+    int Write(unsigned block, const void *buffer);
+    int Zero(unsigned block);
+    int Sync();
+    
+    int FreeBlocks();
+    int AllocBlock();
+    int AllocRun(unsigned count);
+    void FreeBlock(unsigned block);
+    int WriteBitmap();
+    
+    int WriteEntry(const FileEntry &f);
+    
+    int FindEntry(unsigned dirKey, const char *name, FileEntry *entry);
+    int CreateFile(unsigned dirKey, const char *name, unsigned fileType, FileEntry *entry);
+    int CreateDirectory(unsigned dirKey, const char *name, FileEntry *entry);
+    int Delete(unsigned dirKey, const char *name);
+    
+    static bool ValidName(const char *name);
+    
 private:
     Disk();
     Disk(Device::BlockDevicePointer device);
     
+    int LoadBitmap();
+    
+    int FindSlot(unsigned dirKey, uint32_t *address);
+    int AddEntry(unsigned dirKey, FileEntry *entry);
+    int ReleaseBlocks(unsigned storageType, unsigned block);
+    
+    int ReadIndex(unsigned block, void *buffer, unsigned level, off_t offset, unsigned blocks, ProDOS::VisitedSet *visited);
+    int ReadExtents(unsigned block, unsigned level, unsigned blocks, ExtentList *extents, ProDOS::VisitedSet *visited);
+    
+    // visited sets are pooled so concurrent walks don't share (or allocate) one.
+    class Visited {
+    public:
+        Visited(Disk *disk);
+        ~Visited();
+        
+        ProDOS::VisitedSet *operator->() const { return _set; }
+        ProDOS::VisitedSet *get() const { return _set; }
+        
+    private:
+        Disk *_disk;
+        ProDOS::VisitedSet *_set;
+    };
+    
     unsigned _blocks;
 
     Device::BlockDevicePointer _device;
+    Device::BlockCachePointer _cache;
+    
+    // protects the cache.
+    Lock _lock;
+    
+    ProDOS::Bitmap *_bitmap;
+    unsigned _bitmapPointer;
+    
+    Lock _visitedLock;
+    std::vector<ProDOS::VisitedSet *> _visitedPool;
 };
 
 
@@ -72,6 +72,57 @@ bool FileEntry::Load(const void *data)
 }
 
 
+void FileEntry::Store(void *data) const
+{
+    uint8_t *cp = (uint8_t *)data;
+    
+    unsigned xcase = 0;
+    unsigned mask = 0x4000;
+    
+    std::memset(cp, 0, FILE_ENTRY_SIZE);
+    
+    cp[0x00] = (storage_type << 4) | (name_length & 0x0f);
+    
+    // names are stored in upper case; lower case is in the version bytes.
+    for (unsigned i = 0; i < name_length; i++)
+    {
+        char c = file_name[i];
+        if (islower(c)) xcase |= mask;
+        cp[0x01 + i] = toupper(c);
+        mask = mask >> 1;
+    }
+    
+    cp[0x10] = file_type;
+    
+    Write16(&cp[0x11], key_pointer);
+    
+    Write16(&cp[0x13], blocks_used);
+    
+    Write24(&cp[0x15], eof);
+    
+    if (creation)
+    {
+        ProDOS::DateTime c(creation);
+        Write16(&cp[0x18], c.date());
+        Write16(&cp[0x1a], c.time());
+    }
+    
+    if (xcase) Write16(&cp[0x1c], xcase | 0x8000);
+    
+    cp[0x1e] = access;
+    
+    Write16(&cp[0x1f], aux_type);
+    
+    if (last_mod)
+    {
+        ProDOS::DateTime m(last_mod);
+        Write16(&cp[0x21], m.date());
+        Write16(&cp[0x23], m.time());
+    }
+    
+    Write16(&cp[0x25], header_pointer);
+}
+
 
 
 bool ExtendedEntry::Load(const void *data)
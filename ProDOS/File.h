@@ -43,6 +43,7 @@ class FileEntry {
 public:
     
     bool Load(const void *data);
+    void Store(void *data) const;
     
     unsigned storage_type;
     unsigned name_length;
@@ -0,0 +1,545 @@
+
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+
+#include <ProDOS/Fork.h>
+#include <ProDOS/common.h>
+
+using namespace ProDOS;
+
+
+Fork::Fork(DiskPointer disk) :
+    _disk(disk)
+{
+    std::memset(&_entry, 0, sizeof(_entry));
+
+    _storageType = 0;
+    _master = 0;
+    _dirty = false;
+}
+
+Fork::~Fork()
+{
+}
+
+
+int Fork::open(uint32_t address)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    int ok;
+
+    ok = _disk->Read(address >> 9, buffer);
+    if (ok < 0) return ok;
+
+    _entry.Load(buffer + (address & 0x1ff));
+    _entry.address = address;
+
+    _storageType = _entry.storage_type;
+    _master = 0;
+    _index.clear();
+    _blocks.clear();
+    _released.clear();
+    _dirty = false;
+
+    switch (_storageType)
+    {
+        case SEEDLING_FILE:
+            _blocks.push_back(_entry.key_pointer);
+            break;
+
+        case SAPLING_FILE:
+            _index.push_back(_entry.key_pointer);
+            ok = loadIndex(_entry.key_pointer, 1);
+            if (ok < 0) return ok;
+            break;
+
+        case TREE_FILE:
+            _master = _entry.key_pointer;
+            ok = loadIndex(_entry.key_pointer, 2);
+            if (ok < 0) return ok;
+            break;
+
+        default:
+            // extended files and directories are not supported.
+            return -P8_INVALID_STORAGE_TYPE;
+    }
+
+    // trailing sparse blocks are implied.
+    while (_blocks.size() > 1 && _blocks.back() == 0) _blocks.pop_back();
+
+    return 1;
+}
+
+
+int Fork::loadIndex(unsigned block, unsigned level)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    int ok;
+
+    ok = _disk->Read(block, buffer);
+    if (ok < 0) return ok;
+
+    // the master index only uses 128 entries (24-bit eof).
+    unsigned count = level == 2 ? 128 : 256;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned p = buffer[i] | (buffer[256 + i] << 8);
+
+        if (level == 1)
+        {
+            _blocks.push_back(p);
+            continue;
+        }
+
+        _index.push_back(p);
+
+        if (p)
+        {
+            ok = loadIndex(p, 1);
+            if (ok < 0) return ok;
+        }
+        else _blocks.resize(_blocks.size() + 256, 0);
+    }
+
+    return 1;
+}
+
+
+int Fork::read(void *buffer, size_t size, off_t offset)
+{
+    uint8_t tmp[BLOCK_SIZE];
+    uint8_t *out = (uint8_t *)buffer;
+    int ok;
+
+    if (offset >= _entry.eof) return 0;
+
+    size = std::min(size, (size_t)(_entry.eof - offset));
+
+    size_t remaining = size;
+
+    while (remaining)
+    {
+        unsigned block = offset >> 9;
+        unsigned start = offset & 0x1ff;
+        unsigned count = std::min(remaining, (size_t)(BLOCK_SIZE - start));
+        unsigned p = block < _blocks.size() ? _blocks[block] : 0;
+
+        if (!p)
+        {
+            std::memset(out, 0, count);
+        }
+        else if (count == BLOCK_SIZE)
+        {
+            ok = _disk->Read(p, out);
+            if (ok < 0) return ok;
+        }
+        else
+        {
+            ok = _disk->Read(p, tmp);
+            if (ok < 0) return ok;
+
+            std::memcpy(out, tmp + start, count);
+        }
+
+        out += count;
+        offset += count;
+        remaining -= count;
+    }
+
+    return size;
+}
+
+
+/*
+ * allocate any sparse blocks in the range.  Each sparse run is allocated
+ * contiguously if possible.
+ */
+int Fork::allocate(unsigned first, unsigned last)
+{
+    unsigned i = first;
+
+    while (i <= last)
+    {
+        if (_blocks[i])
+        {
+            ++i;
+            continue;
+        }
+
+        unsigned j = i;
+        while (j <= last && !_blocks[j]) ++j;
+
+        int block = _disk->AllocRun(j - i);
+
+        if (block >= 0)
+        {
+            for ( ; i < j; ++i) _blocks[i] = block++;
+            continue;
+        }
+
+        // fragmented -- one at a time.
+        for ( ; i < j; ++i)
+        {
+            block = _disk->AllocBlock();
+            if (block < 0) return block;
+
+            _blocks[i] = block;
+        }
+    }
+
+    return 1;
+}
+
+
+int Fork::write(const void *buffer, size_t size, off_t offset)
+{
+    uint8_t tmp[BLOCK_SIZE];
+    const uint8_t *in = (const uint8_t *)buffer;
+    int ok;
+
+    if (_disk->ReadOnly()) return -P8_READ_ONLY;
+
+    if (!size) return 0;
+
+    if (offset + size > MaxSize) return -P8_FILE_TOO_LARGE;
+
+    unsigned first = offset >> 9;
+    unsigned last = (offset + size - 1) >> 9;
+
+    if (_blocks.size() <= last) _blocks.resize(last + 1, 0);
+
+    // partial blocks which are newly allocated must be zero-filled.
+    bool newFirst = _blocks[first] == 0;
+    bool newLast = _blocks[last] == 0;
+
+    ok = allocate(first, last);
+    if (ok < 0) return ok;
+
+    _dirty = true;
+
+    size_t remaining = size;
+
+    while (remaining)
+    {
+        unsigned block = offset >> 9;
+        unsigned start = offset & 0x1ff;
+        unsigned count = std::min(remaining, (size_t)(BLOCK_SIZE - start));
+        unsigned p = _blocks[block];
+
+        if (count == BLOCK_SIZE)
+        {
+            ok = _disk->Write(p, in);
+            if (ok < 0) return ok;
+        }
+        else
+        {
+            if ((block == first && newFirst) || (block == last && newLast))
+            {
+                std::memset(tmp, 0, sizeof(tmp));
+            }
+            else
+            {
+                ok = _disk->Read(p, tmp);
+                if (ok < 0) return ok;
+            }
+
+            std::memcpy(tmp + start, in, count);
+
+            ok = _disk->Write(p, tmp);
+            if (ok < 0) return ok;
+        }
+
+        in += count;
+        offset += count;
+        remaining -= count;
+    }
+
+    if (offset > _entry.eof) _entry.eof = offset;
+    _entry.last_mod = std::time(NULL);
+
+    return size;
+}
+
+
+int Fork::truncate(uint32_t size)
+{
+    uint8_t tmp[BLOCK_SIZE];
+    int ok;
+
+    if (_disk->ReadOnly()) return -P8_READ_ONLY;
+
+    if (size > MaxSize) return -P8_FILE_TOO_LARGE;
+
+    if (size < _entry.eof)
+    {
+        unsigned keep = std::max(1u, (size + BLOCK_SIZE - 1) >> 9);
+
+        for (unsigned i = keep; i < _blocks.size(); ++i)
+        {
+            if (_blocks[i]) _released.push_back(_blocks[i]);
+        }
+
+        if (_blocks.size() > keep) _blocks.resize(keep);
+    }
+
+    // zero out anything past the (new or old) end of the last block.
+    unsigned eof = std::min(size, _entry.eof);
+    unsigned block = eof >> 9;
+
+    if (block < _blocks.size() && _blocks[block] && (eof & 0x1ff || eof == 0))
+    {
+        ok = _disk->Read(_blocks[block], tmp);
+        if (ok < 0) return ok;
+
+        std::memset(tmp + (eof & 0x1ff), 0, BLOCK_SIZE - (eof & 0x1ff));
+
+        ok = _disk->Write(_blocks[block], tmp);
+        if (ok < 0) return ok;
+    }
+
+    _entry.eof = size;
+    _entry.last_mod = std::time(NULL);
+    _dirty = true;
+
+    return flush();
+}
+
+
+// number of blocks needed for the current eof / data.
+unsigned Fork::level() const
+{
+    unsigned count = std::max((size_t)1, _blocks.size());
+
+    count = std::max(count, (_entry.eof + BLOCK_SIZE - 1) >> 9);
+
+    if (count <= 1) return 0;
+    if (count <= 256) return 1;
+    return 2;
+}
+
+unsigned Fork::blocksUsed() const
+{
+    unsigned count = _master ? 1 : 0;
+
+    for (unsigned i = 0; i < _blocks.size(); ++i)
+        if (_blocks[i]) ++count;
+
+    for (unsigned i = 0; i < _index.size(); ++i)
+        if (_index[i]) ++count;
+
+    return count;
+}
+
+
+/*
+ * rebuild the index blocks, changing the storage type if necessary.
+ */
+int Fork::storeIndex()
+{
+    uint8_t buffer[BLOCK_SIZE];
+    unsigned newLevel;
+    int block;
+    int ok;
+
+    while (_blocks.size() > 1 && _blocks.back() == 0) _blocks.pop_back();
+    if (_blocks.empty()) _blocks.push_back(0);
+
+    newLevel = level();
+
+    // index blocks which will no longer be needed.
+    std::vector<unsigned> oldIndex;
+
+    switch (newLevel)
+    {
+        case 0:
+            if (!_blocks[0])
+            {
+                block = _disk->AllocBlock();
+                if (block < 0) return block;
+
+                ok = _disk->Zero(block);
+                if (ok < 0) return ok;
+
+                _blocks[0] = block;
+            }
+
+            oldIndex.swap(_index);
+            if (_master) oldIndex.push_back(_master);
+            _master = 0;
+
+            _entry.key_pointer = _blocks[0];
+            break;
+
+        case 1:
+        {
+            unsigned index = 0;
+
+            // re-use the sapling index or the first tree index.
+            if (!_index.empty() && _index[0])
+            {
+                index = _index[0];
+                oldIndex.assign(_index.begin() + 1, _index.end());
+            }
+            else oldIndex.swap(_index);
+
+            if (_master) oldIndex.push_back(_master);
+            _master = 0;
+
+            if (!index)
+            {
+                block = _disk->AllocBlock();
+                if (block < 0) return block;
+                index = block;
+            }
+
+            _index.assign(1, index);
+            _entry.key_pointer = index;
+            break;
+        }
+
+        case 2:
+        {
+            unsigned groups = (std::max((size_t)((_entry.eof + BLOCK_SIZE - 1) >> 9), _blocks.size()) + 255) / 256;
+
+            // a sapling index becomes the first tree index.
+            if (_storageType == SEEDLING_FILE) _index.clear();
+
+            if (_index.size() > groups)
+            {
+                oldIndex.assign(_index.begin() + groups, _index.end());
+                _index.resize(groups);
+            }
+            _index.resize(groups, 0);
+
+            for (unsigned g = 0; g < groups; ++g)
+            {
+                bool sparse = true;
+
+                for (unsigned i = g * 256; i < (g + 1) * 256 && i < _blocks.size(); ++i)
+                {
+                    if (_blocks[i])
+                    {
+                        sparse = false;
+                        break;
+                    }
+                }
+
+                if (sparse)
+                {
+                    if (_index[g]) oldIndex.push_back(_index[g]);
+                    _index[g] = 0;
+                    continue;
+                }
+
+                if (!_index[g])
+                {
+                    block = _disk->AllocBlock();
+                    if (block < 0) return block;
+                    _index[g] = block;
+                }
+            }
+
+            if (!_master)
+            {
+                block = _disk->AllocBlock();
+                if (block < 0) return block;
+                _master = block;
+            }
+
+            _entry.key_pointer = _master;
+            break;
+        }
+    }
+
+    // write the index blocks.
+    for (unsigned g = 0; newLevel && g < _index.size(); ++g)
+    {
+        if (!_index[g]) continue;
+
+        std::memset(buffer, 0, sizeof(buffer));
+
+        for (unsigned i = 0; i < 256 && g * 256 + i < _blocks.size(); ++i)
+        {
+            unsigned p = _blocks[g * 256 + i];
+
+            buffer[i] = p & 0xff;
+            buffer[256 + i] = p >> 8;
+        }
+
+        ok = _disk->Write(_index[g], buffer);
+        if (ok < 0) return ok;
+    }
+
+    if (newLevel == 2)
+    {
+        std::memset(buffer, 0, sizeof(buffer));
+
+        for (unsigned g = 0; g < _index.size(); ++g)
+        {
+            buffer[g] = _index[g] & 0xff;
+            buffer[256 + g] = _index[g] >> 8;
+        }
+
+        ok = _disk->Write(_master, buffer);
+        if (ok < 0) return ok;
+    }
+
+    for (unsigned i = 0; i < oldIndex.size(); ++i)
+    {
+        if (oldIndex[i]) _released.push_back(oldIndex[i]);
+    }
+
+    _storageType = newLevel + 1;
+
+    _entry.storage_type = _storageType;
+    _entry.blocks_used = blocksUsed();
+
+    return 1;
+}
+
+
+int Fork::flush()
+{
+    int ok;
+
+    if (!_dirty) return 1;
+
+    // 1. data blocks.
+    _disk->Sync();
+
+    // 2. index blocks and the bitmap.
+    ok = storeIndex();
+    if (ok < 0) return ok;
+
+    ok = _disk->WriteBitmap();
+    if (ok < 0) return ok;
+
+    _disk->Sync();
+
+    // 3. the directory entry.
+    ok = _disk->WriteEntry(_entry);
+    if (ok < 0) return ok;
+
+    _disk->Sync();
+
+    // 4. blocks the entry no longer refers to.
+    if (!_released.empty())
+    {
+        for (unsigned i = 0; i < _released.size(); ++i)
+            _disk->FreeBlock(_released[i]);
+
+        _released.clear();
+
+        ok = _disk->WriteBitmap();
+        if (ok < 0) return ok;
+
+        _disk->Sync();
+    }
+
+    _dirty = false;
+
+    return 1;
+}
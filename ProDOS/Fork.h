@@ -0,0 +1,78 @@
+#ifndef __PRODOS_FORK_H__
+#define __PRODOS_FORK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <ProDOS/Disk.h>
+
+
+namespace ProDOS {
+
+/*
+ * An open (data) fork.
+ *
+ * The data block list is loaded once and kept in memory; index blocks
+ * are only rebuilt on flush(), which is also when the storage type
+ * changes (seedling -> sapling -> tree and back).
+ *
+ * Blocks are flushed in order: data, then index blocks and the bitmap,
+ * then the directory entry.  Blocks released by a truncate or a smaller
+ * index aren't freed until the entry is written (and can't be reused
+ * before then), so the entry on disk never refers to a free block.
+ */
+
+class Fork {
+public:
+
+    Fork(DiskPointer disk);
+    ~Fork();
+
+    int open(uint32_t address);
+
+    int read(void *buffer, size_t size, off_t offset);
+    int write(const void *buffer, size_t size, off_t offset);
+    int truncate(uint32_t size);
+
+    int flush();
+
+    const FileEntry &entry() const { return _entry; }
+    bool dirty() const { return _dirty; }
+
+    // 24-bit eof.
+    enum { MaxSize = 0xffffff };
+
+private:
+
+    Fork(const Fork &);
+    Fork& operator=(const Fork &);
+
+    int loadIndex(unsigned block, unsigned level);
+    int allocate(unsigned first, unsigned last);
+    int storeIndex();
+
+    unsigned level() const;
+    unsigned blocksUsed() const;
+
+    DiskPointer _disk;
+    FileEntry _entry;
+
+    // current storage (on disk).
+    unsigned _storageType;
+    unsigned _master;
+    std::vector<unsigned> _index;
+
+    // data blocks (0 = sparse)
+    std::vector<unsigned> _blocks;
+
+    // freed after the entry is written.
+    std::vector<unsigned> _released;
+
+    bool _dirty;
+};
+
+}
+
+#endif
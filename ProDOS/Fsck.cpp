@@ -0,0 +1,531 @@
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+#include <ProDOS/Fsck.h>
+#include <ProDOS/Bitmap.h>
+#include <ProDOS/common.h>
+
+#include <Cache/BlockCache.h>
+#include <Endian/Endian.h>
+
+using namespace ProDOS;
+using namespace LittleEndian;
+
+
+const char *Fsck::ProblemName(unsigned type)
+{
+    switch (type)
+    {
+        case BadVolume:
+            return "bad-volume";
+        case OutOfRange:
+            return "out-of-range";
+        case DoubleAllocated:
+            return "double-allocated";
+        case CyclicChain:
+            return "cyclic-chain";
+        case BadStorageType:
+            return "bad-storage-type";
+        case FileCount:
+            return "file-count";
+        case BlocksUsed:
+            return "blocks-used";
+        case Leaked:
+            return "leaked";
+        case NotAllocated:
+            return "not-allocated";
+        case BadEof:
+            return "bad-eof";
+    }
+    return "unknown";
+}
+
+
+Fsck::Fsck(Device::BlockDevicePointer device) :
+    _device(device)
+{
+    _blocks = 0;
+    _bitmapPointer = 0;
+    _freeBlocks = 0;
+    _ownedBlocks = 0;
+    _files = 0;
+    _directories = 0;
+}
+
+Fsck::~Fsck()
+{
+}
+
+
+void Fsck::problem(unsigned type, unsigned block, const std::string &path, const char *format, ...)
+{
+    char buffer[256];
+    va_list ap;
+
+    va_start(ap, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, ap);
+    va_end(ap);
+
+    Problem p;
+    p.type = type;
+    p.block = block;
+    p.path = path;
+    p.message = buffer;
+
+    _problems.push_back(p);
+}
+
+
+void Fsck::read(unsigned block, void *buffer)
+{
+    _device->read(block, buffer);
+}
+
+
+unsigned Fsck::owner(const std::string &path)
+{
+    _ownerNames.push_back(path);
+
+    // 0 is unowned.
+    return _ownerNames.size();
+}
+
+
+const char *Fsck::blockOwner(unsigned block) const
+{
+    if (block >= _owners.size() || _owners[block] == 0) return NULL;
+
+    return _ownerNames[_owners[block] - 1].c_str();
+}
+
+
+/*
+ * assign a block to an owner.  returns false if the block is out of range
+ * or already owned (in which case it should not be followed).
+ */
+bool Fsck::claim(unsigned block, unsigned owner)
+{
+    const std::string &path = _ownerNames[owner - 1];
+
+    if (block >= _blocks)
+    {
+        problem(OutOfRange, block, path, "block %u is beyond the end of the volume (%u blocks)", block, _blocks);
+        return false;
+    }
+
+    uint32_t current = _owners[block];
+
+    if (current == 0)
+    {
+        _owners[block] = owner;
+        ++_ownedBlocks;
+        return true;
+    }
+
+    if (current == owner)
+    {
+        problem(CyclicChain, block, path, "block %u is referenced more than once", block);
+        return false;
+    }
+
+    problem(DoubleAllocated, block, path, "block %u is also used by %s", block, _ownerNames[current - 1].c_str());
+    return false;
+}
+
+
+unsigned Fsck::check()
+{
+    uint8_t buffer[BLOCK_SIZE];
+    std::vector<Directory> pending;
+    VolumeEntry v;
+
+    _problems.clear();
+    _owners.clear();
+    _ownerNames.clear();
+    _volumeName.clear();
+
+    _blocks = 0;
+    _bitmapPointer = 0;
+    _freeBlocks = 0;
+    _ownedBlocks = 0;
+    _files = 0;
+    _directories = 0;
+
+    if (_device->blocks() < 3)
+    {
+        problem(BadVolume, 0, "", "device is too small (%u blocks)", _device->blocks());
+        return _problems.size();
+    }
+
+    read(2, buffer);
+    v.Load(buffer + 0x04);
+
+    if (v.storage_type != VOLUME_HEADER)
+    {
+        problem(BadVolume, 2, "", "no volume header (storage type $%x)", v.storage_type);
+        return _problems.size();
+    }
+
+    _volumeName = v.volume_name;
+    _blocks = v.total_blocks;
+
+    if (_blocks > _device->blocks())
+    {
+        problem(BadVolume, 2, "/" + _volumeName, "volume size (%u blocks) is larger than the device (%u blocks)",
+            _blocks, _device->blocks());
+        _blocks = _device->blocks();
+    }
+
+    _owners.assign(_blocks, 0);
+
+    unsigned boot = owner("<boot>");
+    claim(0, boot);
+    claim(1, boot);
+
+    checkBitmap(v.bit_map_pointer);
+
+    Directory root;
+    root.key = 2;
+    root.blocksUsed = 0;
+    root.path = "/" + _volumeName;
+
+    pending.push_back(root);
+
+    // depth first, w/o recursion.
+    while (!pending.empty())
+    {
+        Directory dir = pending.back();
+        pending.pop_back();
+
+        checkDirectory(dir, &pending);
+    }
+
+    compareBitmap();
+
+    return _problems.size();
+}
+
+
+void Fsck::checkDirectory(const Directory &dir, std::vector<Directory> *pending)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    unsigned id = owner(dir.path);
+    unsigned block = dir.key;
+    unsigned count = 0;
+    unsigned fileCount = 0;
+    unsigned entryLength = 0;
+    unsigned entriesPerBlock = 0;
+    unsigned dirBlocks = 0;
+    bool ok = true;
+
+    ++_directories;
+
+    for (unsigned index = 1; ; index = 0)
+    {
+        if (!claim(block, id))
+        {
+            ok = false;
+            break;
+        }
+
+        ++dirBlocks;
+        read(block, buffer);
+
+        if (block == dir.key)
+        {
+            // header entry.
+            unsigned storageType = buffer[0x04] >> 4;
+
+            if (dir.key == 2)
+            {
+                VolumeEntry v;
+                v.Load(buffer + 0x04);
+
+                fileCount = v.file_count;
+                entryLength = v.entry_length;
+                entriesPerBlock = v.entries_per_block;
+            }
+            else
+            {
+                SubdirEntry s;
+                s.Load(buffer + 0x04);
+
+                if (storageType != SUBDIR_HEADER)
+                {
+                    problem(BadStorageType, block, dir.path, "directory header has storage type $%x", storageType);
+                    return;
+                }
+
+                fileCount = s.file_count;
+                entryLength = s.entry_length;
+                entriesPerBlock = s.entries_per_block;
+            }
+
+            if (entryLength < FILE_ENTRY_SIZE || entriesPerBlock == 0 || 4 + entryLength * entriesPerBlock > BLOCK_SIZE)
+            {
+                problem(BadStorageType, block, dir.path, "invalid directory geometry (entry length %u, %u entries per block)",
+                    entryLength, entriesPerBlock);
+                return;
+            }
+        }
+
+        for ( ; index < entriesPerBlock; ++index)
+        {
+            unsigned offset = 0x04 + index * entryLength;
+            unsigned storageType = buffer[offset] >> 4;
+
+            if (storageType == DELETED_FILE) continue;
+
+            ++count;
+
+            FileEntry e;
+            e.Load(buffer + offset);
+            e.address = (block << 9) + offset;
+
+            std::string path = dir.path + "/" + e.file_name;
+
+            switch (storageType)
+            {
+                case DIRECTORY_FILE:
+                {
+                    Directory d;
+                    d.key = e.key_pointer;
+                    d.blocksUsed = e.blocks_used;
+                    d.path = path;
+
+                    pending->push_back(d);
+                    break;
+                }
+
+                case SEEDLING_FILE:
+                case SAPLING_FILE:
+                case TREE_FILE:
+                case PASCAL_FILE:
+                case EXTENDED_FILE:
+                    checkFile(e, path);
+                    break;
+
+                default:
+                    problem(BadStorageType, block, path, "invalid storage type $%x", storageType);
+                    break;
+            }
+        }
+
+        block = Read16(buffer + 0x02);
+        if (!block) break;
+    }
+
+    // if the chain was broken, the counts are meaningless.
+    if (!ok) return;
+
+    if (count != fileCount)
+    {
+        problem(FileCount, dir.key, dir.path, "header file count is %u, found %u", fileCount, count);
+    }
+
+    if (dir.blocksUsed && dir.blocksUsed != dirBlocks)
+    {
+        problem(BlocksUsed, dir.key, dir.path, "blocks used is %u, found %u", dir.blocksUsed, dirBlocks);
+    }
+}
+
+
+void Fsck::checkFile(const FileEntry &e, const std::string &path)
+{
+    unsigned id = owner(path);
+    unsigned used = 0;
+
+    ++_files;
+
+    switch (e.storage_type)
+    {
+        case EXTENDED_FILE:
+        {
+            uint8_t buffer[BLOCK_SIZE];
+
+            used = 1;
+            if (!claim(e.key_pointer, id)) return;
+
+            read(e.key_pointer, buffer);
+
+            ExtendedEntry ee;
+            ee.Load(buffer);
+
+            used += checkFork(ee.dataFork.storage_type, ee.dataFork.key_block, ee.dataFork.eof, id);
+            used += checkFork(ee.resourceFork.storage_type, ee.resourceFork.key_block, ee.resourceFork.eof, id);
+            break;
+        }
+
+        case PASCAL_FILE:
+            // pascal area -- a contiguous range of blocks.
+            for (unsigned i = 0; i < e.blocks_used; ++i)
+            {
+                if (!claim(e.key_pointer + i, id)) break;
+            }
+            return;
+
+        default:
+            used = checkFork(e.storage_type, e.key_pointer, e.eof, id);
+            break;
+    }
+
+    if (used != e.blocks_used)
+    {
+        problem(BlocksUsed, e.address >> 9, path, "blocks used is %u, found %u", e.blocks_used, used);
+    }
+}
+
+
+/*
+ * returns the number of blocks referenced.  The eof must be within
+ * the range of the index, and there must not be any data blocks past
+ * the eof (block 0 is always allocated.)
+ */
+unsigned Fsck::checkFork(unsigned storageType, unsigned keyBlock, uint32_t eof, unsigned owner)
+{
+    unsigned count;
+    unsigned end = 1;
+    unsigned levels;
+
+    switch (storageType)
+    {
+        case SEEDLING_FILE:
+            claim(keyBlock, owner);
+            count = 1;
+            levels = 0;
+            break;
+
+        case SAPLING_FILE:
+            count = checkIndex(keyBlock, 1, owner, 0, &end);
+            levels = 1;
+            break;
+
+        case TREE_FILE:
+            count = checkIndex(keyBlock, 2, owner, 0, &end);
+            levels = 2;
+            break;
+
+        default:
+            problem(BadStorageType, keyBlock, _ownerNames[owner - 1], "invalid fork storage type $%x", storageType);
+            return 0;
+    }
+
+    uint32_t eofBlocks = (eof + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if (eofBlocks > (1u << (8 * levels)))
+    {
+        problem(BadEof, keyBlock, _ownerNames[owner - 1], "eof $%x is beyond the end of the index", eof);
+    }
+    else if (end > std::max(eofBlocks, (uint32_t)1))
+    {
+        problem(BadEof, keyBlock, _ownerNames[owner - 1], "eof is $%x, data blocks allocated to $%x",
+            eof, end * BLOCK_SIZE);
+    }
+
+    return count;
+}
+
+
+/*
+ * first is the data block number of the first entry.  end is set to
+ * one past the last data block referenced.
+ */
+unsigned Fsck::checkIndex(unsigned block, unsigned level, unsigned owner, unsigned first, unsigned *end)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    unsigned count = 1;
+    unsigned span = level == 1 ? 1 : 256;
+
+    if (!claim(block, owner)) return count;
+
+    read(block, buffer);
+
+    for (unsigned i = 0; i < 256; ++i)
+    {
+        unsigned p = buffer[i] | (buffer[256 + i] << 8);
+
+        if (!p) continue;
+
+        if (level == 1)
+        {
+            claim(p, owner);
+            ++count;
+            *end = std::max(*end, first + i + 1);
+        }
+        else
+        {
+            count += checkIndex(p, level - 1, owner, first + i * span, end);
+        }
+    }
+
+    return count;
+}
+
+
+void Fsck::checkBitmap(unsigned bitmapPointer)
+{
+    unsigned id = owner("<bitmap>");
+    unsigned bitmapBlocks = (_blocks + 4095) / 4096;
+
+    _bitmapPointer = bitmapPointer;
+
+    for (unsigned i = 0; i < bitmapBlocks; ++i)
+    {
+        if (!claim(bitmapPointer + i, id))
+        {
+            _bitmapPointer = 0;
+            return;
+        }
+    }
+}
+
+
+/*
+ * report runs of leaked (allocated but unowned) and unallocated (owned but
+ * marked free) blocks.
+ */
+void Fsck::compareBitmap()
+{
+    if (!_bitmapPointer) return;
+
+    Device::BlockCachePointer cache = _device->createBlockCache();
+    Bitmap bitmap(cache.get(), _bitmapPointer, _blocks);
+
+    _freeBlocks = bitmap.freeBlocks();
+
+    unsigned runType = 0;
+    unsigned runStart = 0;
+
+    for (unsigned block = 0; block <= _blocks; ++block)
+    {
+        unsigned type = 0;
+
+        if (block < _blocks)
+        {
+            bool owned = _owners[block] != 0;
+            bool free = bitmap.isFree(block);
+
+            if (owned && free) type = NotAllocated;
+            if (!owned && !free) type = Leaked;
+        }
+
+        if (type == runType) continue;
+
+        if (runType == Leaked)
+        {
+            problem(Leaked, runStart, "", "blocks %u-%u are marked in use but not referenced", runStart, block - 1);
+        }
+        if (runType == NotAllocated)
+        {
+            problem(NotAllocated, runStart, _ownerNames[_owners[runStart] - 1],
+                "blocks %u-%u are in use but marked free", runStart, block - 1);
+        }
+
+        runType = type;
+        runStart = block;
+    }
+}
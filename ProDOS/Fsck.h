@@ -0,0 +1,114 @@
+#ifndef __PRODOS_FSCK_H__
+#define __PRODOS_FSCK_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Device/BlockDevice.h>
+#include <ProDOS/File.h>
+
+
+namespace ProDOS {
+
+/*
+ * Read-only volume verification.
+ *
+ * Every directory chain and index tree is walked and each block is
+ * assigned an owner (the path of the file or directory which references
+ * it).  The ownership map is then compared with the volume bitmap.
+ *
+ * Nothing is repaired.
+ */
+
+class Fsck {
+public:
+
+    enum ProblemType {
+        BadVolume = 1,
+        OutOfRange,
+        DoubleAllocated,
+        CyclicChain,
+        BadStorageType,
+        FileCount,
+        BlocksUsed,
+        Leaked,
+        NotAllocated,
+        BadEof
+    };
+
+    struct Problem {
+        unsigned type;
+        unsigned block;
+        std::string path;
+        std::string message;
+    };
+
+    static const char *ProblemName(unsigned type);
+
+    Fsck(Device::BlockDevicePointer device);
+    ~Fsck();
+
+    // returns the number of problems found.
+    unsigned check();
+
+    const std::vector<Problem> &problems() const { return _problems; }
+
+    const std::string &volumeName() const { return _volumeName; }
+
+    // after check(), the file or directory which uses a block (NULL if none.)
+    const char *blockOwner(unsigned block) const;
+
+    unsigned blocks() const { return _blocks; }
+    unsigned freeBlocks() const { return _freeBlocks; }
+    unsigned ownedBlocks() const { return _ownedBlocks; }
+    unsigned files() const { return _files; }
+    unsigned directories() const { return _directories; }
+
+private:
+
+    Fsck(const Fsck &);
+    Fsck& operator=(const Fsck &);
+
+    struct Directory {
+        unsigned key;
+        unsigned blocksUsed;
+        std::string path;
+    };
+
+    void problem(unsigned type, unsigned block, const std::string &path, const char *format, ...);
+
+    unsigned owner(const std::string &path);
+    bool claim(unsigned block, unsigned owner);
+
+    void checkDirectory(const Directory &dir, std::vector<Directory> *pending);
+    void checkFile(const FileEntry &e, const std::string &path);
+    unsigned checkFork(unsigned storageType, unsigned keyBlock, uint32_t eof, unsigned owner);
+    unsigned checkIndex(unsigned block, unsigned level, unsigned owner, unsigned first, unsigned *end);
+
+    void checkBitmap(unsigned bitmapPointer);
+    void compareBitmap();
+
+    void read(unsigned block, void *buffer);
+
+    Device::BlockDevicePointer _device;
+
+    std::vector<uint32_t> _owners;
+    std::vector<std::string> _ownerNames;
+
+    std::vector<Problem> _problems;
+
+    std::string _volumeName;
+
+    unsigned _blocks;
+    unsigned _bitmapPointer;
+    unsigned _freeBlocks;
+    unsigned _ownedBlocks;
+    unsigned _files;
+    unsigned _directories;
+};
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+
+#include <cctype>
+#include <cstring>
+
+#include <ProDOS/MetadataCache.h>
+#include <ProDOS/common.h>
+
+using namespace ProDOS;
+
+
+MetadataCache::MetadataCache(DiskPointer disk) :
+    _disk(disk),
+    _generation(0)
+{
+}
+
+MetadataCache::~MetadataCache()
+{
+}
+
+
+std::string MetadataCache::NormalizeName(const char *name)
+{
+    std::string s(name);
+    
+    for (std::string::iterator iter = s.begin(); iter != s.end(); ++iter)
+        *iter = std::toupper(*iter);
+    
+    return s;
+}
+
+
+int MetadataCache::loadDirectory(unsigned key, Directory *dir)
+{
+    int ok;
+    
+    if (key == 2)
+    {
+        VolumeEntry v;
+        ok = _disk->ReadVolume(&v, &dir->files);
+    }
+    else
+    {
+        SubdirEntry s;
+        ok = _disk->ReadDirectory(key, &s, &dir->files);
+    }
+    if (ok < 0) return ok;
+    
+    for (unsigned i = 0; i < dir->files.size(); ++i)
+    {
+        dir->names[NormalizeName(dir->files[i].file_name)] = i;
+    }
+    
+    return 1;
+}
+
+
+/*
+ * returns the directory contents, loading (and caching) it if necessary.
+ * if files is NULL, the directory is only loaded.
+ */
+int MetadataCache::directory(unsigned key, std::vector<FileEntry> *files)
+{
+    unsigned generation;
+
+    {
+        Locker locker(_lock);
+        std::map<unsigned, Directory>::iterator iter = _directories.find(key);
+        
+        if (iter != _directories.end())
+        {
+            if (files) *files = iter->second.files;
+            return 1;
+        }
+
+        generation = _generation;
+    }
+    
+    // not cached, load it w/o the lock held.
+    // if another thread loaded it in the mean time, the first one wins.
+    Directory dir;
+    int ok = loadDirectory(key, &dir);
+    if (ok < 0) return ok;
+    
+    Locker locker(_lock);
+    
+    if (files) *files = dir.files;
+
+    // invalidated while loading; this copy may be stale.
+    if (generation != _generation) return 1;
+
+    std::vector<FileEntry>::iterator iter;
+    for (iter = dir.files.begin(); iter != dir.files.end(); ++iter)
+    {
+        _entries[iter->address] = *iter;
+    }
+    
+    _directories.insert(std::make_pair(key, dir));
+    
+    return 1;
+}
+
+
+/*
+ * find a file in a directory via the name index.
+ * returns -1 if not found.
+ */
+int MetadataCache::lookup(unsigned key, const char *name, FileEntry *entry)
+{
+    int ok;
+    
+    for (unsigned pass = 0; pass < 2; ++pass)
+    {
+        {
+            Locker locker(_lock);
+            std::map<unsigned, Directory>::iterator iter = _directories.find(key);
+            
+            if (iter != _directories.end())
+            {
+                Directory &dir = iter->second;
+                std::map<std::string, unsigned>::iterator ni = dir.names.find(NormalizeName(name));
+                
+                if (ni == dir.names.end()) return -1;
+                
+                if (entry) *entry = dir.files[ni->second];
+                return 1;
+            }
+        }
+        
+        ok = directory(key, NULL);
+        if (ok < 0) return ok;
+    }
+    
+    return -1;
+}
+
+
+/*
+ * inode table look up.  Falls back to loading the entry from disk.
+ */
+int MetadataCache::entry(uint32_t address, FileEntry *entry)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    unsigned generation;
+    int ok;
+    
+    {
+        Locker locker(_lock);
+        std::map<uint32_t, FileEntry>::iterator iter = _entries.find(address);
+        
+        if (iter != _entries.end())
+        {
+            if (entry) *entry = iter->second;
+            return 1;
+        }
+
+        generation = _generation;
+    }
+    
+    ok = _disk->Read(address >> 9, buffer);
+    if (ok < 0) return ok;
+    
+    FileEntry e;
+    e.Load(buffer + (address & 0x1ff));
+    e.address = address;
+    
+    Locker locker(_lock);
+    if (generation == _generation) _entries[address] = e;
+    
+    if (entry) *entry = e;
+    
+    return 1;
+}
+
+
+/*
+ * extent map for the data fork.
+ */
+int MetadataCache::extents(uint32_t address, ExtentList *extents)
+{
+    unsigned generation;
+    int ok;
+    
+    {
+        Locker locker(_lock);
+        std::map<uint32_t, ExtentList>::iterator iter = _extents.find(address);
+        
+        if (iter != _extents.end())
+        {
+            if (extents) *extents = iter->second;
+            return 1;
+        }
+
+        generation = _generation;
+    }
+    
+    FileEntry e;
+    ExtentList list;
+    
+    ok = entry(address, &e);
+    if (ok < 0) return ok;
+    
+    if (e.storage_type == EXTENDED_FILE)
+    {
+        ok = _disk->Normalize(e, 0);
+        if (ok < 0) return ok;
+    }
+    
+    ok = _disk->ReadExtents(e, &list);
+    if (ok < 0) return ok;
+    
+    Locker locker(_lock);
+    
+    if (extents) *extents = list;
+    if (generation == _generation) _extents[address].swap(list);
+    
+    return 1;
+}
+
+
+bool MetadataCache::hasDirectory(unsigned key)
+{
+    Locker locker(_lock);
+    return _directories.find(key) != _directories.end();
+}
+
+bool MetadataCache::hasExtents(uint32_t address)
+{
+    Locker locker(_lock);
+    return _extents.find(address) != _extents.end();
+}
+
+
+void MetadataCache::invalidate()
+{
+    Locker locker(_lock);
+    
+    ++_generation;
+    _directories.clear();
+    _entries.clear();
+    _extents.clear();
+}
+
+void MetadataCache::invalidateDirectory(unsigned key)
+{
+    Locker locker(_lock);
+    
+    ++_generation;
+    _directories.erase(key);
+}
+
+void MetadataCache::invalidateEntry(uint32_t address)
+{
+    Locker locker(_lock);
+    
+    ++_generation;
+    _entries.erase(address);
+    _extents.erase(address);
+}
+
+
+unsigned MetadataCache::directoryCount()
+{
+    Locker locker(_lock);
+    return _directories.size();
+}
+
+unsigned MetadataCache::entryCount()
+{
+    Locker locker(_lock);
+    return _entries.size();
+}
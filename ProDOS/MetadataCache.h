@@ -0,0 +1,79 @@
+#ifndef __PRODOS_METADATACACHE_H__
+#define __PRODOS_METADATACACHE_H__
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <ProDOS/Disk.h>
+#include <Common/Lock.h>
+
+
+namespace ProDOS {
+
+/*
+ * In-memory copy of the directory structure.
+ *
+ * directories are keyed by their key block (2 is the volume directory).
+ * Each directory has a (case insensitive) name index.
+ * The inode table maps an entry address (the fuse inode) to the entry.
+ * Extent maps are keyed by the entry address and cover the data fork.
+ *
+ * Everything is loaded on demand, so the cache works with or without
+ * the warm-up Scanner.  All methods are thread safe; the disk is never
+ * read with the lock held.  Every invalidation bumps a generation, and
+ * a load which raced with one is returned but not cached.
+ */
+
+class MetadataCache {
+public:
+    
+    MetadataCache(DiskPointer disk);
+    ~MetadataCache();
+    
+    DiskPointer disk() const { return _disk; }
+    
+    int directory(unsigned key, std::vector<FileEntry> *files);
+    int lookup(unsigned key, const char *name, FileEntry *entry);
+    
+    int entry(uint32_t address, FileEntry *entry);
+    int extents(uint32_t address, ExtentList *extents);
+    
+    bool hasDirectory(unsigned key);
+    bool hasExtents(uint32_t address);
+    
+    void invalidate();
+    void invalidateDirectory(unsigned key);
+    void invalidateEntry(uint32_t address);
+    
+    unsigned directoryCount();
+    unsigned entryCount();
+    
+private:
+    
+    MetadataCache(const MetadataCache &);
+    MetadataCache& operator=(const MetadataCache &);
+    
+    struct Directory {
+        std::vector<FileEntry> files;
+        std::map<std::string, unsigned> names;
+    };
+    
+    int loadDirectory(unsigned key, Directory *dir);
+    
+    static std::string NormalizeName(const char *name);
+    
+    DiskPointer _disk;
+    
+    Lock _lock;
+    unsigned _generation;
+    std::map<unsigned, Directory> _directories;
+    std::map<uint32_t, FileEntry> _entries;
+    std::map<uint32_t, ExtentList> _extents;
+};
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+
+#include <cstdio>
+
+#include <ProDOS/Scanner.h>
+#include <ProDOS/common.h>
+
+using namespace ProDOS;
+
+
+Scanner::Scanner(MetadataCache *cache, unsigned threads) :
+    _cache(cache),
+    _pool(threads)
+{
+    _pending = 0;
+    _directories = 0;
+    _files = 0;
+    _errors = 0;
+    _verbose = false;
+    
+    ::gettimeofday(&_start, NULL);
+}
+
+Scanner::~Scanner()
+{
+    // ThreadPool destructor discards anything still queued and joins.
+}
+
+
+void Scanner::start()
+{
+    ::gettimeofday(&_start, NULL);
+    schedule(2, false);
+}
+
+
+/*
+ * called when a directory is accessed.  If it (or its children) are
+ * still waiting to be scanned, move them to the front of the line.
+ */
+void Scanner::prioritize(unsigned key)
+{
+    std::vector<FileEntry> files;
+    
+    if (done()) return;
+    
+    schedule(key, true);
+    
+    // if the directory is already loaded, bump the subdirectories as well.
+    if (!_cache->hasDirectory(key)) return;
+    if (_cache->directory(key, &files) < 0) return;
+    
+    for (std::vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
+    {
+        if (iter->storage_type == DIRECTORY_FILE)
+            schedule(iter->key_pointer, true);
+    }
+}
+
+
+void Scanner::schedule(unsigned key, bool priority)
+{
+    Locker locker(_lock);
+    
+    // each directory is only scanned once (also prevents directory loops.)
+    if (!_queued.insert(key).second)
+    {
+        std::map<unsigned, bool>::iterator iter = _waiting.find(key);
+        
+        if (!priority || iter == _waiting.end() || iter->second) return;
+        
+        iter->second = true;
+        _pool.enqueue(std::bind(&Scanner::scan, this, key), true);
+        return;
+    }
+    
+    ++_pending;
+    _waiting[key] = priority;
+    _pool.enqueue(std::bind(&Scanner::scan, this, key), priority);
+}
+
+
+void Scanner::scan(unsigned key)
+{
+    std::vector<FileEntry> files;
+    unsigned fileCount = 0;
+    unsigned errors = 0;
+    int ok;
+    
+    {
+        Locker locker(_lock);
+        
+        // the other copy of a prioritized directory already ran.
+        if (!_waiting.erase(key)) return;
+    }
+    
+    ok = _cache->directory(key, &files);
+    if (ok < 0) ++errors;
+    
+    for (std::vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
+    {
+        switch (iter->storage_type)
+        {
+            case DIRECTORY_FILE:
+                schedule(iter->key_pointer, false);
+                break;
+                
+            case SEEDLING_FILE:
+            case SAPLING_FILE:
+            case TREE_FILE:
+            case EXTENDED_FILE:
+                ++fileCount;
+                if (_cache->extents(iter->address, NULL) < 0) ++errors;
+                break;
+        }
+    }
+    
+    Locker locker(_lock);
+    
+    ++_directories;
+    _files += fileCount;
+    _errors += errors;
+    
+    if (--_pending == 0 && _verbose)
+    {
+        struct timeval now;
+        double elapsed;
+        
+        ::gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - _start.tv_sec) + (now.tv_usec - _start.tv_usec) / 1000000.0;
+        
+        std::fprintf(stderr, "warm-up: %u directories, %u files, %u errors in %.3f seconds (%u threads)\n",
+            _directories, _files, _errors, elapsed, _pool.threads());
+    }
+}
+
+
+void Scanner::wait()
+{
+    _pool.wait();
+}
+
+bool Scanner::done()
+{
+    Locker locker(_lock);
+    return _pending == 0 && !_queued.empty();
+}
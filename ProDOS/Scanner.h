@@ -0,0 +1,70 @@
+#ifndef __PRODOS_SCANNER_H__
+#define __PRODOS_SCANNER_H__
+
+#include <map>
+#include <set>
+
+#include <sys/time.h>
+
+#include <ProDOS/MetadataCache.h>
+#include <Common/ThreadPool.h>
+#include <Common/Lock.h>
+
+
+namespace ProDOS {
+
+/*
+ * Background warm-up of the MetadataCache.
+ *
+ * Starting at the volume directory, each directory is one task; it loads
+ * the directory, builds the extent maps for its files and queues its
+ * subdirectories.  Requests are never blocked by the scanner -- the cache
+ * loads anything not yet scanned on demand.  prioritize() moves a
+ * directory to the front of the queue when it's accessed; a directory
+ * already in the queue is queued again at the front, and whichever task
+ * runs second does nothing.
+ */
+
+class Scanner {
+public:
+    
+    Scanner(MetadataCache *cache, unsigned threads = 0);
+    ~Scanner();
+    
+    void start();
+    void prioritize(unsigned key);
+    
+    void wait();
+    bool done();
+    
+    void setVerbose(bool verbose) { _verbose = verbose; }
+    
+private:
+    
+    Scanner(const Scanner &);
+    Scanner& operator=(const Scanner &);
+    
+    void schedule(unsigned key, bool priority);
+    void scan(unsigned key);
+    
+    MetadataCache *_cache;
+    ThreadPool _pool;
+    
+    Lock _lock;
+    std::set<unsigned> _queued;
+    
+    // queued but not started -> moved to the front already.
+    std::map<unsigned, bool> _waiting;
+    
+    unsigned _pending;
+    unsigned _directories;
+    unsigned _files;
+    unsigned _errors;
+    bool _verbose;
+    
+    struct timeval _start;
+};
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+
+#include <algorithm>
+
+#include <ProDOS/VisitedSet.h>
+
+using namespace ProDOS;
+
+
+VisitedSet::VisitedSet(unsigned blocks) :
+    _stamps(blocks, 0)
+{
+    _generation = 1;
+}
+
+
+void VisitedSet::reset()
+{
+    if (++_generation == 0)
+    {
+        std::fill(_stamps.begin(), _stamps.end(), 0);
+        _generation = 1;
+    }
+}
+
+
+bool VisitedSet::insert(unsigned block)
+{
+    // out of range blocks are caught by Disk::Read.
+    if (block >= _stamps.size()) return true;
+    
+    if (_stamps[block] == _generation) return false;
+    
+    _stamps[block] = _generation;
+    return true;
+}
+
+bool VisitedSet::contains(unsigned block) const
+{
+    if (block >= _stamps.size()) return false;
+    
+    return _stamps[block] == _generation;
+}
@@ -0,0 +1,39 @@
+#ifndef __PRODOS_VISITEDSET_H__
+#define __PRODOS_VISITEDSET_H__
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace ProDOS {
+
+/*
+ * Set of visited blocks, used for cycle detection.
+ *
+ * Each block has a generation stamp so reset() is O(1) (the table is
+ * only cleared when the generation wraps).  Sized once per volume and
+ * reused, so walks don't allocate.
+ */
+
+class VisitedSet {
+public:
+    
+    VisitedSet(unsigned blocks);
+    
+    void reset();
+    
+    // returns false if the block was already visited.
+    bool insert(unsigned block);
+    bool contains(unsigned block) const;
+    
+    unsigned blocks() const { return _stamps.size(); }
+    
+private:
+    
+    std::vector<uint16_t> _stamps;
+    uint16_t _generation;
+};
+
+}
+
+#endif
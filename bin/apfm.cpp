@@ -10,17 +10,22 @@
 #include <cstdlib>
 #include <cstdarg>
 #include <cerrno>
+#include <cctype>
 
 #include <algorithm>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <unistd.h>
 #include <strings.h>
+#include <fnmatch.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <Pascal/Pascal.h>
 #include <Pascal/Date.h>
-#include <Pascal/TextWriter.h>
 
 #include <Device/Device.h>
 #include <Device/BlockDevice.h>
@@ -28,6 +33,8 @@
 #include <File/File.h>
 #include <File/MappedFile.h>
 
+#include <Common/ThreadPool.h>
+
 
 enum commands {
     kCommandLS = 1,
@@ -37,9 +44,13 @@ enum commands {
     kCommandRM,
     kCommandGET,
     kCommandPUT,
-    kCommandKRUNCH
+    kCommandKRUNCH,
+    kCommandBATCH
 };
 
+// commands from a batch script never prompt.
+static bool fBatch = false;
+
 
 void usage()
 {
@@ -66,7 +77,8 @@ void usage()
         "  mv\n"
         "  rm\n"
         "  get\n"
-        "  put\n",
+        "  put\n"
+        "  batch\n",
         stdout
         );
     
@@ -91,10 +103,11 @@ void commandUsage(unsigned command)
         case kCommandKRUNCH:
             text =
             "Move free blocks to the end of the volume.\n\n" 
-            "apfm krunch [-fi]\n"
+            "apfm krunch [-fin]\n"
             "Options:\n"
             "  -f            Force\n"
             "  -i            Interactive\n"
+            "  -n            Dry run.  List the blocks which would be moved.\n"
             ;
             break;
             
@@ -115,6 +128,16 @@ void commandUsage(unsigned command)
             ;
             break;            
             
+        case kCommandRM:
+            text =
+            "Remove files.\n\n"
+            "apfm rm [-fi] file ...\n"
+            "Options:\n"
+            "  -f            Force (a missing file isn't an error)\n"
+            "  -i            Interactive\n"
+            ;
+            break;
+            
         case kCommandMV:
             text =
             "Rename a file.\n\n"
@@ -129,7 +152,11 @@ void commandUsage(unsigned command)
             text =
             "Copy a file from the Pascal volume to the native file system.\n\n"
             "apfm get [-fi] source [target]\n"
+            "apfm get -a [-fi] [-d directory] [-j jobs] [pattern ...]\n"
             "Options:\n"
+            "  -a            Get every file (or every file matching a pattern)\n"
+            "  -d directory  Directory for -a (default: current directory)\n"
+            "  -j jobs       Number of files written in parallel with -a\n"
             "  -f            Force\n"
             "  -i            Interactive\n"
             ;
@@ -138,10 +165,12 @@ void commandUsage(unsigned command)
         case kCommandPUT:
             text =
             "Copy a file from the native file system to the Pascal volume.\n\n"
-            "apfm put [-fi] source [target]\n"
+            "apfm put [-fiv] [-t type] source [target]\n"
+            "apfm put [-fiv] [-t type] source ...\n"
             "Options:\n"
             "  -f            Force\n"
             "  -i            Interactive\n"
+            "  -v            Print the import rate\n"
             "  -t type       Set the file type.  Valid values:\n"
             "                  code\n"
             "                  data\n"
@@ -151,6 +180,19 @@ void commandUsage(unsigned command)
             "                  text\n"
             ;
             break;
+            
+        case kCommandBATCH:
+            text =
+            "Run commands from a script (or stdin) with the volume opened once.\n"
+            "Each line is a command and its arguments; # starts a comment.\n"
+            "The volume is synced when the script ends.\n\n"
+            "apfm batch [-akv] [script]\n"
+            "Options:\n"
+            "  -a            All or nothing (undo every change if a command fails)\n"
+            "  -k            Keep going after a command fails\n"
+            "  -v            Print each command\n"
+            ;
+            break;
     }
     
     std::fputs(text, stdout);
@@ -182,6 +224,8 @@ unsigned command(const char *command)
 
     if (!::strcasecmp(command, "krunch")) return kCommandKRUNCH;    
 
+    if (!::strcasecmp(command, "batch")) return kCommandBATCH;
+
     
     return -1;
 }
@@ -195,6 +239,7 @@ File::FileFlags commandFlags(unsigned command)
         case kCommandRM:
         case kCommandMV:
         case kCommandCP:
+        case kCommandBATCH:
             return File::ReadWrite;
         default:
             return File::ReadOnly;
@@ -221,6 +266,21 @@ bool yes_or_no(const char *format, ...)
 	return (first == 'y' || first == 'Y');
 }
 
+static bool interactive()
+{
+    return !fBatch && ::isatty(STDIN_FILENO);
+}
+
+static void resetGetopt()
+{
+    #ifdef __linux__
+    optind = 0;
+    #else
+    optreset = 1;
+    optind = 1;
+    #endif
+}
+
 
 const char *MonthName(unsigned m)
 {
@@ -446,7 +506,7 @@ int action_cat(unsigned argc, char **argv, Pascal::VolumeEntry *volume)
 int action_mv(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // mv src dest
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
     int c;
     
     while ((c = ::getopt(argc, argv, "fih")) != -1)
@@ -497,7 +557,11 @@ int action_mv(int argc, char **argv, Pascal::VolumeEntry *volume)
         }        
     }
     
-    volume->rename(source, dest);
+    if (volume->rename(source, dest) != 0)
+    {
+        std::fprintf(stderr, "apfm mv: %s: %s\n", dest, std::strerror(errno));
+        return -1;
+    }
     
     return 0;
 }
@@ -506,7 +570,7 @@ int action_cp(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // cp src dest
     
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
     int c;
     
     while ((c = ::getopt(argc, argv, "fih")) != -1)
@@ -557,7 +621,11 @@ int action_cp(int argc, char **argv, Pascal::VolumeEntry *volume)
         }        
     }
     
-    volume->copy(source, dest);
+    if (volume->copy(source, dest) != 0)
+    {
+        std::fprintf(stderr, "apfm cp: %s: %s\n", dest, std::strerror(errno));
+        return -1;
+    }
     
     return 0;
 }
@@ -566,7 +634,8 @@ int action_rm(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // rm file [file ....]
     
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
+    bool fFlag = false;
     int c;
     
     while ((c = ::getopt(argc, argv, "fih")) != -1)
@@ -574,9 +643,11 @@ int action_rm(int argc, char **argv, Pascal::VolumeEntry *volume)
         switch(c)
         {
             case 'f':
+                fFlag = true;
                 iFlag = false;
                 break;
             case 'i':
+                fFlag = false;
                 iFlag = true;
                 break;
                 
@@ -591,14 +662,18 @@ int action_rm(int argc, char **argv, Pascal::VolumeEntry *volume)
     argc -= optind;
     argv += optind;
     
-    // TODO -- catch errors ?
+    int rv = 0;
+    
     for (int i = 0; i < argc; ++i)
     {
         Pascal::FileEntryPointer e = volume->fileByName(argv[i]);
         
         if (!e)
         {
-            if (iFlag) std::fprintf(stderr, "apfm rm: %s: No such file.\n", argv[i]);
+            if (fFlag) continue;
+            
+            std::fprintf(stderr, "apfm rm: %s: No such file.\n", argv[i]);
+            rv = -1;
             continue;
         }
         
@@ -608,9 +683,13 @@ int action_rm(int argc, char **argv, Pascal::VolumeEntry *volume)
             if (!ok) continue;
         }
               
-        volume->unlink(argv[i]);
+        if (volume->unlink(argv[i]) != 0)
+        {
+            std::fprintf(stderr, "apfm rm: %s: %s\n", argv[i], std::strerror(errno));
+            rv = -1;
+        }
     }
-    return 0;
+    return rv;
     
 }
 
@@ -618,13 +697,17 @@ int action_krunch(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // compress file to remove gaps.
     
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
+    bool nFlag = false;
     int c;
     
-    while ((c = ::getopt(argc, argv, "fih")) != -1)
+    while ((c = ::getopt(argc, argv, "fihn")) != -1)
     {
         switch(c)
         {
+            case 'n':
+                nFlag = true;
+                break;
             case 'f':
                 iFlag = false;
                 break;
@@ -645,6 +728,28 @@ int action_krunch(int argc, char **argv, Pascal::VolumeEntry *volume)
     
 
     
+    if (nFlag)
+    {
+        std::vector<Pascal::VolumeEntry::KrunchMove> plan;
+        std::vector<Pascal::VolumeEntry::KrunchMove>::iterator iter;
+        
+        unsigned gaps;
+        unsigned blocks = volume->krunchPlan(plan, &gaps);
+        
+        for (iter = plan.begin(); iter != plan.end(); ++iter)
+        {
+            std::printf("%-15s %5u -> %5u  %5u blocks\n",
+                iter->file->name(),
+                iter->from, iter->to, iter->blocks);
+        }
+        std::printf("%u blocks moved.\n", blocks);
+        
+        if (gaps)
+            std::printf("%u free blocks left in place (no room to move a file safely.)\n", gaps);
+        
+        return 0;
+    }
+
     if (!volume->canKrunch())
     {
         if (iFlag)
@@ -659,12 +764,143 @@ int action_krunch(int argc, char **argv, Pascal::VolumeEntry *volume)
         if (!ok) return -1;
     }
     
-    volume->krunch();
+    unsigned gaps;
+    
+    if (volume->krunch(&gaps) != 0)
+    {
+        std::fprintf(stderr, "apfm krunch: Volume is damaged.\n");
+        return -1;
+    }
+    
+    if (gaps)
+        std::fprintf(stderr, "apfm krunch: %u free blocks left in place (no room to move a file safely.)\n", gaps);
+    
     return 0;
 }
 
 
 
+typedef SHARED_PTR(std::vector<uint8_t>) BufferPointer;
+
+// read the whole file at once (text pages are only decoded once.)
+static BufferPointer readFile(Pascal::FileEntryPointer entry)
+{
+    BufferPointer buffer = MAKE_SHARED(std::vector<uint8_t>);
+    unsigned fileSize = entry->fileSize();
+    
+    if (fileSize)
+    {
+        buffer->resize(fileSize);
+        
+        int count = entry->read(&(*buffer)[0], fileSize, 0);
+        buffer->resize(count > 0 ? count : 0);
+    }
+    
+    return buffer;
+}
+
+static int writeFile(const char *path, const std::vector<uint8_t> &buffer)
+{
+    File file(path, O_WRONLY | O_CREAT | O_TRUNC, 0666, std::nothrow);
+    
+    if (!file.isValid()) return -1;
+    
+    const uint8_t *cp = buffer.empty() ? NULL : &buffer[0];
+    size_t size = buffer.size();
+    
+    while (size)
+    {
+        ssize_t count = ::write(file.fd(), cp, size);
+        
+        if (count < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        cp += count;
+        size -= count;
+    }
+    
+    return 0;
+}
+
+static bool getMatch(const char *name, int argc, char **argv)
+{
+    if (!argc) return true;
+    
+    for (int i = 0; i < argc; ++i)
+    {
+        if (::fnmatch(argv[i], name, FNM_CASEFOLD) == 0) return true;
+    }
+    
+    return false;
+}
+
+static bool firstBlockLess(Pascal::FileEntryPointer a, Pascal::FileEntryPointer b)
+{
+    return a->firstBlock() < b->firstBlock();
+}
+
+static void getWrite(std::string path, BufferPointer buffer, Lock *lock, int *rv)
+{
+    if (writeFile(path.c_str(), *buffer) == 0) return;
+    
+    Locker locker(*lock);
+    
+    std::fprintf(stderr, "apfm get: %s: %s\n", path.c_str(), std::strerror(errno));
+    *rv = -1;
+}
+
+/*
+ * get -a.  Files are read in disk order on this thread; the native
+ * files are written by a thread pool.
+ */
+static int getAll(int argc, char **argv, const char *directory, unsigned jobs, bool iFlag, Pascal::VolumeEntry *volume)
+{
+    std::vector<Pascal::FileEntryPointer> files;
+    std::vector<Pascal::FileEntryPointer>::iterator iter;
+    
+    unsigned fileCount = volume->fileCount();
+    
+    for (unsigned i = 0; i < fileCount; ++i)
+    {
+        Pascal::FileEntryPointer e = volume->fileAtIndex(i);
+        
+        if (e && getMatch(e->name(), argc, argv)) files.push_back(e);
+    }
+    
+    std::stable_sort(files.begin(), files.end(), firstBlockLess);
+    
+    ThreadPool pool(jobs);
+    Lock lock;
+    int rv = 0;
+    
+    for (iter = files.begin(); iter != files.end(); ++iter)
+    {
+        std::string path(directory);
+        
+        if (!path.empty() && path[path.length() - 1] != '/') path.push_back('/');
+        path.append((*iter)->name());
+        
+        if (iFlag)
+        {
+            struct stat st;
+            
+            if (::stat(path.c_str(), &st) == 0 && !yes_or_no("Overwrite %s?", path.c_str()))
+                continue;
+        }
+        
+        BufferPointer buffer = readFile(*iter);
+        
+        pool.enqueue(std::bind(getWrite, path, buffer, &lock, &rv));
+    }
+    
+    pool.wait();
+    
+    return rv;
+}
+
 int action_get(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // get [-f] pascal_file [native file];
@@ -672,13 +908,25 @@ int action_get(int argc, char **argv, Pascal::VolumeEntry *volume)
     char *infile;
     char *outfile;
     
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
+    bool aFlag = false;
+    const char *directory = ".";
+    unsigned jobs = 0;
     int c;
     
-    while ((c = ::getopt(argc, argv, "fih")) != -1)
+    while ((c = ::getopt(argc, argv, "ad:fij:h")) != -1)
     {
         switch(c)
         {
+            case 'a':
+                aFlag = true;
+                break;
+            case 'd':
+                directory = optarg;
+                break;
+            case 'j':
+                jobs = std::strtoul(optarg, NULL, 10);
+                break;
             case 'f':
                 iFlag = false;
                 break;
@@ -697,6 +945,8 @@ int action_get(int argc, char **argv, Pascal::VolumeEntry *volume)
     argc -= optind;
     argv += optind;
     
+    if (aFlag) return getAll(argc, argv, directory, jobs, iFlag, volume);
+    
     Pascal::FileEntryPointer entry;
     
     switch(argc)
@@ -742,41 +992,127 @@ int action_get(int argc, char **argv, Pascal::VolumeEntry *volume)
     
 
     
-    File file(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writeFile(outfile, *readFile(entry)) != 0)
+    {
+        std::fprintf(stderr, "apfm get: %s: %s\n", outfile, std::strerror(errno));
+        return -1;
+    }
     
-    unsigned fileSize = entry->fileSize();
-    unsigned offset = 0;
+    return 0;
+}
+
+// type from the -t flag or the .text/.txt extension.
+static unsigned putType(const char *outfile, unsigned type, bool tFlag)
+{
+    const char *tmp;
+    
+    if (tFlag) return type;
     
-    while (offset < fileSize)
+    tmp = strrchr(outfile, '.');
+    if (tmp)
     {
-        uint8_t buffer[512];
-        
-        unsigned count = std::min(512u, fileSize - offset);
-        entry->read(buffer, count, offset);
-        
-        ::write(file.fd(), buffer, count);
-        offset += count; 
+        if (::strcasecmp(tmp, ".text") == 0 || strcasecmp(tmp, ".txt") == 0)
+            return Pascal::kTextFile;
+    }
+    
+    return type;
+}
+
+static int putCheck(const char *infile, const char *outfile, struct stat *st)
+{
+    if (!Pascal::FileEntry::ValidName(outfile))
+    {
+        std::fprintf(stderr, "apfm put: `%s' is not a valid pascal name.\n", outfile);
+    }
+
+    if (::stat(infile, st) != 0)
+    {
+        std::fprintf(stderr, "apfm put: %s: no such file.\n", infile);
+        return -1;
+    }
+
+    if (!S_ISREG(st->st_mode))
+    {
+        std::fprintf(stderr, "apfm put: %s: not a regular file.\n", infile);
+        return -1;
+    }
+    
+    unsigned blocks = (st->st_size + 511) / 512;
+    if (blocks > (0xffff - 6))
+    {
+        std::fprintf(stderr, "apfm put: %s: file is too large.\n", infile);
+        return -1;
     }
     
     return 0;
 }
 
+// copy a non-text file.  does not sync.
+static int putData(const char *outfile, unsigned type, const void *data, unsigned size, Pascal::VolumeEntry *volume)
+{
+    Pascal::FileEntryPointer entry = volume->create(outfile, (size + 511) / 512);
+    if (!entry)
+    {
+        perror(NULL);
+        return -1;
+    }
+    
+    entry->setFileKind(type);
+            
+    unsigned remaining = size;
+    unsigned offset = 0;
+    const uint8_t *address = (const uint8_t *)data;
+    while (remaining)
+    {
+        int rv;
+        unsigned count = std::min(512u, remaining);
+
+        rv = entry->write(address + offset, count, offset);
+        if (rv == -1)
+        {
+            perror(NULL);
+            return -1;
+        }
+        offset += count;
+        remaining -= count;
+    }
+    
+    return 0;
+}
+
+static const char *baseName(const char *path)
+{
+    const char *tmp = strrchr(path, '/');
+    
+    return tmp ? tmp + 1 : path;
+}
+
+static double now()
+{
+    struct timeval tv;
+    
+    ::gettimeofday(&tv, NULL);
+    
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
 int action_put(int argc, char **argv, Pascal::VolumeEntry *volume)
 {
     // put [-t type] native_file [pascal_file]
+    // put [-t type] native_file ...
     
     unsigned type = Pascal::kUntypedFile;
     
     struct stat st;
     int c;
+    int rv = 0;
     
-    char *infile;
-    char *outfile;
-    char *tmp;
-    bool iFlag = ::isatty(STDIN_FILENO);
+    bool iFlag = interactive();
     bool tFlag = false;
+    bool vFlag = false;
     
-    while ((c = getopt(argc, argv, "fhit:")) != -1)
+    while ((c = getopt(argc, argv, "fhit:v")) != -1)
     {
         switch (c)
         {
@@ -807,6 +1143,9 @@ int action_put(int argc, char **argv, Pascal::VolumeEntry *volume)
             case 'f':
                 iFlag = false;
                 break;
+            case 'v':
+                vFlag = true;
+                break;
             case 'h':
             default:
                 commandUsage(kCommandPUT);
@@ -820,152 +1159,279 @@ int action_put(int argc, char **argv, Pascal::VolumeEntry *volume)
     argc -= optind;
     argv += optind;
     
-    switch (argc)
+    if (argc < 1)
     {
-        case 1:
-            infile = outfile = argv[0];
-            
-            // need to run basename on outfile.
-            tmp = strrchr(outfile, '/');
-            if (tmp) outfile = tmp + 1;
-            break;
-        case 2:
-            infile = argv[0];
-            outfile = argv[1];
-            break;
-        default:
-            commandUsage(kCommandPUT);
-            return -1;
-            break;
+        commandUsage(kCommandPUT);
+        return -1;
     }
     
+    // 2 args is source, target.  Otherwise, targets are the basename.
+    unsigned count = argc == 2 ? 1 : argc;
+    
+    std::vector<Pascal::VolumeEntry::TextImport> text;
+    std::vector<MappedFile *> maps;
+    
+    unsigned files = 0;
+    double bytes = 0;
+    double start = now();
+    
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const char *infile = argv[i];
+        const char *outfile = argc == 2 ? argv[1] : baseName(infile);
+        
+        if (putCheck(infile, outfile, &st) < 0)
+        {
+            rv = -1;
+            continue;
+        }
+        
+        MappedFile *mf = NULL;
+        const void *address = NULL;
+        
+        // can't map an empty file.
+        if (st.st_size)
+        {
+            File file(infile, File::ReadOnly);
+            mf = new MappedFile(file, File::ReadOnly, st.st_size);
+            address = mf->address();
+        }
+        
+        if (putType(outfile, type, tFlag) == Pascal::kTextFile)
+        {
+            // text files are imported together.
+            Pascal::VolumeEntry::TextImport ti;
+            
+            ti.name = outfile;
+            ti.data = address;
+            ti.length = st.st_size;
+            ti.error = 0;
+            
+            text.push_back(ti);
+            if (mf) maps.push_back(mf);
+            continue;
+        }
+        
+        if (putData(outfile, putType(outfile, type, tFlag), address, st.st_size, volume) < 0)
+        {
+            rv = -1;
+        }
+        else
+        {
+            ++files;
+            bytes += st.st_size;
+        }
+        
+        delete mf;
+    }
     
-    // if no tFlag specified, check .text/.txt
-    if (!tFlag)
+    if (!text.empty())
     {
-        tmp = strrchr(outfile, '.');
-        if (tmp)
+        files += volume->importText(text);
+        
+        for (unsigned i = 0; i < text.size(); ++i)
         {
-            if (::strcasecmp(tmp, ".text") == 0 || strcasecmp(tmp, ".txt") == 0)
-                type = Pascal::kTextFile;
+            if (text[i].error)
+            {
+                std::fprintf(stderr, "apfm put: %s: %s\n", text[i].name, strerror(text[i].error));
+                rv = -1;
+                continue;
+            }
+            bytes += text[i].length;
         }
     }
     
-    if (!Pascal::FileEntry::ValidName(outfile))
+    for (unsigned i = 0; i < maps.size(); ++i)
+        delete maps[i];
+    
+    volume->sync();
+    
+    if (vFlag)
     {
-        std::fprintf(stderr, "apfm put: `%s' is not a valid pascal name.\n", outfile);
+        double elapsed = now() - start;
+        
+        std::fprintf(stderr, "%u files, %.2f MB in %.3f seconds (%.2f MB/s)\n",
+            files, bytes / (1024 * 1024), elapsed,
+            elapsed > 0 ? bytes / (1024 * 1024) / elapsed : 0.0);
     }
+    
+    return rv;
+}
 
-    if (::stat(infile, &st) != 0)
+
+
+static int runAction(unsigned actionCode, int argc, char **argv, Pascal::VolumeEntry *volume)
+{
+    switch (actionCode)
     {
-        std::fprintf(stderr, "apfm put: %s: no such file.\n", infile);
-        return -1;
+        case kCommandCAT:
+            return action_cat(argc, argv, volume);
+        case kCommandCP:
+            return action_cp(argc, argv, volume);
+        case kCommandKRUNCH:
+            return action_krunch(argc, argv, volume);
+        case kCommandLS:
+            return action_ls(argc, argv, volume);
+        case kCommandMV: 
+            return action_mv(argc, argv, volume);
+        case kCommandRM:
+            return action_rm(argc, argv, volume);
+        case kCommandGET:
+            return action_get(argc, argv, volume);
+        case kCommandPUT:
+            return action_put(argc, argv, volume);
     }
+    return 3;
+}
+
 
-    if (!S_ISREG(st.st_mode))
+// split a line into words.  '...' and "..." quote, # starts a comment.
+static void splitLine(const char *cp, std::vector<std::string> &words)
+{
+    words.clear();
+    
+    for (;;)
     {
-        std::fprintf(stderr, "apfm put: %s: not a regular file.\n", infile);
-        return -1;
+        while (*cp && ::isspace((unsigned char)*cp)) ++cp;
+        
+        if (!*cp || *cp == '#') return;
+        
+        std::string word;
+        
+        while (*cp && !::isspace((unsigned char)*cp))
+        {
+            char c = *cp++;
+            
+            if (c == '"' || c == '\'')
+            {
+                while (*cp && *cp != c) word.push_back(*cp++);
+                if (*cp) ++cp;
+                continue;
+            }
+            
+            word.push_back(c);
+        }
+        
+        words.push_back(word);
     }
+}
+
+int action_batch(int argc, char **argv, Pascal::VolumeEntry *volume)
+{
+    bool aFlag = false;
+    bool kFlag = false;
+    bool vFlag = false;
+    int c;
     
-    unsigned blocks = (st.st_size + 511) / 512;
-    if (blocks > (0xffff - 6))
+    while ((c = ::getopt(argc, argv, "akvh")) != -1)
     {
-        std::fprintf(stderr, "apfm put: %s: file is too large.\n", infile);
-        return -1;
+        switch(c)
+        {
+            case 'a':
+                aFlag = true;
+                break;
+            case 'k':
+                kFlag = true;
+                break;
+            case 'v':
+                vFlag = true;
+                break;
+                
+            case 'h':
+            default:
+                commandUsage(kCommandBATCH);
+                return c == 'h' ? 0 : 1;
+                break;
+        }
     }
     
+    argc -= optind;
+    argv += optind;
     
+    if (argc > 1)
+    {
+        commandUsage(kCommandBATCH);
+        return -1;
+    }
     
-    File file(infile, File::ReadOnly);
-    MappedFile mf(file, File::ReadOnly, st.st_size);
+    std::FILE *fp = stdin;
     
+    if (argc == 1 && std::strcmp(argv[0], "-"))
+    {
+        fp = std::fopen(argv[0], "r");
+        if (!fp)
+        {
+            std::fprintf(stderr, "apfm batch: %s: %s\n", argv[0], std::strerror(errno));
+            return -1;
+        }
+    }
     
+    fBatch = true;
+    volume->beginBatch(aFlag);
     
+    std::vector<std::string> words;
+    std::vector<char *> args;
+    char *line = NULL;
+    size_t lineSize = 0;
+    unsigned lineNumber = 0;
+    int rv = 0;
     
-
-    if (type == Pascal::kTextFile)
+    while (::getline(&line, &lineSize, fp) != -1)
     {
-        Pascal::TextWriter text;
+        ++lineNumber;
         
+        splitLine(line, words);
+        if (words.empty()) continue;
         
-        const char *address = (const char *)mf.address();
-
-        unsigned start = 0;
-        unsigned length = st.st_size;
+        args.clear();
+        for (unsigned i = 0; i < words.size(); ++i)
+            args.push_back(&words[i][0]);
+        args.push_back(NULL);
         
-        for (unsigned i = 0; i < length; ++i)
-        {
-            char c = address[i];
-            if (c == 0x0d || c == 0x0a)
-            {
-                //std::fprintf(stdout, "%.*s\n", i - start, address + start);
-                text.writeLine(address + start, i - start);
-                start = i + 1;
-                
-                if (c == 0x0a && i < length && address[i +1 ] == 0x0d)
-                {
-                    ++start;
-                    ++i;
-                }
-            }
-        }
+        if (vFlag) std::fprintf(stderr, "+ %s", line);
         
-        //any remainder.
-        if (start != length) text.writeLine(address + start, length - start);
+        unsigned actionCode = command(args[0]);
+        int ok = -1;
         
-        blocks = text.blocks();
-        
-        Pascal::FileEntryPointer entry = volume->create(outfile, blocks);
-        if (!entry)
+        if (actionCode == (unsigned)-1 || actionCode == kCommandBATCH)
         {
-            perror(NULL);
-            return -1;
+            std::fprintf(stderr, "apfm batch: line %u: %s: invalid command.\n", lineNumber, args[0]);
         }
-        
-        entry->setFileKind(type);
-        entry->write(text);
-        
-    }
-    else
-    {
-        Pascal::FileEntryPointer entry = volume->create(outfile, blocks);
-        if (!entry)
+        else try
         {
-            perror(NULL);
-            return -1;
+            resetGetopt();
+            ok = runAction(actionCode, args.size() - 1, &args[0], volume);
         }
-        
-        entry->setFileKind(type);
-                
-        unsigned remaining = st.st_size;
-        unsigned offset = 0;
-        const uint8_t *address = (const uint8_t *)mf.address();
-        while (remaining)
+        catch (Exception &e)
         {
-            int rv;
-            unsigned count = std::min(512u, remaining);
-    
-            rv = entry->write(address + offset, count, offset);
-            if (rv == -1)
-            {
-                perror(NULL);
-                return -1;
-            }
-            offset += count;
-            remaining -= count;
+            std::fprintf(stderr, "apfm batch: line %u: %s\n", lineNumber, e.what());
+            ok = -1;
         }
         
+        if (ok != 0)
+        {
+            std::fprintf(stderr, "apfm batch: line %u: %s failed.\n", lineNumber, args[0]);
+            rv = -1;
+            
+            if (aFlag || !kFlag) break;
+        }
+    }
+    
+    std::free(line);
+    if (fp != stdin) std::fclose(fp);
+    
+    if (rv && aFlag)
+    {
+        volume->rollback();
+        std::fprintf(stderr, "apfm batch: no changes made.\n");
+        return rv;
     }
-
-    volume->sync();
-    return 0;
     
+    volume->endBatch();
+    return rv;
 }
 
 
-
-
 int main(int argc, char **argv)
 {
     Pascal::VolumeEntryPointer volume;
@@ -1008,12 +1474,7 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
-    #ifdef __linux__
-    optind = 0;
-    #else
-    optreset = 1;
-    optind = 1;
-    #endif
+    resetGetopt();
     
     if (argc < 2)
     {
@@ -1036,34 +1497,12 @@ int main(int argc, char **argv)
         volume = Pascal::VolumeEntry::Open(device);
         device.reset();
 
-        switch (actionCode)
-        {
-            case kCommandCAT:
-                return action_cat(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandCP:
-                return action_cp(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandKRUNCH:
-                return action_krunch(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandLS:
-                return action_ls(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandMV: 
-                return action_mv(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandRM:
-                return action_rm(argc - 1, argv + 1, volume.get());
-                break;
-            case kCommandGET:
-                return action_get(argc -1, argv + 1, volume.get());
-                break;
-            case kCommandPUT:
-                return action_put(argc -1, argv + 1, volume.get());
-                break;
-                 
-        }
+        if (actionCode == kCommandBATCH)
+            return action_batch(argc - 1, argv + 1, volume.get());
+        
+        if (actionCode != (unsigned)-1)
+            return runAction(actionCode, argc - 1, argv + 1, volume.get());
+        
         usage();
         return 3;
     }
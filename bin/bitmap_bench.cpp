@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <ProDOS/Bitmap.h>
+
+
+/*
+ * ProDOS::Bitmap allocation timings on fragmented volumes.
+ *
+ * Each round starts with a full volume and frees a percentage of the
+ * blocks, either as single blocks at random (the worst case for
+ * allocRun) or as random runs of 1-64 blocks.  The free space is then
+ * drained with allocBlock() or allocRun(n); the time is per call,
+ * including the final call which fails.
+ */
+
+
+void usage()
+{
+    std::printf("bitmap_bench [-b blocks] [-f percent] [-r rounds] [-s seed]\n");
+    std::printf("\n");
+    std::printf("  -b blocks        Volume size (default 65535)\n"
+                "  -f percent       Free blocks (default 3)\n"
+                "  -r rounds        Rounds per test (default 20)\n"
+                "  -s seed          Random seed (default 1)\n"
+    );
+}
+
+
+enum {
+    kScattered,
+    kClustered
+};
+
+
+static double now()
+{
+    struct timeval tv;
+
+    ::gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void fragment(ProDOS::Bitmap &bitmap, unsigned percent, unsigned pattern)
+{
+    unsigned blocks = bitmap.blocks();
+    unsigned target = (unsigned long long)blocks * percent / 100;
+
+    while (bitmap.allocBlock() >= 0) ;
+
+    if (pattern == kScattered)
+    {
+        std::vector<unsigned> order(blocks);
+
+        for (unsigned i = 0; i < blocks; ++i) order[i] = i;
+
+        for (unsigned i = 0; i < target; ++i)
+        {
+            std::swap(order[i], order[i + std::rand() % (blocks - i)]);
+            bitmap.freeBlock(order[i]);
+        }
+        return;
+    }
+
+    while (bitmap.freeBlocks() < target)
+    {
+        unsigned start = std::rand() % blocks;
+        unsigned count = 1 + std::rand() % 64;
+
+        for (unsigned i = start; i < blocks && i < start + count && bitmap.freeBlocks() < target; ++i)
+        {
+            if (!bitmap.isFree(i)) bitmap.freeBlock(i);
+        }
+    }
+}
+
+// returns the number of successful calls; *elapsed is the time.
+static unsigned drain(ProDOS::Bitmap &bitmap, unsigned run, double *elapsed)
+{
+    unsigned count = 0;
+    double start = now();
+
+    if (run == 1)
+    {
+        while (bitmap.allocBlock() >= 0) ++count;
+    }
+    else
+    {
+        while (bitmap.allocRun(run) >= 0) ++count;
+    }
+
+    *elapsed = now() - start;
+
+    return count;
+}
+
+static void test(unsigned blocks, unsigned percent, unsigned rounds, unsigned pattern, unsigned run)
+{
+    unsigned long long calls = 0;
+    unsigned long long allocated = 0;
+    double total = 0;
+
+    for (unsigned r = 0; r < rounds; ++r)
+    {
+        ProDOS::Bitmap bitmap(blocks);
+        double elapsed;
+
+        fragment(bitmap, percent, pattern);
+
+        unsigned count = drain(bitmap, run, &elapsed);
+
+        calls += count + 1;
+        allocated += count;
+        total += elapsed;
+    }
+
+    char call[16];
+
+    if (run == 1) std::snprintf(call, sizeof(call), "allocBlock");
+    else std::snprintf(call, sizeof(call), "allocRun(%u)", run);
+
+    std::printf("%-9s  %-12s  %9.1f  %9.1f  %9.3f\n",
+        pattern == kScattered ? "scattered" : "clustered", call,
+        (double)allocated / rounds, total * 1000000000.0 / calls, total * 1000.0 / rounds);
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned blocks = 65535;
+    unsigned percent = 3;
+    unsigned rounds = 20;
+    unsigned seed = 1;
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hb:f:r:s:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : 1;
+                break;
+
+            case 'b':
+                blocks = std::strtoul(optarg, NULL, 0);
+                break;
+
+            case 'f':
+                percent = std::strtoul(optarg, NULL, 0);
+                break;
+
+            case 'r':
+                rounds = std::strtoul(optarg, NULL, 0);
+                break;
+
+            case 's':
+                seed = std::strtoul(optarg, NULL, 0);
+                break;
+        }
+    }
+
+    if (blocks < 1 || blocks > 65535 || percent > 100 || rounds < 1)
+    {
+        usage();
+        return 1;
+    }
+
+    std::srand(seed);
+
+    std::printf("%u blocks, %u%% free, %u rounds\n\n", blocks, percent, rounds);
+    std::printf("pattern    call          allocated    ns/call   ms/drain\n");
+
+    for (unsigned pattern = kScattered; pattern <= kClustered; ++pattern)
+    {
+        test(blocks, percent, rounds, pattern, 1);
+
+        for (unsigned run = 2; run <= 32; run *= 4)
+            test(blocks, percent, rounds, pattern, run);
+    }
+
+    return 0;
+}
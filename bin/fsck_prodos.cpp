@@ -0,0 +1,373 @@
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <Device/BlockDevice.h>
+
+#include <ProDOS/Fsck.h>
+
+#include <Common/Exception.h>
+#include <Common/ThreadPool.h>
+#include <Common/Lock.h>
+
+#include <File/File.h>
+
+
+#define FSCK_VERSION "0.1"
+
+
+enum {
+    kExitClean = 0,
+    kExitProblems = 1,
+    kExitError = 8
+};
+
+
+static bool json = false;
+static bool quiet = false;
+static bool verbose = false;
+static unsigned format = 0;
+
+static Lock outputLock;
+static int exitStatus = kExitClean;
+static unsigned long long totalBytes = 0;
+
+
+void usage()
+{
+    std::printf("fsck_prodos %s\n", FSCK_VERSION);
+    std::printf("\n");
+
+
+    std::printf("fsck_prodos [-jqv] [-t threads] [-f format] file_or_directory ...\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per image)\n"
+                "  -q               Only report images with problems\n"
+                "  -v               Verbose (timing summary on stderr)\n"
+                "  -t threads       Number of images to check in parallel.\n"
+                "                   Default is the number of cpus.\n"
+                "  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image (default)\n"
+                "\n"
+                "Directories are searched recursively.\n"
+    );
+}
+
+
+static std::string quote(const std::string &s)
+{
+    std::string rv("\"");
+
+    for (std::string::const_iterator iter = s.begin(); iter != s.end(); ++iter)
+    {
+        unsigned char c = *iter;
+
+        switch (c)
+        {
+            case '"':
+                rv += "\\\"";
+                break;
+            case '\\':
+                rv += "\\\\";
+                break;
+            default:
+                if (c < 0x20 || c >= 0x80)
+                {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    rv += buffer;
+                }
+                else rv += c;
+                break;
+        }
+    }
+    rv += '"';
+
+    return rv;
+}
+
+
+static std::string format_json(const std::string &path, const ProDOS::Fsck &fsck)
+{
+    std::string rv;
+    char buffer[256];
+
+    const std::vector<ProDOS::Fsck::Problem> &problems = fsck.problems();
+
+    rv = "{\"image\":" + quote(path);
+    rv += ",\"status\":";
+    rv += problems.empty() ? "\"ok\"" : "\"damaged\"";
+    rv += ",\"volume\":" + quote(fsck.volumeName());
+
+    std::snprintf(buffer, sizeof(buffer), ",\"blocks\":%u,\"free\":%u,\"used\":%u,\"files\":%u,\"directories\":%u",
+        fsck.blocks(), fsck.freeBlocks(), fsck.ownedBlocks(), fsck.files(), fsck.directories());
+    rv += buffer;
+
+    rv += ",\"problems\":[";
+    for (unsigned i = 0; i < problems.size(); ++i)
+    {
+        const ProDOS::Fsck::Problem &p = problems[i];
+
+        if (i) rv += ',';
+
+        std::snprintf(buffer, sizeof(buffer), "{\"type\":\"%s\",\"block\":%u,\"path\":",
+            ProDOS::Fsck::ProblemName(p.type), p.block);
+        rv += buffer;
+        rv += quote(p.path);
+        rv += ",\"message\":" + quote(p.message);
+        rv += '}';
+    }
+    rv += "]}\n";
+
+    return rv;
+}
+
+
+static std::string format_text(const std::string &path, const ProDOS::Fsck &fsck)
+{
+    std::string rv;
+    char buffer[512];
+
+    const std::vector<ProDOS::Fsck::Problem> &problems = fsck.problems();
+
+    std::snprintf(buffer, sizeof(buffer), "%s: /%s: %u files, %u directories, %u/%u blocks used, %u free%s\n",
+        path.c_str(), fsck.volumeName().c_str(), fsck.files(), fsck.directories(),
+        fsck.ownedBlocks(), fsck.blocks(), fsck.freeBlocks(),
+        problems.empty() ? "" : " -- DAMAGED");
+    rv = buffer;
+
+    for (unsigned i = 0; i < problems.size(); ++i)
+    {
+        const ProDOS::Fsck::Problem &p = problems[i];
+
+        std::snprintf(buffer, sizeof(buffer), "  %-16s %s%s%s\n",
+            ProDOS::Fsck::ProblemName(p.type),
+            p.path.c_str(), p.path.empty() ? "" : ": ",
+            p.message.c_str());
+        rv += buffer;
+    }
+
+    return rv;
+}
+
+
+static std::string format_error(const std::string &path, const char *message)
+{
+    if (json)
+    {
+        return "{\"image\":" + quote(path) + ",\"status\":\"error\",\"error\":" + quote(message) + "}\n";
+    }
+
+    return path + ": " + message + "\n";
+}
+
+
+static void check(const std::string path)
+{
+    std::string output;
+    int status = kExitClean;
+    unsigned long long bytes = 0;
+
+    try
+    {
+        Device::BlockDevicePointer device;
+
+        device = Device::BlockDevice::Open(path.c_str(), File::ReadOnly, format);
+
+        if (!device)
+        {
+            output = format_error(path, "Unknown or unsupported device type.");
+            status = kExitError;
+        }
+        else
+        {
+            ProDOS::Fsck fsck(device);
+
+            if (fsck.check()) status = kExitProblems;
+
+            bytes = device->blocks() * 512ull;
+
+            if (status || !quiet)
+                output = json ? format_json(path, fsck) : format_text(path, fsck);
+        }
+    }
+    catch (::Exception &e)
+    {
+        std::string message(e.what());
+
+        if (e.error())
+        {
+            message += ": ";
+            message += e.errorString();
+        }
+
+        output = format_error(path, message.c_str());
+        status = kExitError;
+    }
+
+    Locker locker(outputLock);
+
+    std::fputs(output.c_str(), stdout);
+
+    exitStatus |= status;
+    totalBytes += bytes;
+}
+
+
+// recursively add files to the list.
+static void scan(const std::string &path, std::vector<std::string> *files)
+{
+    struct stat st;
+
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        files->push_back(path);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        files->push_back(path);
+        return;
+    }
+
+    DIR *dp = ::opendir(path.c_str());
+    if (!dp) return;
+
+    std::vector<std::string> names;
+    struct dirent *dir;
+
+    while ((dir = ::readdir(dp)) != NULL)
+    {
+        if (dir->d_name[0] == '.') continue;
+        names.push_back(dir->d_name);
+    }
+    ::closedir(dp);
+
+    std::sort(names.begin(), names.end());
+
+    for (std::vector<std::string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        std::string child = path + "/" + *iter;
+
+        if (::stat(child.c_str(), &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) scan(child, files);
+        else if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) files->push_back(child);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned threads = 0;
+    std::vector<std::string> files;
+    struct timeval start, end;
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hjqvt:f:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : kExitError;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'q':
+                quiet = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't':
+                threads = std::strtoul(optarg, NULL, 10);
+                break;
+
+            case 'f':
+                format = Device::BlockDevice::ImageType(optarg);
+                if (format == 0)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                    return kExitError;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+    {
+        usage();
+        return kExitError;
+    }
+
+    for (int i = 0; i < argc; ++i)
+    {
+        std::string path(argv[i]);
+
+        // trailing /
+        while (path.length() > 1 && path[path.length() - 1] == '/')
+            path.erase(path.length() - 1);
+
+        scan(path, &files);
+    }
+
+    ::gettimeofday(&start, NULL);
+
+    if (files.size() == 1)
+    {
+        check(files.front());
+    }
+    else
+    {
+        if (threads == 0) threads = ThreadPool::DefaultThreads();
+        if (threads > files.size()) threads = files.size();
+
+        ThreadPool pool(threads);
+
+        for (std::vector<std::string>::iterator iter = files.begin(); iter != files.end(); ++iter)
+        {
+            pool.enqueue(std::bind(check, *iter));
+        }
+
+        pool.wait();
+    }
+
+    ::gettimeofday(&end, NULL);
+
+    if (verbose)
+    {
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+        double mb = totalBytes / (1024.0 * 1024.0);
+
+        std::fprintf(stderr, "%u images, %.1f MB in %.3f seconds (%.1f MB/s)\n",
+            (unsigned)files.size(), mb, elapsed, elapsed > 0 ? mb / elapsed : 0.0);
+    }
+
+    return exitStatus;
+}
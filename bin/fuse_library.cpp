@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+#include <string>
+
+#include <unistd.h>
+
+
+#define FUSE_USE_VERSION 27
+
+#include <fuse_opt.h>
+#include <fuse_lowlevel.h>
+
+#include <Device/BlockDevice.h>
+
+std::string fDirectory;
+
+
+
+void usage()
+{
+    std::printf("fuse_library 0.1\n\n");
+    std::printf(
+        "usage:\n"
+        "fuse_library [options] directory [mountpoint]\n"
+        "Every disk image in directory is a subdirectory of the mount point.\n"
+        "ProDOS and Pascal volumes are supported (read only.)\n"
+        "Options:\n"
+        "  -d                debug\n"
+        "  -v                verbose\n"
+        "  --idle=seconds    close volumes unused for this long (default 60, 0 = never)\n"
+        "  --budget=MB       total size of open volumes (default 256)\n"
+        "  --format=format   specify the disk image format. Valid values are:\n"
+        "                    dc42  DiskCopy 4.2 Image\n"
+        "                    davex Davex Disk Image\n"
+        "                    2img  Universal Disk Image\n"
+#ifdef HAVE_NUFX
+        "                    sdk   ShrinkIt Disk Image\n"
+#endif
+        "                    do    DOS Order Disk Image\n"
+        "                    po    ProDOS Order Disk Image\n"
+        "                    The default is to check each image.\n"
+        "  -o opt1,opt2...   other mount parameters.\n"
+    );
+}
+
+
+static struct fuse_lowlevel_ops library_ops;
+
+enum {
+    LIBRARY_OPT_HELP,
+    LIBRARY_OPT_VERSION
+};
+
+struct options {
+    char *format;
+    int verbose;
+    unsigned idle;
+    unsigned budget;
+} options;
+
+#define LIBRARY_OPT_KEY(T, P, V) {T, offsetof(struct options, P), V}
+
+static struct fuse_opt library_options[] = {
+    FUSE_OPT_KEY("-h",             LIBRARY_OPT_HELP),
+    FUSE_OPT_KEY("--help",         LIBRARY_OPT_HELP),
+    FUSE_OPT_KEY("-V",             LIBRARY_OPT_VERSION),
+    FUSE_OPT_KEY("--version",      LIBRARY_OPT_VERSION),
+
+    LIBRARY_OPT_KEY("-v", verbose, 1),
+
+    LIBRARY_OPT_KEY("--idle=%u", idle, 0),
+    LIBRARY_OPT_KEY("idle=%u", idle, 0),
+
+    LIBRARY_OPT_KEY("--budget=%u", budget, 0),
+    LIBRARY_OPT_KEY("budget=%u", budget, 0),
+
+    LIBRARY_OPT_KEY("--format=%s", format, 0),
+    LIBRARY_OPT_KEY("format=%s", format, 0),
+
+    {0, 0, 0}
+};
+
+
+static int library_option_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    switch(key)
+    {
+        case LIBRARY_OPT_HELP:
+            usage();
+            exit(0);
+            break;
+
+        case LIBRARY_OPT_VERSION:
+            // TODO
+            exit(0);
+            break;
+
+
+        case FUSE_OPT_KEY_NONOPT:
+            // first arg is the image directory.
+            if (fDirectory.empty())
+            {
+                fDirectory = arg;
+                return 0;
+            }
+            return 1;
+    }
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    extern void init_library_ops(fuse_lowlevel_ops *ops);
+    extern int library_scan(const char *directory);
+    extern unsigned fIdleTimeout;
+    extern unsigned long long fCacheBudget;
+    extern unsigned fFormat;
+
+    struct options options;
+
+    std::memset(&options, 0, sizeof(options));
+    options.idle = 60;
+    options.budget = 256;
+
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_chan *ch;
+    char *mountpoint = NULL;
+    int err = -1;
+    int count;
+
+    int foreground = false;
+    int multithread = false;
+
+
+    init_library_ops(&library_ops);
+
+
+    if (fuse_opt_parse(&args, &options, library_options, library_option_proc) == -1)
+        exit(1);
+
+    if (fDirectory.empty())
+    {
+        usage();
+        exit(1);
+    }
+
+    fIdleTimeout = options.idle;
+    fCacheBudget = (unsigned long long)options.budget << 20;
+
+    if (options.format)
+    {
+        fFormat = Device::BlockDevice::ImageType(options.format);
+        if (!fFormat)
+            std::fprintf(stderr, "Warning: Unknown image type ``%s''\n", options.format);
+    }
+
+    // images are listed now but not opened until they're used.
+    count = library_scan(fDirectory.c_str());
+    if (count < 0)
+    {
+        std::perror(fDirectory.c_str());
+        return 1;
+    }
+
+    if (options.verbose)
+        std::fprintf(stderr, "%d images in ``%s''\n", count, fDirectory.c_str());
+
+
+    fuse_opt_add_arg(&args, "-ofsname=ImageLibrary");
+    fuse_opt_add_arg(&args, "-oro");
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithread, &foreground) == -1)
+    {
+        usage();
+        return -1;
+    }
+
+
+    if ((ch = fuse_mount(mountpoint, &args)) != NULL)
+    {
+        struct fuse_session* se;
+
+        std::printf("Mounting ``%s'' on ``%s''\n", fDirectory.c_str(), mountpoint);
+
+        se = fuse_lowlevel_new(&args, &library_ops, sizeof(library_ops), NULL);
+
+        if (se) do {
+
+
+            err = fuse_daemonize(foreground);
+            if (err < 0 ) break;
+
+            err = fuse_set_signal_handlers(se);
+            if (err < 0) break;
+
+            fuse_session_add_chan(se, ch);
+
+            if (multithread) err = fuse_session_loop_mt(se);
+            else err = fuse_session_loop(se);
+
+            fuse_remove_signal_handlers(se);
+            fuse_session_remove_chan(ch);
+
+        } while (false);
+        if (se) fuse_session_destroy(se);
+        fuse_unmount(mountpoint, ch);
+    }
+
+
+    fuse_opt_free_args(&args);
+
+
+    return err ? 1 : 0;
+}
@@ -0,0 +1,911 @@
+#define FUSE_USE_VERSION 27
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+
+#include <fuse_opt.h>
+#include <fuse_lowlevel.h>
+
+
+#include <Pascal/Pascal.h>
+#include <ProDOS/Disk.h>
+#include <Batch/Batch.h>
+#include <Device/BlockDevice.h>
+#include <File/MappedFile.h>
+#include <Common/auto.h>
+#include <Common/Exception.h>
+#include <Common/Lock.h>
+#include <Common/HandleTable.h>
+
+
+#undef ERROR
+#define ERROR(cond,errno) if ( (cond) ){ fuse_reply_err(req, errno); return; }
+
+#define DEBUGNAME() \
+    if (0) { std::fprintf(stderr, "%s\n", __func__); }
+
+
+/*
+ * Inode numbers are (image + 1) << 32 | inode within the image.  Within
+ * an image, 1 is the volume directory.  Pascal files use the volume's
+ * inode numbers; ProDOS files use the address of the directory entry.
+ * Both are stable if the volume is closed and re-opened.
+ */
+
+static_assert(sizeof(fuse_ino_t) >= 8, "fuse_ino_t must be 64 bits");
+
+#define MAKE_INO(image, inode) ((((fuse_ino_t)(image) + 1) << 32) | (inode))
+#define INO_IMAGE(ino) ((unsigned)((ino) >> 32) - 1)
+#define INO_INODE(ino) ((unsigned)((ino) & 0xffffffff))
+
+
+// seconds before an unused volume is closed (0 = never).
+unsigned fIdleTimeout = 60;
+
+// bytes of open volumes to keep before closing the least recently used.
+unsigned long long fCacheBudget = 256ull << 20;
+
+// forced image format (0 = detect.)
+unsigned fFormat = 0;
+
+
+struct Image {
+    std::string name;
+    std::string path;
+    time_t mtime;
+
+    // detected on first open and kept after the volume is closed.
+    unsigned format;
+    unsigned fileSystem;
+    int error;
+
+    // serializes opening the volume.
+    Lock openLock;
+
+    // protected by libraryLock.
+    Device::BlockDevicePointer device;
+    Pascal::VolumeEntryPointer pascal;
+    DiskPointer disk;
+    unsigned users; // open files and requests in progress.
+    time_t lastUse;
+    unsigned long long charge;
+};
+
+// an image with the volume open (and a use held.)
+struct Volume {
+    Image *image;
+    unsigned index;
+    Pascal::VolumeEntryPointer pascal;
+    DiskPointer disk;
+};
+
+struct OpenFile {
+    unsigned index;
+    Pascal::FileEntryPointer pascal;
+    DiskPointer disk;
+    ExtentList extents;
+    uint32_t eof;
+
+    OpenFile() : index(0), eof(0) {}
+};
+
+
+static std::vector<Image *> images;
+static std::map<std::string, unsigned> imageNames;
+
+static Lock libraryLock;
+static unsigned long long openCharge = 0;
+
+static HandleTable<OpenFile, 4096> fd_table;
+
+static pthread_t reaper;
+static bool reaperRunning = false;
+static bool shutdownReaper = false;
+
+
+// list the images in a directory (not recursive.)
+int library_scan(const char *directory)
+{
+    DIR *dp = ::opendir(directory);
+
+    if (!dp) return -1;
+
+    std::vector<std::string> names;
+    struct dirent *dir;
+
+    while ((dir = ::readdir(dp)) != NULL)
+    {
+        if (dir->d_name[0] == '.') continue;
+        names.push_back(dir->d_name);
+    }
+    ::closedir(dp);
+
+    std::sort(names.begin(), names.end());
+
+    for (std::vector<std::string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        struct stat st;
+        std::string path = std::string(directory) + "/" + *iter;
+
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        Image *image = new Image();
+
+        image->name = *iter;
+        image->path = path;
+        image->mtime = st.st_mtime;
+        image->format = fFormat;
+        image->fileSystem = Batch::Image::kUnknown;
+        image->error = 0;
+        image->users = 0;
+        image->lastUse = 0;
+        image->charge = 0;
+
+        imageNames[image->name] = images.size();
+        images.push_back(image);
+    }
+
+    return images.size();
+}
+
+
+#pragma mark -
+#pragma mark volumes
+
+// libraryLock must be held.
+static void closeImage(Image *image)
+{
+    image->pascal.reset();
+    image->disk.reset();
+    image->device.reset();
+
+    openCharge -= image->charge;
+    image->charge = 0;
+}
+
+// close the least recently used volumes until the open volumes fit the budget.
+static void trim()
+{
+    Locker locker(libraryLock);
+
+    while (openCharge > fCacheBudget)
+    {
+        Image *lru = NULL;
+
+        for (std::vector<Image *>::iterator iter = images.begin(); iter != images.end(); ++iter)
+        {
+            Image *image = *iter;
+
+            if (!image->device || image->users) continue;
+            if (!lru || image->lastUse < lru->lastUse) lru = image;
+        }
+
+        if (!lru) break;
+
+        closeImage(lru);
+    }
+}
+
+static void *reap(void *)
+{
+    unsigned ticks = 0;
+
+    for (;;)
+    {
+        ::sleep(1);
+
+        Locker locker(libraryLock);
+
+        if (shutdownReaper) break;
+
+        if (++ticks < std::max(1u, fIdleTimeout / 4)) continue;
+        ticks = 0;
+
+        time_t now = std::time(NULL);
+
+        for (std::vector<Image *>::iterator iter = images.begin(); iter != images.end(); ++iter)
+        {
+            Image *image = *iter;
+
+            if (image->device && !image->users && now - image->lastUse >= (time_t)fIdleTimeout)
+                closeImage(image);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * open the volume (if necessary) and hold a use.  The image format and
+ * file system are only detected the first time.  Returns false (and
+ * errno) on failure.
+ */
+static bool acquire(unsigned index, Volume &volume)
+{
+    if (index >= images.size())
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    Image *image = images[index];
+
+    volume.image = image;
+    volume.index = index;
+
+    Locker openLocker(image->openLock);
+
+    // not an image (or not a supported file system.)  Don't try again.
+    if (image->error)
+    {
+        errno = image->error;
+        return false;
+    }
+
+    {
+        Locker locker(libraryLock);
+
+        if (image->device)
+        {
+            ++image->users;
+            image->lastUse = std::time(NULL);
+
+            volume.pascal = image->pascal;
+            volume.disk = image->disk;
+            return true;
+        }
+    }
+
+    Device::BlockDevicePointer device;
+    Pascal::VolumeEntryPointer pascal;
+    DiskPointer disk;
+
+    // set when the image will never open; anything else (EMFILE,
+    // ENOMEM, ...) may succeed next time.
+    bool unsupported = false;
+
+    try
+    {
+        if (!image->format)
+            image->format = Device::BlockDevice::ImageType(image->path.c_str(), 0);
+
+        if (!image->format)
+        {
+            MappedFile file(image->path.c_str(), File::ReadOnly);
+            image->format = Device::BlockDevice::ImageType(&file, 'PO__');
+        }
+
+        device = Device::BlockDevice::Open(image->path.c_str(), File::ReadOnly, image->format);
+
+        if (!device)
+        {
+            unsupported = true;
+            throw ::Exception("Unknown or unsupported device type.");
+        }
+
+        if (image->fileSystem == Batch::Image::kUnknown)
+            image->fileSystem = Batch::Image(image->path, device).fileSystem();
+
+        switch (image->fileSystem)
+        {
+            case Batch::Image::kPascal:
+                pascal = Pascal::VolumeEntry::Open(device);
+                break;
+            case Batch::Image::kProDOS:
+                disk = Disk::OpenFile(device);
+                break;
+            default:
+                unsupported = true;
+                throw ::Exception("Unknown file system.");
+        }
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s: %s\n", image->path.c_str(), e.what());
+
+        if (unsupported)
+        {
+            image->error = EIO;
+            errno = EIO;
+            return false;
+        }
+
+        errno = e.error() ? e.error() : EIO;
+        return false;
+    }
+
+    {
+        Locker locker(libraryLock);
+
+        image->device = device;
+        image->pascal = pascal;
+        image->disk = disk;
+        image->charge = device->blocks() * 512ull;
+        openCharge += image->charge;
+
+        ++image->users;
+        image->lastUse = std::time(NULL);
+    }
+
+    volume.pascal = pascal;
+    volume.disk = disk;
+
+    trim();
+
+    return true;
+}
+
+static void release(Volume &volume)
+{
+    Locker locker(libraryLock);
+
+    --volume.image->users;
+    volume.image->lastUse = std::time(NULL);
+}
+
+// releases the use when it goes out of scope.
+class VolumeUser {
+public:
+    VolumeUser(Volume &volume) : _volume(volume) {}
+    ~VolumeUser() { release(_volume); }
+private:
+    Volume &_volume;
+};
+
+
+#pragma mark -
+#pragma mark ProDOS
+
+static int loadEntry(Disk *disk, uint32_t address, FileEntry *entry)
+{
+    uint8_t buffer[512];
+    int ok;
+
+    ok = disk->Read(address >> 9, buffer);
+    if (ok < 0) return ok;
+
+    if (!entry->Load(buffer + (address & 0x1ff))) return -P8_INVALID_STORAGE_TYPE;
+    entry->address = address;
+
+    return 1;
+}
+
+// the data fork eof and blocks.
+static void stat(Disk *disk, unsigned index, FileEntry &e, struct stat *st)
+{
+    FileEntry f = e;
+
+    std::memset(st, 0, sizeof(struct stat));
+
+    if (e.storage_type == DIRECTORY_FILE)
+    {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+    }
+    else
+    {
+        disk->Normalize(f, P8_DATA_FORK);
+
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+    }
+
+    st->st_ino = MAKE_INO(index, e.address);
+    st->st_size = f.eof;
+    st->st_blocks = e.blocks_used;
+    st->st_blksize = 512;
+
+    st->st_atime = e.last_mod;
+    st->st_mtime = e.last_mod;
+    st->st_ctime = e.last_mod;
+}
+
+// directory key block for an inode (2 is the volume directory.)
+static int directoryKey(Disk *disk, unsigned inode, unsigned *key)
+{
+    FileEntry e;
+    int ok;
+
+    if (inode == 1)
+    {
+        *key = 2;
+        return 1;
+    }
+
+    ok = loadEntry(disk, inode, &e);
+    if (ok < 0) return ok;
+
+    if (e.storage_type != DIRECTORY_FILE) return -P8_INVALID_STORAGE_TYPE;
+
+    *key = e.key_pointer;
+    return 1;
+}
+
+
+#pragma mark -
+#pragma mark Pascal
+
+static Pascal::FileEntryPointer findChild(Pascal::VolumeEntry *volume, unsigned inode)
+{
+    for (unsigned i = 0, l = volume->fileCount(); i < l; ++i)
+    {
+        Pascal::FileEntryPointer child = volume->fileAtIndex(i);
+
+        if (child && inode == child->inode()) return child;
+    }
+
+    return Pascal::FileEntryPointer();
+}
+
+static void stat(Pascal::FileEntry *file, unsigned index, struct stat *st)
+{
+    std::memset(st, 0, sizeof(struct stat));
+
+    time_t t = file->modification();
+
+    st->st_ino = MAKE_INO(index, file->inode());
+    st->st_nlink = 1;
+    st->st_mode = S_IFREG | 0444;
+    st->st_size = file->fileSize();
+    st->st_blocks = file->blocks();
+    st->st_blksize = 512;
+
+    st->st_atime = t;
+    st->st_mtime = t;
+    st->st_ctime = t;
+}
+
+
+// an image directory.  Doesn't open the volume.
+static void stat(unsigned index, struct stat *st)
+{
+    std::memset(st, 0, sizeof(struct stat));
+
+    st->st_ino = MAKE_INO(index, 1);
+    st->st_nlink = 2;
+    st->st_mode = S_IFDIR | 0555;
+    st->st_blksize = 512;
+
+    st->st_atime = images[index]->mtime;
+    st->st_mtime = images[index]->mtime;
+    st->st_ctime = images[index]->mtime;
+}
+
+
+#pragma mark -
+#pragma mark fs
+
+static void library_init(void *userdata, struct fuse_conn_info *conn)
+{
+    DEBUGNAME()
+
+    // after fuse_daemonize, so the thread survives.
+    if (fIdleTimeout && ::pthread_create(&reaper, NULL, reap, NULL) == 0)
+        reaperRunning = true;
+}
+
+static void library_destroy(void *userdata)
+{
+    DEBUGNAME()
+
+    if (reaperRunning)
+    {
+        libraryLock.lock();
+        shutdownReaper = true;
+        libraryLock.unlock();
+
+        ::pthread_join(reaper, NULL);
+        reaperRunning = false;
+    }
+
+    Locker locker(libraryLock);
+
+    for (std::vector<Image *>::iterator iter = images.begin(); iter != images.end(); ++iter)
+    {
+        closeImage(*iter);
+        delete *iter;
+    }
+
+    images.clear();
+    imageNames.clear();
+}
+
+
+static void library_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    DEBUGNAME()
+
+    struct statvfs vst;
+
+    std::memset(&vst, 0, sizeof(vst));
+
+    vst.f_bsize = 512;
+    vst.f_frsize = 512;
+    vst.f_files = images.size();
+    vst.f_flag = ST_RDONLY | ST_NOSUID;
+    vst.f_namemax = 255;
+
+    fuse_reply_statfs(req, &vst);
+}
+
+
+static void library_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    DEBUGNAME()
+
+    struct fuse_entry_param entry;
+    Volume volume;
+
+    std::memset(&entry, 0, sizeof(entry));
+    entry.attr_timeout = 0.0;
+    entry.entry_timeout = 0.0;
+
+    if (parent == 1)
+    {
+        std::map<std::string, unsigned>::iterator iter = imageNames.find(name);
+
+        ERROR(iter == imageNames.end(), ENOENT)
+
+        entry.ino = MAKE_INO(iter->second, 1);
+        stat(iter->second, &entry.attr);
+        fuse_reply_entry(req, &entry);
+        return;
+    }
+
+    ERROR(!acquire(INO_IMAGE(parent), volume), errno)
+
+    VolumeUser user(volume);
+
+    if (volume.pascal)
+    {
+        ERROR(INO_INODE(parent) != 1, ENOTDIR)
+        ERROR(!Pascal::FileEntry::ValidName(name), ENOENT)
+
+        Pascal::FileEntryPointer file = volume.pascal->fileByName(name);
+
+        ERROR(!file, ENOENT)
+
+        entry.ino = MAKE_INO(volume.index, file->inode());
+        stat(file.get(), volume.index, &entry.attr);
+        fuse_reply_entry(req, &entry);
+        return;
+    }
+
+    unsigned key;
+    FileEntry e;
+
+    ERROR(directoryKey(volume.disk.get(), INO_INODE(parent), &key) < 0, ENOTDIR)
+    ERROR(volume.disk->FindEntry(key, name, &e) < 0, ENOENT)
+
+    entry.ino = MAKE_INO(volume.index, e.address);
+    stat(volume.disk.get(), volume.index, e, &entry.attr);
+    fuse_reply_entry(req, &entry);
+}
+
+
+static void library_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    struct stat st;
+    Volume volume;
+
+    if (ino == 1)
+    {
+        std::memset(&st, 0, sizeof(st));
+
+        st.st_ino = 1;
+        st.st_mode = S_IFDIR | 0555;
+        st.st_nlink = 2 + images.size();
+        st.st_blksize = 512;
+
+        fuse_reply_attr(req, &st, 0.0);
+        return;
+    }
+
+    ERROR(INO_IMAGE(ino) >= images.size(), ENOENT)
+
+    // image directories don't need the volume.
+    if (INO_INODE(ino) == 1)
+    {
+        stat(INO_IMAGE(ino), &st);
+        fuse_reply_attr(req, &st, 0.0);
+        return;
+    }
+
+    ERROR(!acquire(INO_IMAGE(ino), volume), errno)
+
+    VolumeUser user(volume);
+
+    if (volume.pascal)
+    {
+        Pascal::FileEntryPointer file = findChild(volume.pascal.get(), INO_INODE(ino));
+
+        ERROR(!file, ENOENT)
+
+        stat(file.get(), volume.index, &st);
+        fuse_reply_attr(req, &st, 0.0);
+        return;
+    }
+
+    FileEntry e;
+
+    ERROR(loadEntry(volume.disk.get(), INO_INODE(ino), &e) < 0, ENOENT)
+
+    stat(volume.disk.get(), volume.index, e, &st);
+    fuse_reply_attr(req, &st, 0.0);
+}
+
+
+#pragma mark -
+#pragma mark directories
+
+static void library_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    ERROR(ino != 1 && INO_IMAGE(ino) >= images.size(), ENOENT)
+
+    fuse_reply_open(req, fi);
+}
+
+static void library_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    fuse_reply_err(req, 0);
+}
+
+
+struct DirectoryEntry {
+    std::string name;
+    fuse_ino_t ino;
+    mode_t mode;
+};
+
+static void library_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    std::vector<DirectoryEntry> entries;
+    DirectoryEntry d;
+    Volume volume;
+
+    d.name = ".";
+    d.ino = ino;
+    d.mode = S_IFDIR;
+    entries.push_back(d);
+
+    d.name = "..";
+    d.ino = ino == 1 || INO_INODE(ino) == 1 ? 1 : MAKE_INO(INO_IMAGE(ino), 1);
+    entries.push_back(d);
+
+    if (ino == 1)
+    {
+        for (unsigned i = 0; i < images.size(); ++i)
+        {
+            d.name = images[i]->name;
+            d.ino = MAKE_INO(i, 1);
+            entries.push_back(d);
+        }
+    }
+    else
+    {
+        ERROR(!acquire(INO_IMAGE(ino), volume), errno)
+
+        VolumeUser user(volume);
+
+        if (volume.pascal)
+        {
+            ERROR(INO_INODE(ino) != 1, ENOTDIR)
+
+            for (unsigned i = 0, l = volume.pascal->fileCount(); i < l; ++i)
+            {
+                Pascal::FileEntryPointer file = volume.pascal->fileAtIndex(i);
+
+                d.name = file->name();
+                d.ino = MAKE_INO(volume.index, file->inode());
+                d.mode = S_IFREG;
+                entries.push_back(d);
+            }
+        }
+        else
+        {
+            std::vector<FileEntry> files;
+            unsigned key;
+            int ok;
+
+            ERROR(directoryKey(volume.disk.get(), INO_INODE(ino), &key) < 0, ENOTDIR)
+
+            if (key == 2) ok = volume.disk->ReadVolume(NULL, &files);
+            else ok = volume.disk->ReadDirectory(key, NULL, &files);
+
+            ERROR(ok < 0, EIO)
+
+            for (std::vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
+            {
+                d.name = iter->file_name;
+                d.ino = MAKE_INO(volume.index, iter->address);
+                d.mode = iter->storage_type == DIRECTORY_FILE ? S_IFDIR : S_IFREG;
+                entries.push_back(d);
+            }
+        }
+    }
+
+    ::auto_array<uint8_t> buffer(new uint8_t[size]);
+    unsigned currentSize = 0;
+    struct stat st;
+
+    std::memset(&st, 0, sizeof(st));
+
+    for (unsigned i = off; i < entries.size(); ++i)
+    {
+        const char *name = entries[i].name.c_str();
+        unsigned tmp = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+
+        if (tmp + currentSize > size) break;
+
+        // only these fields are used.
+        st.st_ino = entries[i].ino;
+        st.st_mode = entries[i].mode;
+
+        fuse_add_direntry(req, (char *)buffer.get() + currentSize, size, name, &st, i + 1);
+        currentSize += tmp;
+    }
+
+    fuse_reply_buf(req, (char *)buffer.get(), currentSize);
+}
+
+
+#pragma mark -
+#pragma mark files
+
+static void library_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    OpenFile of;
+    Volume volume;
+
+    ERROR(ino == 1 || INO_INODE(ino) == 1, EISDIR)
+    ERROR((fi->flags & O_ACCMODE) != O_RDONLY, EROFS)
+
+    ERROR(!acquire(INO_IMAGE(ino), volume), errno)
+
+    of.index = volume.index;
+
+    if (volume.pascal)
+    {
+        of.pascal = findChild(volume.pascal.get(), INO_INODE(ino));
+
+        if (!of.pascal)
+        {
+            release(volume);
+            ERROR(true, ENOENT)
+        }
+    }
+    else
+    {
+        FileEntry e;
+
+        if (loadEntry(volume.disk.get(), INO_INODE(ino), &e) < 0
+            || e.storage_type == DIRECTORY_FILE
+            || volume.disk->Normalize(e, P8_DATA_FORK) < 0
+            || volume.disk->ReadExtents(e, &of.extents) < 0)
+        {
+            release(volume);
+            ERROR(true, EIO)
+        }
+
+        of.disk = volume.disk;
+        of.eof = e.eof;
+    }
+
+    // the use is held until release.
+    fi->fh = fd_table.allocate(of);
+
+    if (!fi->fh)
+    {
+        release(volume);
+        ERROR(true, ENFILE)
+    }
+
+    fuse_reply_open(req, fi);
+}
+
+
+static void library_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    OpenFile *of = fd_table.find(fi->fh);
+
+    ERROR(of == NULL, EBADF)
+
+    Volume volume;
+
+    volume.image = images[of->index];
+    volume.index = of->index;
+
+    fd_table.free(fi->fh);
+    release(volume);
+
+    fuse_reply_err(req, 0);
+}
+
+
+static void library_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    OpenFile *of = fd_table.find(fi->fh);
+
+    ERROR(of == NULL, EBADF)
+
+    try
+    {
+        if (of->pascal)
+        {
+            ::auto_array<uint8_t> buffer(new uint8_t[size]);
+            unsigned rsize = of->pascal->read(buffer.get(), size, off);
+
+            fuse_reply_buf(req, (char *)buffer.get(), rsize);
+            return;
+        }
+
+        if (off >= of->eof)
+        {
+            fuse_reply_buf(req, NULL, 0);
+            return;
+        }
+
+        size = std::min(size, (size_t)(of->eof - off));
+
+        unsigned first = off >> 9;
+        unsigned count = ((off + size + 511) >> 9) - first;
+
+        ::auto_array<uint8_t> buffer(new uint8_t[count * 512]);
+
+        ERROR(of->disk->ReadBlocks(of->extents, first, count, buffer.get()) < 0, EIO)
+
+        fuse_reply_buf(req, (char *)buffer.get() + (off & 0x1ff), size);
+    }
+    catch (::Exception &e)
+    {
+        ERROR(true, EIO)
+    }
+}
+
+
+void init_library_ops(fuse_lowlevel_ops *ops)
+{
+    std::memset(ops, 0, sizeof(fuse_lowlevel_ops));
+
+    ops->init = library_init;
+    ops->destroy = library_destroy;
+    ops->statfs = library_statfs;
+
+    ops->lookup = library_lookup;
+    ops->getattr = library_getattr;
+
+    ops->opendir = library_opendir;
+    ops->readdir = library_readdir;
+    ops->releasedir = library_releasedir;
+
+    ops->open = library_open;
+    ops->read = library_read;
+    ops->release = library_release;
+}
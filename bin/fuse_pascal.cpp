@@ -23,6 +23,7 @@
 
 #include <Device/Device.h>
 #include <Device/BlockDevice.h>
+#include <Device/OverlayDevice.h>
 
 std::string fDiskImage;
 
@@ -37,8 +38,9 @@ void usage()
         "Options:\n"
         "  -d                debug\n"
         "  -r                readonly\n"
-        "  -w                mount writable [not yet]\n"
+        "  -w                mount writable\n"
         "  -v                verbose\n"
+        "  --warmup[=threads] index text files in the background\n"
         "  --format=format   specify the disk image format. Valid values are:\n"
         "                    dc42  DiskCopy 4.2 Image\n"
         "                    davex Davex Disk Image\n"
@@ -48,6 +50,7 @@ void usage()
 #endif
         "                    do    DOS Order Disk Image\n"
         "                    po    ProDOS Order Disk Image (default)\n"
+        "  --overlay=file    mount writable; changes go to file, not the disk image\n"
         "  -o opt1,opt2...   other mount parameters.\n"
     );
 }
@@ -65,9 +68,11 @@ enum {
 
 struct options {
     char *format;
+    char *overlay;
     int readOnly;
     int readWrite;
     int verbose;
+    unsigned warmup;
 } options;
 
 #define PASCAL_OPT_KEY(T, P, V) {T, offsetof(struct options, P), V}
@@ -81,11 +86,22 @@ static struct fuse_opt pascal_options[] = {
     
     PASCAL_OPT_KEY("-v", verbose, 1),
     
+    PASCAL_OPT_KEY("-r", readOnly, 1),
+    PASCAL_OPT_KEY("ro", readOnly, 1),
+    
     PASCAL_OPT_KEY("-w", readWrite, 1),
     PASCAL_OPT_KEY("rw", readWrite, 1),
     
+    PASCAL_OPT_KEY("--warmup", warmup, 4),
+    PASCAL_OPT_KEY("warmup", warmup, 4),
+    PASCAL_OPT_KEY("--warmup=%u", warmup, 0),
+    PASCAL_OPT_KEY("warmup=%u", warmup, 0),
+    
     PASCAL_OPT_KEY("--format=%s", format, 0),
     PASCAL_OPT_KEY("format=%s", format, 0),
+
+    PASCAL_OPT_KEY("--overlay=%s", overlay, 0),
+    PASCAL_OPT_KEY("overlay=%s", overlay, 0),
     
     {0, 0, 0}
 };
@@ -156,6 +172,7 @@ bool make_mount_dir(std::string name, std::string &path)
 int main(int argc, char **argv)
 {
     extern void init_ops(fuse_lowlevel_ops *ops);
+    extern unsigned fWarmup;
     struct options options;
 
     std::memset(&options, 0, sizeof(options));
@@ -187,6 +204,12 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    fWarmup = options.warmup;
+    
+    // read only unless -w is specified.
+    if (options.overlay) options.readWrite = 1;
+    if (!options.readWrite) options.readOnly = 1;
+    
     // default prodos-order disk image.
     if (options.format)
     {
@@ -200,7 +223,8 @@ int main(int argc, char **argv)
     {        
         Device::BlockDevicePointer device;
         
-        device = Device::BlockDevice::Open(fDiskImage.c_str(), File::ReadOnly, format);
+        device = Device::BlockDevice::Open(fDiskImage.c_str(), 
+            options.readOnly || options.overlay ? File::ReadOnly : File::ReadWrite, format);
         
        
         if (!device.get())
@@ -208,6 +232,10 @@ int main(int argc, char **argv)
             std::fprintf(stderr, "Error: Unknown or unsupported device type.\n");
             exit(1);
         }
+
+        // the image is opened read only; writes go to the overlay.
+        if (options.overlay)
+            device = Device::OverlayDevice::Open(device, options.overlay);
         
         volume = Pascal::VolumeEntry::Open(device);
     }
@@ -236,13 +264,8 @@ int main(int argc, char **argv)
 
     fuse_opt_add_arg(&args, "-ofsname=PascalFS");
 
-    if (!options.readOnly)
-        fuse_opt_add_arg(&args, "-ordonly");
-        
-    if (options.readWrite)
-    {
-        std::fprintf(stderr, "Warning:  write support is not yet enabled.\n");
-    }
+    if (options.readOnly)
+        fuse_opt_add_arg(&args, "-oro");
 
     if (fuse_parse_cmdline(&args, &mountpoint, &multithread, &foreground) == -1)
     {
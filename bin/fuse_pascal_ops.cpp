@@ -20,9 +20,13 @@
 
 
 #include <Pascal/Pascal.h>
+#include <Pascal/TextEncoder.h>
 #include <Common/auto.h>
 #include <Common/Exception.h>
 #include <POSIX/Exception.h>
+#include <Common/ThreadPool.h>
+#include <Common/Lock.h>
+#include <Common/HandleTable.h>
 
 #define NO_ATTR() \
 { \
@@ -54,10 +58,60 @@
 using namespace Pascal;
 
 
-// fd_table is files which have been open.
-// fd_table_available is a list of indexes in fd_table which are not currently used.
-static std::vector<FileEntryPointer> fd_table;
-static std::vector<unsigned> fd_table_available;
+// an open file (per-handle state).  Text files are encoded as they are
+// written, so they must be written sequentially (starting with an empty
+// file.)
+struct OpenFile {
+    FileEntryPointer file;
+    TextEncoder *encoder;
+    unsigned offset; // bytes passed to the encoder.
+    bool dirty;
+    
+    OpenFile() : encoder(NULL), offset(0), dirty(false) {}
+};
+
+// fi->fh is a generation tagged handle, so a stale handle is EBADF.
+static HandleTable<OpenFile> fd_table;
+
+// the volume is not thread safe.  Operations which only read take
+// a read lock, so lookups and reads can run concurrently.
+static RWLock volumeLock;
+
+
+// the caller must hold the write lock (so nothing is opened or released.)
+static bool isOpen(FileEntry *file)
+{
+    for (unsigned i = 0; i < fd_table.size(); ++i)
+    {
+        OpenFile *of = fd_table.at(i);
+        if (of && of->file.get() == file) return true;
+    }
+    return false;
+}
+
+// returns 0 if there are too many open files.
+static uint64_t openFile(FileEntryPointer file)
+{
+    OpenFile of;
+    
+    of.file = file;
+    
+    return fd_table.allocate(of);
+}
+
+// .text/.txt files are text, everything else is untyped.
+static unsigned fileKind(const char *name)
+{
+    const char *tmp = std::strrchr(name, '.');
+    
+    if (tmp)
+    {
+        if (::strcasecmp(tmp, ".text") == 0 || ::strcasecmp(tmp, ".txt") == 0)
+            return kTextFile;
+    }
+    
+    return kUntypedFile;
+}
 
 static FileEntryPointer findChild(VolumeEntry *volume, unsigned inode)
 {
@@ -78,29 +132,43 @@ static FileEntryPointer findChild(VolumeEntry *volume, unsigned inode)
 #pragma mark fs
 
 
+// number of threads used to index text files at mount (0 = on demand).
+unsigned fWarmup = 0;
+
+static ThreadPool *warmupPool = NULL;
+
+
 static void pascal_init(void *userdata, struct fuse_conn_info *conn)
 {
     DEBUGNAME()
 
-    // nop
-    
-    // text files have a non-thread safe index.
-    // which is initialized via read() or fileSize()
+    // text files have a page index, which is built on first use
+    // (read() or fileSize()).  Optionally build them in the background.
     VolumeEntry *volume = (VolumeEntry *)userdata;
     
+    if (!fWarmup) return;
+    
+    warmupPool = new ThreadPool(fWarmup);
+    
     for (unsigned i = 0, l = volume->fileCount(); i < l; ++i)
     {
         FileEntryPointer child = volume->fileAtIndex(i);
-        child->fileSize();
+        
+        if (child && child->fileKind() == kTextFile)
+            warmupPool->enqueue(std::bind(&FileEntry::buildTextIndex, child));
     }
-
 }
 
 static void pascal_destroy(void *userdata)
 {
     DEBUGNAME()
 
-    // nop
+    VolumeEntry *volume = (VolumeEntry *)userdata;
+
+    delete warmupPool;
+    warmupPool = NULL;
+    
+    if (!volume->readOnly()) volume->sync();
 }
 
 
@@ -108,6 +176,8 @@ static void pascal_statfs(fuse_req_t req, fuse_ino_t ino)
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     struct statvfs vst;
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
 
@@ -140,6 +210,8 @@ static void pascal_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     FileEntryPointer file;
     std::string attr;
@@ -183,6 +255,8 @@ static void pascal_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, si
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
 
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     FileEntryPointer file;
@@ -258,6 +332,8 @@ static void pascal_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     ::auto_array<uint8_t> buffer(new uint8_t[size]);
     unsigned count = volume->fileCount();
@@ -309,7 +385,7 @@ static void pascal_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
             if (file == NULL) break; //?
         
             // only these fields are used.
-            st.st_mode = S_IFREG | 0444;
+            st.st_mode = S_IFREG | (volume->readOnly() ? 0444 : 0644);
             st.st_ino = file->inode();
             
         
@@ -339,11 +415,12 @@ static void stat(FileEntry *file, struct stat *st)
 
     std::memset(st, 0, sizeof(struct stat));
     
+    VolumeEntryPointer volume = file->parent().lock();
     time_t t = file->modification();
     
     st->st_ino = file->inode();
     st->st_nlink = 1;
-    st->st_mode = S_IFREG | 0444;
+    st->st_mode = S_IFREG | (volume && !volume->readOnly() ? 0644 : 0444);
     st->st_size = file->fileSize();
     st->st_blocks = file->blocks();
     st->st_blksize = 512;
@@ -364,7 +441,7 @@ static void stat(VolumeEntry *volume, struct stat *st)
     
     st->st_ino = volume->inode();
     st->st_nlink = 1 + volume->fileCount();
-    st->st_mode = S_IFDIR | 0555;
+    st->st_mode = S_IFDIR | (volume->readOnly() ? 0555 : 0755);
     st->st_size = volume->blocks() * 512;
     st->st_blocks = volume->blocks();
     st->st_blksize = 512;
@@ -379,32 +456,25 @@ static void pascal_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     struct fuse_entry_param entry;
 
     ERROR(parent != 1, ENOTDIR)
     ERROR(!FileEntry::ValidName(name), ENOENT)
 
+    FileEntryPointer file = volume->fileByName(name);
     
-    for (unsigned i = 0, l = volume->fileCount(); i < l; ++i)
-    {
-        FileEntryPointer file = volume->fileAtIndex(i);
-        if (file == NULL) break;
+    ERROR(!file, ENOENT)
     
-        if (::strcasecmp(file->name(), name)) continue;
-        
-        // found it!
-        std::memset(&entry, 0, sizeof(entry));
-        entry.attr_timeout = 0.0;
-        entry.entry_timeout = 0.0;
-        entry.ino = file->inode();
-        
-        stat(file.get(), &entry.attr);
-        fuse_reply_entry(req, &entry); 
-        return;
-    }
+    std::memset(&entry, 0, sizeof(entry));
+    entry.attr_timeout = 0.0;
+    entry.entry_timeout = 0.0;
+    entry.ino = file->inode();
     
-    ERROR(true, ENOENT)
+    stat(file.get(), &entry.attr);
+    fuse_reply_entry(req, &entry); 
 }
 
 
@@ -412,6 +482,8 @@ static void pascal_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 {
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     struct stat st;
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     FileEntryPointer file;
@@ -438,9 +510,10 @@ static void pascal_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 static void pascal_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    unsigned index;
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
+
     VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
     FileEntryPointer file;
     
@@ -450,34 +523,88 @@ static void pascal_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *f
     
     ERROR(file == NULL, ENOENT)
     
-    ERROR((fi->flags & O_ACCMODE) != O_RDONLY, EACCES)
+    ERROR((fi->flags & O_ACCMODE) != O_RDONLY && volume->readOnly(), EROFS)
     
-    // insert the FileEntryPointer into fd_table.
-    if (fd_table_available.size())
-    {
-        index = fd_table_available.back();
-        fd_table_available.pop_back();
-        fd_table[index] = file;
-    }
-    else
+    fi->fh = openFile(file);
+    ERROR(fi->fh == 0, ENFILE)
+    
+    fuse_reply_open(req, fi);
+}
+
+
+static void pascal_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    FileEntryPointer file;
+    struct fuse_entry_param entry;
+    
+    ERROR(parent != 1, ENOTDIR)
+    ERROR(volume->readOnly(), EROFS)
+    ERROR(!FileEntry::ValidName(name), EINVAL)
+    
+    // the size isn't known yet, so use the largest gap.  
+    // fallocate() or a write which doesn't fit will move it.
+    unsigned blocks = volume->maxContiguousBlocks();
+    ERROR(blocks == 0, ENOSPC)
+    
+    file = volume->create(name, blocks);
+    ERROR(file == NULL, errno)
+    
+    file->setFileKind(fileKind(name));
+    
+    fi->fh = openFile(file);
+    if (fi->fh == 0)
     {
-        index = fd_table.size();
-        fd_table.push_back(file);
+        // don't leave a file the caller doesn't know about.
+        volume->unlink(file->name());
+        
+        fuse_reply_err(req, ENFILE);
+        return;
     }
     
-    fi->fh = index;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.attr_timeout = 0.0;
+    entry.entry_timeout = 0.0;
+    entry.ino = file->inode();
     
-    fuse_reply_open(req, fi);
+    stat(file.get(), &entry.attr);
+    fuse_reply_create(req, &entry, fi);
 }
 
 
 static void pascal_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    unsigned index = fi->fh;
     DEBUGNAME()
 
-    fd_table[index].reset();
-    fd_table_available.push_back(index);
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    OpenFile *of = fd_table.find(fi->fh);
+    
+    ERROR(of == NULL, EBADF)
+    
+    if (of->encoder || of->dirty)
+    {
+        WriteLocker locker(volumeLock);
+        
+        if (of->encoder)
+        {
+            if (of->encoder->close() < 0)
+                std::fprintf(stderr, "%s: %s\n", of->file->name(), std::strerror(errno));
+        
+            delete of->encoder;
+        }
+        
+        if (of->dirty) volume->sync();
+    }
+    
+    // isOpen() runs with the write lock held.
+    {
+        ReadLocker locker(volumeLock);
+        fd_table.free(fi->fh);
+    }
 
     fuse_reply_err(req, 0);
 }
@@ -485,13 +612,16 @@ static void pascal_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 static void pascal_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-    unsigned index = fi->fh;
-    
     DEBUGNAME()
 
+    ReadLocker locker(volumeLock);
 
     //VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
-    FileEntryPointer file = fd_table[index];
+    OpenFile *of = fd_table.find(fi->fh);
+    
+    ERROR(of == NULL, EBADF)
+    
+    FileEntryPointer file = of->file;
     
 
     
@@ -517,6 +647,226 @@ static void pascal_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     
 }
 
+
+static void pascal_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    int rv;
+
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    OpenFile *of = fd_table.find(fi->fh);
+    
+    ERROR(of == NULL, EBADF)
+    ERROR(volume->readOnly(), EROFS)
+    
+    if (of->file->fileKind() == kTextFile)
+    {
+        if (!of->encoder)
+        {
+            ERROR(off != 0 || of->file->fileSize() != 0, EINVAL)
+            
+            of->encoder = new TextEncoder(of->file);
+            of->offset = 0;
+        }
+        
+        ERROR(off != of->offset, EINVAL)
+        
+        rv = of->encoder->write(buf, size);
+        ERROR(rv < 0, errno)
+        
+        of->offset += size;
+        of->dirty = true;
+        
+        fuse_reply_write(req, size);
+        return;
+    }
+    
+    // move the file if it doesn't fit.
+    ERROR(volume->reserve(of->file.get(), off + size) < 0, errno)
+    
+    rv = of->file->write((const uint8_t *)buf, size, off);
+    ERROR(rv < 0, errno)
+    
+    of->dirty = true;
+    
+    fuse_reply_write(req, rv);
+}
+
+
+/*
+ * called on every close(2).  A text file is finished here rather than
+ * in release() (which runs after close returns), so an error is
+ * reported to the writer and the file is complete before close returns.
+ * Anything else is written back on fsync() and release().
+ */
+static void pascal_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+    
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    
+    WriteLocker locker(volumeLock);
+    
+    OpenFile *of = fd_table.find(fi->fh);
+    
+    ERROR(of == NULL, EBADF)
+    
+    if (of->encoder)
+    {
+        int rv = of->encoder->close();
+        int error = errno;
+        
+        delete of->encoder;
+        of->encoder = NULL;
+        
+        volume->sync();
+        of->dirty = false;
+        
+        ERROR(rv < 0, error)
+    }
+    
+    fuse_reply_err(req, 0);
+}
+
+static void pascal_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    
+    if (!volume->readOnly()) volume->sync();
+    
+    fuse_reply_err(req, 0);
+}
+
+
+#if FUSE_VERSION >= 29
+// the size hint is used to find a gap large enough for the file.
+static void pascal_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    OpenFile *of = fd_table.find(fi->fh);
+    unsigned size = offset + length;
+    
+    ERROR(mode != 0, EOPNOTSUPP)
+    ERROR(of == NULL, EBADF)
+    ERROR(volume->readOnly(), EROFS)
+    
+    if (of->file->fileKind() == kTextFile)
+    {
+        // the text can't be moved once encoding starts.
+        ERROR(of->encoder, EINVAL)
+        
+        ERROR(volume->reserve(of->file.get(), TextEncoder::MaxBlocks(size) * 512) < 0, errno)
+    }
+    else
+    {
+        ERROR(volume->reserve(of->file.get(), size) < 0, errno)
+        
+        if (size > of->file->fileSize())
+        {
+            ERROR(of->file->truncate(size) < 0, errno)
+            of->dirty = true;
+        }
+    }
+    
+    fuse_reply_err(req, 0);
+}
+#endif
+
+
+static void pascal_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    FileEntryPointer file;
+    struct stat st;
+    
+    if (ino == 1)
+    {
+        stat(volume, &st);
+        fuse_reply_attr(req, &st, 0.0);
+        return;
+    }
+    
+    file = findChild(volume, ino);
+    ERROR(file == NULL, ENOENT)
+    
+    if (to_set & FUSE_SET_ATTR_SIZE)
+    {
+        ERROR(volume->readOnly(), EROFS)
+        
+        ERROR(volume->reserve(file.get(), attr->st_size) < 0, errno)
+        ERROR(file->truncate(attr->st_size) < 0, errno)
+        
+        volume->sync();
+    }
+    
+    stat(file.get(), &st);
+    fuse_reply_attr(req, &st, 0.0);
+}
+
+
+#pragma mark -
+#pragma mark dirent
+
+static void pascal_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    FileEntryPointer file;
+    
+    ERROR(parent != 1, ENOTDIR)
+    ERROR(volume->readOnly(), EROFS)
+    
+    file = volume->fileByName(name);
+    ERROR(file == NULL, ENOENT)
+    
+    // the blocks would be re-used while still open.
+    ERROR(isOpen(file.get()), EBUSY)
+    
+    ERROR(volume->unlink(name) < 0, errno)
+    
+    fuse_reply_err(req, 0);
+}
+
+static void pascal_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
+{
+    DEBUGNAME()
+
+    WriteLocker locker(volumeLock);
+
+    VolumeEntry *volume = (VolumeEntry *)fuse_req_userdata(req);
+    FileEntryPointer file;
+    
+    ERROR(parent != 1 || newparent != 1, ENOTDIR)
+    ERROR(volume->readOnly(), EROFS)
+    ERROR(!FileEntry::ValidName(newname), EINVAL)
+    
+    // rename replaces newname.
+    file = volume->fileByName(newname);
+    ERROR(file != NULL && isOpen(file.get()), EBUSY)
+    
+    ERROR(volume->rename(name, newname) < 0, errno)
+    
+    fuse_reply_err(req, 0);
+}
+
 void init_ops(fuse_lowlevel_ops *ops)
 {
     DEBUGNAME()
@@ -543,5 +893,17 @@ void init_ops(fuse_lowlevel_ops *ops)
     ops->open = pascal_open;
     ops->release = pascal_release;
     ops->read = pascal_read;
+    
+    ops->create = pascal_create;
+    ops->write = pascal_write;
+    ops->flush = pascal_flush;
+    ops->fsync = pascal_fsync;
+    ops->setattr = pascal_setattr;
+#if FUSE_VERSION >= 29
+    ops->fallocate = pascal_fallocate;
+#endif
+    
+    ops->unlink = pascal_unlink;
+    ops->rename = pascal_rename;
 
 }
@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <Device/BlockDevice.h>
+
+#include <Batch/Batch.h>
+#include <Batch/Tasks.h>
+
+#include <Common/Exception.h>
+
+
+#define IMGBATCH_VERSION "0.1"
+
+
+enum {
+    kExitClean = 0,
+    kExitProblems = 1,
+    kExitError = 8
+};
+
+
+void usage()
+{
+    std::printf("imgbatch %s\n", IMGBATCH_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgbatch [-jv] [-t threads] [-f format] [-d directory] task[,task ...] file_or_directory ...\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per record)\n"
+                "  -v               Verbose (timing summary on stderr)\n"
+                "  -t threads       Number of worker threads.\n"
+                "                   Default is the number of cpus.\n"
+                "  -d directory     Output directory for extract (default: current directory)\n"
+                "  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "\n"
+                "Tasks:\n"
+                "  catalog          List the volume and every file\n"
+                "  extract          Copy every file to directory/image.d/\n"
+                "  verify           Check the volume structure\n"
+                "  checksum         CRC-32 of every block\n"
+                "\n"
+                "Directories are searched recursively.  ProDOS and Pascal volumes\n"
+                "are supported.\n"
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned threads = 0;
+    unsigned format = 0;
+    bool json = false;
+    bool verbose = false;
+    const char *directory = ".";
+
+    struct timeval start, end;
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hjvt:f:d:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : kExitError;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't':
+                threads = std::strtoul(optarg, NULL, 10);
+                break;
+
+            case 'd':
+                directory = optarg;
+                break;
+
+            case 'f':
+                format = Device::BlockDevice::ImageType(optarg);
+                if (format == 0)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                    return kExitError;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 2)
+    {
+        usage();
+        return kExitError;
+    }
+
+    Batch::CatalogTask catalog;
+    Batch::ExtractTask extract(directory);
+    Batch::VerifyTask verify;
+    Batch::ChecksumTask checksum;
+
+    std::vector<Batch::Task *> tasks;
+    std::string names(argv[0]);
+
+    for (size_t i = 0; i <= names.length(); )
+    {
+        size_t j = names.find(',', i);
+        if (j == std::string::npos) j = names.length();
+
+        std::string name = names.substr(i, j - i);
+
+        if (name == "catalog") tasks.push_back(&catalog);
+        else if (name == "extract") tasks.push_back(&extract);
+        else if (name == "verify") tasks.push_back(&verify);
+        else if (name == "checksum") tasks.push_back(&checksum);
+        else
+        {
+            std::fprintf(stderr, "Error: `%s' is not a valid task.\n", name.c_str());
+            return kExitError;
+        }
+
+        i = j + 1;
+    }
+
+    std::vector<std::string> paths(argv + 1, argv + argc);
+
+    try
+    {
+        Batch::Output output(stdout, json);
+        Batch::Driver driver(output, threads);
+
+        driver.setFormat(format);
+
+        for (unsigned i = 0; i < tasks.size(); ++i)
+            driver.addTask(tasks[i]);
+
+        ::gettimeofday(&start, NULL);
+
+        driver.run(paths);
+
+        ::gettimeofday(&end, NULL);
+
+        std::fflush(stdout);
+
+        if (verbose)
+        {
+            double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+            double mb = driver.bytes() / (1024.0 * 1024.0);
+
+            std::fprintf(stderr, "%u images, %.1f MB in %.3f seconds (%.1f MB/s)\n",
+                driver.images(), mb, elapsed, elapsed > 0 ? mb / elapsed : 0.0);
+        }
+
+        if (driver.errors()) return kExitError;
+        if (driver.problems()) return kExitProblems;
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return kExitError;
+    }
+
+    return kExitClean;
+}
@@ -0,0 +1,259 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <Device/BlockDevice.h>
+
+#include <Batch/Batch.h>
+#include <Batch/Convert.h>
+
+#include <Common/Exception.h>
+#include <Common/WorkPool.h>
+#include <Common/Lock.h>
+
+
+#define IMGCONVERT_VERSION "0.1"
+
+
+enum {
+    kExitClean = 0,
+    kExitError = 8
+};
+
+
+void usage()
+{
+    std::printf("imgconvert %s\n", IMGCONVERT_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgconvert [-jv] [-t threads] [-f format] [-d directory] -o format image ...\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per record)\n"
+                "  -v               Verbose (timing summary on stderr)\n"
+                "  -t threads       Number of worker threads.\n"
+                "                   Default is the number of cpus.\n"
+                "  -d directory     Output directory (default: current directory)\n"
+                "  -f format        Specify the input disk image format.\n"
+                "  -o format        Specify the output disk image format.\n"
+                "                   Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "                   pfm   Chunk store manifest (see imgstore)\n"
+                "\n"
+                "Each image is written to directory/name.ext.  Existing files are\n"
+                "not replaced.\n"
+    );
+}
+
+
+struct Context {
+    unsigned format;
+    unsigned outputFormat;
+    std::string directory;
+
+    Batch::Output *output;
+
+    Lock lock;
+    unsigned images;
+    unsigned errors;
+    unsigned long long bytes;
+};
+
+
+static const char *extension(unsigned format)
+{
+    switch (format)
+    {
+        case '2IMG': return "2mg";
+        case 'DC42': return "dc42";
+        case 'DVX_': return "dvx";
+        case 'DO__': return "do";
+        case 'PO__': return "po";
+        case 'PFM_': return "pfm";
+    }
+    return "img";
+}
+
+// image.dc42 -> directory/image.po
+static std::string outputName(const std::string &directory, const std::string &path, unsigned format)
+{
+    std::string::size_type slash = path.rfind('/');
+    std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+    std::string::size_type dot = name.rfind('.');
+    if (dot != std::string::npos && dot != 0) name.erase(dot);
+
+    return directory + "/" + name + "." + extension(format);
+}
+
+
+static void convertImage(Context *context, std::string path)
+{
+    try
+    {
+        struct stat st;
+
+        unsigned format = context->format ? context->format : Device::BlockDevice::ImageType(path.c_str(), 0);
+        std::string name = outputName(context->directory, path, context->outputFormat);
+
+        // also catches converting an image to itself.
+        if (::stat(name.c_str(), &st) == 0)
+            throw ::Exception(name + ": File exists.");
+
+        Device::BlockDevicePointer device;
+
+        device = Device::BlockDevice::Open(path.c_str(), File::ReadOnly, format);
+
+        if (!device) throw ::Exception("Unknown or unsupported device type.");
+
+        unsigned written = Batch::Convert(device, name.c_str(), context->outputFormat);
+
+        Batch::Record r("convert", path);
+
+        r.add("output", name);
+        r.add("blocks", (unsigned long long)device->blocks());
+        r.add("written", (unsigned long long)written);
+
+        context->output->write(r);
+
+        Locker locker(context->lock);
+        ++context->images;
+        context->bytes += device->blocks() * 512ull;
+    }
+    catch (::Exception &e)
+    {
+        std::string message(e.what());
+
+        if (e.error())
+        {
+            message += ": ";
+            message += e.errorString();
+        }
+
+        Batch::Record r("error", path);
+        r.add("error", message);
+
+        context->output->write(r);
+
+        Locker locker(context->lock);
+        ++context->errors;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned threads = 0;
+    bool json = false;
+    bool verbose = false;
+
+    struct timeval start, end;
+
+    Context context;
+    int c;
+
+    context.format = 0;
+    context.outputFormat = 0;
+    context.directory = ".";
+    context.images = 0;
+    context.errors = 0;
+    context.bytes = 0;
+
+    while ( (c = ::getopt(argc, argv, "hjvt:f:o:d:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : kExitError;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't':
+                threads = std::strtoul(optarg, NULL, 10);
+                break;
+
+            case 'd':
+                context.directory = optarg;
+                break;
+
+            case 'f':
+            case 'o':
+                {
+                    unsigned format = Device::BlockDevice::ImageType(optarg);
+                    if (format == 0)
+                    {
+                        std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                        return kExitError;
+                    }
+                    if (c == 'f') context.format = format;
+                    else context.outputFormat = format;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1 || !context.outputFormat)
+    {
+        usage();
+        return kExitError;
+    }
+
+    ::gettimeofday(&start, NULL);
+
+    try
+    {
+        Batch::Output output(stdout, json);
+        WorkPool pool(threads);
+
+        context.output = &output;
+
+        for (int i = 0; i < argc; ++i)
+            pool.enqueue(std::bind(convertImage, &context, std::string(argv[i])));
+
+        pool.wait();
+
+        std::fflush(stdout);
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return kExitError;
+    }
+
+    ::gettimeofday(&end, NULL);
+
+    if (verbose)
+    {
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+        double mb = context.bytes / (1024.0 * 1024.0);
+
+        std::fprintf(stderr, "%u images, %.1f MB in %.3f seconds (%.1f MB/s)\n",
+            context.images, mb, elapsed, elapsed > 0 ? mb / elapsed : 0.0);
+    }
+
+    return context.errors ? kExitError : kExitClean;
+}
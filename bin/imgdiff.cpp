@@ -0,0 +1,254 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <Device/BlockDevice.h>
+
+#include <Batch/Batch.h>
+#include <Batch/Patch.h>
+
+#include <Common/Exception.h>
+
+
+#define IMGDIFF_VERSION "0.1"
+
+
+enum {
+    kExitSame = 0,
+    kExitDifferent = 1,
+    kExitError = 8
+};
+
+
+void usage()
+{
+    std::printf("imgdiff %s\n", IMGDIFF_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgdiff [-jqs] [-f format] [-F format] [-o patch] old_image new_image\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per record)\n"
+                "  -q               Quiet (exit status only)\n"
+                "  -s               Summary only\n"
+                "  -o patch         Write the changed blocks to a patch file (see imgpatch)\n"
+                "  -f format        Format of old_image.\n"
+                "  -F format        Format of new_image.  Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "\n"
+                "Changed blocks are listed with the ProDOS or Pascal file which uses\n"
+                "them.  Exit status is 0 if the images are the same, 1 if they differ.\n"
+    );
+}
+
+
+static unsigned imageType(const char *type)
+{
+    unsigned format = Device::BlockDevice::ImageType(type);
+
+    if (format == 0)
+    {
+        std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", type);
+        std::exit(kExitError);
+    }
+
+    return format;
+}
+
+static Device::BlockDevicePointer openImage(const char *path, unsigned format)
+{
+    Device::BlockDevicePointer device;
+
+    if (!format) format = Device::BlockDevice::ImageType(path, 0);
+
+    device = Device::BlockDevice::Open(path, File::ReadOnly, format);
+
+    if (!device) throw ::Exception("Unknown or unsupported device type.");
+
+    return device;
+}
+
+
+static const char *ownerName(const char *owner)
+{
+    return owner ? owner : "<free>";
+}
+
+// split runs where the owner (in either image) changes.
+static void listRuns(const std::vector<Batch::BlockRun> &runs,
+    const Batch::BlockOwners &oldOwners, const Batch::BlockOwners &newOwners,
+    const std::string &path, Batch::Output &output)
+{
+    for (std::vector<Batch::BlockRun>::const_iterator iter = runs.begin(); iter != runs.end(); ++iter)
+    {
+        unsigned end = iter->block + iter->count;
+
+        for (unsigned block = iter->block; block < end; )
+        {
+            const char *oldOwner = oldOwners.owner(block);
+            const char *newOwner = newOwners.owner(block);
+            unsigned count = 1;
+
+            while (block + count < end
+                && oldOwners.owner(block + count) == oldOwner
+                && newOwners.owner(block + count) == newOwner)
+                ++count;
+
+            Batch::Record r("changed", path);
+
+            r.add("block", (unsigned long long)block);
+            r.add("count", (unsigned long long)count);
+            r.add("owner", ownerName(newOwner));
+
+            if (!oldOwner != !newOwner || (oldOwner && std::strcmp(oldOwner, newOwner)))
+                r.add("old_owner", ownerName(oldOwner));
+
+            output.write(r);
+
+            block += count;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned oldFormat = 0;
+    unsigned newFormat = 0;
+    bool json = false;
+    bool quiet = false;
+    bool summary = false;
+    const char *patch = NULL;
+
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hjqsf:F:o:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : kExitError;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'q':
+                quiet = true;
+                break;
+
+            case 's':
+                summary = true;
+                break;
+
+            case 'o':
+                patch = optarg;
+                break;
+
+            case 'f':
+                oldFormat = imageType(optarg);
+                break;
+
+            case 'F':
+                newFormat = imageType(optarg);
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 2)
+    {
+        usage();
+        return kExitError;
+    }
+
+    try
+    {
+        Device::BlockDevicePointer oldDevice = openImage(argv[0], oldFormat);
+        Device::BlockDevicePointer newDevice = openImage(argv[1], newFormat);
+
+        std::vector<Batch::BlockRun> runs = Batch::DiffBlocks(oldDevice, newDevice);
+
+        unsigned changed = 0;
+        for (unsigned i = 0; i < runs.size(); ++i)
+            changed += runs[i].count;
+
+        if (patch)
+        {
+            std::FILE *fp = std::fopen(patch, "wb");
+
+            if (!fp)
+            {
+                std::fprintf(stderr, "Error: %s: %s\n", patch, std::strerror(errno));
+                return kExitError;
+            }
+
+            try
+            {
+                Batch::WritePatch(fp, oldDevice, newDevice, runs);
+            }
+            catch (...)
+            {
+                std::fclose(fp);
+                throw;
+            }
+
+            if (std::fclose(fp) != 0)
+            {
+                std::fprintf(stderr, "Error: %s: %s\n", patch, std::strerror(errno));
+                return kExitError;
+            }
+        }
+
+        if (!quiet)
+        {
+            Batch::Output output(stdout, json);
+            std::string path(argv[1]);
+
+            // owners are only needed for the details.
+            if (!summary && !runs.empty())
+            {
+                Batch::Image oldImage(argv[0], oldDevice);
+                Batch::Image newImage(argv[1], newDevice);
+
+                Batch::BlockOwners oldOwners(oldImage);
+                Batch::BlockOwners newOwners(newImage);
+
+                listRuns(runs, oldOwners, newOwners, path, output);
+            }
+
+            Batch::Record r("diff", path);
+
+            r.add("old", argv[0]);
+            r.add("blocks", (unsigned long long)newDevice->blocks());
+            r.add("changed", (unsigned long long)changed);
+            r.add("runs", (unsigned long long)runs.size());
+
+            output.write(r);
+        }
+
+        return changed ? kExitDifferent : kExitSame;
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        if (e.error())
+            std::fprintf(stderr, "%s\n", e.errorString());
+        return kExitError;
+    }
+}
@@ -0,0 +1,701 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <Device/BlockDevice.h>
+
+#include <Batch/Batch.h>
+#include <Batch/Catalog.h>
+
+#include <File/File.h>
+
+#include <Common/Exception.h>
+#include <Common/WorkPool.h>
+#include <Common/Lock.h>
+
+
+#define IMGINDEX_VERSION "0.1"
+
+
+void usage()
+{
+    std::printf("imgindex %s\n", IMGINDEX_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgindex [-jv] [-t threads] [-f format] update catalog file_or_directory ...\n");
+    std::printf("imgindex [-jv] [-n name] [-y type[,aux]] [-c crc|file] find catalog\n");
+    std::printf("imgindex stats catalog\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per record)\n"
+                "  -v               Verbose (timing summary on stderr)\n"
+                "  -t threads       Number of worker threads.\n"
+                "                   Default is the number of cpus.\n"
+                "  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "                   pfm   Chunk store manifest (see imgstore)\n"
+                "  -n name          File name (case insensitive, * ? [] allowed)\n"
+                "  -y type[,aux]    File type and aux type ($hex, 0xhex or decimal.)\n"
+                "                   Pascal files use the file kind (text is 3.)\n"
+                "  -c crc|file      CRC-32 of the data fork, or a file to match.\n"
+                "\n"
+                "update adds every image under the paths to the catalog.  Images\n"
+                "which haven't changed (modification time and size) since the last\n"
+                "update aren't read again.  Catalog images under the paths which no\n"
+                "longer exist are removed; other images are kept.\n"
+                "\n"
+                "find lists every file which matches all of the options.\n"
+    );
+}
+
+
+struct Context {
+    unsigned format;
+
+    Batch::Output *output;
+
+    Lock lock;
+    unsigned errors;
+    unsigned long long bytes;
+};
+
+
+static std::string trimPath(const char *path)
+{
+    std::string rv(path);
+
+    while (rv.length() > 1 && rv[rv.length() - 1] == '/') rv.erase(rv.length() - 1);
+
+    return rv;
+}
+
+// directory or file.
+static bool underPath(const std::string &path, const std::string &root)
+{
+    if (path.compare(0, root.length(), root)) return false;
+
+    return path.length() == root.length() || path[root.length()] == '/' || root == "/";
+}
+
+// directories are searched recursively.
+static void findImages(const std::string &path, std::vector<std::string> &rv)
+{
+    struct stat st;
+
+    if (::stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        rv.push_back(path);
+        return;
+    }
+
+    DIR *dp = ::opendir(path.c_str());
+
+    if (!dp)
+    {
+        std::perror(path.c_str());
+        return;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *dir;
+
+    while ((dir = ::readdir(dp)) != NULL)
+    {
+        if (dir->d_name[0] == '.') continue;
+        names.push_back(dir->d_name);
+    }
+    ::closedir(dp);
+
+    std::sort(names.begin(), names.end());
+
+    for (std::vector<std::string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        std::string child = path == "/" ? "/" + *iter : path + "/" + *iter;
+
+        if (::stat(child.c_str(), &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) findImages(child, rv);
+
+        else if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) rv.push_back(child);
+    }
+}
+
+
+static void scanImage(Context *context, Batch::CatalogImage *image)
+{
+    const std::string &path = image->path;
+
+    try
+    {
+        unsigned format = context->format ? context->format : Device::BlockDevice::ImageType(path.c_str(), 0);
+
+        Device::BlockDevicePointer device = Device::BlockDevice::Open(path.c_str(), File::ReadOnly, format);
+
+        if (!device) throw ::Exception("Unknown or unsupported device type.");
+
+        Batch::Image img(path, device);
+
+        Batch::CatalogScan(img, *image);
+
+        Batch::Record r("index", path);
+
+        r.add("filesystem", Batch::Image::FileSystemName(image->fileSystem));
+        r.add("volume", image->volume);
+        r.add("files", (unsigned long long)image->entries.size());
+        r.add("problems", (unsigned long long)image->problems);
+
+        context->output->write(r);
+
+        Locker locker(context->lock);
+        context->bytes += device->blocks() * 512ull;
+    }
+    catch (::Exception &e)
+    {
+        std::string message(e.what());
+
+        if (e.error())
+        {
+            message += ": ";
+            message += e.errorString();
+        }
+
+        // kept (without files) so it isn't opened again until it changes.
+        image->fileSystem = Batch::Image::kUnknown;
+        image->volume.clear();
+        image->entries.clear();
+        image->problems = 1;
+
+        Batch::Record r("error", path);
+        r.add("error", message);
+
+        context->output->write(r);
+
+        Locker locker(context->lock);
+        ++context->errors;
+    }
+}
+
+
+static bool imageLess(const Batch::CatalogImage &a, const Batch::CatalogImage &b)
+{
+    return a.path < b.path;
+}
+
+static bool unchanged(const Batch::CatalogImage &image, const struct stat &st)
+{
+    return image.mtime == (int64_t)st.st_mtim.tv_sec
+        && image.mtimeNSec == (uint32_t)st.st_mtim.tv_nsec
+        && image.size == (uint64_t)st.st_size;
+}
+
+/*
+ * images outside the roots are copied from the old catalog, as are
+ * unchanged images under them.  Everything else is added to scan.
+ * Returns the number of images reused.
+ */
+static unsigned loadCatalog(const char *name, const std::vector<std::string> &roots,
+    const std::vector<std::string> &paths, std::vector<Batch::CatalogImage> &images, std::vector<unsigned> &scan)
+{
+    struct stat st;
+    unsigned reused = 0;
+
+    std::map<std::string, unsigned> previous;
+
+    images.clear();
+    scan.clear();
+
+    Batch::Catalog catalog(name);
+
+    for (unsigned i = 0; i < catalog.images(); ++i)
+    {
+        const char *path = catalog.imagePath(i);
+        bool found = false;
+
+        for (std::vector<std::string>::const_iterator iter = roots.begin(); iter != roots.end(); ++iter)
+        {
+            if (underPath(path, *iter))
+            {
+                found = true;
+                break;
+            }
+        }
+
+        if (found)
+        {
+            previous[path] = i;
+            continue;
+        }
+
+        images.push_back(Batch::CatalogImage());
+        catalog.image(i, images.back());
+        ++reused;
+    }
+
+    for (std::vector<std::string>::const_iterator path = paths.begin(); path != paths.end(); ++path)
+    {
+        std::map<std::string, unsigned>::iterator iter = previous.find(*path);
+
+        images.push_back(Batch::CatalogImage());
+
+        Batch::CatalogImage &image = images.back();
+
+        if (iter != previous.end() && ::stat(path->c_str(), &st) == 0)
+        {
+            catalog.image(iter->second, image, false);
+
+            if (unchanged(image, st))
+            {
+                catalog.image(iter->second, image);
+                ++reused;
+                continue;
+            }
+        }
+
+        image = Batch::CatalogImage();
+        image.path = *path;
+
+        scan.push_back(images.size() - 1);
+    }
+
+    return reused;
+}
+
+static int update(int argc, char **argv, Context &context, unsigned threads, bool json, bool verbose)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    struct timeval start, end;
+    struct stat st;
+
+    ::gettimeofday(&start, NULL);
+
+    const char *name = argv[0];
+
+    std::vector<std::string> roots;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        roots.push_back(trimPath(argv[i]));
+        findImages(roots.back(), paths);
+    }
+
+    std::vector<Batch::CatalogImage> images;
+    std::vector<unsigned> scan;
+    unsigned reused = 0;
+
+    if (::stat(name, &st) == 0)
+    {
+        try
+        {
+            reused = loadCatalog(name, roots, paths, images, scan);
+        }
+        catch (::Exception &e)
+        {
+            // a damaged catalog is rebuilt.
+            std::fprintf(stderr, "%s: %s\n", name, e.what());
+            images.clear();
+            scan.clear();
+            reused = 0;
+        }
+    }
+
+    if (images.empty())
+    {
+        images.resize(paths.size());
+
+        for (unsigned i = 0; i < paths.size(); ++i)
+        {
+            images[i].path = paths[i];
+            scan.push_back(i);
+        }
+    }
+
+    // stat before reading, so a change during the scan is seen next time.
+    for (std::vector<unsigned>::iterator iter = scan.begin(); iter != scan.end(); ++iter)
+    {
+        Batch::CatalogImage &image = images[*iter];
+
+        image.mtime = -1;
+        image.mtimeNSec = 0;
+        image.size = 0;
+        image.fileSystem = Batch::Image::kUnknown;
+        image.problems = 0;
+
+        if (::stat(image.path.c_str(), &st) == 0)
+        {
+            image.mtime = st.st_mtim.tv_sec;
+            image.mtimeNSec = st.st_mtim.tv_nsec;
+            image.size = st.st_size;
+        }
+    }
+
+    Batch::Output output(stdout, json);
+    context.output = &output;
+
+    {
+        WorkPool pool(threads);
+
+        for (std::vector<unsigned>::iterator iter = scan.begin(); iter != scan.end(); ++iter)
+            pool.enqueue(std::bind(scanImage, &context, &images[*iter]));
+
+        pool.wait();
+    }
+
+    std::sort(images.begin(), images.end(), imageLess);
+
+    Batch::CatalogWrite(name, images);
+
+    std::fflush(stdout);
+
+    ::gettimeofday(&end, NULL);
+
+    if (verbose)
+    {
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+        double mb = context.bytes / (1024.0 * 1024.0);
+        unsigned long long files = 0;
+
+        for (std::vector<Batch::CatalogImage>::iterator iter = images.begin(); iter != images.end(); ++iter)
+            files += iter->entries.size();
+
+        std::fprintf(stderr, "%u images (%u scanned, %u unchanged), %llu files, %.1f MB in %.3f seconds\n",
+            (unsigned)images.size(), (unsigned)scan.size(), reused, files, mb, elapsed);
+    }
+
+    return context.errors ? 1 : 0;
+}
+
+
+struct Query {
+    const char *name;
+    bool type;
+    unsigned fileType;
+    int auxType;
+    bool crc;
+    uint32_t crcValue;
+};
+
+static bool parseNumber(const char *cp, unsigned *rv, const char **end)
+{
+    char *ep;
+    int base = 0;
+
+    if (*cp == '$')
+    {
+        ++cp;
+        base = 16;
+    }
+
+    if (!std::isxdigit(*cp)) return false;
+
+    *rv = std::strtoul(cp, &ep, base);
+    *end = ep;
+
+    return true;
+}
+
+// type or type,aux
+static bool parseType(const char *cp, Query &query)
+{
+    unsigned value;
+
+    if (!parseNumber(cp, &value, &cp) || value > 0xffff) return false;
+
+    query.fileType = value;
+    query.auxType = -1;
+
+    if (*cp == 0) return true;
+
+    if (*cp++ != ',' || !parseNumber(cp, &value, &cp) || value > 0xffff || *cp) return false;
+
+    query.auxType = value;
+
+    return true;
+}
+
+// a file to match, or hex.
+static bool parseCrc(const char *cp, Query &query)
+{
+    File file(cp, O_RDONLY, std::nothrow);
+
+    if (file.isValid())
+    {
+        std::vector<uint8_t> buffer(32768);
+        uint32_t crc = 0;
+        ssize_t count;
+
+        while ((count = ::read(file.fd(), &buffer[0], buffer.size())) != 0)
+        {
+            if (count < 0)
+            {
+                if (errno == EINTR) continue;
+                std::perror(cp);
+                return false;
+            }
+
+            crc = Batch::Crc32(crc, &buffer[0], count);
+        }
+
+        query.crcValue = crc;
+        return true;
+    }
+
+    char *ep;
+
+    if (!std::isxdigit(*cp)) return false;
+
+    unsigned long value = std::strtoul(cp, &ep, 16);
+
+    if (*ep || value > 0xffffffff) return false;
+
+    query.crcValue = value;
+
+    return true;
+}
+
+static bool matches(const Batch::CatalogEntry &e, const Query &query)
+{
+    if (query.crc && e.crc != query.crcValue) return false;
+
+    if (query.type)
+    {
+        if (e.fileType != query.fileType) return false;
+        if (query.auxType >= 0 && e.auxType != (unsigned)query.auxType) return false;
+    }
+
+    if (query.name)
+    {
+        std::string::size_type slash = e.path.rfind('/');
+        const char *name = e.path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+
+        if (::fnmatch(query.name, name, FNM_CASEFOLD) != 0) return false;
+    }
+
+    return true;
+}
+
+static int find(int argc, char **argv, const Query &query, bool json, bool verbose)
+{
+    if (argc != 1 || (!query.name && !query.type && !query.crc))
+    {
+        usage();
+        return 1;
+    }
+
+    struct timeval start, end;
+
+    ::gettimeofday(&start, NULL);
+
+    Batch::Catalog catalog(argv[0]);
+    Batch::Output output(stdout, json);
+
+    std::vector<unsigned> entries;
+
+    // the most selective index first; the rest are filters.
+    if (query.crc) catalog.findCrc(query.crcValue, entries);
+    else if (query.type) catalog.findType(query.fileType, query.auxType, entries);
+    else catalog.findName(query.name, entries);
+
+    Batch::CatalogImage image;
+    Batch::CatalogEntry e;
+    unsigned found = 0;
+
+    for (std::vector<unsigned>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+        catalog.entry(*iter, e);
+
+        if (!matches(e, query)) continue;
+
+        catalog.image(catalog.entryImage(*iter), image, false);
+
+        char crc[9];
+        std::snprintf(crc, sizeof(crc), "%08x", e.crc);
+
+        Batch::Record r("file", image.path);
+
+        r.add("volume", image.volume);
+        r.add("path", e.path);
+        r.add("storage", (unsigned long long)e.storage);
+        r.add("filetype", (unsigned long long)e.fileType);
+        r.add("auxtype", (unsigned long long)e.auxType);
+        r.add("size", (unsigned long long)e.size);
+        r.add("blocks", (unsigned long long)e.blocks);
+        r.add("modified", (unsigned long long)e.modified);
+        r.add("crc32", crc);
+
+        output.write(r);
+        ++found;
+    }
+
+    std::fflush(stdout);
+
+    ::gettimeofday(&end, NULL);
+
+    if (verbose)
+    {
+        double elapsed = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+
+        std::fprintf(stderr, "%u matches (%u entries) in %.3f ms\n", found, catalog.entries(), elapsed);
+    }
+
+    return found ? 0 : 1;
+}
+
+
+static int stats(int argc, char **argv)
+{
+    if (argc != 1)
+    {
+        usage();
+        return 1;
+    }
+
+    Batch::Catalog catalog(argv[0]);
+    Batch::CatalogImage image;
+
+    unsigned counts[3] = { 0, 0, 0 };
+    unsigned problems = 0;
+
+    for (unsigned i = 0; i < catalog.images(); ++i)
+    {
+        catalog.image(i, image, false);
+
+        ++counts[image.fileSystem < 3 ? image.fileSystem : 0];
+        if (image.problems) ++problems;
+    }
+
+    std::printf("%u images (%u ProDOS, %u Pascal, %u unknown), %u files, %u with problems\n",
+        catalog.images(), counts[Batch::Image::kProDOS], counts[Batch::Image::kPascal],
+        counts[Batch::Image::kUnknown], catalog.entries(), problems);
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned threads = 0;
+    bool json = false;
+    bool verbose = false;
+
+    Context context;
+    Query query;
+    int c;
+
+    context.format = 0;
+    context.output = NULL;
+    context.errors = 0;
+    context.bytes = 0;
+
+    query.name = NULL;
+    query.type = false;
+    query.fileType = 0;
+    query.auxType = -1;
+    query.crc = false;
+    query.crcValue = 0;
+
+    while ( (c = ::getopt(argc, argv, "hjvt:f:n:y:c:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : 1;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't':
+                threads = std::strtoul(optarg, NULL, 10);
+                break;
+
+            case 'f':
+                context.format = Device::BlockDevice::ImageType(optarg);
+                if (context.format == 0)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'n':
+                query.name = optarg;
+                break;
+
+            case 'y':
+                query.type = parseType(optarg, query);
+                if (!query.type)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a valid file type.\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'c':
+                query.crc = parseCrc(optarg, query);
+                if (!query.crc)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a valid crc or file.\n", optarg);
+                    return 1;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+    {
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        if (!std::strcmp(argv[0], "update")) return update(argc - 1, argv + 1, context, threads, json, verbose);
+        if (!std::strcmp(argv[0], "find")) return find(argc - 1, argv + 1, query, json, verbose);
+        if (!std::strcmp(argv[0], "stats")) return stats(argc - 1, argv + 1);
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        if (e.error())
+            std::fprintf(stderr, "%s\n", e.errorString());
+        return 1;
+    }
+
+    usage();
+    return 1;
+}
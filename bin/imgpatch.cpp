@@ -0,0 +1,199 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <unistd.h>
+
+#include <Device/BlockDevice.h>
+
+#include <Batch/Batch.h>
+#include <Batch/Patch.h>
+
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+#include <Common/WorkPool.h>
+#include <Common/Lock.h>
+
+
+#define IMGPATCH_VERSION "0.1"
+
+
+enum {
+    kExitClean = 0,
+    kExitError = 8
+};
+
+
+void usage()
+{
+    std::printf("imgpatch %s\n", IMGPATCH_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgpatch [-jn] [-t threads] [-f format] patch image ...\n");
+    std::printf("\n");
+    std::printf("  -j               JSON output (one line per record)\n"
+                "  -n               Check the images but don't change them\n"
+                "  -t threads       Number of worker threads.\n"
+                "                   Default is the number of cpus.\n"
+                "  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "\n"
+                "The patch is made by imgdiff -o.  An image is only changed if every\n"
+                "block matches the old image (or is already patched).\n"
+    );
+}
+
+
+struct Context {
+    const char *patch;
+    unsigned format;
+    bool dryRun;
+
+    Batch::Output *output;
+
+    Lock lock;
+    unsigned errors;
+};
+
+
+static void patchImage(Context *context, std::string path)
+{
+    std::FILE *fp = NULL;
+
+    try
+    {
+        unsigned format = context->format ? context->format : Device::BlockDevice::ImageType(path.c_str(), 0);
+
+        Device::BlockDevicePointer device;
+
+        device = Device::BlockDevice::Open(path.c_str(), context->dryRun ? File::ReadOnly : File::ReadWrite, format);
+
+        if (!device) throw ::Exception("Unknown or unsupported device type.");
+
+        // each image reads the patch, so memory use doesn't depend on its size.
+        fp = std::fopen(context->patch, "rb");
+
+        if (!fp) throw POSIX::Exception(context->patch, errno);
+
+        unsigned changed = Batch::ApplyPatch(fp, device, context->dryRun);
+
+        std::fclose(fp);
+
+        Batch::Record r("patch", path);
+
+        r.add("changed", (unsigned long long)changed);
+        r.add("status", changed ? context->dryRun ? "needed" : "patched" : "unchanged");
+
+        context->output->write(r);
+    }
+    catch (::Exception &e)
+    {
+        if (fp) std::fclose(fp);
+
+        std::string message(e.what());
+
+        if (e.error())
+        {
+            message += ": ";
+            message += e.errorString();
+        }
+
+        Batch::Record r("error", path);
+        r.add("error", message);
+
+        context->output->write(r);
+
+        Locker locker(context->lock);
+        ++context->errors;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned threads = 0;
+    bool json = false;
+
+    Context context;
+    int c;
+
+    context.format = 0;
+    context.dryRun = false;
+    context.errors = 0;
+
+    while ( (c = ::getopt(argc, argv, "hjnt:f:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : kExitError;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'n':
+                context.dryRun = true;
+                break;
+
+            case 't':
+                threads = std::strtoul(optarg, NULL, 10);
+                break;
+
+            case 'f':
+                context.format = Device::BlockDevice::ImageType(optarg);
+                if (context.format == 0)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                    return kExitError;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 2)
+    {
+        usage();
+        return kExitError;
+    }
+
+    context.patch = argv[0];
+
+    try
+    {
+        Batch::Output output(stdout, json);
+        WorkPool pool(threads);
+
+        context.output = &output;
+
+        for (int i = 1; i < argc; ++i)
+            pool.enqueue(std::bind(patchImage, &context, std::string(argv[i])));
+
+        pool.wait();
+
+        std::fflush(stdout);
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return kExitError;
+    }
+
+    return context.errors ? kExitError : kExitClean;
+}
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <dirent.h>
+
+#include <Device/BlockDevice.h>
+#include <Device/ChunkDevice.h>
+#include <Device/ChunkStore.h>
+
+#include <Common/Exception.h>
+
+
+#define IMGSTORE_VERSION "0.1"
+
+
+enum {
+    kChunkBlocks = 64
+};
+
+
+void usage()
+{
+    std::printf("imgstore %s\n", IMGSTORE_VERSION);
+    std::printf("\n");
+
+
+    std::printf("imgstore [-f format] add directory image ...\n");
+    std::printf("imgstore stats directory\n");
+    std::printf("\n");
+    std::printf("  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "\n"
+                "add copies each image to directory/name.pfm.  Blocks are shared\n"
+                "by every .pfm image in the directory.  A .pfm image can be used\n"
+                "anywhere a disk image can (format pfm).\n"
+    );
+}
+
+
+// image.po -> directory/image.pfm
+static std::string manifestName(const std::string &directory, const char *path)
+{
+    const char *name = std::strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    const char *dot = std::strrchr(name, '.');
+
+    std::string rv(name, dot && dot != name ? dot : name + std::strlen(name));
+
+    return directory + "/" + rv + ".pfm";
+}
+
+
+static int add(int argc, char **argv, unsigned format)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    std::string directory(argv[0]);
+    std::vector<uint8_t> buffer(kChunkBlocks * 512);
+    int rv = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            const char *path = argv[i];
+            std::string name = manifestName(directory, path);
+
+            Device::BlockDevicePointer src = Device::BlockDevice::Open(path, File::ReadOnly, format);
+
+            if (!src) throw ::Exception("Unknown or unsupported device type.");
+
+            unsigned blocks = src->blocks();
+
+            Device::BlockDevicePointer dest = Device::ChunkDevice::Create(name.c_str(), blocks);
+            Device::ChunkStorePointer store = ((Device::ChunkDevice *)dest.get())->store();
+
+            unsigned before = store->chunks();
+
+            for (unsigned block = 0; block < blocks; block += kChunkBlocks)
+            {
+                unsigned count = std::min((unsigned)kChunkBlocks, blocks - block);
+
+                src->readBlocks(block, count, &buffer[0]);
+                dest->writeBlocks(block, count, &buffer[0]);
+            }
+
+            dest->sync();
+
+            std::printf("%s -> %s (%u blocks, %u new)\n", path, name.c_str(), blocks, store->chunks() - before);
+        }
+        catch (::Exception &e)
+        {
+            std::fprintf(stderr, "%s: %s\n", argv[i], e.what());
+            if (e.error())
+                std::fprintf(stderr, "%s\n", e.errorString());
+            rv = 1;
+        }
+    }
+
+    return rv;
+}
+
+
+static int stats(int argc, char **argv)
+{
+    if (argc != 1)
+    {
+        usage();
+        return 1;
+    }
+
+    std::string directory(argv[0]);
+
+    DIR *dp = ::opendir(directory.c_str());
+
+    if (!dp)
+    {
+        std::perror(directory.c_str());
+        return 1;
+    }
+
+    unsigned images = 0;
+    unsigned long long blocks = 0;
+    struct dirent *dir;
+
+    while ((dir = ::readdir(dp)) != NULL)
+    {
+        size_t l = std::strlen(dir->d_name);
+
+        if (dir->d_name[0] == '.' || l < 4 || std::strcmp(dir->d_name + l - 4, ".pfm")) continue;
+
+        std::string path = directory + "/" + dir->d_name;
+
+        try
+        {
+            Device::BlockDevicePointer device = Device::BlockDevice::Open(path.c_str(), File::ReadOnly, 'PFM_');
+
+            if (!device) continue;
+
+            ++images;
+            blocks += device->blocks();
+        }
+        catch (::Exception &e)
+        {
+            std::fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+        }
+    }
+    ::closedir(dp);
+
+    Device::ChunkStorePointer store = Device::ChunkStore::Open(directory.c_str(), File::ReadOnly);
+
+    // chunk 0 (zeros) isn't stored.
+    unsigned long long chunks = store->chunks() - 1;
+
+    std::printf("%u images, %llu blocks, %llu chunks stored", images, blocks, chunks);
+
+    if (chunks)
+        std::printf(" (%.1f:1)", (double)blocks / chunks);
+
+    std::printf("\n");
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned format = 0;
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hf:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : 1;
+                break;
+
+            case 'f':
+                format = Device::BlockDevice::ImageType(optarg);
+                if (format == 0)
+                {
+                    std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                    return 1;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+    {
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        if (!std::strcmp(argv[0], "add")) return add(argc - 1, argv + 1, format);
+        if (!std::strcmp(argv[0], "stats")) return stats(argc - 1, argv + 1);
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        if (e.error())
+            std::fprintf(stderr, "%s\n", e.errorString());
+        return 1;
+    }
+
+    usage();
+    return 1;
+}
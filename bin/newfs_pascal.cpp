@@ -1,10 +1,12 @@
 
 #include <memory>
 #include <new>
+#include <vector>
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
 #include <cstdlib>
+#include <cctype>
 
 #include <unistd.h>
 #include <sys/stat.h>
@@ -31,6 +33,23 @@ using namespace Device;
 #define NEWFS_VERSION "0.1"
 
 
+// the volume name is in the volume header (block 2).
+void setVolumeName(BlockDevicePointer device, const char *name)
+{
+    uint8_t buffer[512];
+    unsigned length = VolumeEntry::ValidName(name);
+    
+    device->read(2, buffer);
+    
+    buffer[6] = length;
+    std::memset(buffer + 7, 0, 7);
+    for (unsigned i = 0; i < length; ++i)
+        buffer[7 + i] = std::toupper(name[i]);
+    
+    device->write(2, buffer);
+}
+
+
 
 bool yes_or_no()
 {
@@ -117,6 +136,7 @@ void usage()
 
 
     std::printf("newfs_pascal [-v volume_name] [-s size] [-f format] file\n");
+    std::printf("newfs_pascal -t template [-v volume_name] file\n");
     std::printf("\n");
     std::printf("  -v volume_name   Specify the volume name.\n"
                 "                   Default is Untitled.\n"
@@ -129,6 +149,8 @@ void usage()
                 "                   davex Davex Disk Image\n"
                 "                   do    DOS Order Disk Image\n"
                 "                   po    ProDOS Order Disk Image (default)\n"
+                "  -t template      Copy an existing (empty) image.  The size and\n"
+                "                   format are the template's.\n"
     );
 
 
@@ -140,13 +162,14 @@ int main(int argc, char **argv)
     std::string volumeName;
     std::string fileName;
     std::string bootFile;
+    std::string templateFile;
     
     int format = 0;
     const char *fname;
     int c;
     
 
-    while ( (c = ::getopt(argc, argv, "hf:s:v:")) != -1)
+    while ( (c = ::getopt(argc, argv, "hb:f:s:t:v:")) != -1)
     {
         switch(c)
         {
@@ -187,6 +210,10 @@ int main(int argc, char **argv)
             case 'b':
                 bootFile = optarg;
                 break;
+                
+            case 't':
+                templateFile = optarg;
+                break;
         
         }
     }
@@ -215,7 +242,6 @@ int main(int argc, char **argv)
         bool rawDevice = false;
         
         BlockDevicePointer device;
-        VolumeEntryPointer volume;
         
         // Check for block device.  if so, verify.
         // if file exists, verify before overwrite.
@@ -250,6 +276,26 @@ int main(int argc, char **argv)
             
         }
         
+        // a template is copied as is, other than the volume name.
+        if (!templateFile.empty())
+        {
+            if (rawDevice)
+            {
+                std::fprintf(stderr, "Error: a template can't be copied to a raw device.\n");
+                return -1;
+            }
+            
+            File::Clone(templateFile.c_str(), fname);
+            
+            if (!volumeName.empty())
+            {
+                device = BlockDevice::Open(fname, File::ReadWrite);
+                if (device.get()) setVolumeName(device, volumeName.c_str());
+            }
+            
+            return 0;
+        }
+        
         // generate a filename.
         if (volumeName.empty())
         {
@@ -259,15 +305,9 @@ int main(int argc, char **argv)
                 volumeName = "PASCAL";
         }              
         
-        if (!rawDevice)
-            device = BlockDevice::Create(fname, volumeName.c_str(), blocks, format);
-        
-        if (!device.get())
-        {
-            std::fprintf(stderr, "Error: Unsupported diskimage format.\n");
-            return -1;
-        }
-        
+        // boot blocks and the directory.
+        std::vector<uint8_t> buffer(6 * 512);
+        unsigned bootBlocks = 0;
         
         if (!bootFile.empty())
         {
@@ -281,14 +321,10 @@ int main(int argc, char **argv)
             {
                 size_t length = bf.length();
                 // either 1 or 2 blocks.
-                if (length == 512)
-                {
-                    device->write(0, bf.address());
-                }
-                else if (length == 1024)
+                if (length == 512 || length == 1024)
                 {
-                    device->write(0, bf.address());
-                    device->write(1, (uint8_t*)bf.address() + 512);
+                    std::memcpy(&buffer[0], bf.address(), length);
+                    bootBlocks = length / 512;
                 }
                 else
                 {
@@ -297,9 +333,28 @@ int main(int argc, char **argv)
             }
         }
         
+        VolumeEntry::Format(&buffer[2 * 512], blocks, volumeName.c_str());
         
-        volume = VolumeEntry::Create(device, volumeName.c_str());
-
+        // a new image is created with the metadata in place (everything
+        // else is a hole.)  A raw device keeps its boot blocks unless
+        // there's a boot file.
+        if (rawDevice)
+        {
+            unsigned first = bootBlocks ? 0 : 2;
+            
+            device->writeBlocks(first, 6 - first, &buffer[first * 512]);
+            device->sync();
+        }
+        else
+        {
+            device = BlockDevice::Create(fname, volumeName.c_str(), blocks, format, &buffer[0], 6);
+        }
+        
+        if (!device.get())
+        {
+            std::fprintf(stderr, "Error: Unsupported diskimage format.\n");
+            return -1;
+        }
         
     }
     catch (::Exception& e)
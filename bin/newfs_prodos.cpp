@@ -3,25 +3,50 @@
 #include <cstdlib>
 #include <cctype>
 #include <cerrno>
+#include <clocale>
 #include <memory>
+#include <vector>
 
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <Device/BlockDevice.h>
-#include <ProFUSE/Exception.h>
+#include <Device/RawDevice.h>
+
+#include <Endian/Endian.h>
+
+#include <ProDOS/Bitmap.h>
+#include <ProDOS/DateTime.h>
+
+#include <Common/Exception.h>
+
+#include <File/File.h>
 
 
 #define NEWFS_VERSION "0.1"
 
-using namespace ProFUSE;
+using namespace LittleEndian;
 using namespace Device;
 
+
+bool yes_or_no()
+{
+	int ch, first;
+	(void)fflush(stderr);
+    
+	first = ch = getchar();
+	while (ch != '\n' && ch != EOF)
+		ch = getchar();
+	return (first == 'y' || first == 'Y');
+}
+
 void usage()
 {
     std::printf("newfs_prodos %s\n", NEWFS_VERSION);
     std::printf("\n");
     
     std::printf("newfs_prodos [-v volume_name] [-s size] [-f format] file\n");
+    std::printf("newfs_prodos -t template [-v volume_name] file\n");
     std::printf("\n");
     std::printf("  -v volume_name   specify the volume name.\n"
                 "                   Default is Untitled.\n"
@@ -33,6 +58,8 @@ void usage()
                 "                   po    ProDOS Order Disk Image\n"
                 "                   do    DOS Order Disk Image\n"
                 "                   davex Davex Disk Image\n"
+                "  -t template      copy an existing (empty) image.  The size and\n"
+                "                   format are the template's.\n"
     );
 
 }
@@ -126,11 +153,79 @@ bool ValidName(const char *cp)
     return i < 16;
 }
 
+/*
+ * boot blocks (0-1), volume directory (2-5) and bitmap (6-) of a new
+ * volume.  These are the only blocks that aren't zero.
+ */
+std::vector<uint8_t> format(const char *name, unsigned blocks)
+{
+    ProDOS::Bitmap bitmap(blocks);
+    ProDOS::DateTime now;
+    
+    unsigned bitmapPointer = 6;
+    unsigned count = bitmapPointer + bitmap.bitmapBlocks();
+    
+    for (unsigned i = 0; i < count; ++i)
+        bitmap.allocBlock(i);
+    
+    std::vector<uint8_t> buffer(count * 512);
+    
+    // volume directory blocks -- prev, next.
+    for (unsigned i = 2; i < 6; ++i)
+    {
+        uint8_t *cp = &buffer[i * 512];
+        
+        Write16(cp, 0, i == 2 ? 0 : i - 1);
+        Write16(cp, 2, i == 5 ? 0 : i + 1);
+    }
+    
+    // volume directory header.
+    uint8_t *cp = &buffer[2 * 512 + 4];
+    unsigned length = std::strlen(name);
+    
+    cp[0x00] = 0xf0 | length;
+    for (unsigned i = 0; i < length; ++i)
+        cp[0x01 + i] = std::toupper(name[i]);
+    
+    Write16(cp, 0x18, now.date());
+    Write16(cp, 0x1a, now.time());
+    cp[0x1c] = 0; // version
+    cp[0x1d] = 0; // min version
+    cp[0x1e] = 0xc3; // access
+    cp[0x1f] = 0x27; // entry length
+    cp[0x20] = 0x0d; // entries per block
+    Write16(cp, 0x21, 0); // file count
+    Write16(cp, 0x23, bitmapPointer);
+    Write16(cp, 0x25, blocks);
+    
+    bitmap.bitmap(&buffer[bitmapPointer * 512]);
+    
+    return buffer;
+}
+
+// the volume name is in the volume directory header (block 2).
+void setVolumeName(BlockDevicePointer device, const char *name)
+{
+    uint8_t buffer[512];
+    unsigned length = std::strlen(name);
+    
+    device->read(2, buffer);
+    
+    buffer[4] = (buffer[4] & 0xf0) | length;
+    std::memset(buffer + 5, 0, 15);
+    for (unsigned i = 0; i < length; ++i)
+        buffer[5 + i] = std::toupper(name[i]);
+    
+    device->write(2, buffer);
+}
+
+
 int main(int argc, char **argv)
 {
     unsigned blocks = 1600;
     std::string volumeName;
     std::string fileName;
+    std::string templateFile;
     int format = 0;
     const char *fname;
     int c;
@@ -138,7 +233,7 @@ int main(int argc, char **argv)
     // ctype uses ascii only.
     ::setlocale(LC_ALL, "C");
     
-    while ( (c = ::getopt(argc, argv, "hf:s:v:")) != -1)
+    while ( (c = ::getopt(argc, argv, "hf:s:t:v:")) != -1)
     {
         switch(c)
         {
@@ -176,6 +271,11 @@ int main(int argc, char **argv)
                     return -1;
                 }
             }
+            break;
+            
+        case 't':
+            templateFile = optarg;
+            break;
         
         }
     }
@@ -192,57 +292,105 @@ int main(int argc, char **argv)
     fname = argv[0];
     fileName = argv[0];
     
-    // generate a filename.
-    if (volumeName.empty())
-    {
-        volumeName = filename(fileName);
-        if (volumeName.empty() || !ValidName(volumeName.c_str()))
-            volumeName = "Untitled";
-    }
-    
     if (format == 0) format = BlockDevice::ImageType(fname, '2IMG');
     
     
     try
     {
-        std::auto_ptr<BlockDevice> device;
-        std::auto_ptr<VolumeDirectory> volume;
+        struct stat st;
+        bool rawDevice = false;
+        
+        BlockDevicePointer device;
+        
+        // Check for block device.  if so, verify.
+        // if file exists, verify before overwrite.
+        std::memset(&st, 0, sizeof(st));
+        
+        if (::stat(fname, &st) == 0)
+        {
+            if (S_ISBLK(st.st_mode))
+            {
+                std::fprintf(stderr, "`%s' is a raw device. Are you sure you want to initialize it? ", fname);
+                if (!yes_or_no()) return -1;
                 
-        // todo -- check if path matches /dev/xxx; if so, use RawDevice.
-        // todo -- check if file exists at path?
+                device = RawDevice::Open(fname, File::ReadWrite);
+                blocks = device->blocks();
+                rawDevice = true;
+                
+                if (blocks > 0xffff)
+                {
+                    std::fprintf(stderr, "Error: device is too large.\n");
+                    return 0x5a;
+                }
+            }
+            else
+            {
+                std::fprintf(stderr, "`%s' already exists.  Are you sure you want to overwrite it? ", fname);
+                if (!yes_or_no()) return -1;
+            }
+        }
         
-        switch(format)
+        // a template is copied as is, other than the volume name.
+        if (!templateFile.empty())
         {
-        case 'DC42':
-            device.reset(DiskCopy42Image::Create(fname, blocks, volumeName.c_str()));
-            break;
+            if (rawDevice)
+            {
+                std::fprintf(stderr, "Error: a template can't be copied to a raw device.\n");
+                return -1;
+            }
             
-        case 'PO__':
-            device.reset(ProDOSOrderDiskImage::Create(fname, blocks));
-            break;
+            File::Clone(templateFile.c_str(), fname);
             
-        case 'DO__':
-            device.reset(DOSOrderDiskImage::Create(fname, blocks));
-            break;
-        
-        case 'DVX_':
-            device.reset(DavexDiskImage::Create(fname, blocks, volumeName.c_str()));
-            break;
+            if (!volumeName.empty())
+            {
+                device = BlockDevice::Open(fname, File::ReadWrite);
+                if (device.get()) setVolumeName(device, volumeName.c_str());
+            }
             
-        case '2IMG':
-        default:
-            device.reset(UniversalDiskImage::Create(fname, blocks));
+            return 0;
+        }
+        
+        // generate a filename.
+        if (volumeName.empty())
+        {
+            if (!rawDevice)
+                volumeName = filename(fileName);
+            if (volumeName.empty() || !ValidName(volumeName.c_str()))
+                volumeName = "Untitled";
+        }
+        
+        if (blocks < 7)
+        {
+            std::fprintf(stderr, "Error: `%u' blocks is too small.\n", blocks);
+            return 0x5a;
+        }
+        
+        std::vector<uint8_t> buffer = ::format(volumeName.c_str(), blocks);
+        unsigned count = buffer.size() / 512;
+        
+        // a new image is created with the metadata in place (everything
+        // else is a hole.)
+        if (rawDevice)
+        {
+            device->writeBlocks(0, count, &buffer[0]);
+            device->sync();
+        }
+        else
+        {
+            device = BlockDevice::Create(fname, volumeName.c_str(), blocks, format, &buffer[0], count);
+        }
+        
+        if (!device.get())
+        {
+            std::fprintf(stderr, "Error: Unsupported diskimage format.\n");
+            return -1;
         }
-    
-        // VolumeDirectory assumes ownership of device,
-        // but doesn't release it on exception.
-        volume.reset(VolumeDirectory::Create(volumeName.c_str(), device.get()));
-        device.release();
-    
     }
-    catch (Exception e)
+    catch (::Exception &e)
     {
         std::fprintf(stderr, "Error: %s\n", e.what());
+        if (e.error())
+            std::fprintf(stderr, "%s\n", e.errorString());
         return -1;
     }
     return 0;
@@ -0,0 +1,153 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <Device/BlockDevice.h>
+#include <Device/OverlayDevice.h>
+
+#include <Common/Exception.h>
+#include <POSIX/Exception.h>
+
+
+#define OVERLAY_VERSION "0.1"
+
+
+void usage()
+{
+    std::printf("overlay %s\n", OVERLAY_VERSION);
+    std::printf("\n");
+
+
+    std::printf("overlay [-f format] [-t format] command image delta [file]\n");
+    std::printf("\n");
+    std::printf("  -f format        Specify the disk image format. Valid values are:\n"
+                "                   2img  Universal Disk Image\n"
+                "                   dc42  DiskCopy 4.2 Image\n"
+                "                   davex Davex Disk Image\n"
+                "                   do    DOS Order Disk Image\n"
+                "                   po    ProDOS Order Disk Image\n"
+                "  -t format        Format of the exported image (default: from file)\n"
+                "\n"
+                "Commands:\n"
+                "  info             Number of changed blocks\n"
+                "  commit           Write the changed blocks to image\n"
+                "  discard          Forget the changed blocks\n"
+                "  export file      Copy image with the changes to a new image file\n"
+                "\n"
+                "The delta file is created by profuse --overlay or fuse_pascal --overlay.\n"
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned format = 0;
+    unsigned exportFormat = 0;
+    int c;
+
+    while ( (c = ::getopt(argc, argv, "hf:t:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                default:
+                usage();
+                return c == 'h' ? 0 : 1;
+                break;
+
+            case 'f':
+            case 't':
+                {
+                    unsigned type = Device::BlockDevice::ImageType(optarg);
+                    if (type == 0)
+                    {
+                        std::fprintf(stderr, "Error: `%s' is not a supported disk image format.\n", optarg);
+                        return 1;
+                    }
+                    if (c == 'f') format = type;
+                    else exportFormat = type;
+                }
+                break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    const char *command = argv[0];
+    const char *image = argv[1];
+    const char *delta = argv[2];
+
+    bool commit = std::strcmp(command, "commit") == 0;
+
+    if (std::strcmp(command, "export") == 0 && argc != 4)
+    {
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        Device::BlockDevicePointer base;
+        Device::BlockDevicePointer device;
+
+        // only commit writes to the image.
+        base = Device::BlockDevice::Open(image, commit ? File::ReadWrite : File::ReadOnly, format);
+
+        if (!base)
+        {
+            std::fprintf(stderr, "Error: Unknown or unsupported device type.\n");
+            return 1;
+        }
+
+        if (::access(delta, F_OK) != 0)
+            throw POSIX::Exception("Unable to open delta file.", errno);
+
+        device = Device::OverlayDevice::Open(base, delta);
+
+        Device::OverlayDevice *overlay = (Device::OverlayDevice *)device.get();
+
+        if (std::strcmp(command, "info") == 0)
+        {
+            std::printf("%u of %u blocks changed\n", overlay->changedBlocks(), overlay->blocks());
+        }
+        else if (commit)
+        {
+            unsigned changed = overlay->changedBlocks();
+
+            overlay->commit();
+            std::printf("%u blocks committed\n", changed);
+        }
+        else if (std::strcmp(command, "discard") == 0)
+        {
+            overlay->discard();
+        }
+        else if (std::strcmp(command, "export") == 0)
+        {
+            overlay->exportImage(argv[3], exportFormat);
+        }
+        else
+        {
+            std::fprintf(stderr, "Error: `%s' is not a valid command.\n", command);
+            return 1;
+        }
+    }
+    catch (::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        if (e.error())
+            std::fprintf(stderr, "%s\n", e.errorString());
+        return 1;
+    }
+
+    return 0;
+}
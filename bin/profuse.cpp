@@ -19,11 +19,13 @@
 #include <cstring>
 #include <cctype>
 #include <cstddef>
+#include <cerrno>
 
 #include <vector>
 #include <string>
 
 #include <Device/BlockDevice.h>
+#include <Device/OverlayDevice.h>
 
 
 #include "profuse.h"
@@ -45,6 +47,9 @@ std::string fDiskImage;
 DiskPointer disk;
 VolumeEntry volume;
 
+ProDOS::MetadataCache *cache = NULL;
+ProDOS::Scanner *scanner = NULL;
+
 bool validProdosName(const char *name)
 {
     // OS X looks for hidden files that don't exist (and aren't legal prodos names)
@@ -67,6 +72,43 @@ bool validProdosName(const char *name)
     return i < 16;
 }
 
+int prodos_errno(int error)
+{
+    switch (-error)
+    {
+        case P8_READ_ONLY:
+            return EROFS;
+        case P8_VOLUME_FULL:
+        case P8_DIRECTORY_FULL:
+            return ENOSPC;
+        case P8_DUPLICATE_NAME:
+            return EEXIST;
+        case P8_FILE_NOT_FOUND:
+            return ENOENT;
+        case P8_DIRECTORY_NOT_EMPTY:
+            return ENOTEMPTY;
+        case P8_INVALID_NAME:
+            return EINVAL;
+        case P8_FILE_TOO_LARGE:
+            return EFBIG;
+        case P8_INVALID_STORAGE_TYPE:
+            return EPERM;
+    }
+    return EIO;
+}
+
+unsigned prodos_directory_key(fuse_ino_t ino)
+{
+    FileEntry e;
+    
+    if (ino == 1) return 2;
+    
+    if (cache->entry(ino, &e) < 0) return 0;
+    if (e.storage_type != DIRECTORY_FILE) return 0;
+    
+    return e.key_pointer;
+}
+
 
 
 
@@ -85,10 +127,12 @@ enum {
 
 struct options {
     char *format;
+    char *overlay;
     int readOnly;
     int readWrite;
     int verbose;
     int debug;
+    unsigned warmup;
     
 } options;
 
@@ -108,9 +152,17 @@ static struct fuse_opt prodos_opts[] = {
     PRODOS_OPT_KEY("rw", readWrite, 1),
     
     PRODOS_OPT_KEY("-d", debug, 1),
+    
+    PRODOS_OPT_KEY("--warmup", warmup, 4),
+    PRODOS_OPT_KEY("warmup", warmup, 4),
+    PRODOS_OPT_KEY("--warmup=%u", warmup, 0),
+    PRODOS_OPT_KEY("warmup=%u", warmup, 0),
 
     PRODOS_OPT_KEY("--format=%s", format, 0),
     PRODOS_OPT_KEY("format=%s", format, 0),
+
+    PRODOS_OPT_KEY("--overlay=%s", overlay, 0),
+    PRODOS_OPT_KEY("overlay=%s", overlay, 0),
     {0, 0, 0}
 };
 
@@ -121,8 +173,9 @@ static void usage()
             "Options:\n"
             "  -d                debug\n"
             "  -r                readonly\n"
-            "  -w                mount writable [not yet]\n"
+            "  -w                mount writable\n"
             "  -v                verbose\n"
+            "  --warmup[=threads] scan the volume metadata in the background\n"
             "  --format=format   specify the disk image format. Valid values are:\n"
             "                    dc42  DiskCopy 4.2 Image\n"
             "                    davex Davex Disk Image\n"
@@ -132,6 +185,7 @@ static void usage()
             "                    2img  Universal Disk Image\n"
             "                    do    DOS Order Disk Image\n"
             "                    po    ProDOS Order Disk Image (default)\n"
+            "  --overlay=file    mount writable; changes go to file, not the disk image\n"
             "  -o opt1,opt2...   other mount parameters.\n"            
             
             );
@@ -241,6 +295,15 @@ int main(int argc, char *argv[])
     
     prodos_oper.statfs = prodos_statfs;
     
+    prodos_oper.write = prodos_write;
+    prodos_oper.flush = prodos_flush;
+    prodos_oper.fsync = prodos_fsync;
+    prodos_oper.setattr = prodos_setattr;
+    prodos_oper.create = prodos_create;
+    prodos_oper.mkdir = prodos_mkdir;
+    prodos_oper.unlink = prodos_unlink;
+    prodos_oper.rmdir = prodos_rmdir;
+    
 
     // scan the argument list, looking for the name of the disk image.
     if (fuse_opt_parse(&args, &options , prodos_opts, prodos_opt_proc) == -1)
@@ -263,13 +326,16 @@ int main(int argc, char *argv[])
     try {
         Device::BlockDevicePointer device;
         
-        device = Device::BlockDevice::Open(fDiskImage.c_str(), File::ReadOnly, format);
+        device = Device::BlockDevice::Open(fDiskImage.c_str(), options.readWrite && !options.overlay ? File::ReadWrite : File::ReadOnly, format);
         
         if (!device)
         {
             std::fprintf(stderr, "Error: Unknown or unsupported device type.\n");
             exit(1);
         }
+
+        if (options.overlay)
+            device = Device::OverlayDevice::Open(device, options.overlay);
         
         disk = Disk::OpenFile(device);
         
@@ -291,6 +357,8 @@ int main(int argc, char *argv[])
     
     disk->ReadVolume(&volume, NULL);
     
+    cache = new ProDOS::MetadataCache(disk);
+    
 #ifdef __APPLE__
     {
         // Macfuse supports custom volume names (displayed in Finder)
@@ -341,6 +409,14 @@ int main(int argc, char *argv[])
                 err = fuse_daemonize(foreground);
                 if (err < 0 ) break;
                 
+                // threads don't survive the fork, so start after daemonizing.
+                if (options.warmup)
+                {
+                    scanner = new ProDOS::Scanner(cache, options.warmup);
+                    scanner->setVerbose(options.verbose || options.debug);
+                    scanner->start();
+                }
+                
                 err = fuse_set_signal_handlers(se);
                 if (err < 0) break;
                 
@@ -363,6 +439,12 @@ int main(int argc, char *argv[])
     
     fuse_opt_free_args(&args);
     
+    delete scanner;
+    scanner = NULL;
+    
+    delete cache;
+    cache = NULL;
+    
     disk.reset();
     
     
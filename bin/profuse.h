@@ -12,6 +12,9 @@
 #include <ProDOS/File.h>
 #include <ProDOS/Disk.h>
 #include <ProDOS/common.h>
+#include <ProDOS/MetadataCache.h>
+#include <ProDOS/Scanner.h>
+#include <ProDOS/Fork.h>
 
 
 #define FUSE_USE_VERSION 27
@@ -25,9 +28,20 @@
 
 
 extern DiskPointer disk;
+extern ProDOS::MetadataCache *cache;
+extern ProDOS::Scanner *scanner;
+
+// directory key block for an inode (or 0 if not a directory.)
+unsigned prodos_directory_key(fuse_ino_t ino);
 
 bool validProdosName(const char *name);
 
+// map a (negative) P8 error to an errno.
+int prodos_errno(int error);
+
+// the open fork for an inode (or NULL.)  Only used on writable mounts.
+ProDOS::Fork *prodos_fork(fuse_ino_t ino);
+
 // xattr
 void prodos_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size, uint32_t off);
 void prodos_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size);
@@ -38,9 +52,17 @@ void prodos_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void prodos_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void prodos_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
 
+void prodos_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi);
+void prodos_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode);
+void prodos_unlink(fuse_req_t req, fuse_ino_t parent, const char *name);
+void prodos_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name);
+
 // stat
 void prodos_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void prodos_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+void prodos_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi);
+
+int prodos_stat(FileEntry& e, struct stat *st);
 
 void prodos_statfs(fuse_req_t req, fuse_ino_t ino);
 
@@ -49,6 +71,12 @@ void prodos_statfs(fuse_req_t req, fuse_ino_t ino);
 void prodos_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void prodos_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 void prodos_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+void prodos_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi);
+void prodos_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void prodos_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
+
+// open a file (sharing the fork) from create.
+int prodos_open_file(const FileEntry &e, struct fuse_file_info *fi);
 
 
 
@@ -33,36 +33,18 @@ void prodos_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
     // verify it's a directory/volume here?
     
     
-    uint8_t buffer[BLOCK_SIZE];
     vector<FileEntry> files;
-    bool ok;
+    unsigned key;
+    int ok;
     
     
-    ok = disk->Read(ino == 1 ? 2 : ino >> 9, buffer);
-    ERROR(ok < 0, EIO)
+    key = prodos_directory_key(ino);
+    ERROR(key == 0, ENOTDIR)
     
+    if (scanner) scanner->prioritize(key);
     
-    if (ino == 1)
-    {
-        VolumeEntry v;
-        v.Load(buffer + 0x04);
-        
-        ok = disk->ReadVolume(&v, &files);
-        
-        ERROR(ok < 0, EIO)        
-    }
-    else
-    {
-        
-        FileEntry e;
-        e.Load(buffer + (ino & 0x1ff));
-        
-        ERROR(e.storage_type != DIRECTORY_FILE, ENOTDIR)
-        
-        ok = disk->ReadDirectory(e.key_pointer, NULL, &files);
-        
-        ERROR(ok < 0, EIO);
-    } 
+    ok = cache->directory(key, &files);
+    ERROR(ok < 0, EIO)
     
     // copy the vector contents to a vector *.
     vector<FileEntry> *fp = new vector<FileEntry>();
@@ -130,3 +112,130 @@ void prodos_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, stru
     delete []buffer;
 }
 
+
+
+#pragma mark Write Functions
+
+static void reply_entry(fuse_req_t req, FileEntry &f, struct fuse_file_info *fi)
+{
+    struct fuse_entry_param entry;
+    
+    bzero(&entry, sizeof(entry));
+    
+    entry.attr_timeout = 0.0;
+    entry.entry_timeout = 0.0;
+    
+    prodos_stat(f, &entry.attr);
+    entry.ino = f.address;
+    entry.attr.st_ino = f.address;
+    
+    if (fi) fuse_reply_create(req, &entry, fi);
+    else fuse_reply_entry(req, &entry);
+}
+
+
+// new files are created as binary ($06) files.
+void prodos_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    fprintf(stderr, "create: %u %s\n", (unsigned)parent, name);
+    
+    FileEntry f;
+    unsigned key;
+    int ok;
+    
+    ERROR(disk->ReadOnly(), EROFS)
+    ERROR(!validProdosName(name), EINVAL)
+    
+    key = prodos_directory_key(parent);
+    ERROR(key == 0, ENOTDIR)
+    
+    ok = disk->CreateFile(key, name, 0x06, &f);
+    ERROR(ok < 0, prodos_errno(ok))
+    
+    cache->invalidateDirectory(key);
+    
+    ok = prodos_open_file(f, fi);
+    if (ok < 0)
+    {
+        // don't leave a file the caller doesn't know about.
+        disk->Delete(key, name);
+        
+        cache->invalidateDirectory(key);
+        cache->invalidateEntry(f.address);
+        
+        fuse_reply_err(req, prodos_errno(ok));
+        return;
+    }
+    
+    reply_entry(req, f, fi);
+}
+
+void prodos_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    fprintf(stderr, "mkdir: %u %s\n", (unsigned)parent, name);
+    
+    FileEntry f;
+    unsigned key;
+    int ok;
+    
+    ERROR(disk->ReadOnly(), EROFS)
+    ERROR(!validProdosName(name), EINVAL)
+    
+    key = prodos_directory_key(parent);
+    ERROR(key == 0, ENOTDIR)
+    
+    ok = disk->CreateDirectory(key, name, &f);
+    ERROR(ok < 0, prodos_errno(ok))
+    
+    // the parent may have grown a block.
+    cache->invalidateDirectory(key);
+    if (parent != 1) cache->invalidateEntry(parent);
+    
+    reply_entry(req, f, NULL);
+}
+
+
+static void prodos_remove(fuse_req_t req, fuse_ino_t parent, const char *name, bool directory)
+{
+    FileEntry f;
+    unsigned key;
+    int ok;
+    
+    ERROR(disk->ReadOnly(), EROFS)
+    ERROR(!validProdosName(name), ENOENT)
+    
+    key = prodos_directory_key(parent);
+    ERROR(key == 0, ENOTDIR)
+    
+    ok = cache->lookup(key, name, &f);
+    ERROR(ok < 0, ENOENT)
+    
+    ERROR(directory && f.storage_type != DIRECTORY_FILE, ENOTDIR)
+    ERROR(!directory && f.storage_type == DIRECTORY_FILE, EISDIR)
+    
+    // there is no way to keep the blocks of an open file.
+    ERROR(prodos_fork(f.address) != NULL, EBUSY)
+    
+    ok = disk->Delete(key, name);
+    ERROR(ok < 0, prodos_errno(ok))
+    
+    cache->invalidateDirectory(key);
+    cache->invalidateEntry(f.address);
+    if (directory) cache->invalidateDirectory(f.key_pointer);
+    
+    fuse_reply_err(req, 0);
+}
+
+void prodos_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fprintf(stderr, "unlink: %u %s\n", (unsigned)parent, name);
+    
+    prodos_remove(req, parent, name, false);
+}
+
+void prodos_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    fprintf(stderr, "rmdir: %u %s\n", (unsigned)parent, name);
+    
+    prodos_remove(req, parent, name, true);
+}
@@ -10,40 +10,126 @@
 #include <cerrno>
 #include <cstdio>
 
+#include <map>
+
+#include <fcntl.h>
+
 
 #pragma mark Read Functions
 
+// open file state.  The extent list is built once, at open time.
+// Writable mounts share a single Fork per inode instead.
+struct OpenFile {
+    FileEntry entry;
+    ExtentList extents;
+    ProDOS::Fork *fork;
+};
+
+struct SharedFork {
+    ProDOS::Fork *fork;
+    unsigned count;
+};
+
+static std::map<fuse_ino_t, SharedFork> forks;
+
+
+ProDOS::Fork *prodos_fork(fuse_ino_t ino)
+{
+    std::map<fuse_ino_t, SharedFork>::iterator iter = forks.find(ino);
+    
+    return iter == forks.end() ? NULL : iter->second.fork;
+}
+
+
+// the directory entry has changed; drop the cached copies.
+static void invalidate(const FileEntry &e)
+{
+    cache->invalidateEntry(e.address);
+    cache->invalidateDirectory(e.header_pointer);
+}
+
+
+int prodos_open_file(const FileEntry &e, struct fuse_file_info *fi)
+{
+    OpenFile *of = new OpenFile();
+    of->entry = e;
+    of->fork = NULL;
+    
+    if (disk->ReadOnly())
+    {
+        int ok = cache->extents(e.address, &of->extents);
+        if (ok < 0)
+        {
+            delete of;
+            return ok;
+        }
+        
+        fi->fh = (uint64_t)of;
+        return 1;
+    }
+    
+    std::map<fuse_ino_t, SharedFork>::iterator iter = forks.find(e.address);
+    
+    if (iter == forks.end())
+    {
+        SharedFork sf;
+        
+        sf.fork = new ProDOS::Fork(disk);
+        sf.count = 0;
+        
+        int ok = sf.fork->open(e.address);
+        if (ok < 0)
+        {
+            delete sf.fork;
+            delete of;
+            return ok;
+        }
+        
+        iter = forks.insert(std::make_pair((fuse_ino_t)e.address, sf)).first;
+    }
+    
+    iter->second.count++;
+    of->fork = iter->second.fork;
+    
+    if (fi->flags & O_TRUNC)
+    {
+        int ok = of->fork->truncate(0);
+        if (ok >= 0) invalidate(of->fork->entry());
+    }
+    
+    fi->fh = (uint64_t)of;
+    return 1;
+}
+
+
 void prodos_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
     fprintf(stderr, "open: %u\n", (unsigned)ino);
     
     
-    uint8_t buffer[BLOCK_SIZE];
     int ok;
     
-    FileEntry *e = NULL;
+    FileEntry e;
+    bool extended;
     
     ERROR(ino == 1, EISDIR)
     
-    ok = disk->Read(ino >> 9, buffer);
+    ok = cache->entry(ino, &e);
     ERROR(ok < 0, EIO)
     
-    e = new FileEntry();
-    e->Load(buffer + (ino & 0x1ff));
+    extended = e.storage_type == EXTENDED_FILE;
     
-    if (e->storage_type == EXTENDED_FILE)
+    if (extended)
     {
-        ok = disk->Normalize(*e, 0);
+        // the resource fork is read only.
+        ERROR(!disk->ReadOnly() && (fi->flags & O_ACCMODE) != O_RDONLY, EPERM)
         
-        if (ok < 0)
-        {
-            delete e;
-            ERROR(true, EIO)
-        }
+        ok = disk->Normalize(e, 0);
+        ERROR(ok < 0, EIO)
     }
     
     // EXTENDED_FILE already handled (it would be an error here.)
-    switch(e->storage_type)
+    switch(e.storage_type)
     {
         case SEEDLING_FILE:
         case SAPLING_FILE:
@@ -51,19 +137,39 @@ void prodos_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
             break;
             //case PASCAL_FILE: //?
         case DIRECTORY_FILE:
-            delete e;
             ERROR(true, EISDIR)
             break;
         default:
             ERROR(true, EIO)
     }
     
-    if ( (fi->flags & O_ACCMODE) != O_RDONLY)
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
     {
-        delete e;
-        ERROR(true, EACCES);
+        ERROR(disk->ReadOnly(), EROFS)
+        ERROR(!(e.access & 0x02), EACCES)
     }
-    fi->fh = (uint64_t)e;
+    
+    // extended files are read through the extent list.
+    if (!disk->ReadOnly() && extended)
+    {
+        OpenFile *of = new OpenFile();
+        of->entry = e;
+        of->fork = NULL;
+        
+        ok = disk->ReadExtents(e, &of->extents);
+        if (ok < 0)
+        {
+            delete of;
+            ERROR(true, EIO)
+        }
+        
+        fi->fh = (uint64_t)of;
+        fuse_reply_open(req, fi);
+        return;
+    }
+    
+    ok = prodos_open_file(e, fi);
+    ERROR(ok < 0, prodos_errno(ok))
     
     fuse_reply_open(req, fi);
 }
@@ -72,11 +178,32 @@ void prodos_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
     fprintf(stderr, "release: %u\n", (unsigned)ino);
     
-    FileEntry *e = (FileEntry *)fi->fh;
+    OpenFile *of = (OpenFile *)fi->fh;
+    int ok = 0;
     
-    if (e) delete e;
+    if (of && of->fork)
+    {
+        std::map<fuse_ino_t, SharedFork>::iterator iter = forks.find(ino);
+        
+        if (iter != forks.end() && --iter->second.count == 0)
+        {
+            ProDOS::Fork *fork = iter->second.fork;
+            
+            forks.erase(iter);
+            
+            if (fork->dirty())
+            {
+                ok = fork->flush();
+                invalidate(fork->entry());
+            }
+            
+            delete fork;
+        }
+    }
+    
+    if (of) delete of;
     
-    fuse_reply_err(req, 0);
+    fuse_reply_err(req, ok < 0 ? prodos_errno(ok) : 0);
     
 }
 
@@ -84,45 +211,43 @@ void prodos_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct
 {
     fprintf(stderr, "read: %u %u %u\n", (unsigned)ino, (unsigned)size, (unsigned)off);
     
-    FileEntry *e = (FileEntry *)fi->fh;
+    OpenFile *of = (OpenFile *)fi->fh;
     
-    ERROR(e == NULL, EIO)
+    ERROR(of == NULL, EIO)
     
-    if (off >= e->eof)
+    if (of->fork)
     {
-        fuse_reply_buf(req, NULL, 0);
+        uint8_t *buffer = new uint8_t[size];
+        
+        int ok = of->fork->read(buffer, size, off);
+        if (ok < 0)
+        {
+            fuse_reply_err(req, prodos_errno(ok));
+        }
+        else
+        {
+            fuse_reply_buf(req, (const char *)buffer, ok);
+        }
+        
+        delete []buffer;
         return;
     }
     
-    
-    unsigned level = 0;
-    switch(e->storage_type)
+    if (off >= of->entry.eof)
     {
-        case TREE_FILE:
-            level = 2;
-            break;
-        case SAPLING_FILE:
-            level = 1;
-            break;
-        case SEEDLING_FILE:
-            level = 0;
-            break;
+        fuse_reply_buf(req, NULL, 0);
+        return;
     }
     
-    // currently, reading is done on a block basis.
-    // experimentally, fuse reads the entire file
-    // this may not hold for larger files.
+    if (off + size > of->entry.eof) size = of->entry.eof - off;
     
-    
-    // TODO -- error if size + off > eof.
+    // reads are done on a block basis, directly from the extent list.
     
     unsigned blocks = (size + (off & 0x1ff) + BLOCK_SIZE - 1) >> 9;
     int ok;
     uint8_t *buffer = new uint8_t[blocks << 9];
     
-    fprintf(stderr, "ReadIndex(%x, buffer, %x, %x, %x)\n", e->key_pointer, level, (int)off, (int)blocks);
-    
-    ok = disk->ReadIndex(e->key_pointer, buffer, level, off, blocks);
+    ok = disk->ReadBlocks(of->extents, off >> 9, blocks, buffer);
     if (ok < 0)
     {
         fuse_reply_err(req, EIO);
@@ -134,3 +259,46 @@ void prodos_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct
     
     delete []buffer;
 }
+
+
+#pragma mark Write Functions
+
+void prodos_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    fprintf(stderr, "write: %u %u %u\n", (unsigned)ino, (unsigned)size, (unsigned)off);
+    
+    OpenFile *of = (OpenFile *)fi->fh;
+    int ok;
+    
+    ERROR(of == NULL, EIO)
+    ERROR(of->fork == NULL, EBADF)
+    
+    ok = of->fork->write(buf, size, off);
+    ERROR(ok < 0, prodos_errno(ok))
+    
+    fuse_reply_write(req, ok);
+}
+
+
+// data, index blocks, bitmap, then the directory entry.
+void prodos_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    OpenFile *of = (OpenFile *)fi->fh;
+    int ok;
+    
+    if (!of || !of->fork || !of->fork->dirty())
+    {
+        fuse_reply_err(req, 0);
+        return;
+    }
+    
+    ok = of->fork->flush();
+    invalidate(of->fork->entry());
+    
+    fuse_reply_err(req, ok < 0 ? prodos_errno(ok) : 0);
+}
+
+void prodos_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    prodos_flush(req, ino, fi);
+}
@@ -15,6 +15,7 @@
 #include <cstring>
 #include <cstdio>
 
+#include <algorithm>
 #include <vector>
 
 #include <sys/stat.h>
@@ -48,6 +49,10 @@ int prodos_stat(FileEntry& e, struct stat *st)
     st->st_nlink = 1;
     st->st_mode = 0444 | S_IFREG;
     st->st_size = e.eof;    
+    st->st_blocks = e.blocks_used;
+    
+    // write-enabled files on a writable mount.
+    if (!disk->ReadOnly() && (e.access & 0x02)) st->st_mode |= 0200;
     
     
     if (e.storage_type == DIRECTORY_FILE)
@@ -64,6 +69,8 @@ int prodos_stat(FileEntry& e, struct stat *st)
         st->st_size = BLOCK_SIZE;
         st->st_nlink = se.file_count + 1;
         
+        if (!disk->ReadOnly()) st->st_mode |= 0200;
+        
         return 0;
     }
     
@@ -91,6 +98,8 @@ int prodos_stat(const VolumeEntry &v, struct stat *st)
     st->st_mode = S_IFDIR | 0555;
     st->st_ctime = v.creation;
     
+    if (!disk->ReadOnly()) st->st_mode |= 0200;
+    
 #ifdef HAVE_STAT_BIRTHTIME
     st->st_birthtime = v.creation;
 #endif
@@ -122,12 +131,12 @@ void prodos_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
      */
     
     
-    ok = disk->Read(ino == 1 ? 2 : ino >> 9, buffer);
-    ERROR(ok < 0, EIO)
-    
     // ino 1 is the volume header.
     if (ino == 1)
     {
+        ok = disk->Read(2, buffer);
+        ERROR(ok < 0, EIO)
+        
         VolumeEntry v;
         v.Load(buffer + 0x04);
         ok = prodos_stat(v, &st);
@@ -143,7 +152,16 @@ void prodos_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
         
         
         FileEntry e;
-        e.Load(buffer + (ino & 0x1ff));
+        ProDOS::Fork *fork = prodos_fork(ino);
+        
+        // an open fork has the current eof.
+        if (fork) e = fork->entry();
+        else
+        {
+            ok = cache->entry(ino, &e);
+            ERROR(ok < 0, EIO);
+        }
+        
         ok = prodos_stat(e, &st);
         
         ERROR(ok < 0, EIO);
@@ -155,63 +173,38 @@ void prodos_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 }
 
 
-// TODO -- add Disk::Lookup support so we don't have to parse the entire dir header.
-// TODO -- add caching.
 void prodos_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-    uint8_t buffer[BLOCK_SIZE];
     struct fuse_entry_param entry;
+    unsigned key;
     int ok;
-    vector<FileEntry> files;
+    FileEntry f;
     
     
     fprintf(stderr, "lookup: %u %s\n", (unsigned)parent, name);
     
     ERROR(!validProdosName(name), ENOENT)
     
-    ok = disk->Read(parent == 1 ? 2 : parent >> 9, buffer);
-    ERROR(ok < 0, EIO)
+    key = prodos_directory_key(parent);
+    ERROR(key == 0, ENOENT)
+    
+    if (scanner) scanner->prioritize(key);
     
     bzero(&entry, sizeof(entry));
     
     entry.attr_timeout = 0.0;
     entry.entry_timeout = 0.0;
     
-    // get the file list
-    // TODO -- Disk::look-up-one-file
-    if (parent == 1)
-    {
-        VolumeEntry v;
-        ok = disk->ReadVolume(&v, &files);
-        ERROR(ok < 0, EIO)
-    }
-    else
-    {
-        FileEntry e;
-        e.Load(buffer + (parent & 0x1ff));
-        ERROR(e.storage_type != DIRECTORY_FILE, ENOENT);
-        
-        ok = disk->ReadDirectory(e.key_pointer, NULL, &files);
-        ERROR(ok < 0, EIO)
-    }
-    // ok, now go through the file list and look for a (case insensitive) match.
-    
+    // (case insensitive) name index look up.
+    ok = cache->lookup(key, name, &f);
+    ERROR(ok < 0, ENOENT);
     
-    ok = -1;
-    unsigned name_length = strlen(name);
+    if (prodos_fork(f.address)) f = prodos_fork(f.address)->entry();
     
-    for(vector<FileEntry>::iterator iter = files.begin(); iter != files.end(); ++iter)
-    {
-        FileEntry& f = *iter;
-        if ( (f.name_length == name_length) && (strcasecmp(name, f.file_name) == 0))
-        {
-            ok = prodos_stat(f, &entry.attr);
-            fprintf(stderr, "stat %s %x (%x %x) %d\n", f.file_name, f.address, f.address >> 9, f.address & 0x1ff, ok);
-            entry.ino = f.address; 
-            entry.attr.st_ino = f.address;
-            break;
-        }
-    }
+    ok = prodos_stat(f, &entry.attr);
+    fprintf(stderr, "stat %s %x (%x %x) %d\n", f.file_name, f.address, f.address >> 9, f.address & 0x1ff, ok);
+    entry.ino = f.address; 
+    entry.attr.st_ino = f.address;
     
     ERROR(ok < 0, ENOENT);
     
@@ -239,15 +232,65 @@ void prodos_statfs(fuse_req_t req, fuse_ino_t ino)
     vst.f_bsize = 512;  // fs block size
     vst.f_frsize = 512; // fundamental fs block size
     vst.f_blocks = volume.total_blocks;
-    vst.f_bfree = 0; // free blocks
-    vst.f_bavail = 0; // free blocks (non-root)
+    vst.f_bfree = std::max(0, disk->FreeBlocks()); // free blocks
+    vst.f_bavail = vst.f_bfree; // free blocks (non-root)
     vst.f_files = 0; // ?
     vst.f_ffree = -1;  // free inodes.
     vst.f_favail = -1; // free inodes (non-root)
     vst.f_fsid = 0; // file system id?
-    vst.f_flag = ST_RDONLY | ST_NOSUID;
+    vst.f_flag = disk->ReadOnly() ? ST_RDONLY | ST_NOSUID : ST_NOSUID;
     vst.f_namemax = 15;
     
     fuse_reply_statfs(req, &vst);    
 }
 
+
+
+// only the size can be changed.
+void prodos_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+    struct stat st;
+    FileEntry e;
+    int ok;
+    
+    fprintf(stderr, "setattr %u %x\n", (unsigned)ino, to_set);
+    
+    if (!(to_set & FUSE_SET_ATTR_SIZE))
+    {
+        prodos_getattr(req, ino, fi);
+        return;
+    }
+    
+    ERROR(disk->ReadOnly(), EROFS)
+    ERROR(ino == 1, EISDIR)
+    ERROR(attr->st_size < 0 || attr->st_size > ProDOS::Fork::MaxSize, EFBIG)
+    
+    ProDOS::Fork *fork = prodos_fork(ino);
+    ProDOS::Fork tmp(disk);
+    
+    if (!fork)
+    {
+        ok = tmp.open(ino);
+        ERROR(ok < 0, prodos_errno(ok))
+        
+        fork = &tmp;
+    }
+    
+    ERROR(!(fork->entry().access & 0x02), EACCES)
+    
+    ok = fork->truncate(attr->st_size);
+    ERROR(ok < 0, prodos_errno(ok))
+    
+    cache->invalidateEntry(ino);
+    cache->invalidateDirectory(fork->entry().header_pointer);
+    
+    bzero(&st, sizeof(st));
+    
+    e = fork->entry();
+    ok = prodos_stat(e, &st);
+    ERROR(ok < 0, EIO)
+    
+    st.st_ino = ino;
+    
+    fuse_reply_attr(req, &st, 0.0);
+}